@@ -17,12 +17,21 @@ let package = Package(
     .library(
       name: "FlashAttention",
       targets: ["FlashAttention"]),
+    .executable(
+      name: "flash-attention-catalog",
+      targets: ["FlashAttentionCatalog"]),
   ],
   targets: [
     // Targets are the basic building blocks of a package, defining a module or a test suite.
     // Targets can depend on other targets in this package and products from dependencies.
     .target(
-      name: "FlashAttention"),
+      name: "CFlashAttention"),
+    .target(
+      name: "FlashAttention",
+      dependencies: ["CFlashAttention"]),
+    .executableTarget(
+      name: "FlashAttentionCatalog",
+      dependencies: ["FlashAttention"]),
     .testTarget(
       name: "FlashAttentionTests",
       dependencies: ["FlashAttention"]),
@@ -0,0 +1,115 @@
+//
+//  CFlashAttention.c
+//  FlashAttention
+//
+
+#include "CFlashAttention.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+int mfa_shm_open(const char *name, int oflag, mode_t mode) {
+  return shm_open(name, oflag, mode);
+}
+
+int mfa_shm_unlink(const char *name) {
+  return shm_unlink(name);
+}
+
+pid_t mfa_fork(void) {
+  return fork();
+}
+
+// The algorithm of Dmitry Vyukov's bounded queue. Every slot has a sequence
+// number. A slot at 'position' is free when its sequence equals 'position',
+// and published when it equals 'position + 1'. Consuming it advances the
+// sequence by the capacity, to the position of its next lap.
+//
+// Each group of fields sits on its own 128-byte line. The mask and the
+// slot array never change after creation, so every thread reads them from a
+// shared line. The tail is written only by the producers, and the head only
+// by the consumer, so neither side invalidates the other's line.
+struct mfa_mpsc_ring {
+  _Alignas(128) uint64_t mask;
+  _Atomic(uint64_t) *sequences;
+  _Alignas(128) _Atomic(uint64_t) tail;
+  _Alignas(128) uint64_t head;
+};
+
+mfa_mpsc_ring *mfa_mpsc_ring_create(uint32_t capacity) {
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    return NULL;
+  }
+  // The alignment of the struct makes its size a multiple of 128.
+  mfa_mpsc_ring *ring = aligned_alloc(128, sizeof(mfa_mpsc_ring));
+  if (ring == NULL) {
+    return NULL;
+  }
+  ring->sequences = malloc(capacity * sizeof(_Atomic(uint64_t)));
+  if (ring->sequences == NULL) {
+    free(ring);
+    return NULL;
+  }
+  for (uint32_t i = 0; i < capacity; ++i) {
+    atomic_init(&ring->sequences[i], i);
+  }
+  atomic_init(&ring->tail, 0);
+  ring->head = 0;
+  ring->mask = capacity - 1;
+  return ring;
+}
+
+void mfa_mpsc_ring_destroy(mfa_mpsc_ring *ring) {
+  free(ring->sequences);
+  free(ring);
+}
+
+bool mfa_mpsc_ring_claim(mfa_mpsc_ring *ring, uint64_t *position) {
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  while (true) {
+    _Atomic(uint64_t) *sequence = &ring->sequences[tail & ring->mask];
+    uint64_t value = atomic_load_explicit(sequence, memory_order_acquire);
+    int64_t difference = (int64_t)(value - tail);
+    if (difference == 0) {
+      // On failure, 'tail' is reloaded with the value another producer won.
+      if (atomic_compare_exchange_weak_explicit(
+            &ring->tail, &tail, tail + 1,
+            memory_order_relaxed, memory_order_relaxed)) {
+        *position = tail;
+        return true;
+      }
+    } else if (difference < 0) {
+      // The consumer has not freed this slot from the previous lap.
+      return false;
+    } else {
+      tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    }
+  }
+}
+
+void mfa_mpsc_ring_publish(mfa_mpsc_ring *ring, uint64_t position) {
+  _Atomic(uint64_t) *sequence = &ring->sequences[position & ring->mask];
+  atomic_store_explicit(sequence, position + 1, memory_order_release);
+}
+
+bool mfa_mpsc_ring_peek(mfa_mpsc_ring *ring, uint64_t *position) {
+  uint64_t head = ring->head;
+  _Atomic(uint64_t) *sequence = &ring->sequences[head & ring->mask];
+  uint64_t value = atomic_load_explicit(sequence, memory_order_acquire);
+  if (value != head + 1) {
+    return false;
+  }
+  *position = head;
+  return true;
+}
+
+void mfa_mpsc_ring_consume(mfa_mpsc_ring *ring) {
+  uint64_t head = ring->head;
+  _Atomic(uint64_t) *sequence = &ring->sequences[head & ring->mask];
+  atomic_store_explicit(
+    sequence, head + ring->mask + 1, memory_order_release);
+  ring->head = head + 1;
+}
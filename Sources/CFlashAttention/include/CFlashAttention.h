@@ -0,0 +1,58 @@
+//
+//  CFlashAttention.h
+//  FlashAttention
+//
+
+#ifndef CFlashAttention_h
+#define CFlashAttention_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// System calls that Swift cannot import directly.
+//
+// 'shm_open' is variadic on Darwin, so the Clang importer skips it. 'fork' is
+// explicitly marked unavailable in the Swift overlays.
+
+/// Opens a POSIX shared memory object.
+int mfa_shm_open(const char *name, int oflag, mode_t mode);
+
+/// Removes the name of a POSIX shared memory object.
+int mfa_shm_unlink(const char *name);
+
+/// Creates a child process.
+///
+/// The child must only call async-signal-safe functions, plus code that does
+/// not touch locks held by other threads of the parent (e.g. pure arithmetic
+/// over preallocated memory). It must exit with '_exit'.
+pid_t mfa_fork(void);
+
+// A bounded lock-free ring with many producers and one consumer.
+//
+// Swift 5.10 has no portable atomics, so the sequence numbers live here. The
+// ring only hands out slot positions; the caller stores the elements in its
+// own array, indexed by 'position & (capacity - 1)'. Publishing a slot is a
+// release, and peeking it is an acquire, so the element written between
+// 'claim' and 'publish' is visible to the consumer after 'peek'.
+
+typedef struct mfa_mpsc_ring mfa_mpsc_ring;
+
+/// Creates a ring. The capacity must be a power of two.
+mfa_mpsc_ring *mfa_mpsc_ring_create(uint32_t capacity);
+
+void mfa_mpsc_ring_destroy(mfa_mpsc_ring *ring);
+
+/// Reserves the next slot for a producer. Returns false if the ring is full.
+bool mfa_mpsc_ring_claim(mfa_mpsc_ring *ring, uint64_t *position);
+
+/// Makes a claimed slot visible to the consumer.
+void mfa_mpsc_ring_publish(mfa_mpsc_ring *ring, uint64_t position);
+
+/// Consumer only. Returns false if the oldest slot is not published yet.
+bool mfa_mpsc_ring_peek(mfa_mpsc_ring *ring, uint64_t *position);
+
+/// Consumer only. Returns the oldest slot to the producers.
+void mfa_mpsc_ring_consume(mfa_mpsc_ring *ring);
+
+#endif /* CFlashAttention_h */
@@ -0,0 +1,30 @@
+//
+//  AttentionBackend+Async.swift
+//  FlashAttention
+//
+
+import Foundation
+
+extension AttentionBackend {
+  /// Runs an operation of the backend on a worker thread, and suspends the
+  /// caller until it returns.
+  ///
+  /// The attention backends are synchronous, so the operation occupies one
+  /// thread of the global dispatch pool while it executes. The caller's
+  /// thread, and the cooperative thread pool, remain free.
+  ///
+  /// ```swift
+  /// let (O, L) = await backend.run {
+  ///   $0.forward(matrixDimensions: dimensions, Q: Q, K: K, V: V)
+  /// }
+  /// ```
+  public func run<Result>(
+    _ operation: @escaping (Self) -> Result
+  ) async -> Result {
+    await withCheckedContinuation { continuation in
+      DispatchQueue.global().async {
+        continuation.resume(returning: operation(self))
+      }
+    }
+  }
+}
@@ -0,0 +1,45 @@
+//
+//  AttentionBackend.swift
+//  FlashAttention
+//
+
+/// The three attention kernels, as host-callable functions.
+///
+/// Host-side drivers (e.g. ring attention) compose many kernel invocations
+/// over shards of the sequence. Writing them against this protocol lets the
+/// same driver run on the GPU, or on the CPU reference in environments
+/// without Metal.
+///
+/// Operands are FP32, row-major (untransposed), and densely packed:
+/// - Q, O, dO, dQ: row x head
+/// - K, V, dK, dV: column x head
+/// - L, D: row
+///
+/// L and D follow the conventions of the GPU kernels. L is the log-sum-exp
+/// of the scaled attention row, in base 2:
+///
+/// L = log2(Σ_c exp2(S[c] * log2(e) / sqrt(head)))
+///
+/// D is the row-wise dot product of dO and O, divided by sqrt(head).
+public protocol AttentionBackend: AnyObject {
+  /// Computes O and L.
+  func forward(
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    Q: [Float], K: [Float], V: [Float]
+  ) -> (O: [Float], L: [Float])
+
+  /// Computes D and dQ. L must be the statistic over every column of the
+  /// attention matrix, not only the columns passed in.
+  func backwardQuery(
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    Q: [Float], K: [Float], V: [Float],
+    O: [Float], L: [Float], dO: [Float]
+  ) -> (D: [Float], dQ: [Float])
+
+  /// Computes dK and dV.
+  func backwardKeyValue(
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    Q: [Float], K: [Float], V: [Float],
+    L: [Float], D: [Float], dO: [Float]
+  ) -> (dK: [Float], dV: [Float])
+}
@@ -0,0 +1,187 @@
+//
+//  CPUAttentionBackend.swift
+//  FlashAttention
+//
+
+import Foundation
+
+/// A reference implementation of the attention kernels on the CPU.
+///
+/// Materializes one row (or column) of the attention matrix at a time, and
+/// parallelizes over rows (or columns) with Dispatch. Everything is FP32.
+public final class CPUAttentionBackend: AttentionBackend {
+  public init() {
+
+  }
+
+  static let logBase2E: Float = 1.442695041
+
+  /// Base-2 logits for one row of the attention matrix.
+  @inline(__always)
+  static func logits(
+    row: Int, head: Int, columnCount: Int,
+    Q: UnsafePointer<Float>, K: UnsafePointer<Float>,
+    output: UnsafeMutablePointer<Float>
+  ) {
+    let scale = logBase2E / Float(head).squareRoot()
+    for c in 0..<columnCount {
+      var dotProduct: Float = .zero
+      for d in 0..<head {
+        dotProduct += Q[row * head + d] * K[c * head + d]
+      }
+      output[c] = dotProduct * scale
+    }
+  }
+
+  public func forward(
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    Q: [Float], K: [Float], V: [Float]
+  ) -> (O: [Float], L: [Float]) {
+    let (R, C, H) = matrixDimensions
+    var O = [Float](repeating: .zero, count: R * H)
+    var L = [Float](repeating: -.infinity, count: R)
+    guard R > 0, C > 0 else {
+      return (O, L)
+    }
+
+    Q.withUnsafeBufferPointer { Q in
+    K.withUnsafeBufferPointer { K in
+    V.withUnsafeBufferPointer { V in
+    O.withUnsafeMutableBufferPointer { O in
+    L.withUnsafeMutableBufferPointer { L in
+      let pointerO = O.baseAddress!
+      let pointerL = L.baseAddress!
+      DispatchQueue.concurrentPerform(iterations: R) { r in
+        let S = UnsafeMutablePointer<Float>.allocate(capacity: C)
+        defer { S.deallocate() }
+        Self.logits(
+          row: r, head: H, columnCount: C,
+          Q: Q.baseAddress!, K: K.baseAddress!, output: S)
+
+        var m: Float = -.infinity
+        for c in 0..<C {
+          m = max(m, S[c])
+        }
+        var l: Float = .zero
+        for c in 0..<C {
+          let P = exp2(S[c] - m)
+          l += P
+          for d in 0..<H {
+            pointerO[r * H + d] += P * V[c * H + d]
+          }
+        }
+        for d in 0..<H {
+          pointerO[r * H + d] /= l
+        }
+        pointerL[r] = m + log2(l)
+      }
+    }
+    }
+    }
+    }
+    }
+    return (O, L)
+  }
+
+  public func backwardQuery(
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    Q: [Float], K: [Float], V: [Float],
+    O: [Float], L: [Float], dO: [Float]
+  ) -> (D: [Float], dQ: [Float]) {
+    let (R, C, H) = matrixDimensions
+    let rsqrtH = 1 / Float(H).squareRoot()
+    var D = [Float](repeating: .zero, count: R)
+    var dQ = [Float](repeating: .zero, count: R * H)
+    guard R > 0 else {
+      return (D, dQ)
+    }
+
+    Q.withUnsafeBufferPointer { Q in
+    K.withUnsafeBufferPointer { K in
+    V.withUnsafeBufferPointer { V in
+    D.withUnsafeMutableBufferPointer { D in
+    dQ.withUnsafeMutableBufferPointer { dQ in
+      let pointerD = D.baseAddress!
+      let pointerDerivativeQ = dQ.baseAddress!
+      DispatchQueue.concurrentPerform(iterations: R) { r in
+        var termD: Float = .zero
+        for d in 0..<H {
+          termD += dO[r * H + d] * O[r * H + d]
+        }
+        termD *= rsqrtH
+        pointerD[r] = termD
+
+        guard C > 0 else {
+          return
+        }
+        let S = UnsafeMutablePointer<Float>.allocate(capacity: C)
+        defer { S.deallocate() }
+        Self.logits(
+          row: r, head: H, columnCount: C,
+          Q: Q.baseAddress!, K: K.baseAddress!, output: S)
+        for c in 0..<C {
+          let P = exp2(S[c] - L[r])
+          var dP: Float = .zero
+          for d in 0..<H {
+            dP += dO[r * H + d] * V[c * H + d]
+          }
+          let dS = P * (dP * rsqrtH - termD)
+          for d in 0..<H {
+            pointerDerivativeQ[r * H + d] += dS * K[c * H + d]
+          }
+        }
+      }
+    }
+    }
+    }
+    }
+    }
+    return (D, dQ)
+  }
+
+  public func backwardKeyValue(
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    Q: [Float], K: [Float], V: [Float],
+    L: [Float], D: [Float], dO: [Float]
+  ) -> (dK: [Float], dV: [Float]) {
+    let (R, C, H) = matrixDimensions
+    let rsqrtH = 1 / Float(H).squareRoot()
+    var dK = [Float](repeating: .zero, count: C * H)
+    var dV = [Float](repeating: .zero, count: C * H)
+    guard R > 0, C > 0 else {
+      return (dK, dV)
+    }
+
+    Q.withUnsafeBufferPointer { Q in
+    K.withUnsafeBufferPointer { K in
+    dK.withUnsafeMutableBufferPointer { dK in
+    dV.withUnsafeMutableBufferPointer { dV in
+      let pointerDerivativeK = dK.baseAddress!
+      let pointerDerivativeV = dV.baseAddress!
+      DispatchQueue.concurrentPerform(iterations: C) { c in
+        // S^T: one column of the attention matrix.
+        let ST = UnsafeMutablePointer<Float>.allocate(capacity: R)
+        defer { ST.deallocate() }
+        Self.logits(
+          row: c, head: H, columnCount: R,
+          Q: K.baseAddress!, K: Q.baseAddress!, output: ST)
+        for r in 0..<R {
+          let P = exp2(ST[r] - L[r])
+          var dP: Float = .zero
+          for d in 0..<H {
+            dP += dO[r * H + d] * V[c * H + d]
+          }
+          let dS = P * (dP * rsqrtH - D[r])
+          for d in 0..<H {
+            pointerDerivativeV[c * H + d] += P * dO[r * H + d]
+            pointerDerivativeK[c * H + d] += dS * Q[r * H + d]
+          }
+        }
+      }
+    }
+    }
+    }
+    }
+    return (dK, dV)
+  }
+}
@@ -0,0 +1,110 @@
+//
+//  MetalAttentionBackend+Batch.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+extension MetalAttentionBackend {
+  /// Computes O and L for a batch of independent problems of the same size.
+  ///
+  /// Operands are FP32 and row-major, with the problems back to back:
+  /// - Q, O: problem x row x head
+  /// - K, V: problem x column x head
+  /// - L: problem x row
+  ///
+  /// Small problems go to the tiny-sequence kernel, which packs several of
+  /// them into each threadgroup (see
+  /// `AttentionDescriptor.tinySequenceDescriptor`). Other problems run one
+  /// at a time on the tiled kernel.
+  public func forward(
+    batchCount: Int,
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    Q: [Float], K: [Float], V: [Float]
+  ) -> (O: [Float], L: [Float]) {
+    let (R, C, H) = matrixDimensions
+    guard Q.count == batchCount * R * H,
+          K.count == batchCount * C * H,
+          V.count == batchCount * C * H else {
+      fatalError("Operands had the wrong size.")
+    }
+    guard batchCount > 0, R > 0, C > 0 else {
+      return (
+        [Float](repeating: .zero, count: batchCount * R * H),
+        [Float](repeating: -.infinity, count: batchCount * R))
+    }
+
+    // Without a head dimension, every score is 0. O is empty, and the
+    // softmax is uniform over the columns.
+    guard H > 0 else {
+      return ([], [Float](repeating: log2(Float(C)), count: batchCount * R))
+    }
+
+    let attentionDesc = attentionDescriptor(matrixDimensions)
+    guard let tinyDesc = attentionDesc.tinySequenceDescriptor else {
+      var O: [Float] = []
+      var L: [Float] = []
+      for problem in 0..<batchCount {
+        let (problemO, problemL) = forward(
+          matrixDimensions: matrixDimensions,
+          Q: Array(Q[(problem * R * H)..<((problem + 1) * R * H)]),
+          K: Array(K[(problem * C * H)..<((problem + 1) * C * H)]),
+          V: Array(V[(problem * C * H)..<((problem + 1) * C * H)]))
+        O += problemO
+        L += problemL
+      }
+      return (O, L)
+    }
+
+    AttentionTinyKernel.register(descriptor: tinyDesc)
+    let (kernel, pipeline) = AttentionTinyKernel.pipelineCache[tinyDesc]!
+    let device = commandQueue.device
+    func createBuffer(_ contents: [Float]) -> MTLBuffer {
+      let buffer = contents.withUnsafeBytes {
+        device.makeBuffer(bytes: $0.baseAddress!, length: $0.count)
+      }
+      guard let buffer else {
+        fatalError("Could not allocate buffer.")
+      }
+      return buffer
+    }
+    let bufferO = createBuffer(
+      [Float](repeating: .zero, count: batchCount * R * H))
+    let bufferL = createBuffer(
+      [Float](repeating: .zero, count: batchCount * R))
+
+    guard let commandBuffer = commandQueue.makeCommandBuffer(),
+          let encoder = commandBuffer.makeComputeCommandEncoder() else {
+      fatalError("Could not create command buffer.")
+    }
+    encoder.setComputePipelineState(pipeline)
+    encoder.setBuffer(createBuffer(Q), offset: 0, index: 0)
+    encoder.setBuffer(createBuffer(K), offset: 0, index: 1)
+    encoder.setBuffer(createBuffer(V), offset: 0, index: 2)
+    encoder.setBuffer(bufferO, offset: 0, index: 3)
+    encoder.setBuffer(bufferL, offset: 0, index: 4)
+    var problemCount = UInt32(batchCount)
+    encoder.setBytes(&problemCount, length: 4, index: 5)
+    encoder.setThreadgroupMemoryLength(
+      kernel.threadgroupMemoryAllocation, index: 0)
+    encoder.dispatchThreadgroups(
+      MTLSize(
+        width: kernel.threadgroupCount(problemCount: batchCount),
+        height: 1, depth: 1),
+      threadsPerThreadgroup: MTLSize(
+        width: kernel.threadgroupSize, height: 1, depth: 1))
+    encoder.endEncoding()
+    commandBuffer.commit()
+    commandBuffer.waitUntilCompleted()
+
+    func read(_ buffer: MTLBuffer, count: Int) -> [Float] {
+      let pointer = buffer.contents().assumingMemoryBound(to: Float.self)
+      return Array(UnsafeBufferPointer(start: pointer, count: count))
+    }
+    return (
+      read(bufferO, count: batchCount * R * H),
+      read(bufferL, count: batchCount * R))
+  }
+}
+#endif
@@ -0,0 +1,190 @@
+//
+//  MetalAttentionBackend+Schedule.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+extension MetalAttentionBackend {
+  /// Computes O and L for a batch of sequences, with persistent
+  /// threadgroups that pull work items from an `AttentionSchedule`.
+  ///
+  /// Operands are FP32 and row-major. The heads are stored back to back, and
+  /// within each head, the sequences are stored back to back:
+  /// - Q, O: head x (sum of rows) x headDimension
+  /// - K, V: head x (sum of columns) x headDimension
+  /// - L: head x (sum of rows)
+  ///
+  /// If the descriptor leaves out the block dimensions, they are taken from
+  /// the forward kernel. Items that were split write partial results to
+  /// extra rows of O and L, which are merged on the host afterward.
+  public func forward(
+    scheduleDescriptor: AttentionScheduleDescriptor,
+    headDimension: Int,
+    Q: [Float], K: [Float], V: [Float]
+  ) -> (O: [Float], L: [Float]) {
+    guard let sequenceDimensions = scheduleDescriptor.sequenceDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let headCount = scheduleDescriptor.headCount
+    let rowOffsets = sequenceDimensions.reduce(into: [0]) {
+      $0.append($0.last! + $1.row)
+    }
+    let columnOffsets = sequenceDimensions.reduce(into: [0]) {
+      $0.append($0.last! + $1.column)
+    }
+    let rowCount = rowOffsets.last!
+    let columnCount = columnOffsets.last!
+    guard Q.count == headCount * rowCount * headDimension,
+          K.count == headCount * columnCount * headDimension,
+          V.count == headCount * columnCount * headDimension else {
+      fatalError("Operands had the wrong size.")
+    }
+
+    // The sequence lengths are read from the work items, so one pipeline
+    // serves every batch with the same head dimension.
+    let attentionDesc = attentionDescriptor(
+      (row: 1, column: 1, head: headDimension))
+    let (kernel, pipeline) = pipeline(
+      type: .forward, descriptor: attentionDesc, persistent: true)
+    let blockDimensions = kernel.blockDimensions
+
+    var scheduleDesc = scheduleDescriptor
+    if scheduleDesc.blockDimensions == nil {
+      scheduleDesc.blockDimensions = (
+        parallelization: Int(blockDimensions.parallelization),
+        traversal: Int(blockDimensions.traversal))
+    }
+    guard scheduleDesc.blockDimensions!.parallelization
+            == Int(blockDimensions.parallelization),
+          scheduleDesc.blockDimensions!.traversal
+            == Int(blockDimensions.traversal) else {
+      fatalError("Block dimensions did not match the kernel.")
+    }
+    let schedule = AttentionSchedule(descriptor: scheduleDesc)
+    let blockRows = scheduleDesc.blockDimensions!.parallelization
+
+    // Partial results go after the rows of every head.
+    let partialRowStart = headCount * rowCount
+    let outputRowCount = partialRowStart + schedule.partialCount * blockRows
+    var O = [Float](repeating: .zero, count: outputRowCount * headDimension)
+    var L = [Float](repeating: -.infinity, count: outputRowCount)
+    guard !schedule.items.isEmpty else {
+      return (O, L)
+    }
+
+    // Encode the work items in the layout of 'attention_work_item'.
+    var encodedItems: [Int32] = []
+    for item in schedule.items {
+      let (row, column) = sequenceDimensions[item.sequence]
+      let sequenceRow = item.head * rowCount + rowOffsets[item.sequence]
+      let sequenceColumn = item.head * columnCount
+      + columnOffsets[item.sequence]
+      var diagonal = Int(Int32.max)
+      if scheduleDesc.causal {
+        diagonal = column - row
+      }
+      var outputRow = sequenceRow + item.rowStart
+      if let partialSlot = item.partialSlot {
+        outputRow = partialRowStart + partialSlot * blockRows
+      }
+      encodedItems += [
+        sequenceRow, sequenceColumn, row, item.rowStart,
+        item.columnStart, item.columnEnd, diagonal, outputRow,
+      ].map { Int32($0) }
+    }
+
+    let device = commandQueue.device
+    func createBuffer<T>(_ contents: [T]) -> MTLBuffer {
+      let length = max(contents.count * MemoryLayout<T>.stride, 4)
+      let buffer = contents.withUnsafeBytes {
+        if let baseAddress = $0.baseAddress {
+          return device.makeBuffer(
+            bytes: baseAddress, length: length, options: .storageModeShared)
+        } else {
+          return device.makeBuffer(
+            length: length, options: .storageModeShared)
+        }
+      }
+      guard let buffer else {
+        fatalError("Could not allocate buffer.")
+      }
+      return buffer
+    }
+    let bufferO = createBuffer(O)
+    let bufferL = createBuffer(L)
+
+    guard let commandBuffer = commandQueue.makeCommandBuffer(),
+          let encoder = commandBuffer.makeComputeCommandEncoder() else {
+      fatalError("Could not create command buffer.")
+    }
+    encoder.setBuffer(createBuffer(Q), offset: 0, index: 0)
+    encoder.setBuffer(createBuffer(K), offset: 0, index: 1)
+    encoder.setBuffer(createBuffer(V), offset: 0, index: 2)
+    encoder.setBuffer(bufferO, offset: 0, index: 3)
+    encoder.setBuffer(bufferL, offset: 0, index: 4)
+    encoder.setBuffer(createBuffer(encodedItems), offset: 0, index: 10)
+    encoder.setBuffer(createBuffer([UInt32.zero]), offset: 0, index: 11)
+    var itemCount = UInt32(schedule.items.count)
+    encoder.setBytes(&itemCount, length: 4, index: 12)
+    encoder.setComputePipelineState(pipeline)
+    encoder.setThreadgroupMemoryLength(
+      Int(kernel.threadgroupMemoryAllocation), index: 0)
+
+    let threadgroupCount = min(
+      scheduleDesc.workerCount!, schedule.items.count)
+    encoder.dispatchThreadgroups(
+      MTLSize(width: threadgroupCount, height: 1, depth: 1),
+      threadsPerThreadgroup: MTLSize(
+        width: Int(kernel.threadgroupSize), height: 1, depth: 1))
+    encoder.endEncoding()
+    commandBuffer.commit()
+    commandBuffer.waitUntilCompleted()
+
+    O.withUnsafeMutableBytes {
+      $0.copyMemory(from: UnsafeRawBufferPointer(
+        start: bufferO.contents(), count: $0.count))
+    }
+    L.withUnsafeMutableBytes {
+      $0.copyMemory(from: UnsafeRawBufferPointer(
+        start: bufferL.contents(), count: $0.count))
+    }
+
+    // Merge the partial results of each split block. The kernel never
+    // writes the rows of a split block, so they start at O = 0, L = -inf.
+    for item in schedule.items {
+      guard let partialSlot = item.partialSlot else {
+        continue
+      }
+      let sequenceRow = item.head * rowCount + rowOffsets[item.sequence]
+      let blockRowStart = sequenceRow + item.rowStart
+      let blockRowCount = min(
+        blockRows, sequenceDimensions[item.sequence].row - item.rowStart)
+      let partialRow = partialRowStart + partialSlot * blockRows
+
+      var blockO = Array(O[
+        (blockRowStart * headDimension)..<(
+          (blockRowStart + blockRowCount) * headDimension)])
+      var blockL = Array(L[blockRowStart..<(blockRowStart + blockRowCount)])
+      RingAttentionDriver.merge(
+        O: &blockO, L: &blockL,
+        partialO: Array(O[
+          (partialRow * headDimension)..<(
+            (partialRow + blockRowCount) * headDimension)]),
+        partialL: Array(L[partialRow..<(partialRow + blockRowCount)]),
+        head: headDimension)
+      O.replaceSubrange(
+        (blockRowStart * headDimension)..<(
+          (blockRowStart + blockRowCount) * headDimension),
+        with: blockO)
+      L.replaceSubrange(
+        blockRowStart..<(blockRowStart + blockRowCount), with: blockL)
+    }
+
+    O.removeLast(schedule.partialCount * blockRows * headDimension)
+    L.removeLast(schedule.partialCount * blockRows)
+    return (O, L)
+  }
+}
+#endif
@@ -0,0 +1,386 @@
+//
+//  MetalAttentionBackend.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Foundation
+import Metal
+
+/// Decides when the backend compiles a pipeline for a single problem size.
+public enum AttentionPipelinePolicy {
+  /// One pipeline per problem size. The kernels are the fastest, but every
+  /// new sequence length triggers a compilation.
+  case specialized
+
+  /// One pipeline per kernel type and head dimension bucket. See
+  /// `AttentionDescriptor.dynamicShape`.
+  case dynamic
+
+  /// Dynamic pipelines, until a problem size has been seen `threshold`
+  /// times. Then it gets a specialized pipeline, until `capacity`
+  /// specialized pipelines exist.
+  case adaptive(threshold: Int, capacity: Int)
+}
+
+/// Executes the attention kernels on the GPU, in FP32.
+///
+/// Each call encodes a single kernel into its own command buffer and waits
+/// for it. By default, pipelines are cached per kernel type and problem
+/// size, because the sequence lengths are function constants. The pipeline
+/// policy can trade some speed for a bounded number of pipelines.
+public final class MetalAttentionBackend: AttentionBackend {
+  public let commandQueue: MTLCommandQueue
+
+  public let pipelinePolicy: AttentionPipelinePolicy
+
+  struct PipelineKey: Hashable {
+    var type: AttentionKernelType
+    var row: UInt32
+    var column: UInt32
+    var head: UInt16
+    var persistent: Bool
+    var dynamicShape: Bool
+  }
+  var pipelineCache: [PipelineKey: (AttentionKernel, MTLComputePipelineState)]
+    = [:]
+  let pipelineCacheLock = NSLock()
+
+  // How often each problem size was requested, for the adaptive policy.
+  // Only sizes that may still be promoted are tracked, and at most
+  // `maximumTrackedSizes` of them.
+  var requestCounts: [PipelineKey: Int] = [:]
+  static let maximumTrackedSizes = 1024
+
+  public init(
+    commandQueue: MTLCommandQueue = MTLContext.global.commandQueue,
+    pipelinePolicy: AttentionPipelinePolicy = .specialized
+  ) {
+    self.commandQueue = commandQueue
+    self.pipelinePolicy = pipelinePolicy
+  }
+
+  /// The number of pipelines compiled so far.
+  public var pipelineCount: Int {
+    pipelineCacheLock.lock()
+    defer { pipelineCacheLock.unlock() }
+    return pipelineCache.count
+  }
+
+  func attentionDescriptor(
+    _ matrixDimensions: (row: Int, column: Int, head: Int)
+  ) -> AttentionDescriptor {
+    var attentionDesc = AttentionDescriptor()
+    attentionDesc.lowPrecisionInputs = false
+    attentionDesc.lowPrecisionIntermediates = false
+    attentionDesc.matrixDimensions = (
+      row: UInt32(matrixDimensions.row),
+      column: UInt32(matrixDimensions.column),
+      head: UInt16(matrixDimensions.head))
+    attentionDesc.transposeState = (Q: false, K: false, V: false, O: false)
+    return attentionDesc
+  }
+
+  func pipeline(
+    type: AttentionKernelType,
+    descriptor attentionDesc: AttentionDescriptor,
+    persistent: Bool = false
+  ) -> (AttentionKernel, MTLComputePipelineState) {
+    var key = PipelineKey(
+      type: type,
+      row: attentionDesc.matrixDimensions!.row,
+      column: attentionDesc.matrixDimensions!.column,
+      head: attentionDesc.matrixDimensions!.head,
+      persistent: persistent,
+      dynamicShape: attentionDesc.dynamicShape)
+    if attentionDesc.dynamicShape {
+      key.row = 0
+      key.column = 0
+      key.head = attentionDesc.headDimensionBucket
+    }
+
+    pipelineCacheLock.lock()
+    defer { pipelineCacheLock.unlock() }
+    if let cached = pipelineCache[key] {
+      return cached
+    }
+
+    var kernelDesc = attentionDesc.kernelDescriptor(type: type)
+    kernelDesc.persistent = persistent
+    let kernel = AttentionKernel(descriptor: kernelDesc)
+    let device = commandQueue.device
+    let source = kernel.createSource()
+    let library = try! device.makeLibrary(source: source, options: nil)
+
+    let functionConstants = MTLFunctionConstantValues()
+    attentionDesc.setFunctionConstants(functionConstants)
+    let function = try! library.makeFunction(
+      name: "attention", constantValues: functionConstants)
+
+    // A critical part of the heuristic: force the occupancy to 1024 on M1.
+    let pipelineDesc = MTLComputePipelineDescriptor()
+    pipelineDesc.computeFunction = function
+    pipelineDesc.maxTotalThreadsPerThreadgroup = 1024
+    let pipeline = try! device.makeComputePipelineState(
+      descriptor: pipelineDesc, options: [], reflection: nil)
+    pipelineCache[key] = (kernel, pipeline)
+    return (kernel, pipeline)
+  }
+
+  // Applies the pipeline policy to a problem size.
+  func prefersDynamicShape(
+    type: AttentionKernelType,
+    descriptor attentionDesc: AttentionDescriptor
+  ) -> Bool {
+    switch pipelinePolicy {
+    case .specialized:
+      return false
+    case .dynamic:
+      return true
+    case .adaptive(let threshold, let capacity):
+      let matrixDimensions = attentionDesc.matrixDimensions!
+      let key = PipelineKey(
+        type: type,
+        row: matrixDimensions.row,
+        column: matrixDimensions.column,
+        head: matrixDimensions.head,
+        persistent: false,
+        dynamicShape: false)
+
+      pipelineCacheLock.lock()
+      defer { pipelineCacheLock.unlock() }
+      if pipelineCache[key] != nil {
+        return false
+      }
+      let specializedCount = pipelineCache.keys.filter {
+        !$0.dynamicShape
+      }.count
+      guard specializedCount < capacity else {
+        // No problem size can be promoted anymore.
+        requestCounts = [:]
+        return true
+      }
+
+      // Forget the sizes seen only once. If that is not enough, start over.
+      if requestCounts[key] == nil,
+         requestCounts.count >= Self.maximumTrackedSizes {
+        requestCounts = requestCounts.filter { $0.value > 1 }
+        if requestCounts.count >= Self.maximumTrackedSizes {
+          requestCounts = [:]
+        }
+      }
+      requestCounts[key, default: 0] += 1
+      guard requestCounts[key]! >= threshold else {
+        return true
+      }
+      requestCounts[key] = nil
+      return false
+    }
+  }
+
+  /// Binds the operands in the order the generated source expects, and
+  /// dispatches one kernel. Operands absent from `inputs` are zero-filled.
+  func execute(
+    type: AttentionKernelType,
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    inputs: [AttentionOperand: [Float]],
+    outputs: [AttentionOperand]
+  ) -> [AttentionOperand: [Float]] {
+    var attentionDesc = attentionDescriptor(matrixDimensions)
+    attentionDesc.dynamicShape = prefersDynamicShape(
+      type: type, descriptor: attentionDesc)
+    let (kernel, pipeline) = pipeline(type: type, descriptor: attentionDesc)
+    let device = commandQueue.device
+
+    // With a dynamic shape, the operands are padded to the head dimension
+    // bucket.
+    var paddedHead = matrixDimensions.head
+    if attentionDesc.dynamicShape {
+      paddedHead = Int(attentionDesc.headDimensionBucket)
+    }
+
+    func sequenceLength(_ operand: AttentionOperand) -> Int {
+      switch operand {
+      case .K, .V, .dV, .dK:
+        return matrixDimensions.column
+      case .Q, .O, .dO, .dQ, .L, .D:
+        return matrixDimensions.row
+      default:
+        fatalError("Unsupported operand.")
+      }
+    }
+    func elementCount(_ operand: AttentionOperand) -> Int {
+      switch operand {
+      case .L, .D:
+        return sequenceLength(operand)
+      default:
+        return sequenceLength(operand) * matrixDimensions.head
+      }
+    }
+    func paddedElementCount(_ operand: AttentionOperand) -> Int {
+      switch operand {
+      case .L, .D:
+        return sequenceLength(operand)
+      default:
+        return sequenceLength(operand) * paddedHead
+      }
+    }
+
+    // Changes the stride of each row from one head dimension to another.
+    func pad(
+      _ operand: AttentionOperand, _ contents: [Float],
+      from sourceHead: Int, to destinationHead: Int
+    ) -> [Float] {
+      guard sourceHead != destinationHead,
+            operand != .L, operand != .D else {
+        return contents
+      }
+      let rowCount = sequenceLength(operand)
+      var output = [Float](repeating: .zero, count: rowCount * destinationHead)
+      let copiedHead = min(sourceHead, destinationHead)
+      for r in 0..<rowCount {
+        for d in 0..<copiedHead {
+          output[r * destinationHead + d] = contents[r * sourceHead + d]
+        }
+      }
+      return output
+    }
+
+    let bufferIndices: [(AttentionOperand, Int)] = [
+      (.Q, 0), (.K, 1), (.V, 2), (.O, 3), (.L, 4), (.D, 5),
+      (.dO, 6), (.dV, 7), (.dK, 8), (.dQ, 9),
+    ]
+    var buffers: [AttentionOperand: MTLBuffer] = [:]
+    for (operand, _) in bufferIndices {
+      let length = max(paddedElementCount(operand) * 4, 4)
+      var buffer: MTLBuffer?
+      if var contents = inputs[operand] {
+        guard contents.count == elementCount(operand) else {
+          fatalError("Operand \(operand) had the wrong size.")
+        }
+        contents = pad(
+          operand, contents, from: matrixDimensions.head, to: paddedHead)
+        buffer = contents.withUnsafeBytes {
+          device.makeBuffer(
+            bytes: $0.baseAddress!, length: length,
+            options: .storageModeShared)
+        }
+      } else {
+        buffer = device.makeBuffer(
+          length: length, options: .storageModeShared)
+      }
+      guard let buffer else {
+        fatalError("Could not allocate buffer.")
+      }
+      buffers[operand] = buffer
+    }
+
+    guard let commandBuffer = commandQueue.makeCommandBuffer(),
+          let encoder = commandBuffer.makeComputeCommandEncoder() else {
+      fatalError("Could not create command buffer.")
+    }
+    for (operand, index) in bufferIndices {
+      encoder.setBuffer(buffers[operand]!, offset: 0, index: index)
+    }
+    if attentionDesc.dynamicShape {
+      attentionDesc.setShapeArguments(encoder)
+    }
+    encoder.setComputePipelineState(pipeline)
+    encoder.setThreadgroupMemoryLength(
+      Int(kernel.threadgroupMemoryAllocation), index: 0)
+
+    var parallelizationDimension: Int
+    switch type {
+    case .forward, .backwardQuery:
+      parallelizationDimension = matrixDimensions.row
+    case .backwardKeyValue:
+      parallelizationDimension = matrixDimensions.column
+    }
+    let granularity = Int(kernel.blockDimensions.parallelization)
+    let gridSize = MTLSize(
+      width: (parallelizationDimension + granularity - 1) / granularity,
+      height: 1,
+      depth: 1)
+    let groupSize = MTLSize(
+      width: Int(kernel.threadgroupSize),
+      height: 1,
+      depth: 1)
+    encoder.dispatchThreadgroups(
+      gridSize, threadsPerThreadgroup: groupSize)
+    encoder.endEncoding()
+    commandBuffer.commit()
+    commandBuffer.waitUntilCompleted()
+
+    var output: [AttentionOperand: [Float]] = [:]
+    for operand in outputs {
+      let count = paddedElementCount(operand)
+      let pointer = buffers[operand]!.contents()
+        .assumingMemoryBound(to: Float.self)
+      let contents = Array(UnsafeBufferPointer(start: pointer, count: count))
+      output[operand] = pad(
+        operand, contents, from: paddedHead, to: matrixDimensions.head)
+    }
+    return output
+  }
+
+  public func forward(
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    Q: [Float], K: [Float], V: [Float]
+  ) -> (O: [Float], L: [Float]) {
+    // The kernel does not handle an empty attention row.
+    guard matrixDimensions.row > 0, matrixDimensions.column > 0 else {
+      return (
+        [Float](
+          repeating: .zero,
+          count: matrixDimensions.row * matrixDimensions.head),
+        [Float](repeating: -.infinity, count: matrixDimensions.row))
+    }
+    let output = execute(
+      type: .forward, matrixDimensions: matrixDimensions,
+      inputs: [.Q: Q, .K: K, .V: V], outputs: [.O, .L])
+    return (output[.O]!, output[.L]!)
+  }
+
+  public func backwardQuery(
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    Q: [Float], K: [Float], V: [Float],
+    O: [Float], L: [Float], dO: [Float]
+  ) -> (D: [Float], dQ: [Float]) {
+    guard matrixDimensions.row > 0, matrixDimensions.column > 0 else {
+      // D does not depend on the columns. Compute it on the host.
+      let H = matrixDimensions.head
+      var D = [Float](repeating: .zero, count: matrixDimensions.row)
+      for r in D.indices {
+        for d in 0..<H {
+          D[r] += dO[r * H + d] * O[r * H + d]
+        }
+        D[r] /= Float(H).squareRoot()
+      }
+      return (D, [Float](repeating: .zero, count: matrixDimensions.row * H))
+    }
+    let output = execute(
+      type: .backwardQuery, matrixDimensions: matrixDimensions,
+      inputs: [.Q: Q, .K: K, .V: V, .O: O, .L: L, .dO: dO],
+      outputs: [.D, .dQ])
+    return (output[.D]!, output[.dQ]!)
+  }
+
+  public func backwardKeyValue(
+    matrixDimensions: (row: Int, column: Int, head: Int),
+    Q: [Float], K: [Float], V: [Float],
+    L: [Float], D: [Float], dO: [Float]
+  ) -> (dK: [Float], dV: [Float]) {
+    guard matrixDimensions.row > 0, matrixDimensions.column > 0 else {
+      let count = matrixDimensions.column * matrixDimensions.head
+      return (
+        [Float](repeating: .zero, count: count),
+        [Float](repeating: .zero, count: count))
+    }
+    let output = execute(
+      type: .backwardKeyValue, matrixDimensions: matrixDimensions,
+      inputs: [.Q: Q, .K: K, .V: V, .L: L, .D: D, .dO: dO],
+      outputs: [.dK, .dV])
+    return (output[.dK]!, output[.dV]!)
+  }
+}
+#endif
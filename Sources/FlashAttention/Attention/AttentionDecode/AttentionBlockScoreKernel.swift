@@ -0,0 +1,95 @@
+//
+//  AttentionBlockScoreKernel.swift
+//  FlashAttention
+//
+
+/// The scoring pass of `AttentionBlockSelection`.
+///
+/// Each simdgroup scores one block, with the lanes splitting the head
+/// dimension. It reads 2 * D summary values per block, instead of
+/// `blockSize * D` keys.
+public struct AttentionBlockScoreKernel {
+  var headDimension: UInt16
+
+  /// The number of simdgroups in a threadgroup.
+  public var simdgroupsPerThreadgroup: Int = 8
+
+  public init(descriptor: AttentionDecodeDescriptor) {
+    guard let headDimension = descriptor.headDimension,
+          descriptor.blockSelection != nil else {
+      fatalError("Descriptor was incomplete.")
+    }
+    self.headDimension = headDimension
+  }
+
+  public var threadgroupSize: Int {
+    32 * simdgroupsPerThreadgroup
+  }
+
+  // The number of elements of a row each lane holds.
+  var elementsPerLane: Int {
+    (Int(headDimension) + 31) / 32
+  }
+}
+
+extension AttentionBlockScoreKernel {
+  public func createSource() -> String {
+    """
+
+#include <metal_stdlib>
+using namespace metal;
+
+constant uint D = \(headDimension);
+
+// Matches the layout of 'AttentionBlockScoreArguments'.
+struct attention_block_score_arguments {
+  uint row_count;
+  uint block_count;
+};
+
+kernel void attention_block_score(
+  device float *Q [[buffer(0)]],
+  device float *key_summaries [[buffer(1)]],
+  device float *scores [[buffer(2)]],
+  constant attention_block_score_arguments &arguments [[buffer(3)]],
+
+  uint gid [[threadgroup_position_in_grid]],
+  ushort sidx [[simdgroup_index_in_threadgroup]],
+  ushort lane_id [[thread_index_in_simdgroup]])
+{
+  uint block = gid * \(simdgroupsPerThreadgroup) + sidx;
+  if (block >= arguments.block_count) {
+    return;
+  }
+
+  device float *k_min = key_summaries + block * 2 * D;
+  device float *k_max = k_min + D;
+  float lower[\(elementsPerLane)];
+  float upper[\(elementsPerLane)];
+#pragma clang loop unroll(full)
+  for (ushort i = 0; i < \(elementsPerLane); ++i) {
+    uint d = lane_id + 32 * i;
+    lower[i] = (d < D) ? k_min[d] : 0;
+    upper[i] = (d < D) ? k_max[d] : 0;
+  }
+
+  // The largest logit any row could reach in this block.
+  float score = -numeric_limits<float>::max();
+  for (uint r = 0; r < arguments.row_count; ++r) {
+    float bound = 0;
+#pragma clang loop unroll(full)
+    for (ushort i = 0; i < \(elementsPerLane); ++i) {
+      uint d = lane_id + 32 * i;
+      float q = (d < D) ? Q[r * D + d] : 0;
+      bound += max(q * lower[i], q * upper[i]);
+    }
+    score = max(score, simd_sum(bound));
+  }
+  if (lane_id == 0) {
+    scores[block] = score;
+  }
+}
+
+"""
+  }
+}
@@ -0,0 +1,98 @@
+//
+//  AttentionBlockSelection.swift
+//  FlashAttention
+//
+
+/// Query-aware selection of key-value blocks, for attention over long
+/// caches.
+///
+/// The cache is split into blocks of `blockSize` columns. For each block,
+/// the per-channel minimum and maximum of K are kept up to date as rows are
+/// appended. Before every step, a scoring pass bounds the largest logit any
+/// query of the step could reach in each full block:
+///
+/// ```
+/// score = max over rows of sum over d of max(q[d] * min[d], q[d] * max[d])
+/// ```
+///
+/// The `blockCount` highest-scoring blocks are attended. The columns after
+/// the last full block, which include the new rows, are always attended.
+public struct AttentionBlockSelection: Equatable {
+  /// The number of columns per block.
+  public var blockSize: UInt32
+
+  /// The number of full blocks each step attends.
+  public var blockCount: UInt32
+
+  public init(blockSize: UInt32, blockCount: UInt32) {
+    self.blockSize = blockSize
+    self.blockCount = blockCount
+  }
+}
+
+extension AttentionBlockSelection {
+  /// The per-channel minimum and maximum of K, for every block that has at
+  /// least one row. Each block holds D minimums followed by D maximums.
+  ///
+  /// The reference for the summaries the cache maintains at append time.
+  public func summaries(K: [Float], headDimension: Int) -> [Float] {
+    let D = headDimension
+    let B = Int(blockSize)
+    let columnCount = K.count / D
+    let blockCount = (columnCount + B - 1) / B
+    var output = [Float](repeating: .zero, count: blockCount * 2 * D)
+    for block in 0..<blockCount {
+      let columns = (block * B)..<min((block + 1) * B, columnCount)
+      for d in 0..<D {
+        var minimum = Float.greatestFiniteMagnitude
+        var maximum = -Float.greatestFiniteMagnitude
+        for c in columns {
+          minimum = min(minimum, K[c * D + d])
+          maximum = max(maximum, K[c * D + d])
+        }
+        output[block * 2 * D + d] = minimum
+        output[block * 2 * D + D + d] = maximum
+      }
+    }
+    return output
+  }
+
+  /// The upper bound on the logits of each block, before scaling.
+  ///
+  /// The reference for the scoring pass.
+  public static func scores(
+    Q: [Float], summaries: [Float], headDimension: Int
+  ) -> [Float] {
+    let D = headDimension
+    let rowCount = Q.count / D
+    let blockCount = summaries.count / (2 * D)
+    var output = [Float](repeating: .zero, count: blockCount)
+    for block in 0..<blockCount {
+      var score = -Float.greatestFiniteMagnitude
+      for r in 0..<rowCount {
+        var bound: Float = .zero
+        for d in 0..<D {
+          let q = Q[r * D + d]
+          let minimum = summaries[block * 2 * D + d]
+          let maximum = summaries[block * 2 * D + D + d]
+          bound += max(q * minimum, q * maximum)
+        }
+        score = max(score, bound)
+      }
+      output[block] = score
+    }
+    return output
+  }
+
+  /// The indices of the `blockCount` highest scores, in increasing order so
+  /// the kernel reads the cache front to back. Ties go to the earlier block.
+  public func select(scores: [Float]) -> [UInt32] {
+    let order = scores.indices.sorted {
+      if scores[$0] != scores[$1] {
+        return scores[$0] > scores[$1]
+      }
+      return $0 < $1
+    }
+    return order.prefix(Int(blockCount)).sorted().map { UInt32($0) }
+  }
+}
@@ -0,0 +1,131 @@
+//
+//  AttentionDecodeDescriptor.swift
+//  FlashAttention
+//
+
+/// How the rows of a key-value cache map to memory.
+public enum AttentionCacheLayout: Equatable {
+  /// Logical column `c` is row `c` of the K and V buffers.
+  case contiguous
+
+  /// The columns are split into pages of `pageSize` rows. A page table maps
+  /// each logical page to a page of the K and V buffers.
+  case paged(pageSize: UInt32)
+
+  /// The cache is a ring buffer, for streaming with a sliding window. The
+  /// first `sinkCount` columns stay in the first rows. Every later column
+  /// `c` goes to row `sinkCount + (c - sinkCount) % (capacity - sinkCount)`,
+  /// overwriting a column that fell out of the window.
+  case ring
+}
+
+/// A description of attention over a key-value cache, for a few new rows at
+/// a time (decoding, or chunked prefill).
+///
+/// Each step brings R new tokens. Their queries attend to the C columns
+/// already in the cache, and causally to the keys of the new tokens up to
+/// their own position. The sequence lengths are not part of the descriptor,
+/// because they change every step. They are bound at dispatch time.
+public struct AttentionDecodeDescriptor {
+  /// Whether the kernel writes the new rows of K and V into the cache. The
+  /// default is `true`.
+  ///
+  /// The new rows are bound as separate buffers. Each threadgroup writes one
+  /// of them into its cache slot, and reads the new rows it attends to from
+  /// those buffers instead of the cache. This saves the launch of an append
+  /// kernel, and a round trip through memory, per layer and per token.
+  ///
+  /// When `false`, the new rows must already be in the cache.
+  public var appendsKeyValue: Bool = true
+
+  public var cacheLayout: AttentionCacheLayout = .contiguous
+
+  /// The number of columns at the start of the sequence that every row
+  /// sees, regardless of the window (attention sinks). The default is 0.
+  public var sinkCount: UInt32 = 0
+
+  /// The number of columns each row sees, counting itself and the previous
+  /// ones, beyond the sinks. The default is `nil`, for every column.
+  ///
+  /// The window and the causal mask are computed in logical positions, so
+  /// they do not depend on where the columns sit in the cache. The ring
+  /// layout requires a window.
+  public var slidingWindow: UInt32?
+
+  /// Attends only the blocks of the cache that a scoring pass selects,
+  /// instead of every column. The default is `nil`.
+  ///
+  /// Not supported with a sliding window.
+  public var blockSelection: AttentionBlockSelection?
+
+  /// The output dimension of W_o, to fuse the output projection into the
+  /// kernel. The default is `nil`.
+  ///
+  /// When set, each row is multiplied by this head's D x M slice of W_o
+  /// while it is still on chip. The kernel writes a partial of the projected
+  /// output (R x M) instead of O. The partials of the heads are summed
+  /// afterward, in a fixed order, because there are no FP32 atomics.
+  public var outputProjectionDimension: UInt32?
+
+  /// The precision of K and V, both in the cache and the new rows. Q, O, and
+  /// L are always FP32.
+  public var cachePrecision: GEMMOperandPrecision = .FP32
+
+  /// Required. The head dimension.
+  public var headDimension: UInt16?
+
+  public init() {
+
+  }
+}
+
+struct AttentionDecodeKey: Equatable, Hashable {
+  var appendsKeyValue: UInt8
+  var blockSelection: SIMD2<UInt32>
+  var cacheLayout: SIMD2<UInt32>
+  var cachePrecision: UInt16
+  var headDimension: UInt16
+  var outputProjectionDimension: UInt32
+  var sinkCount: UInt32
+  var slidingWindow: UInt32
+
+  init(copying source: AttentionDecodeDescriptor) {
+    appendsKeyValue = GEMMKernelKey.createBoolean(source.appendsKeyValue)
+    cachePrecision = source.cachePrecision.rawValue
+    headDimension = source.headDimension ?? .max
+    outputProjectionDimension = source.outputProjectionDimension ?? .zero
+    sinkCount = source.sinkCount
+    slidingWindow = source.slidingWindow ?? .max
+
+    if let selection = source.blockSelection {
+      blockSelection = SIMD2(selection.blockSize, selection.blockCount)
+    } else {
+      blockSelection = .zero
+    }
+
+    switch source.cacheLayout {
+    case .contiguous:
+      cacheLayout = SIMD2(0, 0)
+    case .paged(let pageSize):
+      cacheLayout = SIMD2(1, pageSize)
+    case .ring:
+      cacheLayout = SIMD2(2, 0)
+    }
+  }
+}
+
+extension AttentionDecodeDescriptor: Hashable, Equatable {
+  public static func == (
+    lhs: AttentionDecodeDescriptor,
+    rhs: AttentionDecodeDescriptor
+  ) -> Bool {
+    let lhsKey = AttentionDecodeKey(copying: lhs)
+    let rhsKey = AttentionDecodeKey(copying: rhs)
+    return lhsKey == rhsKey
+  }
+
+  public func hash(into hasher: inout Hasher) {
+    let key = AttentionDecodeKey(copying: self)
+    hasher.combine(key)
+  }
+}
@@ -0,0 +1,39 @@
+//
+//  AttentionDecodeKernel+PipelineCache.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+extension AttentionDecodeKernel {
+  public typealias PipelineValue = (
+    kernel: AttentionDecodeKernel, pipeline: MTLComputePipelineState)
+
+  public static var pipelineCache: [
+    AttentionDecodeDescriptor: PipelineValue] = [:]
+}
+
+extension AttentionDecodeKernel {
+  // Register this problem configuration in the cache.
+  public static func register(descriptor: AttentionDecodeDescriptor) {
+    guard pipelineCache[descriptor] == nil else {
+      return
+    }
+
+    let kernel = AttentionDecodeKernel(descriptor: descriptor)
+    let source = kernel.createSource()
+    let device = MTLContext.global.device
+    let library: MTLLibrary
+    do {
+      library = try device.makeLibrary(source: source, options: nil)
+    } catch {
+      print("Metal compile error:\n\(error)\n")
+      fatalError("Metal compile failed")
+    }
+    let function = library.makeFunction(name: "attention_decode")!
+    let pipeline = try! device.makeComputePipelineState(function: function)
+    pipelineCache[descriptor] = (kernel, pipeline)
+  }
+}
+#endif
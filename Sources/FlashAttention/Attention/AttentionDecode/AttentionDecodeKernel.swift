@@ -0,0 +1,506 @@
+//
+//  AttentionDecodeKernel.swift
+//  FlashAttention
+//
+
+/// The kernel for `AttentionDecodeDescriptor`.
+///
+/// Each threadgroup owns one new row. Its simdgroups take turns over the
+/// columns, each keeping its own online softmax, and the lanes of a
+/// simdgroup split the head dimension. Every column then reads one
+/// contiguous row of K and V. At the end, the simdgroups merge their partial
+/// results through threadgroup memory.
+///
+/// There is no blocking into tiles. With a handful of rows, attention over
+/// a cache is limited by the bandwidth of reading K and V, not by the
+/// arithmetic.
+public struct AttentionDecodeKernel {
+  /// The largest head dimension this kernel accepts.
+  public static let maximumHeadDimension: UInt16 = 256
+
+  var appendsKeyValue: Bool
+  var blockSelection: AttentionBlockSelection?
+  var cacheLayout: AttentionCacheLayout
+  var cachePrecision: GEMMOperandPrecision
+  var headDimension: UInt16
+  var outputProjectionDimension: UInt32?
+  var sinkCount: UInt32
+  var slidingWindow: UInt32?
+
+  /// The number of simdgroups in a threadgroup.
+  public var simdgroupsPerThreadgroup: Int = 8
+
+  public init(descriptor: AttentionDecodeDescriptor) {
+    guard let headDimension = descriptor.headDimension else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard headDimension <= Self.maximumHeadDimension else {
+      fatalError("Head dimension was too large.")
+    }
+    guard descriptor.cachePrecision != .BF16 else {
+      fatalError("BF16 is not supported.")
+    }
+    if case .paged(let pageSize) = descriptor.cacheLayout {
+      guard pageSize > 0 else {
+        fatalError("Invalid page size.")
+      }
+    }
+    if case .ring = descriptor.cacheLayout {
+      guard descriptor.slidingWindow != nil else {
+        fatalError("The ring layout requires a sliding window.")
+      }
+    }
+    if let slidingWindow = descriptor.slidingWindow {
+      guard slidingWindow > 0 else {
+        fatalError("Invalid sliding window.")
+      }
+    }
+    if let blockSelection = descriptor.blockSelection {
+      guard blockSelection.blockSize > 0,
+            blockSelection.blockCount > 0 else {
+        fatalError("Invalid block selection.")
+      }
+      guard descriptor.slidingWindow == nil else {
+        fatalError("Block selection does not support sliding windows.")
+      }
+    }
+    if let outputProjectionDimension = descriptor.outputProjectionDimension {
+      guard outputProjectionDimension > 0 else {
+        fatalError("Invalid output projection dimension.")
+      }
+    }
+    self.appendsKeyValue = descriptor.appendsKeyValue
+    self.blockSelection = descriptor.blockSelection
+    self.cacheLayout = descriptor.cacheLayout
+    self.cachePrecision = descriptor.cachePrecision
+    self.headDimension = headDimension
+    self.outputProjectionDimension = descriptor.outputProjectionDimension
+    self.sinkCount = descriptor.sinkCount
+    self.slidingWindow = descriptor.slidingWindow
+  }
+
+  public var threadgroupSize: Int {
+    32 * simdgroupsPerThreadgroup
+  }
+
+  /// The partial results of every simdgroup: m, l, and one row of O.
+  public var threadgroupMemoryAllocation: Int {
+    simdgroupsPerThreadgroup * (2 + Int(headDimension)) * 4
+  }
+
+  // The number of elements of a row each lane holds.
+  var elementsPerLane: Int {
+    (Int(headDimension) + 31) / 32
+  }
+}
+
+extension AttentionDecodeKernel {
+  public func createSource() -> String {
+    let logBase2E: Float = 1.442695041
+    let scale = logBase2E / Float(headDimension).squareRoot()
+
+    return """
+
+#include <metal_stdlib>
+using namespace metal;
+
+constant uint D = \(headDimension);
+
+// Matches the layout of 'AttentionDecodeArguments'.
+struct attention_decode_arguments {
+  uint row_count;
+  uint cache_length;
+  uint cache_capacity;
+  uint selected_block_count;
+};
+
+kernel void attention_decode(\(createBufferBindings())
+                             threadgroup float *threadgroup_block
+                             [[threadgroup(0)]],
+
+                             uint gid [[threadgroup_position_in_grid]],
+                             ushort sidx [[simdgroup_index_in_threadgroup]],
+                             ushort lane_id [[thread_index_in_simdgroup]])
+{
+  uint row = gid;
+  if (row >= arguments.row_count) {
+    return;
+  }
+  uint cache_length = arguments.cache_length;
+
+  // Lane 'i' holds the elements 'i', 'i + 32', 'i + 64', ...
+  float q[\(elementsPerLane)];
+  float o[\(elementsPerLane)];
+#pragma clang loop unroll(full)
+  for (ushort i = 0; i < \(elementsPerLane); ++i) {
+    uint d = lane_id + 32 * i;
+    q[i] = (d < D) ? Q[row * D + d] * \(scale) : 0;
+    o[i] = 0;
+  }
+  float m = -numeric_limits<float>::max();
+  float l = 0;
+
+  \(createAppend())
+  \(createSummaryUpdate())
+  \(createTraversal())
+  \(createMerge())
+}
+
+"""
+  }
+
+  func createBufferBindings() -> String {
+    let name = cachePrecision.name
+    var output = """
+
+                             device float *Q [[buffer(0)]],
+                             device \(name) *K [[buffer(1)]],
+                             device \(name) *V [[buffer(2)]],
+"""
+    if appendsKeyValue {
+      output += """
+
+                             device \(name) *K_new [[buffer(3)]],
+                             device \(name) *V_new [[buffer(4)]],
+"""
+    }
+    output += """
+
+                             device float *O [[buffer(5)]],
+                             device float *L [[buffer(6)]],
+"""
+    if case .paged = cacheLayout {
+      output += """
+
+                             device uint *page_table [[buffer(7)]],
+"""
+    }
+    output += """
+
+                             constant attention_decode_arguments &arguments
+                             [[buffer(8)]],
+"""
+    if blockSelection != nil {
+      output += """
+
+                             device uint *block_list [[buffer(9)]],
+"""
+      if appendsKeyValue {
+        output += """
+
+                             device float *key_summaries [[buffer(10)]],
+"""
+      }
+    }
+    if outputProjectionDimension != nil {
+      output += """
+
+                             device float *W_o [[buffer(11)]],
+"""
+    }
+    return output
+  }
+
+  // The row of the K and V buffers that holds a logical column.
+  func cacheRow(_ column: String) -> String {
+    switch cacheLayout {
+    case .contiguous:
+      return "(\(column))"
+    case .paged(let pageSize):
+      return """
+        (page_table[(\(column)) / \(pageSize)] * \(pageSize) + \
+        (\(column)) % \(pageSize))
+        """
+    case .ring:
+      // The sinks keep their rows. The other columns share the rest of the
+      // buffer, modulo its size.
+      guard sinkCount > 0 else {
+        return "((\(column)) % arguments.cache_capacity)"
+      }
+      return """
+        ((\(column)) < \(sinkCount) ? (\(column)) : \(sinkCount) + \
+        ((\(column)) - \(sinkCount)) % \
+        (arguments.cache_capacity - \(sinkCount)))
+        """
+    }
+  }
+
+  // Each threadgroup writes its new row into the cache. The other
+  // threadgroups never read that slot, so there is no race. In the ring
+  // layout, the slot held a column that left the window of every new row
+  // (checked on the host).
+  func createAppend() -> String {
+    guard appendsKeyValue else {
+      return ""
+    }
+
+    return """
+
+  if (sidx == 0) {
+    uint destination = \(cacheRow("cache_length + row"));
+#pragma clang loop unroll(full)
+    for (ushort i = 0; i < \(elementsPerLane); ++i) {
+      uint d = lane_id + 32 * i;
+      if (d < D) {
+        K[destination * D + d] = K_new[row * D + d];
+        V[destination * D + d] = V_new[row * D + d];
+      }
+    }
+  }
+
+"""
+  }
+
+  // One threadgroup folds the new keys into the summaries of their blocks.
+  // The lanes own disjoint channels, so no other thread touches them. The
+  // scoring pass for this step already ran.
+  func createSummaryUpdate() -> String {
+    guard let blockSelection = blockSelection, appendsKeyValue else {
+      return ""
+    }
+    let blockSize = blockSelection.blockSize
+
+    return """
+
+  if (row == 0 && sidx == 0) {
+    for (uint r = 0; r < arguments.row_count; ++r) {
+      uint column = cache_length + r;
+      device float *k_min = key_summaries + (column / \(blockSize)) * 2 * D;
+      device float *k_max = k_min + D;
+      bool first = (column % \(blockSize) == 0);
+#pragma clang loop unroll(full)
+      for (ushort i = 0; i < \(elementsPerLane); ++i) {
+        uint d = lane_id + 32 * i;
+        if (d < D) {
+          float k = float(K_new[r * D + d]);
+          k_min[d] = first ? k : min(k_min[d], k);
+          k_max[d] = first ? k : max(k_max[d], k);
+        }
+      }
+    }
+  }
+
+"""
+  }
+
+  // Finds the rows of K and V for a logical column. The new rows come from
+  // their own buffers, if the kernel appends them.
+  func createColumnAddress() -> String {
+    let name = cachePrecision.name
+    guard appendsKeyValue else {
+      return """
+
+      uint source = \(cacheRow("c"));
+      device \(name) *K_row = K + source * D;
+      device \(name) *V_row = V + source * D;
+
+"""
+    }
+
+    return """
+
+      device \(name) *K_row;
+      device \(name) *V_row;
+      if (c < cache_length) {
+        uint source = \(cacheRow("c"));
+        K_row = K + source * D;
+        V_row = V + source * D;
+      } else {
+        K_row = K_new + (c - cache_length) * D;
+        V_row = V_new + (c - cache_length) * D;
+      }
+
+"""
+  }
+
+  // Folds one column into the online softmax of this simdgroup.
+  func createColumnUpdate() -> String {
+    """
+
+    {
+      \(createColumnAddress())
+      float s = 0;
+#pragma clang loop unroll(full)
+      for (ushort i = 0; i < \(elementsPerLane); ++i) {
+        uint d = lane_id + 32 * i;
+        if (d < D) {
+          s += q[i] * float(K_row[d]);
+        }
+      }
+      s = simd_sum(s);
+
+      float m_new = max(m, s);
+      float correction = fast::exp2(m - m_new);
+      float p = fast::exp2(s - m_new);
+      l = l * correction + p;
+#pragma clang loop unroll(full)
+      for (ushort i = 0; i < \(elementsPerLane); ++i) {
+        uint d = lane_id + 32 * i;
+        if (d < D) {
+          o[i] = o[i] * correction + p * float(V_row[d]);
+        }
+      }
+      m = m_new;
+    }
+
+"""
+  }
+
+  // Row 'row' sees the columns up to its own logical position. With block
+  // selection, it sees the selected blocks, and the columns after them.
+  // With a sliding window, it sees the sinks, and the columns in the
+  // window. The masks come from the loop bounds, in logical positions, so
+  // they do not depend on the layout of the cache.
+  func createTraversal() -> String {
+    let stride = simdgroupsPerThreadgroup
+    if let blockSelection = blockSelection {
+      let blockSize = blockSelection.blockSize
+      return """
+
+  uint position = cache_length + row;
+  for (uint i = 0; i < arguments.selected_block_count; ++i) {
+    uint block_start = block_list[i] * \(blockSize);
+    uint block_end = block_start + \(blockSize);
+    for (uint c = block_start + sidx; c < block_end; c += \(stride)) {
+      \(createColumnUpdate())
+    }
+  }
+
+  // The columns after the last full block are always attended.
+  uint tail_start = (cache_length / \(blockSize)) * \(blockSize);
+  for (uint c = tail_start + sidx; c <= position; c += \(stride)) {
+    \(createColumnUpdate())
+  }
+
+"""
+    }
+    guard let slidingWindow = slidingWindow else {
+      return """
+
+  uint position = cache_length + row;
+  for (uint c = sidx; c <= position; c += \(stride)) {
+    \(createColumnUpdate())
+  }
+
+"""
+    }
+
+    return """
+
+  uint position = cache_length + row;
+  uint window_start = (position + 1 > \(slidingWindow))
+    ? position + 1 - \(slidingWindow) : 0;
+  uint sink_end = min(uint(\(sinkCount)), window_start);
+  for (uint c = sidx; c < sink_end; c += \(stride)) {
+    \(createColumnUpdate())
+  }
+  for (uint c = window_start + sidx; c <= position; c += \(stride)) {
+    \(createColumnUpdate())
+  }
+
+"""
+  }
+
+  func createMerge() -> String {
+    let simdgroupCount = simdgroupsPerThreadgroup
+    let exchange = """
+
+  threadgroup float *m_block = threadgroup_block;
+  threadgroup float *l_block = m_block + \(simdgroupCount);
+  threadgroup float *o_block = l_block + \(simdgroupCount);
+  if (lane_id == 0) {
+    m_block[sidx] = m;
+    l_block[sidx] = l;
+  }
+#pragma clang loop unroll(full)
+  for (ushort i = 0; i < \(elementsPerLane); ++i) {
+    uint d = lane_id + 32 * i;
+    if (d < D) {
+      o_block[sidx * D + d] = o[i];
+    }
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+
+"""
+
+    let combine = """
+
+  float m_max = m_block[0];
+  for (ushort s = 1; s < \(simdgroupCount); ++s) {
+    m_max = max(m_max, m_block[s]);
+  }
+  float l_sum = 0;
+#pragma clang loop unroll(full)
+  for (ushort i = 0; i < \(elementsPerLane); ++i) {
+    o[i] = 0;
+  }
+  for (ushort s = 0; s < \(simdgroupCount); ++s) {
+    float correction = fast::exp2(m_block[s] - m_max);
+    l_sum += l_block[s] * correction;
+#pragma clang loop unroll(full)
+    for (ushort i = 0; i < \(elementsPerLane); ++i) {
+      uint d = lane_id + 32 * i;
+      if (d < D) {
+        o[i] += o_block[s * D + d] * correction;
+      }
+    }
+  }
+  if (lane_id == 0) {
+    // Premultiplied by log_base_2(e).
+    L[row] = m_max + log2(l_sum);
+  }
+
+"""
+
+    guard let projectionDimension = outputProjectionDimension else {
+      return """
+
+  \(exchange)
+  if (sidx != 0) {
+    return;
+  }
+  \(combine)
+
+#pragma clang loop unroll(full)
+  for (ushort i = 0; i < \(elementsPerLane); ++i) {
+    uint d = lane_id + 32 * i;
+    if (d < D) {
+      O[row * D + d] = o[i] / l_sum;
+    }
+  }
+
+"""
+    }
+
+    // The normalized row replaces the partial of simdgroup 0. Each lane
+    // only overwrites the elements it already read. Then every thread
+    // computes a few columns of the projection, reading W_o in coalesced
+    // rows.
+    return """
+
+  \(exchange)
+  if (sidx == 0) {
+    \(combine)
+
+#pragma clang loop unroll(full)
+    for (ushort i = 0; i < \(elementsPerLane); ++i) {
+      uint d = lane_id + 32 * i;
+      if (d < D) {
+        o_block[d] = o[i] / l_sum;
+      }
+    }
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+
+  for (uint j = sidx * 32 + lane_id; j < \(projectionDimension);
+       j += \(threadgroupSize)) {
+    float sum = 0;
+    for (uint d = 0; d < D; ++d) {
+      sum += o_block[d] * W_o[d * \(projectionDimension) + j];
+    }
+    O[row * \(projectionDimension) + j] = sum;
+  }
+
+"""
+  }
+}
@@ -0,0 +1,394 @@
+//
+//  AttentionKeyValueCache.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+// Matches the layout of 'attention_decode_arguments'.
+struct AttentionDecodeArguments {
+  var rowCount: UInt32
+  var cacheLength: UInt32
+  var cacheCapacity: UInt32
+  var selectedBlockCount: UInt32
+}
+
+// Matches the layout of 'attention_block_score_arguments'.
+struct AttentionBlockScoreArguments {
+  var rowCount: UInt32
+  var blockCount: UInt32
+}
+
+/// The keys and values of one head, kept on the GPU across decoding steps.
+///
+/// Every step attends the queries of the new tokens to the cache, and
+/// appends their keys and values. With `appendsKeyValue`, both happen in a
+/// single kernel.
+public final class AttentionKeyValueCache {
+  public let descriptor: AttentionDecodeDescriptor
+  public let commandQueue: MTLCommandQueue
+
+  /// The number of rows the cache can hold. In the ring layout, the
+  /// sequence can grow beyond it, as long as the sinks and the window fit.
+  public let capacity: Int
+
+  /// Stored in the cache precision, with `capacity` rows.
+  public let keys: MTLBuffer
+  public let values: MTLBuffer
+
+  /// For block selection: the per-channel minimum and maximum of K in each
+  /// block, as FP32 (see `AttentionBlockSelection.summaries`).
+  public let keySummaries: MTLBuffer?
+
+  /// For the paged layout: the page of the K and V buffers that holds each
+  /// logical page. Initially the identity.
+  public var pageTable: [UInt32] = []
+
+  /// For the fused output projection: this head's slice of W_o, D x M and
+  /// row-major, as FP32.
+  public var outputProjection: [Float] = []
+
+  /// The number of columns of the sequence so far. In the ring layout, only
+  /// `residentColumns` remain in the cache.
+  public private(set) var length: Int = 0
+
+  /// For block selection: the full blocks the last step attended.
+  public private(set) var selectedBlocks: [UInt32] = []
+
+  /// The GPU time of the last step, in seconds.
+  public private(set) var latency: Double = 0
+
+  public init(
+    descriptor: AttentionDecodeDescriptor,
+    capacity: Int,
+    commandQueue: MTLCommandQueue = MTLContext.global.commandQueue
+  ) {
+    guard let headDimension = descriptor.headDimension else {
+      fatalError("Descriptor was incomplete.")
+    }
+    if case .paged(let pageSize) = descriptor.cacheLayout {
+      guard capacity % Int(pageSize) == 0 else {
+        fatalError("Capacity must be a multiple of the page size.")
+      }
+      pageTable = (0..<(capacity / Int(pageSize))).map(UInt32.init)
+    }
+    if case .ring = descriptor.cacheLayout {
+      guard capacity > Int(descriptor.sinkCount) else {
+        fatalError("Capacity must exceed the sink count.")
+      }
+    }
+    self.descriptor = descriptor
+    self.commandQueue = commandQueue
+    self.capacity = capacity
+
+    let device = commandQueue.device
+    let length = max(
+      capacity * Int(headDimension) * descriptor.cachePrecision.size, 4)
+    guard let keys = device.makeBuffer(length: length),
+          let values = device.makeBuffer(length: length) else {
+      fatalError("Could not allocate buffer.")
+    }
+    self.keys = keys
+    self.values = values
+
+    if let blockSelection = descriptor.blockSelection {
+      let blockSize = Int(blockSelection.blockSize)
+      let blockCount = (capacity + blockSize - 1) / blockSize
+      keySummaries = device.makeBuffer(
+        length: max(blockCount * 2 * Int(headDimension) * 4, 4))
+    } else {
+      keySummaries = nil
+    }
+  }
+
+  // The row of the K and V buffers that holds a logical column.
+  func cacheRow(_ column: Int) -> Int {
+    switch descriptor.cacheLayout {
+    case .contiguous:
+      return column
+    case .paged(let pageSize):
+      let size = Int(pageSize)
+      return Int(pageTable[column / size]) * size + column % size
+    case .ring:
+      let sinkCount = Int(descriptor.sinkCount)
+      guard column >= sinkCount else {
+        return column
+      }
+      return sinkCount + (column - sinkCount) % (capacity - sinkCount)
+    }
+  }
+
+  /// The logical columns whose keys and values are still in the cache, in
+  /// order. In the ring layout, these are the sinks and the most recent
+  /// columns. Otherwise, every column.
+  public var residentColumns: [Int] {
+    guard case .ring = descriptor.cacheLayout else {
+      return Array(0..<length)
+    }
+    let sinkCount = Int(descriptor.sinkCount)
+    let recentStart = max(sinkCount, length - (capacity - sinkCount))
+    return Array(0..<min(sinkCount, length)) + Array(recentStart..<length)
+  }
+
+  /// Reads the resident rows in logical order, as FP32.
+  public func cachedRows() -> (K: [Float], V: [Float]) {
+    let headDimension = Int(descriptor.headDimension!)
+    let precision = descriptor.cachePrecision
+    let columns = residentColumns
+    var K = [Float](repeating: .zero, count: columns.count * headDimension)
+    var V = [Float](repeating: .zero, count: columns.count * headDimension)
+    for (c, column) in columns.enumerated() {
+      let source = cacheRow(column) * headDimension
+      for d in 0..<headDimension {
+        K[c * headDimension + d] = precision.load(keys.contents(), source + d)
+        V[c * headDimension + d] = precision.load(
+          values.contents(), source + d)
+      }
+    }
+    return (K, V)
+  }
+
+  /// Runs the scoring pass of block selection. Returns the score of every
+  /// full block in the cache, for the queries of the next step.
+  public func scoreBlocks(Q: [Float]) -> [Float] {
+    guard let blockSelection = descriptor.blockSelection,
+          let keySummaries = keySummaries else {
+      fatalError("The cache does not select blocks.")
+    }
+    let headDimension = Int(descriptor.headDimension!)
+    let rowCount = Q.count / headDimension
+    let blockCount = length / Int(blockSelection.blockSize)
+    guard rowCount > 0, blockCount > 0 else {
+      return []
+    }
+
+    AttentionBlockScoreKernel.register(descriptor: descriptor)
+    let (kernel, pipeline) = AttentionBlockScoreKernel
+      .pipelineCache[descriptor]!
+    let device = commandQueue.device
+    let bufferQ = Q.withUnsafeBytes {
+      device.makeBuffer(bytes: $0.baseAddress!, length: $0.count)
+    }
+    guard let bufferScores = device.makeBuffer(length: blockCount * 4),
+          let commandBuffer = commandQueue.makeCommandBuffer(),
+          let encoder = commandBuffer.makeComputeCommandEncoder() else {
+      fatalError("Could not create command buffer.")
+    }
+    encoder.setComputePipelineState(pipeline)
+    encoder.setBuffer(bufferQ, offset: 0, index: 0)
+    encoder.setBuffer(keySummaries, offset: 0, index: 1)
+    encoder.setBuffer(bufferScores, offset: 0, index: 2)
+    var arguments = AttentionBlockScoreArguments(
+      rowCount: UInt32(rowCount), blockCount: UInt32(blockCount))
+    encoder.setBytes(
+      &arguments, length: MemoryLayout<AttentionBlockScoreArguments>.stride,
+      index: 3)
+    let simdgroupCount = kernel.simdgroupsPerThreadgroup
+    encoder.dispatchThreadgroups(
+      MTLSize(
+        width: (blockCount + simdgroupCount - 1) / simdgroupCount,
+        height: 1, depth: 1),
+      threadsPerThreadgroup: MTLSize(
+        width: kernel.threadgroupSize, height: 1, depth: 1))
+    encoder.endEncoding()
+    commandBuffer.commit()
+    commandBuffer.waitUntilCompleted()
+    latency += commandBuffer.gpuEndTime - commandBuffer.gpuStartTime
+
+    let scores = bufferScores.contents()
+      .assumingMemoryBound(to: Float.self)
+    return Array(UnsafeBufferPointer(start: scores, count: blockCount))
+  }
+
+  // Folds rows written on the host into the summaries of their blocks.
+  private func updateSummaries(rowCount: Int) {
+    guard let blockSelection = descriptor.blockSelection,
+          let keySummaries = keySummaries else {
+      return
+    }
+    let headDimension = Int(descriptor.headDimension!)
+    let blockSize = Int(blockSelection.blockSize)
+    let precision = descriptor.cachePrecision
+    let summaries = keySummaries.contents()
+      .assumingMemoryBound(to: Float.self)
+    for column in length..<(length + rowCount) {
+      let source = cacheRow(column) * headDimension
+      let minimum = summaries + (column / blockSize) * 2 * headDimension
+      let maximum = minimum + headDimension
+      let first = (column % blockSize == 0)
+      for d in 0..<headDimension {
+        // Read back the key, rounded to the cache precision.
+        let k = precision.load(keys.contents(), source + d)
+        minimum[d] = first ? k : min(minimum[d], k)
+        maximum[d] = first ? k : max(maximum[d], k)
+      }
+    }
+  }
+
+  /// Attends the new rows to the cache and to each other (causally), then
+  /// leaves them in the cache. Returns O and L (base 2, see
+  /// `AttentionBackend`) for the new rows.
+  ///
+  /// Q, K, and V are row-major, with one row per new token. With block
+  /// selection, the step first runs the scoring pass, then attends only the
+  /// selected blocks. With the output projection, O is this head's partial
+  /// of the projected output, R x M (see `reduceOutputProjection`).
+  public func step(
+    Q: [Float], K: [Float], V: [Float]
+  ) -> (O: [Float], L: [Float]) {
+    let headDimension = Int(descriptor.headDimension!)
+    let rowCount = Q.count / headDimension
+    guard Q.count == rowCount * headDimension,
+          K.count == Q.count, V.count == Q.count else {
+      fatalError("Operands had the wrong size.")
+    }
+    if case .ring = descriptor.cacheLayout {
+      // The new rows overwrite the oldest columns. The first new row must
+      // not need any of them.
+      let window = Int(descriptor.slidingWindow!)
+      let recentCapacity = capacity - Int(descriptor.sinkCount)
+      guard window + rowCount - 1 <= recentCapacity else {
+        fatalError("The window and the new rows do not fit in the cache.")
+      }
+    } else {
+      guard length + rowCount <= capacity else {
+        fatalError("The cache is full.")
+      }
+    }
+    guard rowCount > 0 else {
+      return ([], [])
+    }
+
+    let device = commandQueue.device
+    let precision = descriptor.cachePrecision
+    func createBuffer(
+      _ contents: [Float], _ precision: GEMMOperandPrecision
+    ) -> MTLBuffer {
+      guard let buffer = device.makeBuffer(
+        length: max(contents.count * precision.size, 4)) else {
+        fatalError("Could not allocate buffer.")
+      }
+      for i in contents.indices {
+        precision.store(contents[i], buffer.contents(), i)
+      }
+      return buffer
+    }
+
+    // Without the fused append, write the new rows on the host. This stands
+    // in for the separate append kernel.
+    if !descriptor.appendsKeyValue {
+      for r in 0..<rowCount {
+        let destination = cacheRow(length + r) * headDimension
+        for d in 0..<headDimension {
+          let source = r * headDimension + d
+          precision.store(K[source], keys.contents(), destination + d)
+          precision.store(V[source], values.contents(), destination + d)
+        }
+      }
+      updateSummaries(rowCount: rowCount)
+    }
+
+    latency = 0
+    if let blockSelection = descriptor.blockSelection {
+      selectedBlocks = blockSelection.select(scores: scoreBlocks(Q: Q))
+    }
+
+    AttentionDecodeKernel.register(descriptor: descriptor)
+    let (kernel, pipeline) = AttentionDecodeKernel
+      .pipelineCache[descriptor]!
+    let outputDimension = descriptor.outputProjectionDimension
+      .map { Int($0) } ?? headDimension
+    let bufferO = createBuffer(
+      [Float](repeating: .zero, count: rowCount * outputDimension), .FP32)
+    let bufferL = createBuffer(
+      [Float](repeating: .zero, count: rowCount), .FP32)
+
+    guard let commandBuffer = commandQueue.makeCommandBuffer(),
+          let encoder = commandBuffer.makeComputeCommandEncoder() else {
+      fatalError("Could not create command buffer.")
+    }
+    encoder.setComputePipelineState(pipeline)
+    encoder.setBuffer(createBuffer(Q, .FP32), offset: 0, index: 0)
+    encoder.setBuffer(keys, offset: 0, index: 1)
+    encoder.setBuffer(values, offset: 0, index: 2)
+    if descriptor.appendsKeyValue {
+      encoder.setBuffer(createBuffer(K, precision), offset: 0, index: 3)
+      encoder.setBuffer(createBuffer(V, precision), offset: 0, index: 4)
+    }
+    encoder.setBuffer(bufferO, offset: 0, index: 5)
+    encoder.setBuffer(bufferL, offset: 0, index: 6)
+    if case .paged = descriptor.cacheLayout {
+      let pageTableBuffer = pageTable.withUnsafeBytes {
+        device.makeBuffer(bytes: $0.baseAddress!, length: $0.count)
+      }
+      encoder.setBuffer(pageTableBuffer, offset: 0, index: 7)
+    }
+    var arguments = AttentionDecodeArguments(
+      rowCount: UInt32(rowCount), cacheLength: UInt32(length),
+      cacheCapacity: UInt32(capacity),
+      selectedBlockCount: UInt32(selectedBlocks.count))
+    encoder.setBytes(
+      &arguments, length: MemoryLayout<AttentionDecodeArguments>.stride,
+      index: 8)
+    if let outputDimension = descriptor.outputProjectionDimension {
+      let weightCount = headDimension * Int(outputDimension)
+      guard outputProjection.count == weightCount else {
+        fatalError("Output projection had the wrong size.")
+      }
+      encoder.setBuffer(
+        createBuffer(outputProjection, .FP32), offset: 0, index: 11)
+    }
+    if descriptor.blockSelection != nil {
+      // Pad the list, so the buffer is never empty.
+      let blockList = (selectedBlocks + [0]).withUnsafeBytes {
+        device.makeBuffer(bytes: $0.baseAddress!, length: $0.count)
+      }
+      encoder.setBuffer(blockList, offset: 0, index: 9)
+      encoder.setBuffer(keySummaries, offset: 0, index: 10)
+    }
+    encoder.setThreadgroupMemoryLength(
+      kernel.threadgroupMemoryAllocation, index: 0)
+    encoder.dispatchThreadgroups(
+      MTLSize(width: rowCount, height: 1, depth: 1),
+      threadsPerThreadgroup: MTLSize(
+        width: kernel.threadgroupSize, height: 1, depth: 1))
+    encoder.endEncoding()
+    commandBuffer.commit()
+    commandBuffer.waitUntilCompleted()
+    latency += commandBuffer.gpuEndTime - commandBuffer.gpuStartTime
+    length += rowCount
+
+    var O = [Float](repeating: .zero, count: rowCount * outputDimension)
+    var L = [Float](repeating: .zero, count: rowCount)
+    for i in O.indices {
+      O[i] = GEMMOperandPrecision.FP32.load(bufferO.contents(), i)
+    }
+    for i in L.indices {
+      L[i] = GEMMOperandPrecision.FP32.load(bufferL.contents(), i)
+    }
+    return (O, L)
+  }
+
+  /// Sums the partials of the output projection over the heads. The heads
+  /// are added in order, so the result does not depend on when each head
+  /// finished.
+  public static func reduceOutputProjection(
+    _ partials: [[Float]]
+  ) -> [Float] {
+    guard let first = partials.first else {
+      return []
+    }
+    var output = first
+    for partial in partials.dropFirst() {
+      guard partial.count == output.count else {
+        fatalError("Partials had different sizes.")
+      }
+      for i in output.indices {
+        output[i] += partial[i]
+      }
+    }
+    return output
+  }
+}
+#endif
@@ -5,14 +5,12 @@
 //  Created by Philip Turner on 8/19/24.
 //
 
-import Metal
-
 // MARK: - API
 
 extension AttentionDescriptor {
   func parameterFile(type: AttentionKernelType) -> String {
     // Choose a function pointer for the parameters.
-    var createParameters: (MTLDevice) -> String
+    var createParameters: (DeviceProfile) -> String
     if lowPrecisionInputs && lowPrecisionIntermediates {
       switch type {
       case .forward: 
@@ -34,15 +32,12 @@ extension AttentionDescriptor {
     }
     
     // Retrieve the parameter file.
-    let device = MTLContext.global.device
+    let device = DeviceProfile.current
     return createParameters(device)
   }
   
   func row(table: [AttentionParameterRow]) -> AttentionParameterRow {
-    guard let matrixDimensions = self.matrixDimensions else {
-      fatalError("Descriptor was incomplete.")
-    }
-    let headDimension = matrixDimensions.head
+    let headDimension = kernelHeadDimension
     
     // Pick a row of the table.
     //
@@ -74,7 +69,7 @@ extension AttentionDescriptor {
   ///
   /// Use this as a fallback option, in contexts where the fine-tuned
   /// parameters do not generalize.
-  static func defaultParameters(device: MTLDevice) -> String {
+  static func defaultParameters(device: DeviceProfile) -> String {
     if device.supportsFamily(.apple9) {
       return """
       | 0   | 16 | 128 | 16 |      |
@@ -103,7 +98,7 @@ extension AttentionDescriptor {
   ///
   /// memoryPrecisions[.L] = .FP16
   /// ```
-  static func forwardMixed(device: MTLDevice) -> String {
+  static func forwardMixed(device: DeviceProfile) -> String {
     if device.supportsFamily(.apple9) {
       return """
       | 32  | 16 | 128 | 16 | Q, O |
@@ -126,7 +121,7 @@ extension AttentionDescriptor {
   /// Block sizes and cached operands for FP32 forward.
   ///
   /// If any of the operands is FP16, the parameters will fail to generalize.
-  static func forward(device: MTLDevice) -> String {
+  static func forward(device: DeviceProfile) -> String {
     if device.supportsFamily(.apple9) {
       return """
       | 8   | 16 | 128 | 16 | Q, O |
@@ -169,7 +164,7 @@ extension AttentionDescriptor {
   /// registerPrecisions[.dS] = .BF16 (M3) .FP32 (M1)
   /// registerPrecisions[.dQ] = .FP32
   /// ```
-  static func backwardQueryMixed(device: MTLDevice) -> String {
+  static func backwardQueryMixed(device: DeviceProfile) -> String {
     if device.supportsFamily(.apple9) {
       return """
       | 80  | 16 | 64  | 8  | Q, dO, dQ |
@@ -191,7 +186,7 @@ extension AttentionDescriptor {
   ///
   /// If any of the operands is FP16 or BF16, the parameters will fail to
   /// generalize.
-  static func backwardQuery(device: MTLDevice) -> String {
+  static func backwardQuery(device: DeviceProfile) -> String {
     if device.supportsFamily(.apple9) {
       return """
       | 16  | 16 | 64  | 8  | Q, dO, dQ |
@@ -236,7 +231,7 @@ extension AttentionDescriptor {
   /// registerPrecisions[.dK] = .FP32
   /// registerPrecisions[.dQ] = .FP32
   /// ```
-  static func backwardKeyValueMixed(device: MTLDevice) -> String {
+  static func backwardKeyValueMixed(device: DeviceProfile) -> String {
     if device.supportsFamily(.apple9) {
       return """
       | 56  | 16 | 64  | 8  | K, V, dV, dK |
@@ -262,7 +257,7 @@ extension AttentionDescriptor {
   ///
   /// If any of the operands is FP16 or BF16, the parameters will fail to
   /// generalize.
-  static func backwardKeyValue(device: MTLDevice) -> String {
+  static func backwardKeyValue(device: DeviceProfile) -> String {
     if device.supportsFamily(.apple9) {
       return """
       | 16  | 16 | 64  | 8  | K, V, dV, dK |
@@ -151,8 +151,7 @@ extension AttentionDescriptor {
     
     // Query whether the hardware fuses the promotion of BF16 to FP32 with
     // the FMA assembly instruction.
-    let device = MTLContext.global.device
-    let hasNativeBF16Casting = device.supportsFamily(.apple9)
+    let hasNativeBF16Casting = DeviceProfile.current.supportsFamily(.apple9)
     
     // Inputs have the same register precision across kernels.
     if lowPrecisionInputs {
@@ -194,10 +193,18 @@ extension AttentionDescriptor {
       // FP16 (Q, K, S) | 5e-2
       // FP16 (P)       | 2.7e-3
       // BF16 (dS)      | 8e-3
-      registerPrecisions[.S] = lowPrecisionInputs ? .FP16 : .FP32
+      //
+      // The accuracy policy can veto both the FP16 accumulator for S and the
+      // BF16 truncation of dS.
+      let allowsFP16S = accuracyPolicy
+        .permitsLowPrecisionAccumulator(output: .FP16)
+      let allowsBF16DS = accuracyPolicy.permitsBF16Truncation
+      registerPrecisions[.S] = (lowPrecisionInputs && allowsFP16S)
+        ? .FP16 : .FP32
       registerPrecisions[.P] = .FP16
       registerPrecisions[.dP] = .FP32
-      registerPrecisions[.dS] = hasNativeBF16Casting ? .BF16 : .FP32
+      registerPrecisions[.dS] = (hasNativeBF16Casting && allowsBF16DS)
+        ? .BF16 : .FP32
     } else {
       registerPrecisions[.S] = .FP32
       registerPrecisions[.P] = .FP32
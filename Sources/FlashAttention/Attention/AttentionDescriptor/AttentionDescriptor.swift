@@ -5,8 +5,6 @@
 //  Created by Philip Turner on 8/8/24.
 //
 
-import Metal
-
 public struct AttentionDescriptor {
   // Q, K, V, dO
   public var lowPrecisionInputs: Bool = false
@@ -21,6 +19,44 @@ public struct AttentionDescriptor {
   
   public var transposeState: (Q: Bool, K: Bool, V: Bool, O: Bool)?
   
+  // Only matters when the intermediates are low precision. Decides whether
+  // S may accumulate in FP16, and whether dS may be truncated to BF16. For
+  // '.errorBound', the reduction length of S is the head dimension.
+  public var accuracyPolicy: AccuracyPolicy = .fastest
+  
+  /// The number of query heads that share each key-value head (grouped-query
+  /// attention). The default is 1.
+  ///
+  /// The query heads of a group are packed into the row dimension. Q, O, dO,
+  /// and dQ hold the heads back to back, as one row-major matrix of
+  /// `packedRowDimension` rows. L and D do the same. Every threadgroup can
+  /// then share its tiles of K and V among rows from several heads, and the
+  /// gradients of K and V sum over the whole group. Q and O must not be
+  /// transposed.
+  public var queryHeadsPerKeyValueHead: UInt32 = 1
+  
+  /// Whether each threadgroup processes several blocks of query rows, when
+  /// the head dimension is small. The default is `false`.
+  ///
+  /// At a head dimension of 64 or less, the tuned parallelization block is
+  /// only 16 - 32 rows. Packing grows it to 64 rows, across more simdgroups.
+  /// The tiles of K and V loaded into threadgroup memory then serve
+  /// 64 / parallelization times as many rows (2x - 4x), at the cost of
+  /// launching fewer threadgroups. This applies to the kernels that
+  /// parallelize over rows (forward and backward query).
+  public var multiQueryBlockPacking: Bool = false
+  
+  /// Whether one pipeline serves every sequence length. The default is
+  /// `false`.
+  ///
+  /// The kernels read the sequence lengths from an argument buffer (see
+  /// `setShapeArguments`), instead of function constants. The head dimension
+  /// is rounded up to `headDimensionBucket`. Operands must have that many
+  /// elements along the head dimension, with the extra elements set to zero.
+  /// Then the number of pipelines no longer grows with the number of
+  /// distinct problem sizes.
+  public var dynamicShape: Bool = false
+  
   public init() {
     
   }
@@ -39,7 +75,7 @@ extension AttentionDescriptor {
     let row = row(table: table)
     
     func createBlockDimensions() -> (UInt16, UInt16, UInt16) {
-      guard let parallelization = UInt16(row.parallelization),
+      guard var parallelization = UInt16(row.parallelization),
             let traversal = UInt16(row.traversal),
             let originalHead = UInt16(row.head) else {
         fatalError("Could not decode block dimensions.")
@@ -50,9 +86,24 @@ extension AttentionDescriptor {
       let paddedHeadDimension = (headDimension + 7) / 8 * 8
       let revisedHead = min(originalHead, paddedHeadDimension)
       
+      parallelization *= createQueryBlockCount(
+        parallelization: parallelization)
       return (parallelization, traversal, revisedHead)
     }
     
+    func createQueryBlockCount(parallelization: UInt16) -> UInt16 {
+      guard multiQueryBlockPacking,
+            createHeadDimension() <= 64 else {
+        return 1
+      }
+      switch type {
+      case .forward, .backwardQuery:
+        return max(64 / parallelization, 1)
+      case .backwardKeyValue:
+        return 1
+      }
+    }
+    
     func createCacheState() -> [AttentionOperand: Bool] {
       var expectedOperands: Set<AttentionOperand>
       switch type {
@@ -86,16 +137,18 @@ extension AttentionDescriptor {
     }
     
     func createHeadDimension() -> UInt16 {
-      guard let matrixDimensions = self.matrixDimensions else {
-        fatalError("Descriptor was incomplete.")
-      }
-      return matrixDimensions.head
+      kernelHeadDimension
     }
     
     func createTransposeState() -> [AttentionOperand: Bool] {
       guard let transposeState = self.transposeState else {
         fatalError("Descriptor was incomplete.")
       }
+      if queryHeadsPerKeyValueHead > 1 {
+        guard !transposeState.Q, !transposeState.O else {
+          fatalError("Grouped-query attention requires untransposed Q and O.")
+        }
+      }
       
       var output: [AttentionOperand: Bool] = [:]
       output[.Q] = transposeState.Q
@@ -113,9 +166,10 @@ extension AttentionDescriptor {
     var output = AttentionKernelDescriptor()
     output.blockDimensions = createBlockDimensions()
     output.cacheState = createCacheState()
+    output.dynamicShape = dynamicShape
     output.headDimension = createHeadDimension()
     output.memoryPrecisions = memoryPrecisions
-    if MTLContext.global.device.supportsFamily(.apple9) {
+    if DeviceProfile.current.supportsFamily(.apple9) {
       output.preferAsyncCache = true
       output.preferAsyncLoad = false
     } else {
@@ -130,20 +184,103 @@ extension AttentionDescriptor {
   }
 }
 
+extension AttentionDescriptor {
+  /// The number of rows the kernels see: the row dimension of every query
+  /// head in a group. Size the grid of the row-parallel kernels with this.
+  public var packedRowDimension: UInt32 {
+    guard let matrixDimensions = self.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    return matrixDimensions.row * queryHeadsPerKeyValueHead
+  }
+  
+  /// The head dimension of the kernel with a dynamic shape.
+  ///
+  /// The smallest power of two, or operating limit of a row in the forward
+  /// parameter table, that is not smaller than the head dimension. Rounding
+  /// to a power of two bounds the wasted work to 2x. Rounding to the limit
+  /// of a table row keeps the tuned block sizes of that row.
+  public var headDimensionBucket: UInt16 {
+    guard let matrixDimensions = self.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let headDimension = matrixDimensions.head
+    
+    var powerOfTwo: UInt16 = 8
+    while powerOfTwo < headDimension {
+      powerOfTwo *= 2
+    }
+    let table = AttentionParameterRow.parseTable(
+      parameterFile(type: .forward))
+    let rowLimits = table.map(\.maximumHeadDimension).filter {
+      $0 >= headDimension
+    }
+    return min(powerOfTwo, rowLimits.min() ?? powerOfTwo)
+  }
+  
+  // The head dimension embedded into the source.
+  var kernelHeadDimension: UInt16 {
+    guard let matrixDimensions = self.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    return dynamicShape ? headDimensionBucket : matrixDimensions.head
+  }
+  
+  /// The Metal function constants that specialize the kernels for this
+  /// problem. Empty with a dynamic shape.
+  public var functionConstantValues: [(index: Int, value: UInt32)] {
+    guard let matrixDimensions = self.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard !dynamicShape else {
+      return []
+    }
+    return [
+      (0, packedRowDimension),
+      (1, matrixDimensions.column),
+    ]
+  }
+}
+
+#if canImport(Metal)
+import Metal
+
 extension AttentionDescriptor {
   // Specialize the Metal function with this attention descriptor.
   //
   // You can initialize a MTLFunctionConstantValues object once, then recycle
   // it for all three kernels when gradient is requested. This may simplify
   // the code or incrementally reduce the compilation latency.
+  //
+  // With a dynamic shape, the kernels have no function constants.
   public func setFunctionConstants(_ constants: MTLFunctionConstantValues) {
+    for constant in functionConstantValues {
+      var value = constant.value
+      constants.setConstantValue(&value, type: .uint, index: constant.index)
+    }
+  }
+  
+  /// Bind the problem size of a kernel with a dynamic shape.
+  ///
+  /// Call this for every dispatch, as the pipeline may be shared with other
+  /// problem sizes.
+  public func setShapeArguments(_ encoder: MTLComputeCommandEncoder) {
     guard let matrixDimensions = self.matrixDimensions else {
       fatalError("Descriptor was incomplete.")
     }
     
-    var rowDimension = matrixDimensions.row
-    var columnDimension = matrixDimensions.column
-    constants.setConstantValue(&rowDimension, type: .uint, index: 0)
-    constants.setConstantValue(&columnDimension, type: .uint, index: 1)
+    // Matches the layout of 'attention_shape'.
+    struct Arguments {
+      var rowDimension: UInt32
+      var columnDimension: UInt32
+      var rsqrtHead: Float
+    }
+    var arguments = Arguments(
+      rowDimension: packedRowDimension,
+      columnDimension: matrixDimensions.column,
+      rsqrtHead: 1 / Float(matrixDimensions.head).squareRoot())
+    encoder.setBytes(
+      &arguments, length: MemoryLayout<Arguments>.stride, index: 13)
   }
 }
+#endif
@@ -0,0 +1,265 @@
+//
+//  RingAttentionDriver.swift
+//  FlashAttention
+//
+
+import Foundation
+
+/// Sequence-parallel attention, with the sequence sharded across a ring of
+/// workers.
+///
+/// Worker `i` owns the i-th contiguous shard of the rows (Q, O, dO, L) and
+/// of the columns (K, V). Shards may have different sizes. The K/V shards
+/// travel around the ring, while each worker keeps its rows in place:
+///
+/// ```
+/// step 0:  worker 0 sees KV 0   worker 1 sees KV 1   worker 2 sees KV 2
+/// step 1:  worker 0 sees KV 2   worker 1 sees KV 0   worker 2 sees KV 1
+/// step 2:  worker 0 sees KV 1   worker 1 sees KV 2   worker 2 sees KV 0
+/// ```
+///
+/// Forward: every step produces a partial output and log-sum-exp over one
+/// block of columns. Partials are merged exactly:
+///
+/// L = log2(2^L_a + 2^L_b)
+/// O = 2^(L_a - L) * O_a + 2^(L_b - L) * O_b
+///
+/// The next block is sent before the current one is processed, so the
+/// transfer overlaps with the computation.
+///
+/// Backward: the rows of each worker depend on the global L, which the
+/// forward pass already produced. dQ accumulates locally. The dK and dV
+/// accumulators travel with their K/V block, and one extra rotation returns
+/// them to the owner.
+///
+/// Each worker runs on its own thread, and calls the backend independently.
+/// The workers stand in for separate devices; the transport decides how the
+/// blocks move between them.
+public final class RingAttentionDriver {
+  public let backend: AttentionBackend
+  public let transport: RingTransport
+
+  public init(backend: AttentionBackend, transport: RingTransport) {
+    self.backend = backend
+    self.transport = transport
+  }
+
+  /// Computes O and L (base 2, see `AttentionBackend`) for every shard.
+  public func forward(
+    Q: [[Float]], K: [[Float]], V: [[Float]], head: Int
+  ) -> (O: [[Float]], L: [[Float]]) {
+    let workerCount = transport.workerCount
+    guard Q.count == workerCount,
+          K.count == workerCount,
+          V.count == workerCount else {
+      fatalError("Expected one shard per worker.")
+    }
+
+    var O = [[Float]](repeating: [], count: workerCount)
+    var L = [[Float]](repeating: [], count: workerCount)
+    let outputLock = NSLock()
+    runWorkers { workerID in
+      let rowCount = Q[workerID].count / head
+      var accumulatorO = [Float](repeating: .zero, count: rowCount * head)
+      var accumulatorL = [Float](repeating: -.infinity, count: rowCount)
+
+      var block = RingMessage(owner: workerID, tensors: [
+        K[workerID], V[workerID]
+      ])
+      for step in 0..<workerCount {
+        if step < workerCount - 1 {
+          transport.send(block.encode(), from: workerID)
+        }
+
+        let columnCount = block.tensors[0].count / head
+        let (partialO, partialL) = backend.forward(
+          matrixDimensions: (rowCount, columnCount, head),
+          Q: Q[workerID], K: block.tensors[0], V: block.tensors[1])
+        Self.merge(
+          O: &accumulatorO, L: &accumulatorL,
+          partialO: partialO, partialL: partialL, head: head)
+
+        if step < workerCount - 1 {
+          block = RingMessage(decoding: transport.receive(at: workerID))
+        }
+      }
+
+      outputLock.lock()
+      O[workerID] = accumulatorO
+      L[workerID] = accumulatorL
+      outputLock.unlock()
+    }
+    return (O, L)
+  }
+
+  /// Computes dQ, dK, and dV for every shard. O and L must come from the
+  /// forward pass over the entire sequence.
+  public func backward(
+    Q: [[Float]], K: [[Float]], V: [[Float]],
+    O: [[Float]], L: [[Float]], dO: [[Float]],
+    head: Int
+  ) -> (dQ: [[Float]], dK: [[Float]], dV: [[Float]]) {
+    let workerCount = transport.workerCount
+    for operand in [Q, K, V, O, L, dO] {
+      guard operand.count == workerCount else {
+        fatalError("Expected one shard per worker.")
+      }
+    }
+
+    var dQ = [[Float]](repeating: [], count: workerCount)
+    var dK = [[Float]](repeating: [], count: workerCount)
+    var dV = [[Float]](repeating: [], count: workerCount)
+    let outputLock = NSLock()
+    runWorkers { workerID in
+      let rowCount = Q[workerID].count / head
+      var accumulatorDerivativeQ = [Float](
+        repeating: .zero, count: rowCount * head)
+      var D: [Float] = []
+
+      // K, V, dK, dV
+      let columnCount = K[workerID].count / head
+      let zeros = [Float](repeating: .zero, count: columnCount * head)
+      var block = RingMessage(owner: workerID, tensors: [
+        K[workerID], V[workerID], zeros, zeros
+      ])
+      for _ in 0..<workerCount {
+        let blockColumnCount = block.tensors[0].count / head
+        let matrixDimensions = (rowCount, blockColumnCount, head)
+
+        let (termD, partialDerivativeQ) = backend.backwardQuery(
+          matrixDimensions: matrixDimensions,
+          Q: Q[workerID], K: block.tensors[0], V: block.tensors[1],
+          O: O[workerID], L: L[workerID], dO: dO[workerID])
+        D = termD
+        for i in accumulatorDerivativeQ.indices {
+          accumulatorDerivativeQ[i] += partialDerivativeQ[i]
+        }
+
+        let (partialDerivativeK, partialDerivativeV) = backend
+          .backwardKeyValue(
+            matrixDimensions: matrixDimensions,
+            Q: Q[workerID], K: block.tensors[0], V: block.tensors[1],
+            L: L[workerID], D: D, dO: dO[workerID])
+        for i in block.tensors[2].indices {
+          block.tensors[2][i] += partialDerivativeK[i]
+          block.tensors[3][i] += partialDerivativeV[i]
+        }
+
+        // After the last step, this sends the block home.
+        transport.send(block.encode(), from: workerID)
+        block = RingMessage(decoding: transport.receive(at: workerID))
+      }
+      guard block.owner == workerID else {
+        fatalError("Gradient block did not return to its owner.")
+      }
+
+      outputLock.lock()
+      dQ[workerID] = accumulatorDerivativeQ
+      dK[workerID] = block.tensors[2]
+      dV[workerID] = block.tensors[3]
+      outputLock.unlock()
+    }
+    return (dQ, dK, dV)
+  }
+}
+
+extension RingAttentionDriver {
+  /// Folds one partial result into the running output, for a single block
+  /// of columns. Rows where both operands are empty (L = -inf) stay empty.
+  public static func merge(
+    O: inout [Float], L: inout [Float],
+    partialO: [Float], partialL: [Float],
+    head: Int
+  ) {
+    for r in L.indices {
+      let maximum = max(L[r], partialL[r])
+      guard maximum > -.infinity else {
+        continue
+      }
+      let scale = exp2(L[r] - maximum)
+      let partialScale = exp2(partialL[r] - maximum)
+      let sum = scale + partialScale
+      for d in 0..<head {
+        let address = r * head + d
+        O[address] = (scale * O[address] + partialScale * partialO[address])
+          / sum
+      }
+      L[r] = maximum + log2(sum)
+    }
+  }
+
+  /// Runs the body once per worker, each on a dedicated thread.
+  ///
+  /// Workers block on each other through the transport, so they cannot run
+  /// on a thread pool that might have fewer threads than workers.
+  func runWorkers(_ body: @escaping (Int) -> Void) {
+    let group = DispatchGroup()
+    for workerID in 0..<transport.workerCount {
+      group.enter()
+      let thread = Thread {
+        body(workerID)
+        group.leave()
+      }
+      thread.start()
+    }
+    group.wait()
+  }
+}
+
+/// A block of tensors in transit, tagged with the worker that owns it.
+struct RingMessage {
+  var owner: Int
+  var tensors: [[Float]]
+
+  init(owner: Int, tensors: [[Float]]) {
+    self.owner = owner
+    self.tensors = tensors
+  }
+
+  // Layout: owner, tensor count, then each tensor's element count followed
+  // by its elements. All fields are little-endian.
+  init(decoding bytes: [UInt8]) {
+    var cursor = 0
+    func readWord() -> UInt32 {
+      var value: UInt32 = 0
+      withUnsafeMutableBytes(of: &value) {
+        $0.copyBytes(from: bytes[cursor..<cursor + 4])
+      }
+      cursor += 4
+      return UInt32(littleEndian: value)
+    }
+
+    owner = Int(readWord())
+    let tensorCount = Int(readWord())
+    tensors = []
+    for _ in 0..<tensorCount {
+      let elementCount = Int(readWord())
+      var words = [UInt32](repeating: .zero, count: elementCount)
+      words.withUnsafeMutableBytes {
+        $0.copyBytes(from: bytes[cursor..<cursor + elementCount * 4])
+      }
+      cursor += elementCount * 4
+      tensors.append(words.map { Float(bitPattern: UInt32(littleEndian: $0)) })
+    }
+  }
+
+  func encode() -> [UInt8] {
+    var output: [UInt8] = []
+    func appendWord(_ value: Int) {
+      withUnsafeBytes(of: UInt32(value).littleEndian) {
+        output.append(contentsOf: $0)
+      }
+    }
+
+    appendWord(owner)
+    appendWord(tensors.count)
+    for tensor in tensors {
+      appendWord(tensor.count)
+      let words = tensor.map { $0.bitPattern.littleEndian }
+      words.withUnsafeBytes {
+        output.append(contentsOf: $0)
+      }
+    }
+    return output
+  }
+}
@@ -0,0 +1,176 @@
+//
+//  RingTransport.swift
+//  FlashAttention
+//
+
+import Foundation
+
+/// Moves messages between neighbors in a ring of workers.
+///
+/// Worker `i` sends to worker `(i + 1) % workerCount`, and receives from
+/// worker `(i - 1 + workerCount) % workerCount`. Messages on each edge
+/// arrive in the order they were sent.
+public protocol RingTransport: AnyObject {
+  var workerCount: Int { get }
+
+  /// Sends a message to the next worker. Must not wait for the receiver, so
+  /// that every worker can send before any worker receives.
+  func send(_ message: [UInt8], from workerID: Int)
+
+  /// Blocks until a message from the previous worker arrives.
+  func receive(at workerID: Int) -> [UInt8]
+}
+
+/// Passes messages through memory shared by all workers.
+///
+/// Each edge of the ring is a queue guarded by a condition variable. Sending
+/// only enqueues a reference to the message, so no bytes are copied.
+public final class SharedMemoryRingTransport: RingTransport {
+  public let workerCount: Int
+
+  final class Mailbox {
+    let condition = NSCondition()
+    var messages: [[UInt8]] = []
+  }
+
+  // The mailbox at index i receives messages for worker i.
+  let mailboxes: [Mailbox]
+
+  public init(workerCount: Int) {
+    guard workerCount > 0 else {
+      fatalError("Worker count must be positive.")
+    }
+    self.workerCount = workerCount
+    self.mailboxes = (0..<workerCount).map { _ in Mailbox() }
+  }
+
+  public func send(_ message: [UInt8], from workerID: Int) {
+    let mailbox = mailboxes[(workerID + 1) % workerCount]
+    mailbox.condition.lock()
+    mailbox.messages.append(message)
+    mailbox.condition.signal()
+    mailbox.condition.unlock()
+  }
+
+  public func receive(at workerID: Int) -> [UInt8] {
+    let mailbox = mailboxes[workerID]
+    mailbox.condition.lock()
+    defer { mailbox.condition.unlock() }
+    while mailbox.messages.isEmpty {
+      mailbox.condition.wait()
+    }
+    return mailbox.messages.removeFirst()
+  }
+}
+
+/// Passes messages through local (Unix domain) stream sockets.
+///
+/// Each edge of the ring is a connected socket pair. Messages are framed
+/// with a 64-bit length prefix. Writes happen on a serial queue owned by the
+/// sender, so a full socket buffer never blocks the sending worker.
+public final class SocketRingTransport: RingTransport {
+  public let workerCount: Int
+
+  // The edge at index i carries messages from worker i to worker i + 1.
+  var sendSockets: [Int32] = []
+  var receiveSockets: [Int32] = []
+  let sendQueues: [DispatchQueue]
+
+  public init(workerCount: Int) {
+    guard workerCount > 0 else {
+      fatalError("Worker count must be positive.")
+    }
+    self.workerCount = workerCount
+    self.sendQueues = (0..<workerCount).map {
+      DispatchQueue(label: "com.mfa.ring-transport.\($0)")
+    }
+
+    let streamType: Int32
+#if os(Linux)
+    streamType = Int32(SOCK_STREAM.rawValue)
+#else
+    streamType = SOCK_STREAM
+#endif
+    for _ in 0..<workerCount {
+      var fileDescriptors: [Int32] = [0, 0]
+      guard socketpair(AF_UNIX, streamType, 0, &fileDescriptors) == 0 else {
+        fatalError("Could not create socket pair: errno \(errno)")
+      }
+      sendSockets.append(fileDescriptors[0])
+      receiveSockets.append(fileDescriptors[1])
+    }
+  }
+
+  deinit {
+    // Let pending writes finish before closing the sockets.
+    for queue in sendQueues {
+      queue.sync { }
+    }
+    for fileDescriptor in sendSockets + receiveSockets {
+      close(fileDescriptor)
+    }
+  }
+
+  public func send(_ message: [UInt8], from workerID: Int) {
+    let fileDescriptor = sendSockets[workerID]
+    sendQueues[workerID].async {
+      var length = UInt64(message.count).littleEndian
+      withUnsafeBytes(of: &length) {
+        Self.writeAll(fileDescriptor, $0)
+      }
+      message.withUnsafeBytes {
+        Self.writeAll(fileDescriptor, $0)
+      }
+    }
+  }
+
+  public func receive(at workerID: Int) -> [UInt8] {
+    let previousID = (workerID + workerCount - 1) % workerCount
+    let fileDescriptor = receiveSockets[previousID]
+
+    var length: UInt64 = 0
+    withUnsafeMutableBytes(of: &length) {
+      Self.readAll(fileDescriptor, $0)
+    }
+    let count = Int(UInt64(littleEndian: length))
+    var message = [UInt8](repeating: 0, count: count)
+    message.withUnsafeMutableBytes {
+      Self.readAll(fileDescriptor, $0)
+    }
+    return message
+  }
+
+  static func writeAll(
+    _ fileDescriptor: Int32, _ bytes: UnsafeRawBufferPointer
+  ) {
+    var offset = 0
+    while offset < bytes.count {
+      let result = write(
+        fileDescriptor, bytes.baseAddress! + offset, bytes.count - offset)
+      if result > 0 {
+        offset += result
+      } else if result < 0, errno == EINTR {
+        continue
+      } else {
+        fatalError("Could not write to socket: errno \(errno)")
+      }
+    }
+  }
+
+  static func readAll(
+    _ fileDescriptor: Int32, _ bytes: UnsafeMutableRawBufferPointer
+  ) {
+    var offset = 0
+    while offset < bytes.count {
+      let result = read(
+        fileDescriptor, bytes.baseAddress! + offset, bytes.count - offset)
+      if result > 0 {
+        offset += result
+      } else if result < 0, errno == EINTR {
+        continue
+      } else {
+        fatalError("Could not read from socket: errno \(errno)")
+      }
+    }
+  }
+}
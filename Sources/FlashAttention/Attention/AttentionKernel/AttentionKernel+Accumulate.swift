@@ -449,7 +449,7 @@ extension AttentionKernel {
       return """
       
       \(allocateAccumulator(descriptor: descriptor))
-      if (\(traversalOffset) == 0) {
+      if (\(traversalOffset) == \(traversalStart)) {
         \(initializeAccumulator(descriptor: descriptor))
       } else {
         \(cacheAccumulator(
@@ -0,0 +1,150 @@
+//
+//  AttentionKernel+Persistent.swift
+//  FlashAttention
+//
+
+// Persistent scheduling of the forward pass.
+//
+// The grid holds a fixed number of threadgroups. Each one pulls work items
+// from a schedule built on the host (see `AttentionSchedule`), until the
+// schedule runs out. A work item is one block of rows, of one head of one
+// sequence, over a range of columns.
+//
+// Inside the loop over work items, local variables shadow the function
+// constants (R, C) and the operand pointers (Q, K, V, O, L). The code that
+// generates the attention loop then works unchanged on the slice of the
+// problem described by the item.
+
+extension AttentionKernel {
+  func createWorkItemStructure() -> String {
+    guard persistent else {
+      return ""
+    }
+
+    return """
+
+    // Mirrors the encoding in 'MetalAttentionBackend+Schedule.swift'.
+    struct attention_work_item {
+      // First row of the sequence in Q, and column in K and V.
+      uint sequence_row;
+      uint sequence_column;
+
+      // Rows of the sequence, and the first row of this block.
+      uint row_count;
+      uint row_start;
+
+      // The range of columns this item covers.
+      uint column_start;
+      uint column_end;
+
+      // Column 'c' is visible to row 'r' if c - r <= diagonal.
+      int diagonal;
+
+      // Where the first row of this block goes in O and L.
+      int output_row;
+    };
+
+    """
+  }
+
+  func createScheduleBindings() -> String {
+    guard persistent else {
+      return ""
+    }
+
+    return """
+
+    device attention_work_item *schedule [[buffer(10)]],
+    device atomic_uint *schedule_counter [[buffer(11)]],
+    constant uint &schedule_count [[buffer(12)]],
+
+    """
+  }
+
+  func createPersistentBody(
+    setup: String, loop: String, cleanup: String
+  ) -> String {
+    func shadow(_ operand: AttentionOperand, offset: String) -> String {
+      "auto \(operand) = \(operand)_base + \(offset) * \(headDimension);"
+    }
+
+    return """
+
+    threadgroup uint next_item_index;
+    auto Q_base = Q;
+    auto K_base = K;
+    auto V_base = V;
+    auto O_base = O;
+    auto L_base = L;
+
+    while (true) {
+      // Everyone has read the previous index before it is overwritten.
+      threadgroup_barrier(mem_flags::mem_threadgroup);
+      if (sidx == 0 && lane_id == 0) {
+        next_item_index = atomic_fetch_add_explicit(
+          schedule_counter, 1, memory_order_relaxed);
+      }
+      threadgroup_barrier(mem_flags::mem_threadgroup);
+      uint item_index = next_item_index;
+      if (item_index >= schedule_count) {
+        break;
+      }
+      attention_work_item item = schedule[item_index];
+
+      // Shadow the problem size with the extent of this item.
+      uint R = item.row_count;
+      uint C = item.column_end;
+      uint column_start = item.column_start;
+      int diagonal = item.diagonal;
+      uint parallelization_group_offset = item.row_start;
+
+      // Shadow the operands with the slices of this item. The output rows
+      // may be redirected to a buffer of partial results.
+      long output_shift = long(item.output_row) - long(item.row_start);
+      \(shadow(.Q, offset: "item.sequence_row"))
+      \(shadow(.K, offset: "item.sequence_column"))
+      \(shadow(.V, offset: "item.sequence_column"))
+      \(shadow(.O, offset: "output_shift"))
+      auto L = L_base + output_shift;
+
+      \(setup)
+      \(loop)
+      \(cleanup)
+    }
+
+    """
+  }
+
+  // Mask the columns past the diagonal, for causal attention.
+  func maskAttentionMatrixDiagonal() -> String {
+    guard persistent else {
+      return ""
+    }
+    let blockDim = blockDimensions.traversal
+    let logBase2E: Float = 1.442695041
+
+    return """
+
+    // The first row of the block sees the fewest columns.
+    if (int(c + \(blockDim)) - int(\(parallelizationGroupOffset)) - 1 >
+        diagonal) {
+      const \(registerName(.S)) mask_value =
+      (0.875 / \(logBase2E)) * -numeric_limits<\(registerName(.S))>::max();
+      int row = int(\(unsafeParallelizationThreadOffset));
+
+      #pragma clang loop unroll(full)
+      for (ushort c_inner = 0; c_inner < \(blockDim); c_inner += 8) {
+        auto S_elements = S_sram[c_inner / 8].thread_elements();
+        #pragma clang loop unroll(full)
+        for (ushort index = 0; index < 2; ++index) {
+          int column = int(c + c_inner + morton_offset.x + index);
+          if (column - row > diagonal) {
+            (*S_elements)[index] = mask_value;
+          }
+        }
+      }
+    }
+
+    """
+  }
+}
@@ -14,14 +14,25 @@ extension AttentionKernel {
   //
   // Parameters:
   // - derivative: Whether this is the derivative softmax.
-  func dotProductScale(derivative: Bool) -> Float {
+  //
+  // With a dynamic shape, the head dimension of the kernel is a bucket. The
+  // scale factor must come from the head dimension of the problem, which is
+  // only known at runtime.
+  func dotProductScale(derivative: Bool) -> String {
     let logBase2E: Float = 1.442695041
-    let rsqrtD = 1 / Float(headDimension).squareRoot()
+    if dynamicShape {
+      if !derivative {
+        return "(\(logBase2E) * shape.rsqrt_head)"
+      } else {
+        return "shape.rsqrt_head"
+      }
+    }
     
+    let rsqrtD = 1 / Float(headDimension).squareRoot()
     if !derivative {
-      return logBase2E * rsqrtD
+      return "\(logBase2E * rsqrtD)"
     } else {
-      return rsqrtD
+      return "\(rsqrtD)"
     }
   }
 }
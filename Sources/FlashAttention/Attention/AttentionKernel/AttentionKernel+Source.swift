@@ -20,6 +20,31 @@ extension AttentionKernel {
       }
     }
     
+    func createBody() -> String {
+      if persistent {
+        return createPersistentBody(
+          setup: createSetup(),
+          loop: createLoop(),
+          cleanup: createCleanup(type: type))
+      }
+      
+      return """
+      
+      uint parallelization_group_offset = gid;
+      parallelization_group_offset *= \(blockDimensions.parallelization);
+      
+      // Return early if the entire SIMD is out of bounds.
+      if (\(parallelizationGroupOffset) >= \(parallelizationDimension)) {
+        return;
+      }
+      
+      \(createSetup())
+      \(createLoop())
+      \(createCleanup(type: type))
+      
+      """
+    }
+    
     return """
     
     \(createMetalSimdgroupEvent())
@@ -27,10 +52,13 @@ extension AttentionKernel {
     using namespace metal;
     
     \(createConstants())
+    \(createWorkItemStructure())
     
     // Declare the function.
     kernel void attention(
       \(createBufferBindings())
+      \(createScheduleBindings())
+      \(createShapeBindings())
       threadgroup uchar *threadgroup_block [[threadgroup(0)]],
       
       uint gid [[threadgroup_position_in_grid]],
@@ -38,17 +66,8 @@ extension AttentionKernel {
       ushort lane_id [[thread_index_in_simdgroup]]
     ) {
       ushort2 morton_offset = morton_order(lane_id);
-      uint parallelization_group_offset = gid;
-      parallelization_group_offset *= \(blockDimensions.parallelization);
-      
-      // Return early if the entire SIMD is out of bounds.
-      if (\(parallelizationGroupOffset) >= \(parallelizationDimension)) {
-        return;
-      }
-      
-      \(createSetup())
-      \(createLoop())
-      \(createCleanup(type: type))
+      \(createShapeArguments())
+      \(createBody())
     }
     
     """
@@ -59,7 +78,22 @@ extension AttentionKernel {
 
 extension AttentionKernel {
   func createConstants() -> String {
-    """
+    if dynamicShape {
+      return """
+      
+      // R = row dimension (output sequence)
+      // C = column dimension (input sequence)
+      // rsqrt_head = 1 / sqrt(head dimension before bucketing)
+      struct attention_shape {
+        uint R;
+        uint C;
+        float rsqrt_head;
+      };
+      
+      """
+    }
+    
+    return """
     
     // R = row dimension (output sequence)
     // C = column dimension (input sequence)
@@ -69,6 +103,30 @@ extension AttentionKernel {
     """
   }
   
+  func createShapeBindings() -> String {
+    guard dynamicShape else {
+      return ""
+    }
+    return """
+    
+    constant attention_shape &shape [[buffer(13)]],
+    
+    """
+  }
+  
+  // Read the problem size, in place of the function constants.
+  func createShapeArguments() -> String {
+    guard dynamicShape else {
+      return ""
+    }
+    return """
+    
+    uint R = shape.R;
+    uint C = shape.C;
+    
+    """
+  }
+  
   func createBufferBindings() -> String {
     // What operands does the kernel use?
     var operands: [AttentionOperand] = []
@@ -173,10 +231,13 @@ extension AttentionKernel {
     return """
     
     // Outer loop over the traversal dimension.
-    for (uint c = 0; c < C; c += \(blockDimensions.traversal)) {
+    for (
+      uint c = \(traversalStart); c < C; c += \(blockDimensions.traversal)
+    ) {
       // S = Q * K^T
       \(QKT)
       \(maskAttentionMatrixEdge())
+      \(maskAttentionMatrixDiagonal())
       
       // m = reduce(m)
       \(onlineReduceMaximum())
@@ -12,7 +12,9 @@ public struct AttentionKernel {
   
   // Categorical attributes for each operand.
   var cacheState: [AttentionOperand: Bool]
+  var dynamicShape: Bool
   var memoryPrecisions: [AttentionOperand: GEMMOperandPrecision]
+  var persistent: Bool
   var preferAsyncCache: Bool
   var preferAsyncLoad: Bool
   var registerPrecisions: [AttentionOperand: GEMMOperandPrecision]
@@ -35,7 +37,9 @@ public struct AttentionKernel {
     self.type = type
     
     self.cacheState = descriptor.cacheState
+    self.dynamicShape = descriptor.dynamicShape
     self.memoryPrecisions = descriptor.memoryPrecisions
+    self.persistent = descriptor.persistent
     self.preferAsyncCache = preferAsyncCache
     self.preferAsyncLoad = preferAsyncLoad
     self.registerPrecisions = descriptor.registerPrecisions
@@ -47,6 +51,17 @@ public struct AttentionKernel {
     // Pick the threadgroup memory allocation size.
     threadgroupMemoryAllocation = .zero
     threadgroupMemoryAllocation = createThreadgroupMemoryAllocation()
+    
+    if persistent {
+      guard type == .forward else {
+        fatalError("Persistent scheduling only supports the forward pass.")
+      }
+      for operand in [AttentionOperand.Q, .K, .V, .O] {
+        guard !transposed(operand) else {
+          fatalError("Persistent scheduling requires untransposed operands.")
+        }
+      }
+    }
   }
 }
 
@@ -243,6 +258,12 @@ extension AttentionKernel {
     }
   }
   
+  // Where the traversal starts. A work item of the persistent kernel may
+  // cover a range of columns that does not start at zero.
+  var traversalStart: String {
+    persistent ? "column_start" : "0"
+  }
+  
   var paddedTraversalEdge: String {
     let blockDim = blockDimensions.traversal
     let remainder = "\(traversalDimension) % \(blockDim)"
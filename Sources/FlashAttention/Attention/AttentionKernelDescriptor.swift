@@ -12,11 +12,24 @@ public struct AttentionKernelDescriptor {
   /// Whether each operand is cached in registers.
   public var cacheState: [AttentionOperand: Bool] = [:]
   
+  /// Whether the sequence lengths and the scale factor are read from an
+  /// argument buffer, instead of function constants. The default is `false`.
+  ///
+  /// The head dimension is still embedded into the source. In this mode, it
+  /// is the bucket from `AttentionDescriptor.headDimensionBucket`.
+  public var dynamicShape: Bool = false
+  
   /// Required. The problem size along the head dimension.
   public var headDimension: UInt16?
   
   public var memoryPrecisions: [AttentionOperand: GEMMOperandPrecision] = [:]
   
+  /// Whether threadgroups pull work items from a schedule, instead of
+  /// owning one block of the grid. The default is `false`.
+  ///
+  /// Only the forward kernel supports this mode. See `AttentionSchedule`.
+  public var persistent: Bool = false
+  
   /// Reads with a one-to-one mapping to threads (like GEMM store) and writes.
   public var preferAsyncCache: Bool?
   
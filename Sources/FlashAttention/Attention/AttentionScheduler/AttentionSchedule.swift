@@ -0,0 +1,168 @@
+//
+//  AttentionSchedule.swift
+//  FlashAttention
+//
+
+/// One unit of work for a persistent threadgroup: a block of rows, of one
+/// head of one sequence, over a range of columns.
+public struct AttentionWorkItem {
+  public var sequence: Int
+  public var head: Int
+
+  /// The first row of the block, within the sequence.
+  public var rowStart: Int
+
+  /// The range of columns, within the sequence.
+  public var columnStart: Int
+  public var columnEnd: Int
+
+  /// The estimated cost, in elements of the attention matrix.
+  public var cost: Int
+
+  /// Where the partial result goes, if the item covers only part of the
+  /// columns its rows can see.
+  public var partialSlot: Int?
+}
+
+/// An ordered list of work items, covering every row of every head of every
+/// sequence.
+///
+/// Under causal masking, the blocks near the top of the attention matrix
+/// see only a few columns, while the blocks near the bottom see all of
+/// them. With ragged sequences, the blocks of a long sequence do much more
+/// work than those of a short one. A plain grid leaves the most expensive
+/// threadgroups running alone at the end.
+///
+/// The schedule takes two measures against this:
+/// - Items are ordered from the most to the least expensive. Threadgroups
+///   pull them in order, so the cheap items fill in the gaps at the end
+///   (longest processing time first).
+/// - Items whose cost exceeds the fair share of a threadgroup are split
+///   into ranges of columns. The pieces run on different threadgroups, and
+///   are merged exactly with their log-sum-exp.
+///
+/// The cost of an item is the area of the tiles it computes, plus one tile
+/// for loading the rows and storing the outputs. Masked tiles on the
+/// diagonal count fully, since the kernel computes them anyway.
+public struct AttentionSchedule {
+  public let descriptor: AttentionScheduleDescriptor
+  public private(set) var items: [AttentionWorkItem] = []
+
+  /// The number of blocks of partial results.
+  public private(set) var partialCount: Int = 0
+
+  public init(descriptor: AttentionScheduleDescriptor) {
+    guard let sequenceDimensions = descriptor.sequenceDimensions,
+          let blockDimensions = descriptor.blockDimensions,
+          let workerCount = descriptor.workerCount else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard blockDimensions.parallelization > 0,
+          blockDimensions.traversal > 0,
+          workerCount > 0,
+          descriptor.headCount > 0,
+          descriptor.maximumSplitCount > 0 else {
+      fatalError("Invalid schedule descriptor.")
+    }
+    self.descriptor = descriptor
+
+    var gridItems: [AttentionWorkItem] = []
+    for (sequenceID, dimensions) in sequenceDimensions.enumerated() {
+      guard dimensions.row >= 0, dimensions.column >= 0 else {
+        fatalError("Invalid sequence dimensions.")
+      }
+      guard dimensions.row == 0 || dimensions.column > 0 else {
+        fatalError("Every row must see at least one column.")
+      }
+      if descriptor.causal {
+        guard dimensions.column >= dimensions.row else {
+          fatalError("Causal attention requires columns >= rows.")
+        }
+      }
+
+      for head in 0..<descriptor.headCount {
+        for rowStart in stride(
+          from: 0, to: dimensions.row, by: blockDimensions.parallelization
+        ) {
+          var columnEnd = dimensions.column
+          if descriptor.causal {
+            let lastRow = min(
+              rowStart + blockDimensions.parallelization, dimensions.row) - 1
+            let diagonal = dimensions.column - dimensions.row
+            columnEnd = min(columnEnd, lastRow + diagonal + 1)
+          }
+
+          var item = AttentionWorkItem(
+            sequence: sequenceID, head: head, rowStart: rowStart,
+            columnStart: 0, columnEnd: columnEnd, cost: 0)
+          item.cost = cost(item)
+          gridItems.append(item)
+        }
+      }
+    }
+
+    if descriptor.splitsColumns {
+      let totalCost = gridItems.reduce(0) { $0 + $1.cost }
+      let fairShare = max((totalCost + workerCount - 1) / workerCount, 1)
+      for item in gridItems {
+        items += split(item, fairShare: fairShare)
+      }
+    } else {
+      items = gridItems
+    }
+
+    if descriptor.sortsByCost {
+      // Break ties by position, so the order is deterministic.
+      items = items.enumerated().sorted {
+        ($0.element.cost, -$0.offset) > ($1.element.cost, -$1.offset)
+      }.map(\.element)
+    }
+  }
+
+  func cost(_ item: AttentionWorkItem) -> Int {
+    let blockDimensions = descriptor.blockDimensions!
+    let blockDim = blockDimensions.traversal
+    let columnCount = item.columnEnd - item.columnStart
+    let paddedColumnCount = (columnCount + blockDim - 1) / blockDim * blockDim
+    return blockDimensions.parallelization * (paddedColumnCount + blockDim)
+  }
+
+  // Split the columns at multiples of the traversal block, so the kernel
+  // sees the same tiles as without splitting.
+  mutating func split(
+    _ item: AttentionWorkItem, fairShare: Int
+  ) -> [AttentionWorkItem] {
+    let blockDim = descriptor.blockDimensions!.traversal
+    let blockCount = (item.columnEnd - item.columnStart + blockDim - 1)
+    / blockDim
+    var pieceCount = (item.cost + fairShare - 1) / fairShare
+    pieceCount = min(pieceCount, descriptor.maximumSplitCount, blockCount)
+    guard pieceCount > 1 else {
+      return [item]
+    }
+
+    let blocksPerPiece = (blockCount + pieceCount - 1) / pieceCount
+    var output: [AttentionWorkItem] = []
+    for columnStart in stride(
+      from: item.columnStart, to: item.columnEnd, by: blocksPerPiece * blockDim
+    ) {
+      var piece = item
+      piece.columnStart = columnStart
+      piece.columnEnd = min(
+        columnStart + blocksPerPiece * blockDim, item.columnEnd)
+      piece.cost = cost(piece)
+      piece.partialSlot = partialCount
+      partialCount += 1
+      output.append(piece)
+    }
+    return output
+  }
+}
+
+extension AttentionSchedule {
+  /// Predicts how evenly the items spread over the workers.
+  public func simulate() -> AttentionScheduleSimulation {
+    AttentionScheduleSimulation(
+      costs: items.map(\.cost), workerCount: descriptor.workerCount!)
+  }
+}
@@ -0,0 +1,55 @@
+//
+//  AttentionScheduleDescriptor.swift
+//  FlashAttention
+//
+
+/// A batch of attention problems, to be distributed over a fixed number of
+/// persistent threadgroups.
+///
+/// Every sequence of the batch has its own row and column dimensions
+/// (variable-length attention). All sequences share the head count and the
+/// head dimension.
+public struct AttentionScheduleDescriptor {
+  /// Required. The rows and columns of each sequence.
+  public var sequenceDimensions: [(row: Int, column: Int)]?
+
+  /// The number of heads. The default is 1.
+  public var headCount: Int = 1
+
+  /// Whether each row only attends to the columns up to its position. The
+  /// default is `false`.
+  ///
+  /// The diagonal is aligned to the bottom right corner of the attention
+  /// matrix. Row `r` sees the columns `0...(r + column - row)`. This requires
+  /// at least as many columns as rows.
+  public var causal: Bool = false
+
+  /// Required. The rows and columns of one tile of the attention matrix,
+  /// which are the parallelization and traversal block dimensions of the
+  /// forward kernel.
+  public var blockDimensions: (parallelization: Int, traversal: Int)?
+
+  /// Required. The number of threadgroups that pull from the schedule.
+  public var workerCount: Int?
+
+  /// Whether to order the work items from the most to the least expensive.
+  /// The default is `true`.
+  ///
+  /// When `false`, and nothing is split, the items follow the order of a
+  /// plain grid over (sequence, head, block of rows).
+  public var sortsByCost: Bool = true
+
+  /// Whether to split the most expensive items into ranges of columns. The
+  /// default is `true`.
+  ///
+  /// The pieces produce partial results, which are merged afterward with
+  /// their log-sum-exp.
+  public var splitsColumns: Bool = true
+
+  /// The largest number of pieces a single item is split into.
+  public var maximumSplitCount: Int = 8
+
+  public init() {
+
+  }
+}
@@ -0,0 +1,88 @@
+//
+//  AttentionScheduleSimulation.swift
+//  FlashAttention
+//
+
+/// The load balance of a list of work items, pulled in order by a fixed
+/// number of workers.
+///
+/// Each item goes to the worker that becomes free first. This is how
+/// persistent threadgroups consume a schedule, and it is a close model of
+/// how the GPU hands out the threadgroups of a plain grid.
+///
+/// To compare a plain grid against the persistent schedule, simulate the
+/// same descriptor twice, with `sortsByCost` and `splitsColumns` both
+/// `false` the first time:
+///
+/// ```swift
+/// var scheduleDesc = AttentionScheduleDescriptor()
+/// ...
+/// let persistent = AttentionSchedule(descriptor: scheduleDesc).simulate()
+/// scheduleDesc.sortsByCost = false
+/// scheduleDesc.splitsColumns = false
+/// let grid = AttentionSchedule(descriptor: scheduleDesc).simulate()
+/// print(grid)
+/// print(persistent)
+/// ```
+public struct AttentionScheduleSimulation {
+  public var workerCount: Int
+
+  /// The sum of the costs of every item.
+  public var totalCost: Int
+
+  /// The time when the last worker finishes.
+  public var makespan: Int
+
+  /// The time each worker spends busy.
+  public var workerCosts: [Int]
+
+  public init(costs: [Int], workerCount: Int) {
+    guard workerCount > 0 else {
+      fatalError("Invalid worker count.")
+    }
+    self.workerCount = workerCount
+
+    workerCosts = Array(repeating: .zero, count: workerCount)
+    for cost in costs {
+      let workerID = workerCosts.indices.min {
+        workerCosts[$0] < workerCosts[$1]
+      }!
+      workerCosts[workerID] += cost
+    }
+    totalCost = costs.reduce(0, +)
+    makespan = workerCosts.max()!
+  }
+
+  /// The makespan if the work were spread perfectly.
+  public var idealMakespan: Double {
+    Double(totalCost) / Double(workerCount)
+  }
+
+  /// The ratio of the makespan to the ideal makespan. 1 is perfect balance.
+  public var loadImbalance: Double {
+    guard totalCost > 0 else {
+      return 1
+    }
+    return Double(makespan) / idealMakespan
+  }
+
+  /// The fraction of the worker time spent on useful work.
+  public var utilization: Double {
+    1 / loadImbalance
+  }
+}
+
+extension AttentionScheduleSimulation: CustomStringConvertible {
+  public var description: String {
+    func format(_ value: Double) -> String {
+      let rounded = (value * 1000).rounded() / 1000
+      return "\(rounded)"
+    }
+    return """
+      workers: \(workerCount), makespan: \(makespan), \
+      ideal: \(format(idealMakespan)), \
+      imbalance: \(format(loadImbalance)), \
+      utilization: \(format(utilization))
+      """
+  }
+}
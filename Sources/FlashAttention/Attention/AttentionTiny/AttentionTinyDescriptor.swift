@@ -0,0 +1,93 @@
+//
+//  AttentionTinyDescriptor.swift
+//  FlashAttention
+//
+
+/// A description of the forward pass over many independent attention
+/// problems of the same small size (windowed vision, short utterances).
+///
+/// The tiled kernels give each problem at least one threadgroup, sized for
+/// long sequences. At 49 tokens, most of its lanes sit idle. The tiny kernel
+/// instead keeps K and V of several problems in threadgroup memory, and
+/// gives each query row one thread.
+public struct AttentionTinyDescriptor {
+  /// Required. The size of every problem in the batch.
+  public var matrixDimensions: (row: UInt16, column: UInt16, head: UInt16)?
+
+  public init() {
+
+  }
+}
+
+struct AttentionTinyKey: Equatable, Hashable {
+  var matrixDimensions: SIMD3<UInt16>
+
+  init(copying source: AttentionTinyDescriptor) {
+    if let matrixDimensions = source.matrixDimensions {
+      self.matrixDimensions = SIMD3(
+        matrixDimensions.row,
+        matrixDimensions.column,
+        matrixDimensions.head)
+    } else {
+      self.matrixDimensions = SIMD3(repeating: .max)
+    }
+  }
+}
+
+extension AttentionTinyDescriptor: Hashable, Equatable {
+  public static func == (
+    lhs: AttentionTinyDescriptor,
+    rhs: AttentionTinyDescriptor
+  ) -> Bool {
+    let lhsKey = AttentionTinyKey(copying: lhs)
+    let rhsKey = AttentionTinyKey(copying: rhs)
+    return lhsKey == rhsKey
+  }
+
+  public func hash(into hasher: inout Hasher) {
+    let key = AttentionTinyKey(copying: self)
+    hasher.combine(key)
+  }
+}
+
+extension AttentionDescriptor {
+  /// The tiny-sequence kernel for this problem size, or `nil` if the tiled
+  /// kernels should run it.
+  ///
+  /// Chosen when both sequences are at most
+  /// `AttentionTinyKernel.maximumSequenceLength`, the head dimension is
+  /// between 1 and `AttentionTinyKernel.maximumHeadDimension`, and K and V
+  /// of one problem fit in threadgroup memory. Only the plain FP32 forward
+  /// pass is supported.
+  public var tinySequenceDescriptor: AttentionTinyDescriptor? {
+    guard let matrixDimensions = self.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let (row, column, head) = matrixDimensions
+    guard row > 0, column > 0, head > 0,
+          row <= AttentionTinyKernel.maximumSequenceLength,
+          column <= AttentionTinyKernel.maximumSequenceLength,
+          head <= AttentionTinyKernel.maximumHeadDimension else {
+      return nil
+    }
+    guard !lowPrecisionInputs, !lowPrecisionIntermediates,
+          queryHeadsPerKeyValueHead == 1, !dynamicShape else {
+      return nil
+    }
+    if let transposeState = self.transposeState {
+      guard !transposeState.Q, !transposeState.K,
+            !transposeState.V, !transposeState.O else {
+        return nil
+      }
+    }
+
+    var tinyDesc = AttentionTinyDescriptor()
+    tinyDesc.matrixDimensions = (
+      row: UInt16(row), column: UInt16(column), head: head)
+    let memory = AttentionTinyKernel.memoryPerProblem(descriptor: tinyDesc)
+    guard memory <= AttentionTinyKernel.threadgroupMemoryCapacity else {
+      return nil
+    }
+    return tinyDesc
+  }
+}
@@ -0,0 +1,39 @@
+//
+//  AttentionTinyKernel+PipelineCache.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+extension AttentionTinyKernel {
+  public typealias PipelineValue = (
+    kernel: AttentionTinyKernel, pipeline: MTLComputePipelineState)
+
+  public static var pipelineCache: [
+    AttentionTinyDescriptor: PipelineValue] = [:]
+}
+
+extension AttentionTinyKernel {
+  // Register this problem configuration in the cache.
+  public static func register(descriptor: AttentionTinyDescriptor) {
+    guard pipelineCache[descriptor] == nil else {
+      return
+    }
+
+    let kernel = AttentionTinyKernel(descriptor: descriptor)
+    let source = kernel.createSource()
+    let device = MTLContext.global.device
+    let library: MTLLibrary
+    do {
+      library = try device.makeLibrary(source: source, options: nil)
+    } catch {
+      print("Metal compile error:\n\(error)\n")
+      fatalError("Metal compile failed")
+    }
+    let function = library.makeFunction(name: "attention_tiny")!
+    let pipeline = try! device.makeComputePipelineState(function: function)
+    pipelineCache[descriptor] = (kernel, pipeline)
+  }
+}
+#endif
@@ -0,0 +1,177 @@
+//
+//  AttentionTinyKernel.swift
+//  FlashAttention
+//
+
+/// The kernel for `AttentionTinyDescriptor`.
+///
+/// Each threadgroup owns several problems. It first copies K and V of all of
+/// them into threadgroup memory. Then each thread takes one query row, with
+/// Q and O held in registers, and streams over the columns of its problem
+/// with an online softmax. The rows of a problem read the same column at
+/// the same time, so threadgroup memory broadcasts it.
+public struct AttentionTinyKernel {
+  /// The largest row or column dimension this kernel accepts.
+  public static let maximumSequenceLength: UInt32 = 128
+
+  /// The largest head dimension this kernel accepts. Q and O of a row live
+  /// in registers, so this bounds the register pressure.
+  public static let maximumHeadDimension: UInt16 = 64
+
+  // The threadgroup memory the kernel may use, in bytes.
+  static let threadgroupMemoryCapacity: Int = 32 * 1024
+
+  // The number of threads the kernel aims for, per threadgroup.
+  static let targetThreadgroupSize: Int = 256
+
+  var matrixDimensions: (row: UInt16, column: UInt16, head: UInt16)
+
+  /// The number of problems in a threadgroup.
+  public private(set) var problemsPerThreadgroup: Int
+
+  public init(descriptor: AttentionTinyDescriptor) {
+    guard let matrixDimensions = descriptor.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard matrixDimensions.row > 0,
+          matrixDimensions.column > 0,
+          matrixDimensions.head > 0 else {
+      fatalError("Problem size was empty.")
+    }
+    guard UInt32(matrixDimensions.row) <= Self.maximumSequenceLength,
+          UInt32(matrixDimensions.column) <= Self.maximumSequenceLength,
+          matrixDimensions.head <= Self.maximumHeadDimension else {
+      fatalError("Problem size was too large.")
+    }
+    let memoryPerProblem = Self.memoryPerProblem(descriptor: descriptor)
+    guard memoryPerProblem <= Self.threadgroupMemoryCapacity else {
+      fatalError("K and V did not fit in threadgroup memory.")
+    }
+    self.matrixDimensions = matrixDimensions
+
+    // Fill the threadgroup with rows, as far as threadgroup memory allows.
+    let byThreads = Self.targetThreadgroupSize / Int(matrixDimensions.row)
+    let byMemory = Self.threadgroupMemoryCapacity / memoryPerProblem
+    problemsPerThreadgroup = max(min(byThreads, byMemory), 1)
+  }
+
+  // The bytes of threadgroup memory for K and V of one problem.
+  static func memoryPerProblem(descriptor: AttentionTinyDescriptor) -> Int {
+    let (_, column, head) = descriptor.matrixDimensions!
+    return 2 * Int(column) * Int(head) * 4
+  }
+
+  public var threadgroupSize: Int {
+    let threadCount = problemsPerThreadgroup * Int(matrixDimensions.row)
+    return (threadCount + 31) / 32 * 32
+  }
+
+  public var threadgroupMemoryAllocation: Int {
+    let (column, head) = (matrixDimensions.column, matrixDimensions.head)
+    return problemsPerThreadgroup * 2 * Int(column) * Int(head) * 4
+  }
+
+  /// The number of threadgroups for a batch of problems.
+  public func threadgroupCount(problemCount: Int) -> Int {
+    (problemCount + problemsPerThreadgroup - 1) / problemsPerThreadgroup
+  }
+}
+
+extension AttentionTinyKernel {
+  public func createSource() -> String {
+    let (row, column, head) = matrixDimensions
+    let logBase2E: Float = 1.442695041
+    let scale = logBase2E / Float(head).squareRoot()
+
+    return """
+
+#include <metal_stdlib>
+using namespace metal;
+
+constant uint R = \(row);
+constant uint C = \(column);
+constant uint D = \(head);
+constant uint P = \(problemsPerThreadgroup);
+
+// Q, O: problem x R x D
+// K, V: problem x C x D
+// L: problem x R
+kernel void attention_tiny(device float *Q [[buffer(0)]],
+                           device float *K [[buffer(1)]],
+                           device float *V [[buffer(2)]],
+                           device float *O [[buffer(3)]],
+                           device float *L [[buffer(4)]],
+                           constant uint &problem_count [[buffer(5)]],
+                           threadgroup float *threadgroup_block
+                           [[threadgroup(0)]],
+
+                           uint gid [[threadgroup_position_in_grid]],
+                           ushort tid [[thread_index_in_threadgroup]])
+{
+  uint problem_start = gid * P;
+  uint local_count = min(P, problem_count - problem_start);
+  threadgroup float *K_block = threadgroup_block;
+  threadgroup float *V_block = K_block + P * C * D;
+
+  // Stage K and V of every problem in this threadgroup.
+  {
+    uint element_count = local_count * C * D;
+    device float *K_source = K + problem_start * C * D;
+    device float *V_source = V + problem_start * C * D;
+    for (uint i = tid; i < element_count; i += \(threadgroupSize)) {
+      K_block[i] = K_source[i];
+      V_block[i] = V_source[i];
+    }
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+
+  uint local_problem = tid / R;
+  uint row = tid % R;
+  if (local_problem >= local_count) {
+    return;
+  }
+  uint problem = problem_start + local_problem;
+  uint address = (problem * R + row) * D;
+
+  float q[\(head)];
+  float o[\(head)];
+#pragma clang loop unroll(full)
+  for (ushort d = 0; d < D; ++d) {
+    q[d] = Q[address + d] * \(scale);
+    o[d] = 0;
+  }
+  float m = -numeric_limits<float>::max();
+  float l = 0;
+
+  threadgroup float *K_problem = K_block + local_problem * C * D;
+  threadgroup float *V_problem = V_block + local_problem * C * D;
+  for (uint c = 0; c < C; ++c) {
+    float s = 0;
+#pragma clang loop unroll(full)
+    for (ushort d = 0; d < D; ++d) {
+      s += q[d] * K_problem[c * D + d];
+    }
+
+    float m_new = max(m, s);
+    float correction = fast::exp2(m - m_new);
+    float p = fast::exp2(s - m_new);
+    l = l * correction + p;
+#pragma clang loop unroll(full)
+    for (ushort d = 0; d < D; ++d) {
+      o[d] = o[d] * correction + p * V_problem[c * D + d];
+    }
+    m = m_new;
+  }
+
+#pragma clang loop unroll(full)
+  for (ushort d = 0; d < D; ++d) {
+    O[address + d] = o[d] / l;
+  }
+
+  // Premultiplied by log_base_2(e).
+  L[problem * R + row] = m + log2(l);
+}
+
+"""
+  }
+}
@@ -0,0 +1,79 @@
+//
+//  AsyncExecutionQueue.swift
+//  FlashAttention
+//
+
+/// Schedules many asynchronous operations, with a bound on how many are in
+/// flight at once.
+///
+/// Submit work from as many tasks as needed. The first
+/// `maximumInFlight` operations start immediately. The others suspend
+/// until an earlier operation finishes, and then start in the order they
+/// were submitted.
+///
+/// ```swift
+/// let queue = AsyncExecutionQueue(maximumInFlight: 4)
+/// await withTaskGroup(of: Void.self) { group in
+///   for layer in layers {
+///     group.addTask {
+///       await queue.submit {
+///         await backend.run { layer.encode($0) }
+///       }
+///     }
+///   }
+/// }
+/// ```
+public actor AsyncExecutionQueue {
+  public let maximumInFlight: Int
+
+  /// The operations that have started, but not finished.
+  public private(set) var inFlightCount: Int = 0
+
+  /// The largest value `inFlightCount` has reached.
+  public private(set) var peakInFlightCount: Int = 0
+
+  /// The operations that have finished.
+  public private(set) var completedCount: Int = 0
+
+  // Operations waiting for a slot, in submission order.
+  private var waiters: [CheckedContinuation<Void, Never>] = []
+
+  public init(maximumInFlight: Int) {
+    guard maximumInFlight > 0 else {
+      fatalError("Invalid in-flight limit.")
+    }
+    self.maximumInFlight = maximumInFlight
+  }
+
+  /// Waits for a slot, runs the operation, and returns its result.
+  public func submit<Result>(
+    _ operation: () async -> Result
+  ) async -> Result {
+    await acquire()
+    let result = await operation()
+    release()
+    return result
+  }
+
+  private func acquire() async {
+    if inFlightCount < maximumInFlight {
+      inFlightCount += 1
+    } else {
+      // 'release' hands its slot over directly, so the count stays the
+      // same.
+      await withCheckedContinuation { continuation in
+        waiters.append(continuation)
+      }
+    }
+    peakInFlightCount = max(peakInFlightCount, inFlightCount)
+  }
+
+  private func release() {
+    completedCount += 1
+    if waiters.isEmpty {
+      inFlightCount -= 1
+    } else {
+      waiters.removeFirst().resume()
+    }
+  }
+}
@@ -0,0 +1,623 @@
+//
+//  CPUGEMMBackend.swift
+//  FlashAttention
+//
+
+import Foundation
+
+/// A reference backend that executes GEMMs on the CPU.
+///
+/// Command buffers execute asynchronously, in commit order, on a private
+/// serial queue. The multiplication itself is parallelized over rows of C
+/// and vectorized over columns. Operands are decoded into FP32 and the
+/// accumulator is FP32, regardless of the memory precisions. This matches the
+/// GPU kernel, except when every operand is FP16 (the GPU then accumulates in
+/// FP16).
+public final class CPUGEMMBackend: GEMMBackend {
+  let queue = DispatchQueue(label: "com.flash-attention.cpu-gemm")
+
+  public init() {
+
+  }
+
+  public func makeBuffer(length: Int) -> GEMMBackendBuffer {
+    CPUGEMMBuffer(length: length)
+  }
+
+  public func makeCommandBuffer() -> GEMMCommandBuffer {
+    CPUGEMMCommandBuffer(queue: queue)
+  }
+}
+
+/// Page-aligned host memory.
+public final class CPUGEMMBuffer: GEMMBackendBuffer {
+  public let contents: UnsafeMutableRawPointer
+  public let length: Int
+
+  public init(length: Int) {
+    self.length = length
+    self.contents = .allocate(
+      byteCount: max(length, 1), alignment: WeightFileFormat.alignment)
+    contents.initializeMemory(as: UInt8.self, repeating: 0, count: length)
+  }
+
+  deinit {
+    contents.deallocate()
+  }
+}
+
+final class CPUGEMMCommandBuffer: GEMMCommandBuffer {
+  let queue: DispatchQueue
+  let group = DispatchGroup()
+  let lock = NSLock()
+  var commands: [() -> Void] = []
+  var completedHandlers: [() -> Void] = []
+  var committed = false
+  var completed = false
+
+  init(queue: DispatchQueue) {
+    self.queue = queue
+  }
+
+  func encodeGEMM(
+    descriptor: GEMMDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    C: GEMMOperandBinding
+  ) {
+    guard !committed else {
+      fatalError("Command buffer was already committed.")
+    }
+    let pointerA = UnsafeRawPointer(A.contents)
+    let pointerB = UnsafeRawPointer(B.contents)
+    let pointerC = C.contents
+    let buffers = [A.buffer, B.buffer, C.buffer]
+    commands.append {
+      withExtendedLifetime(buffers) {
+        CPUGEMMBackend.multiply(
+          descriptor: descriptor, A: pointerA, B: pointerB, C: pointerC)
+      }
+    }
+  }
+
+  func encodeChainedGEMM(
+    descriptor: GEMMChainedDescriptor,
+    A: GEMMOperandBinding,
+    B1: GEMMOperandBinding,
+    B2: GEMMOperandBinding,
+    W: GEMMOperandBinding?,
+    C: GEMMOperandBinding
+  ) {
+    guard !committed else {
+      fatalError("Command buffer was already committed.")
+    }
+    let pointerA = UnsafeRawPointer(A.contents)
+    let pointerB1 = UnsafeRawPointer(B1.contents)
+    let pointerB2 = UnsafeRawPointer(B2.contents)
+    let pointerW = W.map { UnsafeRawPointer($0.contents) }
+    let pointerC = C.contents
+    let buffers = [A.buffer, B1.buffer, B2.buffer, C.buffer]
+    + (W.map { [$0.buffer] } ?? [])
+    commands.append {
+      withExtendedLifetime(buffers) {
+        CPUGEMMBackend.multiplyChained(
+          descriptor: descriptor,
+          A: pointerA, B1: pointerB1, B2: pointerB2, W: pointerW,
+          C: pointerC)
+      }
+    }
+  }
+
+  func encodeComplexGEMM(
+    descriptor: GEMMComplexDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    C: GEMMOperandBinding
+  ) {
+    guard !committed else {
+      fatalError("Command buffer was already committed.")
+    }
+    let pointerA = UnsafeRawPointer(A.contents)
+    let pointerB = UnsafeRawPointer(B.contents)
+    let pointerC = C.contents
+    let buffers = [A.buffer, B.buffer, C.buffer]
+    commands.append {
+      withExtendedLifetime(buffers) {
+        CPUGEMMBackend.multiplyComplex(
+          descriptor: descriptor, A: pointerA, B: pointerB, C: pointerC)
+      }
+    }
+  }
+
+  func encodeSparseGEMM(
+    descriptor: GEMMSparseDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    metadata: GEMMOperandBinding,
+    C: GEMMOperandBinding
+  ) {
+    guard !committed else {
+      fatalError("Command buffer was already committed.")
+    }
+    let pointerA = UnsafeRawPointer(A.contents)
+    let pointerB = UnsafeRawPointer(B.contents)
+    let pointerMetadata = UnsafeRawPointer(metadata.contents)
+    let pointerC = C.contents
+    let buffers = [A.buffer, B.buffer, metadata.buffer, C.buffer]
+    commands.append {
+      withExtendedLifetime(buffers) {
+        CPUGEMMBackend.multiplySparse(
+          descriptor: descriptor, A: pointerA, B: pointerB,
+          metadata: pointerMetadata, C: pointerC)
+      }
+    }
+  }
+
+  func addCompletedHandler(_ handler: @escaping () -> Void) {
+    guard !committed else {
+      fatalError("Command buffer was already committed.")
+    }
+    completedHandlers.append(handler)
+  }
+
+  func commit() {
+    guard !committed else {
+      fatalError("Command buffer was already committed.")
+    }
+    committed = true
+
+    let commands = self.commands
+    let completedHandlers = self.completedHandlers
+    group.enter()
+    queue.async { [self] in
+      for command in commands {
+        command()
+      }
+      lock.withLock {
+        completed = true
+      }
+      for handler in completedHandlers {
+        handler()
+      }
+      group.leave()
+    }
+  }
+
+  func waitUntilCompleted() {
+    guard committed else {
+      fatalError("Command buffer was not committed.")
+    }
+    group.wait()
+  }
+
+  var isCompleted: Bool {
+    lock.withLock { completed }
+  }
+}
+
+// MARK: - Reference Multiplication
+
+extension GEMMOperandPrecision {
+  /// Decodes the element at `index` into FP32.
+  @inline(__always)
+  func load(_ pointer: UnsafeRawPointer, _ index: Int) -> Float {
+    switch self {
+    case .FP32:
+      return pointer.load(fromByteOffset: index * 4, as: Float.self)
+    case .FP16:
+      let value = pointer.load(fromByteOffset: index * 2, as: Float16.self)
+      return Float(value)
+    case .BF16:
+      let value = pointer.load(fromByteOffset: index * 2, as: UInt16.self)
+      return Float(bitPattern: UInt32(value) << 16)
+    }
+  }
+
+  /// Encodes an FP32 value, truncating BF16 like the GPU kernel does.
+  @inline(__always)
+  func store(_ value: Float, _ pointer: UnsafeMutableRawPointer, _ index: Int) {
+    switch self {
+    case .FP32:
+      pointer.storeBytes(of: value, toByteOffset: index * 4, as: Float.self)
+    case .FP16:
+      pointer.storeBytes(
+        of: Float16(value), toByteOffset: index * 2, as: Float16.self)
+    case .BF16:
+      let value16 = UInt16(truncatingIfNeeded: value.bitPattern >> 16)
+      pointer.storeBytes(of: value16, toByteOffset: index * 2, as: UInt16.self)
+    }
+  }
+}
+
+extension CPUGEMMBackend {
+  typealias Vector = SIMD8<Float>
+
+  /// Executes a GEMM synchronously on the calling thread (plus worker
+  /// threads for the row-parallel loop).
+  ///
+  /// Set `concurrent` to false in contexts where Dispatch is unavailable.
+  /// In a forked child process, use `multiply(descriptor:A:B:C:scratch:)`
+  /// instead, which does not allocate.
+  public static func multiply(
+    descriptor: GEMMDescriptor,
+    A: UnsafeRawPointer,
+    B: UnsafeRawPointer,
+    C: UnsafeMutableRawPointer,
+    concurrent: Bool = true
+  ) {
+    let layout = ProblemLayout(descriptor: descriptor)
+    let accumulatorCount = layout.vectorCount * (
+      concurrent ? layout.taskCount : 1)
+    let accumulators = UnsafeMutablePointer<Vector>.allocate(
+      capacity: max(accumulatorCount, 1))
+    let decodedB = UnsafeMutablePointer<Float>.allocate(
+      capacity: layout.decodedBCount)
+    defer {
+      accumulators.deallocate()
+      decodedB.deallocate()
+    }
+    multiplyBatch(
+      descriptor: descriptor, A: A, B: B, C: C,
+      decodedB: decodedB, accumulators: accumulators,
+      concurrent: concurrent)
+  }
+
+  /// The bytes of scratch memory `multiply(descriptor:A:B:C:scratch:)`
+  /// needs for this problem.
+  public static func scratchLength(descriptor: GEMMDescriptor) -> Int {
+    let layout = ProblemLayout(descriptor: descriptor)
+    return max(layout.vectorCount, 1) * MemoryLayout<Vector>.stride
+      + layout.decodedBCount * 4
+  }
+
+  /// Executes a GEMM on the calling thread only, in scratch memory provided
+  /// by the caller. Nothing is allocated, so this is safe to call in a
+  /// child forked from a multithreaded process.
+  ///
+  /// - Parameter scratch: At least `scratchLength(descriptor:)` bytes,
+  ///   aligned to 32 bytes.
+  public static func multiply(
+    descriptor: GEMMDescriptor,
+    A: UnsafeRawPointer,
+    B: UnsafeRawPointer,
+    C: UnsafeMutableRawPointer,
+    scratch: UnsafeMutableRawPointer
+  ) {
+    let layout = ProblemLayout(descriptor: descriptor)
+    let accumulatorLength = max(layout.vectorCount, 1)
+      * MemoryLayout<Vector>.stride
+    let accumulators = scratch.bindMemory(
+      to: Vector.self, capacity: max(layout.vectorCount, 1))
+    let decodedB = (scratch + accumulatorLength).bindMemory(
+      to: Float.self, capacity: layout.decodedBCount)
+    multiplyBatch(
+      descriptor: descriptor, A: A, B: B, C: C,
+      decodedB: decodedB, accumulators: accumulators,
+      concurrent: false)
+  }
+
+  // The sizes of the buffers for one problem of the batch.
+  struct ProblemLayout {
+    var vectorCount: Int
+    var paddedN: Int
+    var rowsPerTask: Int
+    var taskCount: Int
+
+    // B is decoded into a dense FP32 matrix (K x N), padded to the vector
+    // width, so the inner loop is a unit-stride SIMD multiply-add.
+    var decodedBCount: Int
+
+    init(descriptor: GEMMDescriptor) {
+      guard let matrixDimensions = descriptor.matrixDimensions else {
+        fatalError("Descriptor was incomplete.")
+      }
+      let M = Int(matrixDimensions.M)
+      let N = Int(matrixDimensions.N)
+      let K = Int(matrixDimensions.K)
+      vectorCount = (N + Vector.scalarCount - 1) / Vector.scalarCount
+      paddedN = vectorCount * Vector.scalarCount
+
+      // Chunk the rows to amortize the dispatch overhead.
+      rowsPerTask = max(1, 4096 / max(paddedN, 1))
+      taskCount = (M + rowsPerTask - 1) / rowsPerTask
+      decodedBCount = max(K * paddedN, 1)
+    }
+  }
+
+  static func multiplyBatch(
+    descriptor: GEMMDescriptor,
+    A: UnsafeRawPointer,
+    B: UnsafeRawPointer,
+    C: UnsafeMutableRawPointer,
+    decodedB: UnsafeMutablePointer<Float>,
+    accumulators: UnsafeMutablePointer<Vector>,
+    concurrent: Bool
+  ) {
+    guard let memoryPrecisions = descriptor.memoryPrecisions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    var problemDesc = descriptor
+    problemDesc.batchDimension = 1
+    let batchStrides = descriptor.batchStrides
+
+    // Execute the problems one at a time, reusing the buffers.
+    for problemID in 0..<descriptor.batchDimension {
+      multiplyProblem(
+        descriptor: problemDesc,
+        A: A + problemID * batchStrides.A * memoryPrecisions.A.size,
+        B: B + problemID * batchStrides.B * memoryPrecisions.B.size,
+        C: C + problemID * batchStrides.C * memoryPrecisions.C.size,
+        decodedB: decodedB,
+        accumulators: accumulators,
+        concurrent: concurrent)
+    }
+  }
+
+  // With 'concurrent', 'accumulators' holds one row of vectors per task.
+  // Otherwise, it holds a single row.
+  static func multiplyProblem(
+    descriptor: GEMMDescriptor,
+    A: UnsafeRawPointer,
+    B: UnsafeRawPointer,
+    C: UnsafeMutableRawPointer,
+    decodedB: UnsafeMutablePointer<Float>,
+    accumulators: UnsafeMutablePointer<Vector>,
+    concurrent: Bool
+  ) {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions,
+          let transposeState = descriptor.transposeState else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let M = Int(matrixDimensions.M)
+    let N = Int(matrixDimensions.N)
+    let K = Int(matrixDimensions.K)
+    let leadingDimensions = descriptor.resolvedLeadingDimensions
+    let leadingA = Int(leadingDimensions.A)
+    let leadingB = Int(leadingDimensions.B)
+    let leadingC = Int(leadingDimensions.C)
+    guard M > 0, N > 0 else {
+      return
+    }
+
+    let layout = ProblemLayout(descriptor: descriptor)
+    let vectorCount = layout.vectorCount
+    let paddedN = layout.paddedN
+    let rowsPerTask = layout.rowsPerTask
+    decodedB.initialize(repeating: 0, count: layout.decodedBCount)
+    for k in 0..<K {
+      for n in 0..<N {
+        let address = transposeState.B
+        ? n * leadingB + k
+        : k * leadingB + n
+        decodedB[k * paddedN + n] = memoryPrecisions.B.load(B, address)
+      }
+    }
+
+    let rawB = UnsafeRawPointer(decodedB)
+    func executeTask(_ taskID: Int) {
+      let accumulator = concurrent
+      ? accumulators + taskID * vectorCount
+      : accumulators
+
+      let rowStart = taskID * rowsPerTask
+      let rowEnd = min(rowStart + rowsPerTask, M)
+      for m in rowStart..<rowEnd {
+        accumulator.initialize(repeating: .zero, count: vectorCount)
+        for k in 0..<K {
+          let address = transposeState.A
+          ? k * leadingA + m
+          : m * leadingA + k
+          let a = Vector(repeating: memoryPrecisions.A.load(A, address))
+          let rowB = rawB + k * paddedN * 4
+          for v in 0..<vectorCount {
+            let b = rowB.loadUnaligned(
+              fromByteOffset: v * Vector.scalarCount * 4, as: Vector.self)
+            accumulator[v] = accumulator[v].addingProduct(a, b)
+          }
+        }
+
+        let scalars = UnsafeMutableRawPointer(accumulator)
+          .assumingMemoryBound(to: Float.self)
+        for n in 0..<N {
+          let address = descriptor.transposeC
+          ? n * leadingC + m
+          : m * leadingC + n
+          var value = scalars[n]
+          if descriptor.loadPreviousC {
+            value += memoryPrecisions.C.load(C, address)
+          }
+          memoryPrecisions.C.store(value, C, address)
+        }
+      }
+    }
+
+    if concurrent {
+      DispatchQueue.concurrentPerform(
+        iterations: layout.taskCount, execute: executeTask)
+    } else {
+      for taskID in 0..<layout.taskCount {
+        executeTask(taskID)
+      }
+    }
+  }
+}
+
+extension CPUGEMMBackend {
+  /// Executes a chained GEMM synchronously. The intermediate is materialized
+  /// in FP32, like the registers of the GPU kernel.
+  public static func multiplyChained(
+    descriptor: GEMMChainedDescriptor,
+    A: UnsafeRawPointer,
+    B1: UnsafeRawPointer,
+    B2: UnsafeRawPointer,
+    W: UnsafeRawPointer?,
+    C: UnsafeMutableRawPointer
+  ) {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let (M, K, R, N) = matrixDimensions
+    func createDescriptor(
+      _ precisionA: GEMMOperandPrecision,
+      _ precisionB: GEMMOperandPrecision,
+      _ dimensions: (M: UInt32, N: UInt32, K: UInt32)
+    ) -> GEMMDescriptor {
+      var gemmDesc = GEMMDescriptor()
+      gemmDesc.matrixDimensions = dimensions
+      gemmDesc.memoryPrecisions = (precisionA, precisionB, .FP32)
+      gemmDesc.transposeState = (false, false)
+      return gemmDesc
+    }
+
+    // T = act(A * B1), scaled in the low-rank adapter mode.
+    var T = [Float](repeating: .zero, count: max(Int(M * R), 1))
+    T.withUnsafeMutableBytes {
+      multiply(
+        descriptor: createDescriptor(
+          memoryPrecisions.A, memoryPrecisions.B1, (M, R, K)),
+        A: A, B: B1, C: $0.baseAddress!)
+    }
+    let scale = descriptor.lowRankScale ?? 1
+    for i in T.indices {
+      T[i] = scale * descriptor.activation.apply(T[i])
+    }
+
+    // The accumulator starts from A * W in the low-rank adapter mode.
+    var accumulator = [Float](
+      repeating: .zero, count: max(Int(M * N), 1))
+    if descriptor.lowRankScale != nil {
+      guard let W else {
+        fatalError("The low-rank adapter mode requires W.")
+      }
+      accumulator.withUnsafeMutableBytes {
+        multiply(
+          descriptor: createDescriptor(
+            memoryPrecisions.A, memoryPrecisions.B1, (M, N, K)),
+          A: A, B: W, C: $0.baseAddress!)
+      }
+    }
+    T.withUnsafeBytes { T in
+      accumulator.withUnsafeMutableBytes {
+        var gemmDesc = createDescriptor(.FP32, memoryPrecisions.B2, (M, N, R))
+        gemmDesc.loadPreviousC = true
+        multiply(
+          descriptor: gemmDesc, A: T.baseAddress!, B: B2,
+          C: $0.baseAddress!)
+      }
+    }
+
+    for i in 0..<Int(M * N) {
+      var value = accumulator[i]
+      if descriptor.loadPreviousC {
+        value += memoryPrecisions.C.load(C, i)
+      }
+      memoryPrecisions.C.store(value, C, i)
+    }
+  }
+}
+
+extension CPUGEMMBackend {
+  /// Executes a complex GEMM synchronously, straight from the definition.
+  /// The algorithm in the descriptor only affects the GPU kernel.
+  public static func multiplyComplex(
+    descriptor: GEMMComplexDescriptor,
+    A: UnsafeRawPointer,
+    B: UnsafeRawPointer,
+    C: UnsafeMutableRawPointer
+  ) {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let M = Int(matrixDimensions.M)
+    let N = Int(matrixDimensions.N)
+    let K = Int(matrixDimensions.K)
+
+    // Returns the scalar indices of the real and imaginary parts.
+    func addresses(_ index: Int, plane: Int) -> (real: Int, imag: Int) {
+      switch descriptor.layout {
+      case .interleaved:
+        return (2 * index, 2 * index + 1)
+      case .planar:
+        return (index, plane + index)
+      }
+    }
+    func load(
+      _ pointer: UnsafeRawPointer,
+      _ precision: GEMMOperandPrecision,
+      _ index: Int,
+      plane: Int
+    ) -> (real: Float, imag: Float) {
+      let (real, imag) = addresses(index, plane: plane)
+      return (precision.load(pointer, real), precision.load(pointer, imag))
+    }
+
+    for m in 0..<M {
+      for n in 0..<N {
+        var real: Float = .zero
+        var imag: Float = .zero
+        for k in 0..<K {
+          let a = load(A, memoryPrecisions.A, m * K + k, plane: M * K)
+          let b = load(B, memoryPrecisions.B, k * N + n, plane: K * N)
+          real += a.real * b.real - a.imag * b.imag
+          imag += a.real * b.imag + a.imag * b.real
+        }
+        if descriptor.loadPreviousC {
+          let previous = load(
+            C, memoryPrecisions.C, m * N + n, plane: M * N)
+          real += previous.real
+          imag += previous.imag
+        }
+        let address = addresses(m * N + n, plane: M * N)
+        memoryPrecisions.C.store(real, C, address.real)
+        memoryPrecisions.C.store(imag, C, address.imag)
+      }
+    }
+  }
+}
+
+extension CPUGEMMBackend {
+  /// Executes a GEMM with a 2:4 sparse B synchronously, by expanding B into
+  /// a dense FP32 matrix.
+  public static func multiplySparse(
+    descriptor: GEMMSparseDescriptor,
+    A: UnsafeRawPointer,
+    B: UnsafeRawPointer,
+    metadata: UnsafeRawPointer,
+    C: UnsafeMutableRawPointer
+  ) {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let N = Int(matrixDimensions.N)
+    let K = Int(matrixDimensions.K)
+    let groupCount = GEMMSparseMatrix.groupCount(rows: K)
+    let metadataStride = GEMMSparseMatrix.metadataStride(columns: N)
+
+    let values = (0..<(2 * groupCount * N)).map {
+      memoryPrecisions.B.load(B, $0)
+    }
+    let metadataBytes = Array(UnsafeBufferPointer(
+      start: metadata.assumingMemoryBound(to: UInt8.self),
+      count: groupCount * metadataStride))
+    let sparseB = GEMMSparseMatrix(
+      rows: K, columns: N, values: values, metadata: metadataBytes)
+    var denseB = sparseB.expand()
+    // Keeps the base address valid when B is empty.
+    denseB.append(.zero)
+
+    var gemmDesc = GEMMDescriptor()
+    gemmDesc.loadPreviousC = descriptor.loadPreviousC
+    gemmDesc.matrixDimensions = matrixDimensions
+    gemmDesc.memoryPrecisions = (
+      memoryPrecisions.A, .FP32, memoryPrecisions.C)
+    gemmDesc.transposeState = (false, false)
+    denseB.withUnsafeMutableBytes {
+      multiply(
+        descriptor: gemmDesc, A: A, B: $0.baseAddress!, C: C)
+    }
+  }
+}
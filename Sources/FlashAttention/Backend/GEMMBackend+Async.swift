@@ -0,0 +1,37 @@
+//
+//  GEMMBackend+Async.swift
+//  FlashAttention
+//
+
+extension GEMMBackend {
+  /// Encodes one command buffer, commits it, and suspends the caller until
+  /// the commands finish.
+  ///
+  /// The calling thread is never blocked. The completion handler of the
+  /// command buffer resumes the task, so any number of these can be in
+  /// flight from a single thread. Use `AsyncExecutionQueue` to bound them.
+  ///
+  /// ```swift
+  /// await backend.run { commandBuffer in
+  ///   commandBuffer.encodeGEMM(descriptor: gemmDesc, A: A, B: B, C: C)
+  /// }
+  /// ```
+  public func run(_ encode: (GEMMCommandBuffer) -> Void) async {
+    let commandBuffer = makeCommandBuffer()
+    encode(commandBuffer)
+    await commandBuffer.commitAndWait()
+  }
+}
+
+extension GEMMCommandBuffer {
+  /// Commits the command buffer, and suspends the caller until the commands
+  /// finish. The asynchronous counterpart of `waitUntilCompleted()`.
+  public func commitAndWait() async {
+    await withCheckedContinuation { continuation in
+      addCompletedHandler {
+        continuation.resume()
+      }
+      commit()
+    }
+  }
+}
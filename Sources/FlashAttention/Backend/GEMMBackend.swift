@@ -0,0 +1,127 @@
+//
+//  GEMMBackend.swift
+//  FlashAttention
+//
+
+/// A minimal encoder abstraction for host-side GEMM drivers.
+///
+/// Drivers that schedule many GEMMs (streaming, split execution, sharding)
+/// only need a handful of operations: allocate memory visible to the host,
+/// encode a multiplication, and synchronize. Expressing them against this
+/// protocol lets the same scheduling logic run on the GPU, or on the CPU
+/// reference backend in environments without Metal.
+///
+/// The semantics follow Metal. Command buffers created by the same backend
+/// execute in the order they are committed. A command buffer cannot be
+/// modified after it is committed.
+public protocol GEMMBackend: AnyObject {
+  /// Allocates zero-initialized memory that both the host and the device can
+  /// access.
+  func makeBuffer(length: Int) -> GEMMBackendBuffer
+
+  func makeCommandBuffer() -> GEMMCommandBuffer
+}
+
+/// Memory shared between the host and a backend.
+public protocol GEMMBackendBuffer: AnyObject {
+  var contents: UnsafeMutableRawPointer { get }
+  var length: Int { get }
+}
+
+/// A buffer, plus a byte offset into it.
+public struct GEMMOperandBinding {
+  public var buffer: GEMMBackendBuffer
+  public var offset: Int
+
+  public init(_ buffer: GEMMBackendBuffer, offset: Int = 0) {
+    self.buffer = buffer
+    self.offset = offset
+  }
+
+  /// The address of the first element.
+  public var contents: UnsafeMutableRawPointer {
+    buffer.contents + offset
+  }
+}
+
+public protocol GEMMCommandBuffer: AnyObject {
+  /// Appends C = A * B (or C += A * B with `loadPreviousC`).
+  func encodeGEMM(
+    descriptor: GEMMDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    C: GEMMOperandBinding)
+
+  /// Appends C = act(A * B1) * B2, or the low-rank adapter form with the
+  /// base weight `W`. See `GEMMChainedDescriptor`.
+  func encodeChainedGEMM(
+    descriptor: GEMMChainedDescriptor,
+    A: GEMMOperandBinding,
+    B1: GEMMOperandBinding,
+    B2: GEMMOperandBinding,
+    W: GEMMOperandBinding?,
+    C: GEMMOperandBinding)
+
+  /// Appends a complex-valued C = A * B. See `GEMMComplexDescriptor`.
+  func encodeComplexGEMM(
+    descriptor: GEMMComplexDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    C: GEMMOperandBinding)
+
+  /// Appends C = A * B, with B compressed to 2:4 sparsity. `B` binds the
+  /// values of a `GEMMSparseMatrix`, and `metadata` binds its index bytes.
+  func encodeSparseGEMM(
+    descriptor: GEMMSparseDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    metadata: GEMMOperandBinding,
+    C: GEMMOperandBinding)
+
+  /// Registers a closure to run after the commands finish. Must be called
+  /// before `commit()`.
+  func addCompletedHandler(_ handler: @escaping () -> Void)
+
+  func commit()
+
+  func waitUntilCompleted()
+
+  var isCompleted: Bool { get }
+}
+
+extension GEMMDescriptor {
+  /// The leading dimensions after substituting the defaults for `nil`.
+  public var resolvedLeadingDimensions: (A: UInt32, B: UInt32, C: UInt32) {
+    guard let matrixDimensions = self.matrixDimensions,
+          let transposeState = self.transposeState else {
+      fatalError("Descriptor was incomplete.")
+    }
+    if let leadingDimensions {
+      return leadingDimensions
+    }
+    let A = transposeState.A ? matrixDimensions.M : matrixDimensions.K
+    let B = transposeState.B ? matrixDimensions.K : matrixDimensions.N
+    let C = transposeC ? matrixDimensions.M : matrixDimensions.N
+    return (A, B, C)
+  }
+
+  /// The number of elements between consecutive problems of a batch.
+  ///
+  /// The problems are packed back to back. Each one spans the trailing
+  /// dimension of the operand, times the leading dimension.
+  public var batchStrides: (A: Int, B: Int, C: Int) {
+    guard let matrixDimensions = self.matrixDimensions,
+          let transposeState = self.transposeState else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let (M, N, K) = (
+      Int(matrixDimensions.M),
+      Int(matrixDimensions.N),
+      Int(matrixDimensions.K))
+    let leadingDimensions = resolvedLeadingDimensions
+    let A = (transposeState.A ? K : M) * Int(leadingDimensions.A)
+    let B = (transposeState.B ? N : K) * Int(leadingDimensions.B)
+    let C = (transposeC ? N : M) * Int(leadingDimensions.C)
+    return (A, B, C)
+  }
+}
@@ -0,0 +1,152 @@
+//
+//  GEMMSubmissionQueue.swift
+//  FlashAttention
+//
+
+import Foundation
+
+/// A multiplication prepared by a producer thread: the descriptor, plus the
+/// operands it binds.
+public struct GEMMDispatchRecord {
+  public var descriptor: GEMMDescriptor
+  public var A: GEMMOperandBinding
+  public var B: GEMMOperandBinding
+  public var C: GEMMOperandBinding
+
+  /// Runs after the command buffer holding this dispatch finishes.
+  public var completion: (() -> Void)?
+
+  public init(
+    descriptor: GEMMDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    C: GEMMOperandBinding,
+    completion: (() -> Void)? = nil
+  ) {
+    self.descriptor = descriptor
+    self.A = A
+    self.B = B
+    self.C = C
+    self.completion = completion
+  }
+}
+
+/// Funnels GEMMs from many threads into one encoder thread.
+///
+/// Command buffers are not thread-safe. Instead of a command buffer per
+/// thread, or a lock around encoding, producers push prepared dispatches
+/// into an `MPSCRing`. A dedicated thread drains the ring, and coalesces
+/// everything it finds, up to `maximumBatchSize` dispatches, into a single
+/// command buffer. Under load, the cost of each commit is shared by many
+/// dispatches. With a single producer, each dispatch commits right away.
+///
+/// Dispatches from the same producer execute in the order they were
+/// submitted. Dispatches from different producers have no order.
+public final class GEMMSubmissionQueue {
+  public let backend: GEMMBackend
+  public let maximumBatchSize: Int
+
+  enum Entry {
+    case dispatch(GEMMDispatchRecord)
+    case finish
+  }
+  let ring: MPSCRing<Entry>
+
+  // Signaled once per entry. The encoder thread sleeps on it when the ring
+  // is empty.
+  let available = DispatchSemaphore(value: 0)
+  let finished = DispatchSemaphore(value: 0)
+
+  /// The dispatches encoded so far. Only valid after `finish()`.
+  public private(set) var dispatchCount: Int = 0
+
+  /// The command buffers committed so far. Only valid after `finish()`.
+  public private(set) var commandBufferCount: Int = 0
+
+  /// - Parameter capacity: The dispatches that can wait in the ring. Must be
+  ///   a power of two.
+  public init(
+    backend: GEMMBackend,
+    capacity: Int = 1024,
+    maximumBatchSize: Int = 64
+  ) {
+    guard maximumBatchSize > 0 else {
+      fatalError("Invalid batch size.")
+    }
+    self.backend = backend
+    self.maximumBatchSize = maximumBatchSize
+    self.ring = MPSCRing(capacity: capacity)
+
+    let thread = Thread { [self] in
+      encodeLoop()
+    }
+    thread.name = "com.flash-attention.gemm-encoder"
+    thread.qualityOfService = .userInteractive
+    thread.start()
+  }
+
+  /// Enqueues a dispatch. Safe to call from any thread, but not after
+  /// `finish()`.
+  public func submit(_ record: GEMMDispatchRecord) {
+    ring.push(.dispatch(record))
+    available.signal()
+  }
+
+  /// Stops the encoder thread, and waits for every submitted dispatch to
+  /// finish executing. The thread holds a reference to the queue, so this
+  /// must be called before the queue can be released.
+  public func finish() {
+    ring.push(.finish)
+    available.signal()
+    finished.wait()
+  }
+
+  func encodeLoop() {
+    var lastCommandBuffer: GEMMCommandBuffer?
+    var running = true
+    while running {
+      // Only sleep after finding the ring empty. A batch that stopped at
+      // the size limit may leave entries whose signals were consumed.
+      guard var entry = ring.pop() else {
+        available.wait()
+        continue
+      }
+
+      let commandBuffer = backend.makeCommandBuffer()
+      var batchSize = 0
+      while true {
+        switch entry {
+        case .dispatch(let record):
+          commandBuffer.encodeGEMM(
+            descriptor: record.descriptor,
+            A: record.A,
+            B: record.B,
+            C: record.C)
+          if let completion = record.completion {
+            commandBuffer.addCompletedHandler(completion)
+          }
+          batchSize += 1
+        case .finish:
+          running = false
+        }
+        guard running,
+              batchSize < maximumBatchSize,
+              let next = ring.pop() else {
+          break
+        }
+        entry = next
+      }
+
+      if batchSize > 0 {
+        commandBuffer.commit()
+        dispatchCount += batchSize
+        commandBufferCount += 1
+        lastCommandBuffer = commandBuffer
+      }
+    }
+
+    // Command buffers execute in commit order.
+    lastCommandBuffer?.waitUntilCompleted()
+    finished.signal()
+  }
+}
@@ -0,0 +1,333 @@
+//
+//  MetalGEMMBackend.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+/// Executes GEMMs with the generated Metal kernels.
+public final class MetalGEMMBackend: GEMMBackend {
+  public let commandQueue: MTLCommandQueue
+
+  public init(commandQueue: MTLCommandQueue = MTLContext.global.commandQueue) {
+    self.commandQueue = commandQueue
+  }
+
+  public func makeBuffer(length: Int) -> GEMMBackendBuffer {
+    let device = commandQueue.device
+    guard let buffer = device.makeBuffer(
+      length: max(length, 1), options: .storageModeShared) else {
+      fatalError("Could not allocate buffer.")
+    }
+    return MetalGEMMBuffer(buffer)
+  }
+
+  public func makeCommandBuffer() -> GEMMCommandBuffer {
+    guard let commandBuffer = commandQueue.makeCommandBuffer() else {
+      fatalError("Could not create command buffer.")
+    }
+    return MetalGEMMCommandBuffer(commandBuffer)
+  }
+}
+
+/// Adapts a shared `MTLBuffer` to the backend protocol.
+public final class MetalGEMMBuffer: GEMMBackendBuffer {
+  public let buffer: MTLBuffer
+
+  public init(_ buffer: MTLBuffer) {
+    guard buffer.storageMode == .shared else {
+      fatalError("Backend buffers must be accessible to the host.")
+    }
+    self.buffer = buffer
+  }
+
+  public var contents: UnsafeMutableRawPointer {
+    buffer.contents()
+  }
+
+  public var length: Int {
+    buffer.length
+  }
+}
+
+final class MetalGEMMCommandBuffer: GEMMCommandBuffer {
+  let commandBuffer: MTLCommandBuffer
+  var encoder: MTLComputeCommandEncoder?
+
+  init(_ commandBuffer: MTLCommandBuffer) {
+    self.commandBuffer = commandBuffer
+  }
+
+  func encodeGEMM(
+    descriptor: GEMMDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    C: GEMMOperandBinding
+  ) {
+    guard let matrixDimensions = descriptor.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard matrixDimensions.M > 0, matrixDimensions.N > 0 else {
+      return
+    }
+    if encoder == nil {
+      encoder = commandBuffer.makeComputeCommandEncoder()
+    }
+    guard let encoder else {
+      fatalError("Could not create encoder.")
+    }
+
+    func bind(_ binding: GEMMOperandBinding, index: Int) {
+      guard let buffer = binding.buffer as? MetalGEMMBuffer else {
+        fatalError("Buffer was not created by a Metal backend.")
+      }
+      encoder.setBuffer(buffer.buffer, offset: binding.offset, index: index)
+    }
+
+    // Small problems pack into simdgroups. Larger batches fall back to one
+    // dispatch of the main kernel per problem.
+    if GEMMBatchedKernel.isEligible(descriptor: descriptor) {
+      let (kernel, pipeline) = GEMMBatchedKernel.pipeline(
+        descriptor: descriptor)
+      encoder.setComputePipelineState(pipeline)
+      bind(A, index: 0)
+      bind(B, index: 1)
+      bind(C, index: 2)
+      var batchSize = UInt32(descriptor.batchDimension)
+      encoder.setBytes(&batchSize, length: 4, index: 3)
+
+      let problemsPerThreadgroup = kernel.problemsPerThreadgroup
+      let gridSize = MTLSize(
+        width: (descriptor.batchDimension + problemsPerThreadgroup - 1)
+        / problemsPerThreadgroup,
+        height: 1,
+        depth: 1)
+      let groupSize = MTLSize(
+        width: kernel.threadgroupSize,
+        height: 1,
+        depth: 1)
+      encoder.dispatchThreadgroups(
+        gridSize, threadsPerThreadgroup: groupSize)
+      return
+    } else if descriptor.batchDimension > 1 {
+      guard let memoryPrecisions = descriptor.memoryPrecisions else {
+        fatalError("Descriptor was incomplete.")
+      }
+      var problemDesc = descriptor
+      problemDesc.batchDimension = 1
+      let batchStrides = descriptor.batchStrides
+      for problemID in 0..<descriptor.batchDimension {
+        var problemA = A
+        var problemB = B
+        var problemC = C
+        problemA.offset += problemID * batchStrides.A * memoryPrecisions.A.size
+        problemB.offset += problemID * batchStrides.B * memoryPrecisions.B.size
+        problemC.offset += problemID * batchStrides.C * memoryPrecisions.C.size
+        encodeGEMM(
+          descriptor: problemDesc, A: problemA, B: problemB, C: problemC)
+      }
+      return
+    }
+
+    GEMMKernel.register(descriptor: descriptor)
+    let (kernel, pipeline) = GEMMKernel.pipelineCache[descriptor]!
+    encoder.setComputePipelineState(pipeline)
+    encoder.setThreadgroupMemoryLength(
+      Int(kernel.threadgroupMemoryAllocation), index: 0)
+
+    bind(A, index: 0)
+    bind(B, index: 1)
+    bind(C, index: 2)
+
+    func ceilDivide(_ target: UInt32, _ granularity: UInt16) -> Int {
+      (Int(target) + Int(granularity) - 1) / Int(granularity)
+    }
+    let gridSize = MTLSize(
+      width: ceilDivide(matrixDimensions.N, kernel.blockDimensions.N),
+      height: ceilDivide(matrixDimensions.M, kernel.blockDimensions.M),
+      depth: 1)
+    let groupSize = MTLSize(
+      width: Int(kernel.threadgroupSize),
+      height: 1,
+      depth: 1)
+    encoder.dispatchThreadgroups(
+      gridSize, threadsPerThreadgroup: groupSize)
+  }
+
+  func encodeChainedGEMM(
+    descriptor: GEMMChainedDescriptor,
+    A: GEMMOperandBinding,
+    B1: GEMMOperandBinding,
+    B2: GEMMOperandBinding,
+    W: GEMMOperandBinding?,
+    C: GEMMOperandBinding
+  ) {
+    guard let matrixDimensions = descriptor.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard matrixDimensions.M > 0, matrixDimensions.N > 0 else {
+      return
+    }
+    if encoder == nil {
+      encoder = commandBuffer.makeComputeCommandEncoder()
+    }
+    guard let encoder else {
+      fatalError("Could not create encoder.")
+    }
+
+    GEMMChainedKernel.register(descriptor: descriptor)
+    let (kernel, pipeline) = GEMMChainedKernel.pipelineCache[descriptor]!
+    encoder.setComputePipelineState(pipeline)
+
+    func bind(_ binding: GEMMOperandBinding, index: Int) {
+      guard let buffer = binding.buffer as? MetalGEMMBuffer else {
+        fatalError("Buffer was not created by a Metal backend.")
+      }
+      encoder.setBuffer(buffer.buffer, offset: binding.offset, index: index)
+    }
+    bind(A, index: 0)
+    bind(B1, index: 1)
+    bind(B2, index: 2)
+    bind(C, index: 3)
+    if var lowRankScale = descriptor.lowRankScale {
+      guard let W else {
+        fatalError("The low-rank adapter mode requires W.")
+      }
+      bind(W, index: 4)
+      encoder.setBytes(&lowRankScale, length: 4, index: 6)
+    }
+    let columns = kernel.columnsPerThreadgroup()
+    var columnsArgument = UInt32(columns)
+    encoder.setBytes(&columnsArgument, length: 4, index: 5)
+
+    let gridSize = MTLSize(
+      width: (Int(matrixDimensions.N) + columns - 1) / columns,
+      height: (Int(matrixDimensions.M) + kernel.threadgroupRows - 1)
+      / kernel.threadgroupRows,
+      depth: 1)
+    let groupSize = MTLSize(
+      width: kernel.threadgroupSize,
+      height: 1,
+      depth: 1)
+    encoder.dispatchThreadgroups(
+      gridSize, threadsPerThreadgroup: groupSize)
+  }
+
+  func encodeComplexGEMM(
+    descriptor: GEMMComplexDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    C: GEMMOperandBinding
+  ) {
+    guard let matrixDimensions = descriptor.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard matrixDimensions.M > 0, matrixDimensions.N > 0 else {
+      return
+    }
+    if encoder == nil {
+      encoder = commandBuffer.makeComputeCommandEncoder()
+    }
+    guard let encoder else {
+      fatalError("Could not create encoder.")
+    }
+
+    GEMMComplexKernel.register(descriptor: descriptor)
+    let (kernel, pipeline) = GEMMComplexKernel.pipelineCache[descriptor]!
+    encoder.setComputePipelineState(pipeline)
+
+    func bind(_ binding: GEMMOperandBinding, index: Int) {
+      guard let buffer = binding.buffer as? MetalGEMMBuffer else {
+        fatalError("Buffer was not created by a Metal backend.")
+      }
+      encoder.setBuffer(buffer.buffer, offset: binding.offset, index: index)
+    }
+    bind(A, index: 0)
+    bind(B, index: 1)
+    bind(C, index: 2)
+
+    let gridSize = MTLSize(
+      width: (Int(matrixDimensions.N) + kernel.blockColumns - 1)
+      / kernel.blockColumns,
+      height: (Int(matrixDimensions.M) + kernel.threadgroupRows - 1)
+      / kernel.threadgroupRows,
+      depth: 1)
+    let groupSize = MTLSize(
+      width: kernel.threadgroupSize,
+      height: 1,
+      depth: 1)
+    encoder.dispatchThreadgroups(
+      gridSize, threadsPerThreadgroup: groupSize)
+  }
+
+  func encodeSparseGEMM(
+    descriptor: GEMMSparseDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    metadata: GEMMOperandBinding,
+    C: GEMMOperandBinding
+  ) {
+    guard let matrixDimensions = descriptor.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard matrixDimensions.M > 0, matrixDimensions.N > 0 else {
+      return
+    }
+    if encoder == nil {
+      encoder = commandBuffer.makeComputeCommandEncoder()
+    }
+    guard let encoder else {
+      fatalError("Could not create encoder.")
+    }
+
+    GEMMSparseKernel.register(descriptor: descriptor)
+    let (kernel, pipeline) = GEMMSparseKernel.pipelineCache[descriptor]!
+    encoder.setComputePipelineState(pipeline)
+
+    func bind(_ binding: GEMMOperandBinding, index: Int) {
+      guard let buffer = binding.buffer as? MetalGEMMBuffer else {
+        fatalError("Buffer was not created by a Metal backend.")
+      }
+      encoder.setBuffer(buffer.buffer, offset: binding.offset, index: index)
+    }
+    bind(A, index: 0)
+    bind(B, index: 1)
+    bind(metadata, index: 2)
+    bind(C, index: 3)
+
+    let gridSize = MTLSize(
+      width: (Int(matrixDimensions.N) + kernel.blockColumns - 1)
+      / kernel.blockColumns,
+      height: (Int(matrixDimensions.M) + kernel.threadgroupRows - 1)
+      / kernel.threadgroupRows,
+      depth: 1)
+    let groupSize = MTLSize(
+      width: kernel.threadgroupSize,
+      height: 1,
+      depth: 1)
+    encoder.dispatchThreadgroups(
+      gridSize, threadsPerThreadgroup: groupSize)
+  }
+
+  func addCompletedHandler(_ handler: @escaping () -> Void) {
+    commandBuffer.addCompletedHandler { _ in
+      handler()
+    }
+  }
+
+  func commit() {
+    encoder?.endEncoding()
+    encoder = nil
+    commandBuffer.commit()
+  }
+
+  func waitUntilCompleted() {
+    commandBuffer.waitUntilCompleted()
+  }
+
+  var isCompleted: Bool {
+    commandBuffer.status == .completed || commandBuffer.status == .error
+  }
+}
+#endif
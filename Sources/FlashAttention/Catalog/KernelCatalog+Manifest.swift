@@ -0,0 +1,179 @@
+//
+//  KernelCatalog+Manifest.swift
+//  FlashAttention
+//
+
+// The JSON schema of the inputs and the output of the catalog. Every field
+// with a default in the descriptors is optional.
+
+extension KernelCatalog {
+  /// A device the catalog targets.
+  public struct Profile: Codable {
+    public var name: String
+
+    /// The newest Apple GPU family, for example 9 for `.apple9`.
+    public var family: Int
+
+    public var coreCount: Int
+
+    public init(name: String, family: Int, coreCount: Int) {
+      self.name = name
+      self.family = family
+      self.coreCount = coreCount
+    }
+
+    public var deviceProfile: DeviceProfile {
+      guard let family = DeviceProfile.Family(rawValue: family) else {
+        fatalError("Unrecognized GPU family: \(family)")
+      }
+      return DeviceProfile(name: name, family: family, coreCount: coreCount)
+    }
+  }
+
+  public struct GEMMProblem: Codable {
+    public var M: UInt32
+    public var N: UInt32
+    public var K: UInt32
+
+    /// The names of the precisions of A, B, and C, for example "FP16".
+    public var precisions: [String]
+    public var transposeState: [Bool]?
+    public var batchDimension: Int?
+    public var loadPreviousC: Bool?
+
+    public init(
+      M: UInt32, N: UInt32, K: UInt32,
+      precisions: [String],
+      transposeState: [Bool]? = nil
+    ) {
+      self.M = M
+      self.N = N
+      self.K = K
+      self.precisions = precisions
+      self.transposeState = transposeState
+    }
+
+    public var descriptor: GEMMDescriptor {
+      guard precisions.count == 3,
+            (transposeState?.count ?? 2) == 2 else {
+        fatalError("GEMM problem had the wrong number of operands.")
+      }
+      let transposeState = self.transposeState ?? [false, false]
+      var gemmDesc = GEMMDescriptor()
+      gemmDesc.batchDimension = batchDimension ?? 1
+      gemmDesc.loadPreviousC = loadPreviousC ?? false
+      gemmDesc.matrixDimensions = (M, N, K)
+      gemmDesc.memoryPrecisions = (
+        parsePrecision(precisions[0]),
+        parsePrecision(precisions[1]),
+        parsePrecision(precisions[2]))
+      gemmDesc.transposeState = (transposeState[0], transposeState[1])
+      return gemmDesc
+    }
+  }
+
+  public struct AttentionProblem: Codable {
+    public var row: UInt32
+    public var column: UInt32
+    public var head: UInt16
+    public var lowPrecisionInputs: Bool?
+    public var lowPrecisionIntermediates: Bool?
+    public var queryHeadsPerKeyValueHead: UInt32?
+    public var multiQueryBlockPacking: Bool?
+    public var dynamicShape: Bool?
+    public var persistent: Bool?
+
+    /// Any of "forward", "backwardQuery", and "backwardKeyValue". The
+    /// default is the forward kernel only.
+    public var kernels: [String]?
+
+    public init(row: UInt32, column: UInt32, head: UInt16) {
+      self.row = row
+      self.column = column
+      self.head = head
+    }
+
+    public var descriptor: AttentionDescriptor {
+      var attentionDesc = AttentionDescriptor()
+      attentionDesc.lowPrecisionInputs = lowPrecisionInputs ?? false
+      attentionDesc.lowPrecisionIntermediates =
+        lowPrecisionIntermediates ?? false
+      attentionDesc.matrixDimensions = (row, column, head)
+      attentionDesc.transposeState = (false, false, false, false)
+      attentionDesc.queryHeadsPerKeyValueHead =
+        queryHeadsPerKeyValueHead ?? 1
+      attentionDesc.multiQueryBlockPacking = multiQueryBlockPacking ?? false
+      attentionDesc.dynamicShape = dynamicShape ?? false
+      return attentionDesc
+    }
+
+    public var kernelTypes: [AttentionKernelType] {
+      (kernels ?? ["forward"]).map { name in
+        switch name {
+        case "forward": return .forward
+        case "backwardQuery": return .backwardQuery
+        case "backwardKeyValue": return .backwardKeyValue
+        default: fatalError("Unrecognized attention kernel: \(name)")
+        }
+      }
+    }
+  }
+
+  /// The problems to generate kernels for, on every profile.
+  public struct Shapes: Codable {
+    public var gemm: [GEMMProblem]?
+    public var attention: [AttentionProblem]?
+
+    public init(
+      gemm: [GEMMProblem]? = nil, attention: [AttentionProblem]? = nil
+    ) {
+      self.gemm = gemm
+      self.attention = attention
+    }
+  }
+
+  /// A generated source file.
+  public struct KernelFile: Codable {
+    public var name: String
+    public var file: String
+    public var function: String
+  }
+
+  public struct FunctionConstant: Codable {
+    public var index: Int
+
+    /// "uint" or "bool". Booleans are encoded as 0 or 1.
+    public var type: String
+    public var value: UInt32
+  }
+
+  /// The kernels one problem needs on one device.
+  public struct Entry: Codable {
+    public var device: String
+
+    /// "gemm", or "attention." followed by the kernel type.
+    public var operation: String
+    public var gemm: GEMMProblem?
+    public var attention: AttentionProblem?
+
+    /// The names of the kernel files. With more than one, the runtime
+    /// compiles each and keeps the one with the highest occupancy.
+    public var kernels: [String]
+    public var functionConstants: [FunctionConstant]
+    public var maxTotalThreadsPerThreadgroup: Int?
+  }
+
+  public struct Manifest: Codable {
+    public var kernels: [KernelFile]
+    public var entries: [Entry]
+  }
+}
+
+private func parsePrecision(_ name: String) -> GEMMOperandPrecision {
+  for precision in [GEMMOperandPrecision.FP32, .FP16, .BF16] {
+    if "\(precision)" == name {
+      return precision
+    }
+  }
+  fatalError("Unrecognized precision: \(name)")
+}
@@ -0,0 +1,138 @@
+//
+//  KernelCatalog.swift
+//  FlashAttention
+//
+
+import Foundation
+
+/// Generates the sources of the kernels a set of problems needs, ahead of
+/// time, for devices other than this one.
+///
+/// Every problem runs through the same heuristics as at runtime, with
+/// `DeviceProfile.current` substituted by the target. GEMM kernels are
+/// deduplicated by `GEMMKernelDescriptor` (which hashes through
+/// `GEMMKernelKey`), and attention kernels by their source. The manifest
+/// maps each (device, problem) pair to its kernels and function constants,
+/// so a deploy pipeline can precompile the libraries.
+public struct KernelCatalog {
+  public private(set) var kernelFiles: [KernelFile] = []
+  public private(set) var sources: [String] = []
+  public private(set) var entries: [Entry] = []
+
+  var gemmKernelNames: [GEMMKernelDescriptor: String] = [:]
+  var attentionKernelNames: [String: String] = [:]
+
+  public init() {
+
+  }
+
+  public mutating func add(profile: Profile, gemm problem: GEMMProblem) {
+    let gemmDesc = problem.descriptor
+    let kernelDescriptors = DeviceProfile.withProfile(
+      profile.deviceProfile
+    ) {
+      GEMMKernel.candidateDescriptors(descriptor: gemmDesc)
+    }
+
+    var kernelNames: [String] = []
+    for kernelDescriptor in kernelDescriptors {
+      if let name = gemmKernelNames[kernelDescriptor] {
+        kernelNames.append(name)
+        continue
+      }
+      let kernel = GEMMKernel(descriptor: kernelDescriptor)
+      let name = "gemm-\(gemmKernelNames.count)"
+      append(name: name, function: "gemm", source: kernel.createSource())
+      gemmKernelNames[kernelDescriptor] = name
+      kernelNames.append(name)
+    }
+
+    let functionConstants = gemmDesc.functionConstantValues.map {
+      FunctionConstant(
+        index: $0.index,
+        type: $0.isBoolean ? "bool" : "uint",
+        value: $0.value)
+    }
+    entries.append(Entry(
+      device: profile.name,
+      operation: "gemm",
+      gemm: problem,
+      kernels: kernelNames,
+      functionConstants: functionConstants))
+  }
+
+  public mutating func add(
+    profile: Profile, attention problem: AttentionProblem
+  ) {
+    let attentionDesc = problem.descriptor
+    for type in problem.kernelTypes {
+      var kernelDesc = DeviceProfile.withProfile(profile.deviceProfile) {
+        attentionDesc.kernelDescriptor(type: type)
+      }
+      kernelDesc.persistent = problem.persistent ?? false
+      let source = AttentionKernel(descriptor: kernelDesc).createSource()
+
+      let name: String
+      if let existingName = attentionKernelNames[source] {
+        name = existingName
+      } else {
+        name = "attention-\(attentionKernelNames.count)"
+        append(name: name, function: "attention", source: source)
+        attentionKernelNames[source] = name
+      }
+
+      let functionConstants = attentionDesc.functionConstantValues.map {
+        FunctionConstant(index: $0.index, type: "uint", value: $0.value)
+      }
+      entries.append(Entry(
+        device: profile.name,
+        operation: "attention.\(type)",
+        attention: problem,
+        kernels: [name],
+        functionConstants: functionConstants,
+        // Matches the occupancy forced by 'MetalAttentionBackend'.
+        maxTotalThreadsPerThreadgroup: 1024))
+    }
+  }
+
+  /// Adds every problem, for every profile.
+  public mutating func add(profiles: [Profile], shapes: Shapes) {
+    for profile in profiles {
+      for problem in shapes.gemm ?? [] {
+        add(profile: profile, gemm: problem)
+      }
+      for problem in shapes.attention ?? [] {
+        add(profile: profile, attention: problem)
+      }
+    }
+  }
+
+  private mutating func append(
+    name: String, function: String, source: String
+  ) {
+    kernelFiles.append(KernelFile(
+      name: name, file: "kernels/\(name).metal", function: function))
+    sources.append(source)
+  }
+
+  public var manifest: Manifest {
+    Manifest(kernels: kernelFiles, entries: entries)
+  }
+
+  /// Writes `manifest.json`, plus one `.metal` file per kernel under
+  /// `kernels`.
+  public func write(to directory: URL) throws {
+    let kernelDirectory = directory.appendingPathComponent("kernels")
+    try FileManager.default.createDirectory(
+      at: kernelDirectory, withIntermediateDirectories: true)
+    for (kernelFile, source) in zip(kernelFiles, sources) {
+      let url = directory.appendingPathComponent(kernelFile.file)
+      try source.write(to: url, atomically: true, encoding: .utf8)
+    }
+
+    let encoder = JSONEncoder()
+    encoder.outputFormatting = [.prettyPrinted, .sortedKeys]
+    let data = try encoder.encode(manifest)
+    try data.write(to: directory.appendingPathComponent("manifest.json"))
+  }
+}
@@ -0,0 +1,113 @@
+//
+//  AccuracyPolicy.swift
+//  FlashAttention
+//
+
+/// How much rounding error an operation may trade for speed.
+///
+/// The memory precisions fix the formats of the operands in RAM. The policy
+/// selects the formats in registers: most importantly, whether a dot product
+/// may accumulate in FP16. FP16xFP16 into an FP16 accumulator is the only
+/// combination that reaches peak ALU throughput, on both M1 and M3. It is
+/// also the only combination whose error grows quickly with the length of
+/// the reduction.
+///
+/// The policy is set per operation (per descriptor), never globally. A model
+/// can run its attention score GEMMs with `.fastest`, while keeping the
+/// long reductions in its MLP at `.balanced`.
+public enum AccuracyPolicy: Hashable {
+  /// Use the fastest register precisions available. This matches the
+  /// behavior before the policy existed.
+  case fastest
+
+  /// Always accumulate in FP32, and never truncate intermediates to BF16 in
+  /// registers. Low-precision multiplicands still run at full speed.
+  case balanced
+
+  /// Use the fastest register precisions whose modeled error stays below
+  /// `maximum`, for a dot product of `reductionLength` terms.
+  ///
+  /// The bound is relative to Σ_k |a_k * b_k|. See
+  /// `estimatedError(accumulator:output:reductionLength:)`.
+  case errorBound(_ maximum: Float, reductionLength: Int)
+}
+
+extension GEMMOperandPrecision {
+  /// The unit roundoff (half of machine epsilon), for round-to-nearest.
+  public var unitRoundoff: Float {
+    switch self {
+    case .FP32:
+      return 0x1p-24
+    case .FP16:
+      return 0x1p-11
+    case .BF16:
+      return 0x1p-8
+    }
+  }
+}
+
+extension AccuracyPolicy {
+  /// The error model used to evaluate `.errorBound`.
+  ///
+  /// Bounds the error of one element of C, relative to Σ_k |a_k * b_k|,
+  /// where a and b are already in their memory precisions. Two sources
+  /// contribute:
+  /// - Accumulation: each of the K fused multiply-adds rounds once to the
+  ///   accumulator. The worst case is γ_K = K * u / (1 - K * u). Random signs
+  ///   typically do much better (like sqrt(K) * u), but same-sign data makes
+  ///   FP16 stagnate once the partial sum outgrows the products, and the
+  ///   error then grows linearly in K. A bound must hold for both.
+  /// - Output: a single rounding when C is written to memory.
+  ///
+  /// The estimate saturates at 1 (no correct digits). The CPU test suite
+  /// simulates the accumulation with explicit rounding, and confirms the
+  /// observed error stays under this estimate.
+  public static func estimatedError(
+    accumulator: GEMMOperandPrecision,
+    output: GEMMOperandPrecision,
+    reductionLength: Int
+  ) -> Float {
+    let length = Float(max(reductionLength, 1))
+    let accumulation = length * accumulator.unitRoundoff
+    var error: Float = 1
+    if accumulation < 0.5 {
+      error = accumulation / (1 - accumulation)
+    }
+    if output != .FP32 {
+      error += output.unitRoundoff
+    }
+    return min(error, 1)
+  }
+
+  /// Whether a faster, less accurate choice is allowed, given a function
+  /// that returns its modeled error for a reduction length.
+  func permits(_ estimate: (Int) -> Float) -> Bool {
+    switch self {
+    case .fastest:
+      return true
+    case .balanced:
+      return false
+    case .errorBound(let maximum, let reductionLength):
+      return estimate(reductionLength) <= maximum
+    }
+  }
+
+  /// Whether the dot product may accumulate in FP16 instead of FP32.
+  public func permitsLowPrecisionAccumulator(
+    output: GEMMOperandPrecision
+  ) -> Bool {
+    permits { reductionLength in
+      Self.estimatedError(
+        accumulator: .FP16, output: output, reductionLength: reductionLength)
+    }
+  }
+
+  /// Whether an FP32 intermediate may be truncated to BF16 in registers.
+  /// Truncation discards 16 mantissa bits: one rounding of BF16 magnitude,
+  /// which does not depend on the reduction length.
+  public var permitsBF16Truncation: Bool {
+    permits { _ in
+      GEMMOperandPrecision.BF16.unitRoundoff * 2
+    }
+  }
+}
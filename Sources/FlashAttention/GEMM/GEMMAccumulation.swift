@@ -0,0 +1,67 @@
+//
+//  GEMMAccumulation.swift
+//  FlashAttention
+//
+
+/// How the kernel sums the dot products along K.
+///
+/// FP16xFP16->FP16 is the only combination that reaches peak ALU throughput.
+/// With a single FP16 accumulator, the error grows with K: once the partial
+/// sum outgrows the products, every addition loses bits. The blocked modes
+/// keep the fast instruction for the inner loop, but restart the FP16
+/// accumulator at every K_group block. The block sum is folded into an FP32
+/// accumulator, so the FP16 error only grows over K_group terms.
+///
+/// The blocked modes require FP16 memory precisions for A, B, and C. They
+/// cost extra registers (one or two FP32 accumulators per FP16 one), which
+/// may lower occupancy at large block sizes.
+public enum GEMMAccumulation: UInt8 {
+  /// A single accumulator in the register precision of C.
+  case direct = 0
+
+  /// FP16 accumulators per K_group block, added into FP32.
+  case blocked = 1
+
+  /// FP16 accumulators per K_group block, added into FP32 with Kahan
+  /// compensation. The FP32 error no longer grows with the block count.
+  case compensated = 2
+}
+
+extension AccuracyPolicy {
+  /// The error model for blocked accumulation, in the same form as
+  /// `estimatedError(accumulator:output:reductionLength:)`.
+  ///
+  /// The FP16 accumulator only ever sums `blockLength` terms. Converting the
+  /// block sum to FP32 is exact. The outer sum then adds the rounding of
+  /// ceil(K / blockLength) FP32 additions, or about two FP32 roundings when
+  /// compensated.
+  public static func estimatedError(
+    accumulation: GEMMAccumulation,
+    blockLength: Int,
+    output: GEMMOperandPrecision,
+    reductionLength: Int
+  ) -> Float {
+    switch accumulation {
+    case .direct:
+      return estimatedError(
+        accumulator: .FP16, output: output, reductionLength: reductionLength)
+    case .blocked, .compensated:
+      let length = max(reductionLength, 1)
+      let block = max(min(blockLength, length), 1)
+      var error = estimatedError(
+        accumulator: .FP16, output: .FP32, reductionLength: block)
+
+      let blockCount = (length + block - 1) / block
+      if accumulation == .blocked {
+        error += estimatedError(
+          accumulator: .FP32, output: .FP32, reductionLength: blockCount)
+      } else {
+        error += 2 * GEMMOperandPrecision.FP32.unitRoundoff
+      }
+      if output != .FP32 {
+        error += output.unitRoundoff
+      }
+      return min(error, 1)
+    }
+  }
+}
@@ -0,0 +1,55 @@
+//
+//  GEMMActivation.swift
+//  FlashAttention
+//
+
+import func Foundation.exp
+import func Foundation.tanh
+
+/// An elementwise function applied between two chained GEMMs.
+public enum GEMMActivation: UInt8 {
+  case identity = 0
+  case relu = 1
+
+  /// The tanh approximation of GELU.
+  case gelu = 2
+
+  /// x * sigmoid(x), also known as swish.
+  case silu = 3
+}
+
+extension GEMMActivation {
+  /// The reference implementation, for the CPU backend.
+  public func apply(_ x: Float) -> Float {
+    switch self {
+    case .identity:
+      return x
+    case .relu:
+      return max(x, 0)
+    case .gelu:
+      let inner = 0.7978845608 * (x + 0.044715 * x * x * x)
+      return 0.5 * x * (1 + tanh(inner))
+    case .silu:
+      return x / (1 + exp(-x))
+    }
+  }
+
+  /// Creates a Metal expression that applies the function to a 'float2'.
+  ///
+  /// Every case maps zero to zero. Padding with zeros therefore stays zero
+  /// after the activation.
+  func createSource(_ value: String) -> String {
+    switch self {
+    case .identity:
+      return value
+    case .relu:
+      return "max(\(value), float2(0))"
+    case .gelu:
+      let inner = "0.7978845608 * (\(value) + 0.044715 * "
+      + "\(value) * \(value) * \(value))"
+      return "0.5 * \(value) * (1 + precise::tanh(\(inner)))"
+    case .silu:
+      return "\(value) / (1 + exp(-\(value)))"
+    }
+  }
+}
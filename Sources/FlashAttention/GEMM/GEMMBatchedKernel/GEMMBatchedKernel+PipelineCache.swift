@@ -0,0 +1,59 @@
+//
+//  GEMMBatchedKernel+PipelineCache.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+extension GEMMBatchedKernel {
+  public typealias PipelineValue = (
+    kernel: GEMMBatchedKernel, pipeline: MTLComputePipelineState)
+
+  /// Keyed by the descriptor of a single problem. The batch size is a
+  /// runtime argument, so it does not force a recompilation.
+  public static var pipelineCache: [
+    GEMMDescriptor: PipelineValue] = [:]
+
+  static func problemDescriptor(
+    _ descriptor: GEMMDescriptor
+  ) -> GEMMDescriptor {
+    var output = descriptor
+    output.batchDimension = 1
+    output.leadingDimensions = descriptor.resolvedLeadingDimensions
+    return output
+  }
+}
+
+extension GEMMBatchedKernel {
+  // Register this problem configuration in the cache.
+  public static func register(descriptor: GEMMDescriptor) {
+    let key = problemDescriptor(descriptor)
+    guard pipelineCache[key] == nil else {
+      return
+    }
+
+    let kernel = GEMMBatchedKernel(descriptor: descriptor)
+    let source = kernel.createSource()
+    let device = MTLContext.global.device
+    let library: MTLLibrary
+    do {
+      library = try device.makeLibrary(source: source, options: nil)
+    } catch {
+      print("Metal compile error:\n\(error)\n")
+      fatalError("Metal compile failed")
+    }
+    let function = library.makeFunction(name: "gemm_batched")!
+    let pipeline = try! device.makeComputePipelineState(function: function)
+    pipelineCache[key] = (kernel, pipeline)
+  }
+
+  /// Retrieves the kernel and pipeline for a batched descriptor.
+  public static func pipeline(
+    descriptor: GEMMDescriptor
+  ) -> PipelineValue {
+    register(descriptor: descriptor)
+    return pipelineCache[problemDescriptor(descriptor)]!
+  }
+}
+#endif
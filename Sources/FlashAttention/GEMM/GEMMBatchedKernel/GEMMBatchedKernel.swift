@@ -0,0 +1,353 @@
+//
+//  GEMMBatchedKernel.swift
+//  FlashAttention
+//
+
+/// A kernel for batches of small multiplications.
+///
+/// The main GEMM kernel dedicates a threadgroup to a 32x32 or larger block
+/// of C. For an 8x8 problem, most of that threadgroup idles. This kernel
+/// instead assigns whole problems to simdgroups. A, B, and C are held
+/// entirely in registers, so there is no threadgroup memory and no barrier.
+/// For problems that fit in one 8x8 fragment, each simdgroup processes
+/// several problems in sequence.
+///
+/// The problems must be packed back to back; see
+/// `GEMMDescriptor.batchStrides`.
+public struct GEMMBatchedKernel {
+  /// The largest M, N, or K this kernel accepts.
+  public static let maximumDimension: UInt32 = 32
+
+  /// Whether the host dispatcher should choose this kernel over the main
+  /// GEMM kernel. Empty problems are never eligible.
+  public static func isEligible(descriptor: GEMMDescriptor) -> Bool {
+    guard descriptor.batchDimension > 1,
+          let matrixDimensions = descriptor.matrixDimensions else {
+      return false
+    }
+    guard matrixDimensions.M > 0,
+          matrixDimensions.N > 0,
+          matrixDimensions.K > 0 else {
+      return false
+    }
+    return matrixDimensions.M <= maximumDimension &&
+    matrixDimensions.N <= maximumDimension &&
+    matrixDimensions.K <= maximumDimension
+  }
+
+  // Attributes of each problem.
+  var matrixDimensions: (M: UInt32, N: UInt32, K: UInt32)
+  var leadingDimensions: (A: UInt32, B: UInt32, C: UInt32)
+  var batchStrides: (A: Int, B: Int, C: Int)
+  var loadPreviousC: Bool
+  var memoryPrecisions: (
+    A: GEMMOperandPrecision, B: GEMMOperandPrecision, C: GEMMOperandPrecision)
+  var registerPrecisions: (
+    A: GEMMOperandPrecision, B: GEMMOperandPrecision, C: GEMMOperandPrecision)
+  var transposeState: (A: Bool, B: Bool)
+  var transposeC: Bool
+
+  // The dimensions rounded up to the size of a SIMD matrix.
+  var paddedDimensions: (M: UInt16, N: UInt16, K: UInt16)
+
+  /// The number of problems each simdgroup processes.
+  public var problemsPerSimdgroup: Int
+
+  /// The number of simdgroups in a threadgroup.
+  public var simdgroupsPerThreadgroup: Int = 4
+
+  public init(descriptor: GEMMDescriptor) {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions,
+          let transposeState = descriptor.transposeState else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard matrixDimensions.M <= Self.maximumDimension,
+          matrixDimensions.N <= Self.maximumDimension,
+          matrixDimensions.K <= Self.maximumDimension else {
+      fatalError("Matrix dimensions were too large.")
+    }
+    self.matrixDimensions = matrixDimensions
+    self.leadingDimensions = descriptor.resolvedLeadingDimensions
+    self.batchStrides = descriptor.batchStrides
+    self.loadPreviousC = descriptor.loadPreviousC
+    self.memoryPrecisions = memoryPrecisions
+    self.transposeState = transposeState
+    self.transposeC = descriptor.transposeC
+
+    // Reuse the register precisions of the main kernel, which account for
+    // the device and the accuracy policy. With at most 32 terms per dot
+    // product, blocked accumulation gains nothing over FP32.
+    let kernelDescriptor = GEMMKernelDescriptor(descriptor: descriptor)
+    guard var registerPrecisions = kernelDescriptor.registerPrecisions else {
+      fatalError("Register precisions were not set.")
+    }
+    if kernelDescriptor.accumulation != .direct {
+      registerPrecisions.C = .FP32
+    }
+    self.registerPrecisions = registerPrecisions
+
+    func pad(_ dimension: UInt32) -> UInt16 {
+      UInt16((dimension + 7) / 8 * 8)
+    }
+    paddedDimensions = (
+      pad(matrixDimensions.M),
+      pad(matrixDimensions.N),
+      pad(matrixDimensions.K))
+
+    if paddedDimensions == (8, 8, 8) {
+      problemsPerSimdgroup = 4
+    } else {
+      problemsPerSimdgroup = 1
+    }
+  }
+
+  /// The number of problems each threadgroup processes.
+  public var problemsPerThreadgroup: Int {
+    problemsPerSimdgroup * simdgroupsPerThreadgroup
+  }
+
+  public var threadgroupSize: Int {
+    32 * simdgroupsPerThreadgroup
+  }
+}
+
+extension GEMMBatchedKernel {
+  func memoryName(_ operand: String) -> String {
+    switch operand {
+    case "A": return memoryPrecisions.A.name
+    case "B": return memoryPrecisions.B.name
+    case "C": return memoryPrecisions.C.name
+    default:
+      fatalError("Unrecognized operand.")
+    }
+  }
+
+  func registerName(_ operand: String) -> String {
+    switch operand {
+    case "A": return registerPrecisions.A.name
+    case "B": return registerPrecisions.B.name
+    case "C": return registerPrecisions.C.name
+    default:
+      fatalError("Unrecognized operand.")
+    }
+  }
+
+  // The padded, untransposed dimensions of an operand.
+  func shape(_ operand: String) -> (
+    paddedRows: UInt16, paddedColumns: UInt16
+  ) {
+    switch operand {
+    case "A": return (paddedDimensions.M, paddedDimensions.K)
+    case "B": return (paddedDimensions.K, paddedDimensions.N)
+    case "C": return (paddedDimensions.M, paddedDimensions.N)
+    default:
+      fatalError("Unrecognized operand.")
+    }
+  }
+
+  // Whether the operand fills its SIMD matrices exactly. Otherwise, the
+  // memory accesses must be predicated.
+  func aligned(_ operand: String) -> Bool {
+    func isAligned(_ dimension: UInt32) -> Bool {
+      dimension % 8 == 0
+    }
+    let (M, N, K) = matrixDimensions
+    switch operand {
+    case "A": return isAligned(M) && isAligned(K)
+    case "B": return isAligned(K) && isAligned(N)
+    case "C": return isAligned(M) && isAligned(N)
+    default:
+      fatalError("Unrecognized operand.")
+    }
+  }
+
+  // Creates the call that loads or stores one 8x8 fragment.
+  func createAccess(
+    _ operand: String, store: Bool, origin: String
+  ) -> String {
+    let pointer = "\(operand)_src"
+    let arguments = "\(pointer), \(operand)_leading_dimension, \(origin)"
+    if aligned(operand) {
+      var function = store ? "store" : "load"
+      if memoryName(operand) == GEMMOperandPrecision.BF16.name,
+         registerName(operand) == GEMMOperandPrecision.FP32.name {
+        function += "_bfloat"
+      }
+      return "\(function)(\(arguments), \(operand)_trans)"
+    } else {
+      let function = store ? "store_predicated" : "load_predicated"
+      let bounds = "\(operand)_bounds"
+      return "\(function)(\(arguments), \(bounds), \(operand)_trans)"
+    }
+  }
+}
+
+extension GEMMBatchedKernel {
+  public func createSource() -> String {
+    return """
+
+\(createMetalSimdgroupMatrixStorage())
+using namespace metal;
+
+// Indexes into an array of registers.
+template <typename T>
+METAL_FUNC thread simdgroup_matrix_storage<T>* get_sram(
+  thread simdgroup_matrix_storage<T> *sram,
+  ushort sram_leading_dim,
+  ushort2 matrix_origin
+) {
+  return sram + (matrix_origin.y / 8) * (sram_leading_dim / 8) + (matrix_origin.x / 8);
+}
+
+// Dimensions of each problem.
+constant uint M = \(matrixDimensions.M);
+constant uint N = \(matrixDimensions.N);
+constant uint K = \(matrixDimensions.K);
+
+constant uint A_leading_dimension = \(leadingDimensions.A);
+constant uint B_leading_dimension = \(leadingDimensions.B);
+constant uint C_leading_dimension = \(leadingDimensions.C);
+
+// The number of elements between consecutive problems.
+constant ulong A_batch_stride = \(batchStrides.A);
+constant ulong B_batch_stride = \(batchStrides.B);
+constant ulong C_batch_stride = \(batchStrides.C);
+
+constant bool A_trans = \(transposeState.A);
+constant bool B_trans = \(transposeState.B);
+constant bool C_trans = \(transposeC);
+constant bool load_previous_C = \(loadPreviousC);
+
+kernel void gemm_batched(device \(memoryName("A")) *A [[buffer(0)]],
+                         device \(memoryName("B")) *B [[buffer(1)]],
+                         device \(memoryName("C")) *C [[buffer(2)]],
+                         constant uint &batch_size [[buffer(3)]],
+
+                         uint gid [[threadgroup_position_in_grid]],
+                         ushort sidx [[simdgroup_index_in_threadgroup]],
+                         ushort lane_id [[thread_index_in_simdgroup]])
+{
+  ushort2 morton_offset = morton_order(lane_id);
+  uint problem_start = (gid * \(simdgroupsPerThreadgroup) + sidx)
+    * \(problemsPerSimdgroup);
+
+  // The bounds of each operand, relative to this thread's elements.
+  int2 A_bounds = int2(K, M) - int2(morton_offset);
+  int2 B_bounds = int2(N, K) - int2(morton_offset);
+  int2 C_bounds = int2(N, M) - int2(morton_offset);
+
+  for (ushort p = 0; p < \(problemsPerSimdgroup); ++p) {
+    uint problem = problem_start + p;
+    if (problem >= batch_size) {
+      return;
+    }
+
+    \(createOffsets())
+    \(createLoad("A"))
+    \(createLoad("B"))
+    \(createInitializeC())
+    \(createMultiply())
+    \(createStoreC())
+  }
+}
+
+"""
+  }
+
+  func createOffsets() -> String {
+    var output = ""
+    for operand in ["A", "B", "C"] {
+      output += """
+
+      auto \(operand)_src = simdgroup_matrix_storage<\(memoryName(operand))>::apply_offset(
+        \(operand) + problem * \(operand)_batch_stride,
+        \(operand)_leading_dimension, uint2(morton_offset), \(operand)_trans);
+
+      """
+    }
+    return output
+  }
+
+  // Loads an entire operand into registers.
+  func createLoad(_ operand: String) -> String {
+    let shape = shape(operand)
+    return """
+
+    simdgroup_matrix_storage<\(registerName(operand))> \(operand)_sram[
+      \((shape.paddedRows / 8) * (shape.paddedColumns / 8))];
+    #pragma clang loop unroll(full)
+    for (ushort r = 0; r < \(shape.paddedRows); r += 8) {
+      #pragma clang loop unroll(full)
+      for (ushort c = 0; c < \(shape.paddedColumns); c += 8) {
+        ushort2 origin(c, r);
+        auto \(operand) = get_sram(
+          \(operand)_sram, \(shape.paddedColumns), origin);
+        \(operand)->\(createAccess(operand, store: false, origin: "origin"));
+      }
+    }
+
+    """
+  }
+
+  func createInitializeC() -> String {
+    let shape = shape("C")
+    return """
+
+    simdgroup_matrix_storage<\(registerName("C"))> C_sram[
+      \((shape.paddedRows / 8) * (shape.paddedColumns / 8))];
+    #pragma clang loop unroll(full)
+    for (ushort m = 0; m < \(shape.paddedRows); m += 8) {
+      #pragma clang loop unroll(full)
+      for (ushort n = 0; n < \(shape.paddedColumns); n += 8) {
+        ushort2 origin(n, m);
+        auto C = get_sram(C_sram, \(shape.paddedColumns), origin);
+        if (load_previous_C) {
+          C->\(createAccess("C", store: false, origin: "origin"));
+        } else {
+          *C = simdgroup_matrix_storage<\(registerName("C"))>(0);
+        }
+      }
+    }
+
+    """
+  }
+
+  func createMultiply() -> String {
+    let (M, N, K) = paddedDimensions
+    return """
+
+    #pragma clang loop unroll(full)
+    for (ushort k = 0; k < \(K); k += 8) {
+      #pragma clang loop unroll(full)
+      for (ushort m = 0; m < \(M); m += 8) {
+        #pragma clang loop unroll(full)
+        for (ushort n = 0; n < \(N); n += 8) {
+          auto A = get_sram(A_sram, \(K), ushort2(k, m));
+          auto B = get_sram(B_sram, \(N), ushort2(n, k));
+          auto C = get_sram(C_sram, \(N), ushort2(n, m));
+          C->multiply(*A, *B);
+        }
+      }
+    }
+
+    """
+  }
+
+  func createStoreC() -> String {
+    let (M, N, _) = paddedDimensions
+    return """
+
+    #pragma clang loop unroll(full)
+    for (ushort m = 0; m < \(M); m += 8) {
+      #pragma clang loop unroll(full)
+      for (ushort n = 0; n < \(N); n += 8) {
+        ushort2 origin(n, m);
+        auto C = get_sram(C_sram, \(N), origin);
+        C->\(createAccess("C", store: true, origin: "origin"));
+      }
+    }
+
+    """
+  }
+}
@@ -0,0 +1,93 @@
+//
+//  GEMMChainedDescriptor.swift
+//  FlashAttention
+//
+
+/// A description of two back-to-back multiplications, C = act(A * B1) * B2.
+///
+/// The intermediate, T = act(A * B1), never leaves the chip. This pays off
+/// when T is narrow: an MLP with a modest hidden size, or a low-rank
+/// adapter. All operands are row-major and densely packed.
+///
+/// With `lowRankScale`, the descriptor instead describes a GEMM with a
+/// low-rank adapter (LoRA):
+///
+/// ```
+/// C = A * W + lowRankScale * act(A * B1) * B2
+/// ```
+///
+/// W is the K x N base weight. B1 (K x R) and B2 (R x N) are the down and up
+/// projections of the adapter. The low-rank product is added to the base
+/// accumulator in registers, before C is stored.
+public struct GEMMChainedDescriptor {
+  /// The function applied to every element of the intermediate.
+  public var activation: GEMMActivation = .identity
+
+  /// Whether to add the previous contents of C to the result.
+  public var loadPreviousC: Bool = false
+
+  /// Optional. Enables the low-rank adapter mode, and scales the low-rank
+  /// product. W uses the memory precision of B1.
+  ///
+  /// The scale is bound when the kernel is encoded. Descriptors that differ
+  /// only in the value of the scale share a pipeline.
+  public var lowRankScale: Float?
+
+  /// Required. The dimensions of the two multiplications.
+  /// - Parameter M: Number of rows of A, T, and C.
+  /// - Parameter K: Number of columns of A; the first dot products.
+  /// - Parameter R: Number of columns of T; the second dot products.
+  /// - Parameter N: Number of columns of C.
+  public var matrixDimensions: (M: UInt32, K: UInt32, R: UInt32, N: UInt32)?
+
+  /// Required. The intermediate is always FP32 in registers.
+  public var memoryPrecisions: (
+    A: GEMMOperandPrecision,
+    B1: GEMMOperandPrecision,
+    B2: GEMMOperandPrecision,
+    C: GEMMOperandPrecision)?
+
+  public init() {
+
+  }
+}
+
+struct GEMMChainedKey: Equatable, Hashable {
+  var activation: UInt8
+  var loadPreviousC: UInt8
+  var lowRankAdapter: UInt8
+  var matrixDimensions: SIMD4<UInt32>
+  var memoryPrecisions: SIMD4<UInt16>
+
+  init(copying source: GEMMChainedDescriptor) {
+    activation = source.activation.rawValue
+    loadPreviousC = GEMMKernelKey.createBoolean(source.loadPreviousC)
+    lowRankAdapter = GEMMKernelKey.createBoolean(source.lowRankScale != nil)
+
+    matrixDimensions = SIMD4(repeating: .max)
+    if let (M, K, R, N) = source.matrixDimensions {
+      matrixDimensions = SIMD4(M, K, R, N)
+    }
+    memoryPrecisions = SIMD4(repeating: .max)
+    if let (A, B1, B2, C) = source.memoryPrecisions {
+      memoryPrecisions = SIMD4(
+        A.rawValue, B1.rawValue, B2.rawValue, C.rawValue)
+    }
+  }
+}
+
+extension GEMMChainedDescriptor: Hashable, Equatable {
+  public static func == (
+    lhs: GEMMChainedDescriptor,
+    rhs: GEMMChainedDescriptor
+  ) -> Bool {
+    let lhsKey = GEMMChainedKey(copying: lhs)
+    let rhsKey = GEMMChainedKey(copying: rhs)
+    return lhsKey == rhsKey
+  }
+
+  public func hash(into hasher: inout Hasher) {
+    let key = GEMMChainedKey(copying: self)
+    hasher.combine(key)
+  }
+}
@@ -0,0 +1,53 @@
+//
+//  GEMMChainedKernel+PipelineCache.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+extension GEMMChainedKernel {
+  public typealias PipelineValue = (
+    kernel: GEMMChainedKernel, pipeline: MTLComputePipelineState)
+
+  public static var pipelineCache: [
+    GEMMChainedDescriptor: PipelineValue] = [:]
+}
+
+extension GEMMChainedKernel {
+  // Register this problem configuration in the cache.
+  public static func register(descriptor: GEMMChainedDescriptor) {
+    guard pipelineCache[descriptor] == nil else {
+      return
+    }
+
+    let kernel = GEMMChainedKernel(descriptor: descriptor)
+    let source = kernel.createSource()
+    let device = MTLContext.global.device
+    let library: MTLLibrary
+    do {
+      library = try device.makeLibrary(source: source, options: nil)
+    } catch {
+      print("Metal compile error:\n\(error)\n")
+      fatalError("Metal compile failed")
+    }
+    let function = library.makeFunction(name: "gemm_chained")!
+    let pipeline = try! device.makeComputePipelineState(function: function)
+    pipelineCache[descriptor] = (kernel, pipeline)
+  }
+
+  /// Chooses how many columns of C each threadgroup covers.
+  ///
+  /// Every threadgroup recomputes its rows of the intermediate. Splitting
+  /// the columns only pays off when there are too few rows to fill the GPU.
+  public func columnsPerThreadgroup(targetThreadgroupCount: Int = 256) -> Int {
+    let rowGroups = max(
+      (Int(matrixDimensions.M) + threadgroupRows - 1) / threadgroupRows, 1)
+    let columnBlocks = (Int(matrixDimensions.N) + blockColumns - 1)
+    / blockColumns
+    let splits = max(1, min(columnBlocks, targetThreadgroupCount / rowGroups))
+    let blocksPerSplit = (columnBlocks + splits - 1) / splits
+    return max(blocksPerSplit, 1) * blockColumns
+  }
+}
+#endif
@@ -0,0 +1,234 @@
+//
+//  GEMMChainedKernel.swift
+//  FlashAttention
+//
+
+/// The kernel for `GEMMChainedDescriptor`.
+///
+/// Each simdgroup owns 8 rows of A, T, and C. It first computes its rows of
+/// T = act(A * B1) into registers, then sweeps across the columns of C in
+/// blocks of 32. Since no two simdgroups share rows, there is no
+/// threadgroup memory and no barrier. B1 and B2 are small, and are read from
+/// the cache by every simdgroup.
+///
+/// The intermediate occupies R / 4 registers per thread, which limits R to
+/// `maximumIntermediateDimension`.
+public struct GEMMChainedKernel {
+  /// The largest R this kernel accepts.
+  public static let maximumIntermediateDimension: UInt32 = 128
+
+  var activation: GEMMActivation
+  var loadPreviousC: Bool
+  var lowRankAdapter: Bool
+  var matrixDimensions: (M: UInt32, K: UInt32, R: UInt32, N: UInt32)
+  var memoryPrecisions: (
+    A: GEMMOperandPrecision,
+    B1: GEMMOperandPrecision,
+    B2: GEMMOperandPrecision,
+    C: GEMMOperandPrecision)
+
+  /// The number of simdgroups in a threadgroup.
+  public var simdgroupsPerThreadgroup: Int = 4
+
+  /// The number of columns of C in each block.
+  public var blockColumns: Int = 32
+
+  public init(descriptor: GEMMChainedDescriptor) {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard matrixDimensions.R <= Self.maximumIntermediateDimension else {
+      fatalError("Intermediate dimension was too large.")
+    }
+    self.activation = descriptor.activation
+    self.loadPreviousC = descriptor.loadPreviousC
+    self.lowRankAdapter = descriptor.lowRankScale != nil
+    self.matrixDimensions = matrixDimensions
+    self.memoryPrecisions = memoryPrecisions
+  }
+
+  /// The number of rows of C in each threadgroup.
+  public var threadgroupRows: Int {
+    8 * simdgroupsPerThreadgroup
+  }
+
+  public var threadgroupSize: Int {
+    32 * simdgroupsPerThreadgroup
+  }
+
+  // R rounded up to the size of a SIMD matrix.
+  var paddedR: UInt32 {
+    (matrixDimensions.R + 7) / 8 * 8
+  }
+}
+
+extension GEMMChainedKernel {
+  public func createSource() -> String {
+    var baseArguments = ""
+    if lowRankAdapter {
+      baseArguments = """
+      device \(memoryPrecisions.B1.name) *W [[buffer(4)]],
+                               constant float &low_rank_scale [[buffer(6)]],
+      """
+    }
+
+    return """
+
+\(createMetalSimdgroupMatrixStorage())
+using namespace metal;
+
+\(createFragmentAccessors())
+
+constant uint M = \(matrixDimensions.M);
+constant uint K = \(matrixDimensions.K);
+constant uint R = \(matrixDimensions.R);
+constant uint N = \(matrixDimensions.N);
+
+kernel void gemm_chained(device \(memoryPrecisions.A.name) *A [[buffer(0)]],
+                         device \(memoryPrecisions.B1.name) *B1 [[buffer(1)]],
+                         device \(memoryPrecisions.B2.name) *B2 [[buffer(2)]],
+                         device \(memoryPrecisions.C.name) *C [[buffer(3)]],
+                         \(baseArguments)
+                         constant uint &N_chunk [[buffer(5)]],
+
+                         uint2 gid [[threadgroup_position_in_grid]],
+                         ushort sidx [[simdgroup_index_in_threadgroup]],
+                         ushort lane_id [[thread_index_in_simdgroup]])
+{
+  ushort2 morton_offset = morton_order(lane_id);
+  uint M_offset = (gid.y * \(simdgroupsPerThreadgroup) + sidx) * 8;
+  if (M_offset >= M) {
+    return;
+  }
+  uint N_start = gid.x * N_chunk;
+  uint N_end = min(N, N_start + N_chunk);
+
+  \(createIntermediate())
+
+  for (uint n_block = N_start; n_block < N_end; n_block += \(blockColumns)) {
+    \(createInitializeC())
+    \(createBaseProduct())
+    \(createSecondProduct())
+    \(createStoreC())
+  }
+}
+
+"""
+  }
+
+  // Computes this simdgroup's rows of T = act(A * B1), and folds the
+  // low-rank scale into T. The scale is a runtime argument, so it does not
+  // fragment the pipeline cache.
+  func createIntermediate() -> String {
+    var scale = ""
+    if lowRankAdapter {
+      scale = "value *= low_rank_scale;"
+    }
+
+    return """
+
+    simdgroup_matrix_storage<float> T_sram[\(paddedR / 8)];
+#pragma clang loop unroll(full)
+    for (ushort r = 0; r < \(paddedR); r += 8) {
+      T_sram[r / 8] = simdgroup_matrix_storage<float>(0);
+    }
+
+    for (uint k = 0; k < K; k += 8) {
+      simdgroup_matrix_storage<float> A_sram;
+      load_fragment(
+        &A_sram, A, uint2(K, M), uint2(k, M_offset), morton_offset);
+#pragma clang loop unroll(full)
+      for (ushort r = 0; r < \(paddedR); r += 8) {
+        simdgroup_matrix_storage<float> B1_sram;
+        load_fragment(&B1_sram, B1, uint2(R, K), uint2(r, k), morton_offset);
+        T_sram[r / 8].multiply(A_sram, B1_sram);
+      }
+    }
+
+#pragma clang loop unroll(full)
+    for (ushort r = 0; r < \(paddedR); r += 8) {
+      float2 value = *(T_sram[r / 8].thread_elements());
+      value = \(activation.createSource("value"));
+      \(scale)
+      *(T_sram[r / 8].thread_elements()) = value;
+    }
+
+    """
+  }
+
+  func createInitializeC() -> String {
+    """
+
+    simdgroup_matrix_storage<float> C_sram[\(blockColumns / 8)];
+#pragma clang loop unroll(full)
+    for (ushort n = 0; n < \(blockColumns); n += 8) {
+      if (\(loadPreviousC)) {
+        load_fragment(
+          C_sram + n / 8, C, uint2(N, M), uint2(n_block + n, M_offset),
+          morton_offset);
+      } else {
+        C_sram[n / 8] = simdgroup_matrix_storage<float>(0);
+      }
+    }
+
+    """
+  }
+
+  // Accumulates A * W, in the low-rank adapter mode.
+  func createBaseProduct() -> String {
+    guard lowRankAdapter else {
+      return ""
+    }
+
+    return """
+
+    for (uint k = 0; k < K; k += 8) {
+      simdgroup_matrix_storage<float> A_sram;
+      load_fragment(
+        &A_sram, A, uint2(K, M), uint2(k, M_offset), morton_offset);
+#pragma clang loop unroll(full)
+      for (ushort n = 0; n < \(blockColumns); n += 8) {
+        simdgroup_matrix_storage<float> W_sram;
+        load_fragment(
+          &W_sram, W, uint2(N, K), uint2(n_block + n, k), morton_offset);
+        C_sram[n / 8].multiply(A_sram, W_sram);
+      }
+    }
+
+    """
+  }
+
+  // Accumulates T * B2, with T read from registers.
+  func createSecondProduct() -> String {
+    """
+
+#pragma clang loop unroll(full)
+    for (ushort r = 0; r < \(paddedR); r += 8) {
+#pragma clang loop unroll(full)
+      for (ushort n = 0; n < \(blockColumns); n += 8) {
+        simdgroup_matrix_storage<float> B2_sram;
+        load_fragment(
+          &B2_sram, B2, uint2(N, R), uint2(n_block + n, r), morton_offset);
+        C_sram[n / 8].multiply(T_sram[r / 8], B2_sram);
+      }
+    }
+
+    """
+  }
+
+  func createStoreC() -> String {
+    """
+
+#pragma clang loop unroll(full)
+    for (ushort n = 0; n < \(blockColumns); n += 8) {
+      if (n_block + n < N) {
+        store_fragment(
+          C_sram + n / 8, C, uint2(N, M), uint2(n_block + n, M_offset),
+          morton_offset);
+      }
+    }
+
+    """
+  }
+}
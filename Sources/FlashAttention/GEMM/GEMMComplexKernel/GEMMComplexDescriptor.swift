@@ -0,0 +1,120 @@
+//
+//  GEMMComplexDescriptor.swift
+//  FlashAttention
+//
+
+/// How the real and imaginary parts of a complex matrix are stored.
+public enum GEMMComplexLayout: UInt8 {
+  /// Each element is a (real, imaginary) pair, like `std::complex`.
+  case interleaved = 0
+
+  /// The real plane, followed immediately by the imaginary plane. Each plane
+  /// is a dense row-major matrix.
+  case planar = 1
+}
+
+/// How the kernel forms the complex product from real multiplications.
+public enum GEMMComplexAlgorithm: UInt8 {
+  /// Four real products per block:
+  ///
+  /// ```
+  /// real = Ar * Br - Ai * Bi
+  /// imag = Ar * Bi + Ai * Br
+  /// ```
+  case fourM = 0
+
+  /// Three real products per block (Gauss's trick):
+  ///
+  /// ```
+  /// P1 = Ar * Br
+  /// P2 = Ai * Bi
+  /// P3 = (Ar + Ai) * (Br + Bi)
+  /// real = P1 - P2
+  /// imag = P3 - P1 - P2
+  /// ```
+  ///
+  /// Saves a quarter of the multiplications, at the cost of one more
+  /// accumulator and some cancellation in the imaginary part.
+  case threeM = 1
+}
+
+/// A description of a complex-valued GEMM, C = A * B.
+///
+/// The memory precisions refer to each real component, so `.FP32` means
+/// complex float (cf32) and `.FP16` means complex half (cf16). All operands
+/// are row-major and densely packed.
+public struct GEMMComplexDescriptor {
+  public var algorithm: GEMMComplexAlgorithm = .fourM
+
+  public var layout: GEMMComplexLayout = .interleaved
+
+  /// Whether to add the previous contents of C to the result.
+  public var loadPreviousC: Bool = false
+
+  /// Required. The dimensions of the complex matrices.
+  public var matrixDimensions: (M: UInt32, N: UInt32, K: UInt32)?
+
+  /// Required. The precision of the real and imaginary components. BF16 is
+  /// not supported.
+  public var memoryPrecisions: (
+    A: GEMMOperandPrecision,
+    B: GEMMOperandPrecision,
+    C: GEMMOperandPrecision)?
+
+  public init() {
+
+  }
+}
+
+extension GEMMComplexDescriptor {
+  /// The number of real scalars in each operand.
+  public var scalarCounts: (A: Int, B: Int, C: Int) {
+    guard let matrixDimensions = self.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let (M, N, K) = (
+      Int(matrixDimensions.M),
+      Int(matrixDimensions.N),
+      Int(matrixDimensions.K))
+    return (2 * M * K, 2 * K * N, 2 * M * N)
+  }
+}
+
+struct GEMMComplexKey: Equatable, Hashable {
+  var algorithm: UInt8
+  var layout: UInt8
+  var loadPreviousC: UInt8
+  var matrixDimensions: SIMD3<UInt32>
+  var memoryPrecisions: SIMD3<UInt16>
+
+  init(copying source: GEMMComplexDescriptor) {
+    algorithm = source.algorithm.rawValue
+    layout = source.layout.rawValue
+    loadPreviousC = GEMMKernelKey.createBoolean(source.loadPreviousC)
+
+    matrixDimensions = SIMD3(repeating: .max)
+    if let (M, N, K) = source.matrixDimensions {
+      matrixDimensions = SIMD3(M, N, K)
+    }
+    memoryPrecisions = SIMD3(repeating: .max)
+    if let (A, B, C) = source.memoryPrecisions {
+      memoryPrecisions = SIMD3(A.rawValue, B.rawValue, C.rawValue)
+    }
+  }
+}
+
+extension GEMMComplexDescriptor: Hashable, Equatable {
+  public static func == (
+    lhs: GEMMComplexDescriptor,
+    rhs: GEMMComplexDescriptor
+  ) -> Bool {
+    let lhsKey = GEMMComplexKey(copying: lhs)
+    let rhsKey = GEMMComplexKey(copying: rhs)
+    return lhsKey == rhsKey
+  }
+
+  public func hash(into hasher: inout Hasher) {
+    let key = GEMMComplexKey(copying: self)
+    hasher.combine(key)
+  }
+}
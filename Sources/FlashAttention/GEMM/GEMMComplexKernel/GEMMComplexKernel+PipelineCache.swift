@@ -0,0 +1,39 @@
+//
+//  GEMMComplexKernel+PipelineCache.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+extension GEMMComplexKernel {
+  public typealias PipelineValue = (
+    kernel: GEMMComplexKernel, pipeline: MTLComputePipelineState)
+
+  public static var pipelineCache: [
+    GEMMComplexDescriptor: PipelineValue] = [:]
+}
+
+extension GEMMComplexKernel {
+  // Register this problem configuration in the cache.
+  public static func register(descriptor: GEMMComplexDescriptor) {
+    guard pipelineCache[descriptor] == nil else {
+      return
+    }
+
+    let kernel = GEMMComplexKernel(descriptor: descriptor)
+    let source = kernel.createSource()
+    let device = MTLContext.global.device
+    let library: MTLLibrary
+    do {
+      library = try device.makeLibrary(source: source, options: nil)
+    } catch {
+      print("Metal compile error:\n\(error)\n")
+      fatalError("Metal compile failed")
+    }
+    let function = library.makeFunction(name: "gemm_complex")!
+    let pipeline = try! device.makeComputePipelineState(function: function)
+    pipelineCache[descriptor] = (kernel, pipeline)
+  }
+}
+#endif
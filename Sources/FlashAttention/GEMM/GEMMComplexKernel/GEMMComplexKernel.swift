@@ -0,0 +1,302 @@
+//
+//  GEMMComplexKernel.swift
+//  FlashAttention
+//
+
+/// The kernel for `GEMMComplexDescriptor`.
+///
+/// Each simdgroup owns an 8 x 32 block of C. Every load fetches the real and
+/// imaginary parts of a fragment together, and splits them into two real
+/// fragments. The real products are combined into the complex result in
+/// registers, just before the store.
+public struct GEMMComplexKernel {
+  var algorithm: GEMMComplexAlgorithm
+  var layout: GEMMComplexLayout
+  var loadPreviousC: Bool
+  var matrixDimensions: (M: UInt32, N: UInt32, K: UInt32)
+  var memoryPrecisions: (
+    A: GEMMOperandPrecision,
+    B: GEMMOperandPrecision,
+    C: GEMMOperandPrecision)
+
+  /// The number of simdgroups in a threadgroup.
+  public var simdgroupsPerThreadgroup: Int = 4
+
+  /// The number of columns of C in each block.
+  public var blockColumns: Int = 32
+
+  public init(descriptor: GEMMComplexDescriptor) {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    for precision in [
+      memoryPrecisions.A, memoryPrecisions.B, memoryPrecisions.C
+    ] {
+      guard precision != .BF16 else {
+        fatalError("Complex GEMM does not support BF16.")
+      }
+    }
+    self.algorithm = descriptor.algorithm
+    self.layout = descriptor.layout
+    self.loadPreviousC = descriptor.loadPreviousC
+    self.matrixDimensions = matrixDimensions
+    self.memoryPrecisions = memoryPrecisions
+  }
+
+  /// The number of rows of C in each threadgroup.
+  public var threadgroupRows: Int {
+    8 * simdgroupsPerThreadgroup
+  }
+
+  public var threadgroupSize: Int {
+    32 * simdgroupsPerThreadgroup
+  }
+}
+
+extension GEMMComplexKernel {
+  public func createSource() -> String {
+    """
+
+\(createMetalSimdgroupMatrixStorage())
+using namespace metal;
+
+\(createUtilities())
+
+constant uint M = \(matrixDimensions.M);
+constant uint N = \(matrixDimensions.N);
+constant uint K = \(matrixDimensions.K);
+
+kernel void gemm_complex(device \(memoryPrecisions.A.name) *A [[buffer(0)]],
+                         device \(memoryPrecisions.B.name) *B [[buffer(1)]],
+                         device \(memoryPrecisions.C.name) *C [[buffer(2)]],
+
+                         uint2 gid [[threadgroup_position_in_grid]],
+                         ushort sidx [[simdgroup_index_in_threadgroup]],
+                         ushort lane_id [[thread_index_in_simdgroup]])
+{
+  ushort2 morton_offset = morton_order(lane_id);
+  uint M_offset = (gid.y * \(simdgroupsPerThreadgroup) + sidx) * 8;
+  uint N_offset = gid.x * \(blockColumns);
+  if (M_offset >= M) {
+    return;
+  }
+
+  \(createAccumulators())
+
+  for (uint k = 0; k < K; k += 8) {
+    simdgroup_matrix_storage<float> A_real;
+    simdgroup_matrix_storage<float> A_imag;
+    load_complex(
+      &A_real, &A_imag, A, uint2(K, M), uint2(k, M_offset), morton_offset);
+    \(createPrepareA())
+
+#pragma clang loop unroll(full)
+    for (ushort n = 0; n < \(blockColumns); n += 8) {
+      simdgroup_matrix_storage<float> B_real;
+      simdgroup_matrix_storage<float> B_imag;
+      load_complex(
+        &B_real, &B_imag, B, uint2(N, K), uint2(N_offset + n, k),
+        morton_offset);
+      \(createMultiply())
+    }
+  }
+
+  \(createCombine())
+
+#pragma clang loop unroll(full)
+  for (ushort n = 0; n < \(blockColumns); n += 8) {
+    if (N_offset + n < N) {
+      store_complex(
+        C_real + n / 8, C_imag + n / 8, C, uint2(N, M),
+        uint2(N_offset + n, M_offset), morton_offset);
+    }
+  }
+}
+
+"""
+  }
+
+  func createUtilities() -> String {
+    var readElement: String
+    var writeElement: String
+    switch layout {
+    case .interleaved:
+      readElement = """
+      return float2(*(const device vec<U, 2>*)(src + 2 * index));
+      """
+      writeElement = """
+      *(device vec<U, 2>*)(dst + 2 * index) = vec<U, 2>(value);
+      """
+    case .planar:
+      readElement = """
+      return float2(src[index], src[plane + index]);
+      """
+      writeElement = """
+      dst[index] = U(value[0]);
+        dst[plane + index] = U(value[1]);
+      """
+    }
+
+    return """
+
+// Reads the (real, imaginary) pair at 'index'. 'plane' is the number of
+// elements in a planar matrix.
+template <typename U>
+METAL_FUNC float2 read_element(const device U *src, uint index, uint plane) {
+  \(readElement)
+}
+
+template <typename U>
+METAL_FUNC void write_element(
+  device U *dst, uint index, uint plane, float2 value
+) {
+  \(writeElement)
+}
+
+// Loads the 8x8 fragment at 'origin' of a row-major complex matrix, as two
+// real fragments. Elements outside the matrix read as zero.
+template <typename U>
+METAL_FUNC void load_complex(
+  thread simdgroup_matrix_storage<float> *real,
+  thread simdgroup_matrix_storage<float> *imag,
+  const device U *src, uint2 dimensions, uint2 origin, ushort2 morton_offset
+) {
+  uint2 position = origin + uint2(morton_offset);
+  uint plane = dimensions.x * dimensions.y;
+  uint index = position.y * dimensions.x + position.x;
+  float2 first = float2(0);
+  float2 second = float2(0);
+  if (position.y < dimensions.y) {
+    if (position.x < dimensions.x) {
+      first = read_element(src, index, plane);
+    }
+    if (position.x + 1 < dimensions.x) {
+      second = read_element(src, index + 1, plane);
+    }
+  }
+  *(real->thread_elements()) = float2(first[0], second[0]);
+  *(imag->thread_elements()) = float2(first[1], second[1]);
+}
+
+template <typename U>
+METAL_FUNC void store_complex(
+  thread simdgroup_matrix_storage<float> *real,
+  thread simdgroup_matrix_storage<float> *imag,
+  device U *dst, uint2 dimensions, uint2 origin, ushort2 morton_offset
+) {
+  uint2 position = origin + uint2(morton_offset);
+  uint plane = dimensions.x * dimensions.y;
+  uint index = position.y * dimensions.x + position.x;
+  float2 real_value = *(real->thread_elements());
+  float2 imag_value = *(imag->thread_elements());
+  if (position.y >= dimensions.y) {
+    return;
+  }
+#pragma clang loop unroll(full)
+  for (ushort i = 0; i < 2; ++i) {
+    if (position.x + i < dimensions.x) {
+      float2 value = float2(real_value[i], imag_value[i]);
+      if (\(loadPreviousC)) {
+        value += read_element(dst, index + i, plane);
+      }
+      write_element(dst, index + i, plane, value);
+    }
+  }
+}
+
+"""
+  }
+
+  func createAccumulators() -> String {
+    var names: [String]
+    switch algorithm {
+    case .fourM:
+      names = ["C_real", "C_imag"]
+    case .threeM:
+      names = ["P1", "P2", "P3"]
+    }
+
+    var output = ""
+    for name in names {
+      output += """
+
+  simdgroup_matrix_storage<float> \(name)[\(blockColumns / 8)];
+#pragma clang loop unroll(full)
+  for (ushort n = 0; n < \(blockColumns); n += 8) {
+    \(name)[n / 8] = simdgroup_matrix_storage<float>(0);
+  }
+
+"""
+    }
+    return output
+  }
+
+  // Forms the derived fragment of A: -Ai for 4M, and Ar + Ai for 3M.
+  func createPrepareA() -> String {
+    switch algorithm {
+    case .fourM:
+      return """
+
+    simdgroup_matrix_storage<float> A_negated_imag;
+    *(A_negated_imag.thread_elements()) = -*(A_imag.thread_elements());
+
+"""
+    case .threeM:
+      return """
+
+    simdgroup_matrix_storage<float> A_sum;
+    *(A_sum.thread_elements()) =
+      *(A_real.thread_elements()) + *(A_imag.thread_elements());
+
+"""
+    }
+  }
+
+  func createMultiply() -> String {
+    switch algorithm {
+    case .fourM:
+      return """
+
+      C_real[n / 8].multiply(A_real, B_real);
+      C_real[n / 8].multiply(A_negated_imag, B_imag);
+      C_imag[n / 8].multiply(A_real, B_imag);
+      C_imag[n / 8].multiply(A_imag, B_real);
+
+"""
+    case .threeM:
+      return """
+
+      simdgroup_matrix_storage<float> B_sum;
+      *(B_sum.thread_elements()) =
+        *(B_real.thread_elements()) + *(B_imag.thread_elements());
+      P1[n / 8].multiply(A_real, B_real);
+      P2[n / 8].multiply(A_imag, B_imag);
+      P3[n / 8].multiply(A_sum, B_sum);
+
+"""
+    }
+  }
+
+  // Converts the real products into the real and imaginary parts of C.
+  func createCombine() -> String {
+    guard algorithm == .threeM else {
+      return ""
+    }
+
+    return """
+
+  simdgroup_matrix_storage<float> C_real[\(blockColumns / 8)];
+  simdgroup_matrix_storage<float> C_imag[\(blockColumns / 8)];
+#pragma clang loop unroll(full)
+  for (ushort n = 0; n < \(blockColumns); n += 8) {
+    float2 P1_value = *(P1[n / 8].thread_elements());
+    float2 P2_value = *(P2[n / 8].thread_elements());
+    float2 P3_value = *(P3[n / 8].thread_elements());
+    *(C_real[n / 8].thread_elements()) = P1_value - P2_value;
+    *(C_imag[n / 8].thread_elements()) = P3_value - P1_value - P2_value;
+  }
+
+"""
+  }
+}
@@ -0,0 +1,108 @@
+//
+//  GEMMDescriptor+Partition.swift
+//  FlashAttention
+//
+
+/// How to divide a GEMM among tensor-parallel workers.
+public enum GEMMTensorParallelism {
+  /// Split the N dimension. Each shard produces a disjoint set of columns
+  /// of C. No reduction is needed.
+  case column
+
+  /// Split the K dimension. Each shard produces a partial sum over all of C.
+  /// The partial sums must be reduced.
+  case row
+}
+
+/// One worker's portion of a partitioned GEMM.
+public struct GEMMShard {
+  /// The sub-problem. Leading dimensions refer to the full operands.
+  public var descriptor: GEMMDescriptor
+
+  /// Byte offsets of the shard's first element, within the full operands.
+  ///
+  /// For row parallelism, every shard covers all of C. The C offset is zero,
+  /// and each shard should write to a private accumulator.
+  public var offsets: (A: Int, B: Int, C: Int)
+}
+
+extension GEMMDescriptor {
+  /// Partitions the multiplication into `count` shards of nearly equal size.
+  ///
+  /// Some shards may be empty (zero columns or zero depth), if the split
+  /// dimension is smaller than the shard count.
+  public func shards(
+    count: Int,
+    parallelism: GEMMTensorParallelism
+  ) -> [GEMMShard] {
+    guard let matrixDimensions = self.matrixDimensions,
+          let memoryPrecisions = self.memoryPrecisions,
+          let transposeState = self.transposeState else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard count > 0 else {
+      fatalError("Shard count must be positive.")
+    }
+    let leadingDimensions = self.resolvedLeadingDimensions
+    let sizeA = memoryPrecisions.A.size
+    let sizeB = memoryPrecisions.B.size
+    let sizeC = memoryPrecisions.C.size
+
+    var splitDimension: UInt32
+    switch parallelism {
+    case .column:
+      splitDimension = matrixDimensions.N
+    case .row:
+      splitDimension = matrixDimensions.K
+    }
+
+    var output: [GEMMShard] = []
+    for shardID in 0..<count {
+      // Distribute the remainder among the first shards.
+      let quotient = Int(splitDimension) / count
+      let remainder = Int(splitDimension) % count
+      let start = shardID * quotient + min(shardID, remainder)
+      let size = quotient + (shardID < remainder ? 1 : 0)
+
+      var shardDesc = self
+      shardDesc.leadingDimensions = leadingDimensions
+      var offsets = (A: 0, B: 0, C: 0)
+      switch parallelism {
+      case .column:
+        shardDesc.matrixDimensions = (
+          matrixDimensions.M, UInt32(size), matrixDimensions.K)
+
+        // B is K x N, or N x K when transposed.
+        if transposeState.B {
+          offsets.B = start * Int(leadingDimensions.B) * sizeB
+        } else {
+          offsets.B = start * sizeB
+        }
+        // C is M x N, or N x M when transposed.
+        if transposeC {
+          offsets.C = start * Int(leadingDimensions.C) * sizeC
+        } else {
+          offsets.C = start * sizeC
+        }
+      case .row:
+        shardDesc.matrixDimensions = (
+          matrixDimensions.M, matrixDimensions.N, UInt32(size))
+
+        // A is M x K, or K x M when transposed.
+        if transposeState.A {
+          offsets.A = start * Int(leadingDimensions.A) * sizeA
+        } else {
+          offsets.A = start * sizeA
+        }
+        // B is K x N, or N x K when transposed.
+        if transposeState.B {
+          offsets.B = start * sizeB
+        } else {
+          offsets.B = start * Int(leadingDimensions.B) * sizeB
+        }
+      }
+      output.append(GEMMShard(descriptor: shardDesc, offsets: offsets))
+    }
+    return output
+  }
+}
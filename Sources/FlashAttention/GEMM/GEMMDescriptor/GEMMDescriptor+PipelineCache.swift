@@ -5,6 +5,7 @@
 //  Created by Philip Turner on 6/21/24.
 //
 
+#if canImport(Metal)
 import Metal
 
 extension GEMMKernel {
@@ -26,21 +27,8 @@ extension GEMMKernel {
       return
     }
     
-    var kernelDescriptor = GEMMKernelDescriptor(descriptor: descriptor)
-    
+    let kernelDescriptors = candidateDescriptors(descriptor: descriptor)
     let device = MTLContext.global.device
-    if device.supportsFamily(.apple9) {
-      kernelDescriptor.preferAsyncStore = false
-    } else {
-      guard let blockDimensions = kernelDescriptor.blockDimensions else {
-        fatalError("Block dimensions were not set.")
-      }
-      if blockDimensions == (48, 48, 32) {
-        kernelDescriptor.preferAsyncStore = nil
-      } else {
-        kernelDescriptor.preferAsyncStore = true
-      }
-    }
     
     func createLibrary(
       _ kernelDescriptor: GEMMKernelDescriptor
@@ -50,9 +38,22 @@ extension GEMMKernel {
       } else {
         let kernel = GEMMKernel(descriptor: kernelDescriptor)
         let source = kernel.createSource()
+        
+        // Fast math may reassociate '(t - sum) - y' to zero, which would
+        // erase the Kahan compensation.
+        var options: MTLCompileOptions?
+        if kernelDescriptor.accumulation == .compensated {
+          let compileOptions = MTLCompileOptions()
+          if #available(macOS 15.0, iOS 18.0, *) {
+            compileOptions.mathMode = .safe
+          } else {
+            compileOptions.fastMathEnabled = false
+          }
+          options = compileOptions
+        }
         let library: MTLLibrary
           do {
-            library = try device.makeLibrary(source: source, options: nil)
+            library = try device.makeLibrary(source: source, options: options)
           } catch {
             // Print the Metal compiler error and the shader source location.
             // If the source is huge, dump to a file instead.
@@ -85,34 +86,10 @@ extension GEMMKernel {
       return (libraryValue.kernel, pipeline)
     }
     
-    if kernelDescriptor.preferAsyncStore == nil {
+    if kernelDescriptors.count > 1 {
       var candidates: [PipelineValue] = []
-      for candidateID in 0..<4 {
-        var blockDimensions: (M: UInt16, N: UInt16, K: UInt16)
-        var preferAsyncStore: Bool
-        switch candidateID {
-        case 0:
-          blockDimensions = (48, 48, 32)
-          preferAsyncStore = false
-        case 1:
-          blockDimensions = (48, 48, 40)
-          preferAsyncStore = false
-        case 2:
-          blockDimensions = (48, 48, 32)
-          preferAsyncStore = true
-        case 3:
-          blockDimensions = (48, 48, 40)
-          preferAsyncStore = true
-        default:
-          fatalError("This should never happen.")
-        }
-        
-        // Set the attributes unique to this variant.
-        var modifiedKernelDescriptor = kernelDescriptor
-        modifiedKernelDescriptor.blockDimensions = blockDimensions
-        modifiedKernelDescriptor.preferAsyncStore = preferAsyncStore
-        
-        let libraryValue = createLibrary(modifiedKernelDescriptor)
+      for kernelDescriptor in kernelDescriptors {
+        let libraryValue = createLibrary(kernelDescriptor)
         let pipelineValue = createPipeline(libraryValue)
         candidates.append(pipelineValue)
       }
@@ -131,9 +108,70 @@ extension GEMMKernel {
       // Choose the highest-performing candidate.
       GEMMKernel.pipelineCache[descriptor] = candidates.last!
     } else {
-      let libraryValue = createLibrary(kernelDescriptor)
+      let libraryValue = createLibrary(kernelDescriptors[0])
       let pipelineValue = createPipeline(libraryValue)
       GEMMKernel.pipelineCache[descriptor] = pipelineValue
     }
   }
 }
+
+#endif
+
+extension GEMMKernel {
+  /// The kernels `register(descriptor:)` compiles for a problem.
+  ///
+  /// There are several when the heuristic cannot decide between
+  /// asynchronous and direct stores. Then every candidate is compiled, and
+  /// the one with the highest occupancy wins.
+  public static func candidateDescriptors(
+    descriptor: GEMMDescriptor
+  ) -> [GEMMKernelDescriptor] {
+    var kernelDescriptor = GEMMKernelDescriptor(descriptor: descriptor)
+    
+    let profile = DeviceProfile.current
+    if profile.supportsFamily(.apple9) {
+      kernelDescriptor.preferAsyncStore = false
+    } else {
+      guard let blockDimensions = kernelDescriptor.blockDimensions else {
+        fatalError("Block dimensions were not set.")
+      }
+      if blockDimensions == (48, 48, 32) {
+        kernelDescriptor.preferAsyncStore = nil
+      } else {
+        kernelDescriptor.preferAsyncStore = true
+      }
+    }
+    guard kernelDescriptor.preferAsyncStore == nil else {
+      return [kernelDescriptor]
+    }
+    
+    var candidates: [GEMMKernelDescriptor] = []
+    for candidateID in 0..<4 {
+      var blockDimensions: (M: UInt16, N: UInt16, K: UInt16)
+      var preferAsyncStore: Bool
+      switch candidateID {
+      case 0:
+        blockDimensions = (48, 48, 32)
+        preferAsyncStore = false
+      case 1:
+        blockDimensions = (48, 48, 40)
+        preferAsyncStore = false
+      case 2:
+        blockDimensions = (48, 48, 32)
+        preferAsyncStore = true
+      case 3:
+        blockDimensions = (48, 48, 40)
+        preferAsyncStore = true
+      default:
+        fatalError("This should never happen.")
+      }
+      
+      // Set the attributes unique to this variant.
+      var modifiedKernelDescriptor = kernelDescriptor
+      modifiedKernelDescriptor.blockDimensions = blockDimensions
+      modifiedKernelDescriptor.preferAsyncStore = preferAsyncStore
+      candidates.append(modifiedKernelDescriptor)
+    }
+    return candidates
+  }
+}
@@ -5,10 +5,18 @@
 //  Created by Philip Turner on 6/21/24.
 //
 
-import Metal
-
 /// A description of a dense matrix-matrix multiplication.
 public struct GEMMDescriptor {
+  /// How much rounding error the multiplication may trade for speed.
+  /// Controls the register precisions; see `AccuracyPolicy`.
+  public var accuracyPolicy: AccuracyPolicy = .fastest
+  
+  /// Optional. Requests blocked FP16 accumulation, when A, B, and C are all
+  /// FP16. Takes precedence over the accuracy policy, since the blocked
+  /// modes keep most of the FP16 throughput at close to FP32 error. Ignored
+  /// for other precisions.
+  public var accumulation: GEMMAccumulation = .direct
+  
   /// The number of equally sized multiplications that run in parallel.
   /// Batching is out of scope for the reference implementation. However, there
   /// should be a guide for clients that wish to modify the shader, in ways
@@ -39,34 +47,52 @@ public struct GEMMDescriptor {
   public var memoryPrecisions: (
     A: GEMMOperandPrecision, B: GEMMOperandPrecision, C: GEMMOperandPrecision)?
   
+  /// Optional. Overrides the device default for
+  /// `GEMMKernelDescriptor.preferAsyncLoad`. When `nil`, async loads are
+  /// preferred on everything before Apple9.
+  public var preferAsyncLoad: Bool?
+  
   public var transposeState: (A: Bool, B: Bool)?
   
+  /// Whether to store C column-major, as C^T. The leading dimension of C
+  /// then counts elements between consecutive columns, and defaults to M.
+  public var transposeC: Bool = false
+  
   public init() {
     
   }
 }
 
 struct GEMMKey: Equatable, Hashable {
+  var accumulation: UInt8
+  var accuracyPolicy: AccuracyPolicy
   var batchDimension: Int
   var loadPreviousC: UInt8
   // NEW: must be part of the key
   var leadingDimensions: SIMD3<UInt32>
   var matrixDimensions: SIMD3<UInt32>
   var memoryPrecisions: SIMD3<UInt16>
+  var preferAsyncLoad: UInt8
   var transposeState: SIMD2<UInt8>
+  var transposeC: UInt8
  
   init(copying source: GEMMDescriptor) {
+    accumulation = source.accumulation.rawValue
+    accuracyPolicy = source.accuracyPolicy
     batchDimension = source.batchDimension
     loadPreviousC = GEMMKernelKey.createBoolean(source.loadPreviousC)
     // NEW
     leadingDimensions = Self.createLeadingDimensions(
         source.leadingDimensions,
         matrixDimensions: source.matrixDimensions,
-        transposeState: source.transposeState
+        transposeState: source.transposeState,
+        transposeC: source.transposeC
     )
     matrixDimensions = Self.createMatrixDimensions(source.matrixDimensions)
     memoryPrecisions = GEMMKernelKey.createPrecisions(source.memoryPrecisions)
+    preferAsyncLoad = GEMMKernelKey.createBoolean(source.preferAsyncLoad)
     transposeState = GEMMKernelKey.createTransposeState(source.transposeState)
+    transposeC = GEMMKernelKey.createBoolean(source.transposeC)
   }
   
   @_transparent // performance in -Ounchecked
@@ -85,7 +111,8 @@ struct GEMMKey: Equatable, Hashable {
     static func createLeadingDimensions(
         _ specified: (A: UInt32, B: UInt32, C: UInt32)?,
         matrixDimensions: (M: UInt32, N: UInt32, K: UInt32)?,
-        transposeState: (A: Bool, B: Bool)?
+        transposeState: (A: Bool, B: Bool)?,
+        transposeC: Bool
     ) -> SIMD3<UInt32> {
 
         // If we can't compute defaults, fall back to raw optional encoding.
@@ -122,7 +149,7 @@ struct GEMMKey: Equatable, Hashable {
         )
         let c = choose(
             specified?.C,
-            false,
+            transposeC,
             matrixDimensions.M,
             matrixDimensions.N
         )
@@ -168,96 +195,29 @@ extension GEMMKernelDescriptor {
       fatalError("Descriptor was incomplete.")
     }
     
-    // Select the only GPU on an Apple silicon system.
-    //
-    // NOTE: To avoid potentially costly API calls, you may wish to cache the
-    // MTLDevice object or enter a previously created one. The core count
-    // could also be cached on macOS.
-    //
-    // Typical latency to initiate a Metal device, provided the function has
-    // been called numerous times prior:
-    // - macOS 14
-    //   - Swift debug mode,   Metal API validation on:  ≥33 μs
-    //   - Swift release mode, Metal API validation off: ≥38 μs
-    // - iOS 17
-    //   - Swift debug mode,   Metal API validation on:   ≥0 μs
-    //   - Swift release mode, Metal API validation off:  ≥0 μs
-    let mtlDevice = MTLContext.global.device
-    
-    // Trim the device name to something easier to process.
-    //
-    // M1 Max: Apple M1 Max -> M1
-    // M4:     Apple M4 GPU -> M4
-    func createDeviceName() -> String {
-      let deviceName = mtlDevice.name
-      var splits = deviceName.split(separator: " ").map(String.init)
-      splits.removeAll(where: { $0.starts(with: "Apple") })
-      splits.removeAll(where: { $0.starts(with: "GPU") })
-      
-      // Iterate over the space-separated words.
-      var matchingSplitIDs: [UInt32] = []
-      for splitID in splits.indices {
-        // Screen out obvious non-candidates.
-        let split = splits[splitID]
-        guard split.starts(with: "A") || split.starts(with: "M") else {
-          continue
-        }
-        
-        // Extract the second character.
-        guard split.count > 1 else {
-          continue
-        }
-        let secondCharacterInt8 = split.utf8CString[1]
-        let secondCharacterUInt32 = UInt32(secondCharacterInt8)
-        let secondCharacterUnicode = Unicode.Scalar(secondCharacterUInt32)!
-        let secondCharacter = Character(secondCharacterUnicode)
-        
-        // If the second character is numeric, the candidate passes.
-        if secondCharacter.isWholeNumber {
-          matchingSplitIDs.append(UInt32(splitID))
-        }
-      }
-      guard matchingSplitIDs.count == 1 else {
-        fatalError("Failed to locate device name.")
-      }
-      
-      let splitID = matchingSplitIDs[0]
-      return splits[Int(splitID)]
-    }
-    let deviceName = createDeviceName()
-    
-    // Find the core count.
-#if os(macOS)
-let coreCount: Int
-if mtlDevice.supportsFamily(.apple9) {
-  // Not used; setBlockDimensions() returns early on apple9 anyway.
-  coreCount = 0
-} else {
-  coreCount = findCoreCount()
-}
-#elseif os(iOS)
-    var coreCount: Int
-    if deviceName.starts(with: "A") {
-      if mtlDevice.supportsFamily(.apple9) {
-        coreCount = 6
-      } else {
-        coreCount = 5
-      }
-    } else {
-      coreCount = 10
-    }
-#endif
+    // The properties of the GPU, which the tool generating kernels ahead
+    // of time may replace (see `DeviceProfile.current`).
+    let profile = DeviceProfile.current
     
     // Select the register precisions.
     var registerPrecisionA = memoryPrecisions.A
     var registerPrecisionB = memoryPrecisions.B
     var registerPrecisionC = GEMMOperandPrecision.FP32
+    var accumulation = GEMMAccumulation.direct
     if memoryPrecisions.A == .FP16,
        memoryPrecisions.B == .FP16,
        memoryPrecisions.C == .FP16 {
-      registerPrecisionC = GEMMOperandPrecision.FP16
+      // Only FP16xFP16->FP16 reaches peak performance. The accuracy policy
+      // decides, per operation, whether that is worth the rounding error.
+      let policy = descriptor.accuracyPolicy
+      if descriptor.accumulation != .direct {
+        registerPrecisionC = GEMMOperandPrecision.FP16
+        accumulation = descriptor.accumulation
+      } else if policy.permitsLowPrecisionAccumulator(output: .FP16) {
+        registerPrecisionC = GEMMOperandPrecision.FP16
+      }
     }
-    if !mtlDevice.supportsFamily(.apple9) {
+    if !profile.supportsFamily(.apple9) {
       if memoryPrecisions.A == .BF16 {
         registerPrecisionA = .FP32
       }
@@ -267,8 +227,11 @@ if mtlDevice.supportsFamily(.apple9) {
     }
     
     // Set the properties of the 'GEMMKernelDescriptor' object.
+    self.accumulation = accumulation
     self.memoryPrecisions = memoryPrecisions
-    if mtlDevice.supportsFamily(.apple9) {
+    if let preferAsyncLoad = descriptor.preferAsyncLoad {
+      self.preferAsyncLoad = preferAsyncLoad
+    } else if profile.supportsFamily(.apple9) {
       self.preferAsyncLoad = false
     } else {
       self.preferAsyncLoad = true
@@ -277,17 +240,17 @@ if mtlDevice.supportsFamily(.apple9) {
       registerPrecisionA,
       registerPrecisionB,
       registerPrecisionC)
-    if !mtlDevice.supportsFamily(.apple9) {
+    if !profile.supportsFamily(.apple9) {
       self.splits = (2, 2)
     } else {
       self.splits = (1, 1)
     }
     self.transposeState = transposeState
+    self.transposeC = descriptor.transposeC
     
     // Set the properties that deal with block size.
     setBlockDimensions(
-      mtlDevice: mtlDevice,
-      coreCount: coreCount,
+      profile: profile,
       matrixDimensions: matrixDimensions,
       batchDimension: descriptor.batchDimension)
   }
@@ -297,8 +260,7 @@ if mtlDevice.supportsFamily(.apple9) {
   // This function initializes the 'blockDimensions' and
   // 'paddedBlockDimensions' properties.
   private mutating func setBlockDimensions(
-    mtlDevice: MTLDevice,
-    coreCount: Int,
+    profile: DeviceProfile,
     matrixDimensions: (M: UInt32, N: UInt32, K: UInt32),
     batchDimension: Int
   ) {
@@ -306,7 +268,7 @@ if mtlDevice.supportsFamily(.apple9) {
           let transposeState else {
       fatalError("Some properties were not set.")
     }
-    guard !mtlDevice.supportsFamily(.apple9) else {
+    guard !profile.supportsFamily(.apple9) else {
       self.blockDimensions = (32, 32, 8)
       return
     }
@@ -341,7 +303,7 @@ if mtlDevice.supportsFamily(.apple9) {
     
     // Branch on whether the allocation is large / target occupancy is low.
     if useLargeAllocation {
-      let idealGroups = coreCount * 6
+      let idealGroups = profile.coreCount * 6
       if actualGroups <= idealGroups {
         blockDimensions = (32, 32, 32)
       } else {
@@ -371,7 +333,7 @@ if mtlDevice.supportsFamily(.apple9) {
         }
       }
     } else {
-      let idealGroups = coreCount * 9
+      let idealGroups = profile.coreCount * 9
       if actualGroups <= idealGroups {
         blockDimensions = (32, 32, 32)
       } else {
@@ -381,21 +343,36 @@ if mtlDevice.supportsFamily(.apple9) {
   }
 }
 
+#if canImport(Metal)
+import Metal
+
 extension GEMMDescriptor {
   // Specialize the Metal function with this GEMM descriptor.
   func setFunctionConstants(_ constants: MTLFunctionConstantValues) {
+    for constant in functionConstantValues {
+      if constant.isBoolean {
+        var value = constant.value != 0
+        constants.setConstantValue(&value, type: .bool, index: constant.index)
+      } else {
+        var value = constant.value
+        constants.setConstantValue(&value, type: .uint, index: constant.index)
+      }
+    }
+  }
+}
+#endif
+
+extension GEMMDescriptor {
+  /// The Metal function constants that specialize the kernel for this
+  /// problem. Booleans are encoded as 0 or 1.
+  public var functionConstantValues: [
+    (index: Int, isBoolean: Bool, value: UInt32)
+  ] {
     guard let matrixDimensions = self.matrixDimensions,
           let transposeState = self.transposeState else {
       fatalError("Descriptor was incomplete.")
     }
     
-    var M = matrixDimensions.M
-    var N = matrixDimensions.N
-    var K = matrixDimensions.K
-    constants.setConstantValue(&M, type: .uint, index: 0)
-    constants.setConstantValue(&N, type: .uint, index: 1)
-    constants.setConstantValue(&K, type: .uint, index: 2)
-    
     func chooseLeadingDimension(
       _ specifiedLeading: UInt32?,
       _ transposeState: Bool,
@@ -421,20 +398,24 @@ extension GEMMDescriptor {
       
       return actualLeading
     }
-    var leadingDimensionA = chooseLeadingDimension(
+    let leadingDimensionA = chooseLeadingDimension(
       leadingDimensions?.A, transposeState.A,
       matrixDimensions.M, matrixDimensions.K)
-    var leadingDimensionB = chooseLeadingDimension(
+    let leadingDimensionB = chooseLeadingDimension(
       leadingDimensions?.B, transposeState.B,
       matrixDimensions.K, matrixDimensions.N)
-    var leadingDimensionC = chooseLeadingDimension(
-      leadingDimensions?.C, false,
+    let leadingDimensionC = chooseLeadingDimension(
+      leadingDimensions?.C, transposeC,
       matrixDimensions.M, matrixDimensions.N)
-    constants.setConstantValue(&leadingDimensionA, type: .uint, index: 5)
-    constants.setConstantValue(&leadingDimensionB, type: .uint, index: 6)
-    constants.setConstantValue(&leadingDimensionC, type: .uint, index: 7)
     
-    var loadPreviousC = self.loadPreviousC
-    constants.setConstantValue(&loadPreviousC, type: .bool, index: 10)
+    return [
+      (0, false, matrixDimensions.M),
+      (1, false, matrixDimensions.N),
+      (2, false, matrixDimensions.K),
+      (5, false, leadingDimensionA),
+      (6, false, leadingDimensionB),
+      (7, false, leadingDimensionC),
+      (10, true, loadPreviousC ? 1 : 0),
+    ]
   }
 }
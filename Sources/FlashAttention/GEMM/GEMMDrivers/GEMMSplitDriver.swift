@@ -0,0 +1,221 @@
+//
+//  GEMMSplitDriver.swift
+//  FlashAttention
+//
+
+import Dispatch
+
+/// Runs a single GEMM on two backends at once, by partitioning the rows of C.
+///
+/// On unified-memory machines, the CPU cores are idle while the GPU executes a
+/// GEMM. The driver gives the first rows of C to the primary backend (the GPU)
+/// and the rest to the secondary backend (the CPU). Both read the same A and B
+/// allocations, and write disjoint rows of the same C allocation. The buffers
+/// must be created by the primary backend; the CPU backend accepts any buffer
+/// that is visible to the host.
+///
+/// The split is adaptive. After each run, the driver measures the throughput
+/// of both halves, and moves the split point toward the ratio at which both
+/// would finish at the same time. An exponential moving average damps noise
+/// from individual runs.
+public final class GEMMSplitDriver {
+  public let primary: GEMMBackend
+  public let secondary: GEMMBackend
+
+  /// The fraction of rows assigned to the primary backend.
+  public private(set) var primaryFraction: Double
+
+  /// The weight of the newest measurement in the moving average.
+  public var smoothing: Double = 0.5
+
+  /// The split point is rounded to a multiple of this. It keeps the primary
+  /// backend's partition aligned to the GEMM block size.
+  public var rowGranularity: Int = 32
+
+  /// The smallest share of either backend. Launching a command costs more
+  /// than fewer rows would compute.
+  ///
+  /// Both backends always receive at least this many rows, even when the
+  /// measured ratio favors one of them far more. Otherwise the other backend
+  /// would stop being measured, and the split could never move back. A
+  /// problem too small to give both backends this many rows runs entirely
+  /// on the backend with the larger share.
+  public var minimumRows: Int = 32
+
+  public init(
+    primary: GEMMBackend,
+    secondary: GEMMBackend,
+    initialPrimaryFraction: Double = 0.9
+  ) {
+    self.primary = primary
+    self.secondary = secondary
+    self.primaryFraction = initialPrimaryFraction
+  }
+
+  /// Throughput statistics from the last run, in rows per second.
+  public private(set) var lastThroughput: (
+    primary: Double?, secondary: Double?) = (nil, nil)
+
+  /// Chooses the number of rows for the primary backend.
+  func partition(rowCount: Int) -> Int {
+    // The bounds of the primary share, rounded inward to the granularity.
+    let lowerBound = (minimumRows + rowGranularity - 1)
+      / rowGranularity * rowGranularity
+    let upperBound = max(rowCount - minimumRows, 0)
+      / rowGranularity * rowGranularity
+    guard lowerBound <= upperBound else {
+      return (primaryFraction >= 0.5) ? rowCount : 0
+    }
+
+    let idealRows = Double(rowCount) * primaryFraction
+    let granules = (idealRows / Double(rowGranularity)).rounded()
+    let primaryRows = Int(granules) * rowGranularity
+    return min(max(primaryRows, lowerBound), upperBound)
+  }
+
+  /// Encodes C = A * B on both backends, and blocks until both finish.
+  public func multiply(
+    descriptor: GEMMDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    C: GEMMOperandBinding
+  ) {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions,
+          let transposeState = descriptor.transposeState else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let leadingDimensions = descriptor.resolvedLeadingDimensions
+    let rowCount = Int(matrixDimensions.M)
+    let primaryRows = partition(rowCount: rowCount)
+
+    // Create the descriptor and bindings for a range of rows.
+    func slice(
+      rowStart: Int, rowCount: Int
+    ) -> (GEMMDescriptor, GEMMOperandBinding, GEMMOperandBinding) {
+      var sliceDesc = descriptor
+      sliceDesc.leadingDimensions = leadingDimensions
+      sliceDesc.matrixDimensions = (
+        M: UInt32(rowCount), N: matrixDimensions.N, K: matrixDimensions.K)
+
+      // A is M x K, or K x M when transposed. Offsetting a transposed A
+      // skips columns, not rows.
+      var sliceA = A
+      if transposeState.A {
+        sliceA.offset += rowStart * memoryPrecisions.A.size
+      } else {
+        sliceA.offset += rowStart * Int(leadingDimensions.A)
+        * memoryPrecisions.A.size
+      }
+      var sliceC = C
+      if descriptor.transposeC {
+        sliceC.offset += rowStart * memoryPrecisions.C.size
+      } else {
+        sliceC.offset += rowStart * Int(leadingDimensions.C)
+        * memoryPrecisions.C.size
+      }
+      return (sliceDesc, sliceA, sliceC)
+    }
+
+    let clock = SplitClock()
+    var commandBuffers: [GEMMCommandBuffer] = []
+    func launch(
+      backend: GEMMBackend, rowStart: Int, rowCount: Int, index: Int
+    ) {
+      let (sliceDesc, sliceA, sliceC) = slice(
+        rowStart: rowStart, rowCount: rowCount)
+      let commandBuffer = backend.makeCommandBuffer()
+      commandBuffer.encodeGEMM(
+        descriptor: sliceDesc, A: sliceA, B: B, C: sliceC)
+      commandBuffer.addCompletedHandler {
+        clock.finish(index: index)
+      }
+      commandBuffers.append(commandBuffer)
+    }
+    if primaryRows > 0 {
+      launch(backend: primary, rowStart: 0, rowCount: primaryRows, index: 0)
+    }
+    if primaryRows < rowCount {
+      launch(
+        backend: secondary, rowStart: primaryRows,
+        rowCount: rowCount - primaryRows, index: 1)
+    }
+
+    clock.start()
+    for commandBuffer in commandBuffers {
+      commandBuffer.commit()
+    }
+    for commandBuffer in commandBuffers {
+      commandBuffer.waitUntilCompleted()
+    }
+
+    // Feed the measurements back into the partitioner. Metal may return from
+    // 'waitUntilCompleted' before invoking the completion handlers. In that
+    // case, the current time is an upper bound on the latency.
+    clock.finishRemaining()
+    let latencies = clock.latencies()
+    var primaryThroughput: Double?
+    var secondaryThroughput: Double?
+    if primaryRows > 0, let latency = latencies[0], latency > 0 {
+      primaryThroughput = Double(primaryRows) / latency
+    }
+    if primaryRows < rowCount, let latency = latencies[1], latency > 0 {
+      secondaryThroughput = Double(rowCount - primaryRows) / latency
+    }
+    update(primary: primaryThroughput, secondary: secondaryThroughput)
+  }
+
+  /// Moves the split toward the ratio of the measured throughputs.
+  ///
+  /// When only one backend ran, its measurement is paired with the last known
+  /// measurement of the other one.
+  func update(primary: Double?, secondary: Double?) {
+    let primary = primary ?? lastThroughput.primary
+    let secondary = secondary ?? lastThroughput.secondary
+    lastThroughput = (primary, secondary)
+    guard let primary, let secondary, primary + secondary > 0 else {
+      return
+    }
+    let target = primary / (primary + secondary)
+    primaryFraction = (1 - smoothing) * primaryFraction + smoothing * target
+  }
+}
+
+/// Records when each half of a split finishes. Completion handlers run on
+/// arbitrary threads.
+private final class SplitClock {
+  let semaphore = DispatchSemaphore(value: 1)
+  var startTime: UInt64 = 0
+  var endTimes: [UInt64?] = [nil, nil]
+
+  func start() {
+    semaphore.wait()
+    startTime = DispatchTime.now().uptimeNanoseconds
+    semaphore.signal()
+  }
+
+  func finish(index: Int) {
+    semaphore.wait()
+    endTimes[index] = DispatchTime.now().uptimeNanoseconds
+    semaphore.signal()
+  }
+
+  func finishRemaining() {
+    semaphore.wait()
+    let now = DispatchTime.now().uptimeNanoseconds
+    endTimes = endTimes.map { $0 ?? now }
+    semaphore.signal()
+  }
+
+  /// The latencies in seconds.
+  func latencies() -> [Double?] {
+    semaphore.wait()
+    defer { semaphore.signal() }
+    return endTimes.map { endTime in
+      guard let endTime, endTime >= startTime else {
+        return nil
+      }
+      return Double(endTime - startTime) / 1e9
+    }
+  }
+}
@@ -0,0 +1,367 @@
+//
+//  GEMMStreamingDriver.swift
+//  FlashAttention
+//
+
+/// Multiplies matrices that do not fit in device memory.
+///
+/// The operands live in host memory (e.g. a memory-mapped file). The driver
+/// tiles C into output panels, and the K dimension into reduction panels. Each
+/// (M, N, K) panel becomes one GEMM over a staging buffer. Partial products
+/// accumulate in the C staging buffer through `loadPreviousC`.
+///
+/// There are two staging slots for A and B. While the device multiplies the
+/// panels in one slot, the host uploads the next panels into the other. Before
+/// overwriting a slot, the host waits for the command buffer that last read
+/// from it. The C staging buffer is also double-buffered, so that downloading
+/// a finished output panel overlaps with the next one.
+public struct GEMMStreamingDescriptor {
+  /// Forwarded to the descriptor of every panel multiplication.
+  public var accuracyPolicy: AccuracyPolicy = .fastest
+
+  /// Forwarded to the descriptor of every panel multiplication.
+  public var accumulation: GEMMAccumulation = .direct
+
+  /// The dimensions of the full problem.
+  public var matrixDimensions: (M: Int, N: Int, K: Int)?
+
+  public var memoryPrecisions: (
+    A: GEMMOperandPrecision, B: GEMMOperandPrecision, C: GEMMOperandPrecision)?
+
+  public var transposeState: (A: Bool, B: Bool)?
+
+  /// Optional. Leading dimensions of the host matrices.
+  public var leadingDimensions: (A: Int, B: Int, C: Int)?
+
+  /// Whether to accumulate into the existing contents of the host C matrix.
+  public var loadPreviousC: Bool = false
+
+  /// The maximum number of bytes to allocate on the device, across all
+  /// staging buffers.
+  public var memoryBudget: Int?
+
+  public init() {
+
+  }
+}
+
+public final class GEMMStreamingDriver {
+  public let backend: GEMMBackend
+  public let descriptor: GEMMStreamingDescriptor
+
+  /// The panel size chosen to fit the memory budget.
+  public let panelDimensions: (M: Int, N: Int, K: Int)
+
+  /// The number of bytes uploaded to staging buffers during the last call
+  /// to `multiply`. Useful for judging panel reuse.
+  public private(set) var uploadedBytes: Int = 0
+
+  // Two slots for A and B panels, two for C panels.
+  var bufferA: [GEMMBackendBuffer] = []
+  var bufferB: [GEMMBackendBuffer] = []
+  var bufferC: [GEMMBackendBuffer] = []
+
+  public init(backend: GEMMBackend, descriptor: GEMMStreamingDescriptor) {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions,
+          descriptor.transposeState != nil,
+          let memoryBudget = descriptor.memoryBudget else {
+      fatalError("Descriptor was incomplete.")
+    }
+    self.backend = backend
+    self.descriptor = descriptor
+    self.panelDimensions = Self.choosePanelDimensions(
+      matrixDimensions: matrixDimensions,
+      memoryPrecisions: memoryPrecisions,
+      memoryBudget: memoryBudget)
+
+    let panel = panelDimensions
+    for _ in 0..<2 {
+      bufferA.append(backend.makeBuffer(
+        length: panel.M * panel.K * memoryPrecisions.A.size))
+      bufferB.append(backend.makeBuffer(
+        length: panel.K * panel.N * memoryPrecisions.B.size))
+      bufferC.append(backend.makeBuffer(
+        length: panel.M * panel.N * memoryPrecisions.C.size))
+    }
+  }
+
+  /// The device memory needed for a given panel size.
+  static func footprint(
+    panel: (M: Int, N: Int, K: Int),
+    memoryPrecisions: (
+      A: GEMMOperandPrecision, B: GEMMOperandPrecision, C: GEMMOperandPrecision)
+  ) -> Int {
+    var output = 0
+    output += panel.M * panel.K * memoryPrecisions.A.size
+    output += panel.K * panel.N * memoryPrecisions.B.size
+    output += panel.M * panel.N * memoryPrecisions.C.size
+    return 2 * output
+  }
+
+  /// Shrinks the largest panel dimension until the staging buffers fit.
+  ///
+  /// Panel dimensions stay multiples of 32 (the smallest GEMM block size), so
+  /// only the panels at the matrix edges take the slower edge-case code paths.
+  /// Every staging buffer holds fewer than 2^32 elements, the offset limit of
+  /// the kernel.
+  static func choosePanelDimensions(
+    matrixDimensions: (M: Int, N: Int, K: Int),
+    memoryPrecisions: (
+      A: GEMMOperandPrecision, B: GEMMOperandPrecision, C: GEMMOperandPrecision),
+    memoryBudget: Int
+  ) -> (M: Int, N: Int, K: Int) {
+    let granularity = 32
+    func roundUp(_ value: Int) -> Int {
+      (value + granularity - 1) / granularity * granularity
+    }
+    var panel = (
+      M: min(matrixDimensions.M, 1 << 16),
+      N: min(matrixDimensions.N, 1 << 16),
+      K: min(matrixDimensions.K, 1 << 16))
+
+    // The staging buffers are tight, so a panel of R rows and L columns has
+    // a leading dimension of L, and R * L elements.
+    func exceedsOffsetLimit(_ panel: (M: Int, N: Int, K: Int)) -> Bool {
+      let limit = 1 << 32
+      return panel.M * panel.K >= limit
+      || panel.K * panel.N >= limit
+      || panel.M * panel.N >= limit
+    }
+    while exceedsOffsetLimit(panel) ||
+            footprint(panel: panel, memoryPrecisions: memoryPrecisions)
+            > memoryBudget {
+      // Keep K larger than M and N when possible. It amortizes the round
+      // trips of C through device memory.
+      if panel.M >= panel.N, panel.M > granularity, panel.M * 2 > panel.K {
+        panel.M = roundUp(panel.M / 2)
+      } else if panel.N > granularity, panel.N * 2 > panel.K {
+        panel.N = roundUp(panel.N / 2)
+      } else if panel.K > granularity {
+        panel.K = roundUp(panel.K / 2)
+      } else if panel.M > granularity {
+        panel.M = roundUp(panel.M / 2)
+      } else if panel.N > granularity {
+        panel.N = roundUp(panel.N / 2)
+      } else {
+        fatalError("Memory budget was too small.")
+      }
+    }
+    return panel
+  }
+}
+
+extension GEMMStreamingDriver {
+  /// The identity of the panel currently held by a staging slot.
+  struct PanelKey: Equatable {
+    var row: Int
+    var column: Int
+  }
+
+  /// A pair of staging buffers for one operand.
+  struct StagingSlots {
+    var keys: [PanelKey?] = [nil, nil]
+
+    /// The command buffer that last read from each slot.
+    var users: [GEMMCommandBuffer?] = [nil, nil]
+    var cursor: Int = 0
+
+    /// Returns the slot for a panel, and whether it must be uploaded.
+    mutating func acquire(_ key: PanelKey) -> (slot: Int, upload: Bool) {
+      if let index = keys.firstIndex(of: key) {
+        cursor = (index + 1) % 2
+        return (index, false)
+      }
+      let slot = cursor
+      cursor = (cursor + 1) % 2
+      users[slot]?.waitUntilCompleted()
+      keys[slot] = key
+      return (slot, true)
+    }
+  }
+
+  /// Computes C = A * B (or C += A * B) between host allocations.
+  ///
+  /// Blocks until the entire product has been written back to `C`.
+  public func multiply(
+    A: UnsafeRawPointer,
+    B: UnsafeRawPointer,
+    C: UnsafeMutableRawPointer
+  ) {
+    let matrixDimensions = descriptor.matrixDimensions!
+    let memoryPrecisions = descriptor.memoryPrecisions!
+    let transposeState = descriptor.transposeState!
+    let leadingDimensions = descriptor.leadingDimensions ?? (
+      A: transposeState.A ? matrixDimensions.M : matrixDimensions.K,
+      B: transposeState.B ? matrixDimensions.K : matrixDimensions.N,
+      C: matrixDimensions.N)
+    let panel = panelDimensions
+    uploadedBytes = 0
+
+    // An empty product. With K = 0, C is zero or keeps its previous value.
+    guard matrixDimensions.M > 0, matrixDimensions.N > 0,
+          matrixDimensions.K > 0 else {
+      if !descriptor.loadPreviousC {
+        let rowSize = matrixDimensions.N * memoryPrecisions.C.size
+        for rowID in 0..<matrixDimensions.M {
+          let offset = rowID * leadingDimensions.C * memoryPrecisions.C.size
+          (C + offset).initializeMemory(
+            as: UInt8.self, repeating: 0, count: rowSize)
+        }
+      }
+      return
+    }
+
+    // The panels held by the A and B slots.
+    var stagingA = StagingSlots()
+    var stagingB = StagingSlots()
+
+    // The command buffer that last wrote to each C slot, plus the panel to
+    // download once it completes.
+    typealias PendingDownload = (
+      commandBuffer: GEMMCommandBuffer,
+      origin: (M: Int, N: Int),
+      size: (M: Int, N: Int))
+    var pendingDownloads: [PendingDownload?] = [nil, nil]
+    var outputCursor = 0
+
+    func download(_ pending: PendingDownload, slot: Int) {
+      pending.commandBuffer.waitUntilCompleted()
+      Self.copyBlock(
+        source: bufferC[slot].contents,
+        sourceLeadingDimension: pending.size.N,
+        sourceOrigin: (0, 0),
+        destination: C,
+        destinationLeadingDimension: leadingDimensions.C,
+        destinationOrigin: (pending.origin.M, pending.origin.N),
+        size: (pending.size.M, pending.size.N),
+        elementSize: memoryPrecisions.C.size)
+    }
+
+    for originM in stride(from: 0, to: matrixDimensions.M, by: panel.M) {
+      for originN in stride(from: 0, to: matrixDimensions.N, by: panel.N) {
+        let sizeM = min(panel.M, matrixDimensions.M - originM)
+        let sizeN = min(panel.N, matrixDimensions.N - originN)
+
+        // Retire the previous contents of this C slot.
+        let slotC = outputCursor
+        outputCursor = (outputCursor + 1) % 2
+        if let pending = pendingDownloads[slotC] {
+          download(pending, slot: slotC)
+          pendingDownloads[slotC] = nil
+        }
+        if descriptor.loadPreviousC {
+          Self.copyBlock(
+            source: C,
+            sourceLeadingDimension: leadingDimensions.C,
+            sourceOrigin: (originM, originN),
+            destination: bufferC[slotC].contents,
+            destinationLeadingDimension: sizeN,
+            destinationOrigin: (0, 0),
+            size: (sizeM, sizeN),
+            elementSize: memoryPrecisions.C.size)
+          uploadedBytes += sizeM * sizeN * memoryPrecisions.C.size
+        }
+
+        var lastCommandBuffer: GEMMCommandBuffer?
+        for originK in stride(from: 0, to: matrixDimensions.K, by: panel.K) {
+          let sizeK = min(panel.K, matrixDimensions.K - originK)
+          let keyA = PanelKey(row: originM, column: originK)
+          let keyB = PanelKey(row: originK, column: originN)
+
+          // Reuse a slot that already holds the panel. Otherwise, take the
+          // next slot, after the device is done reading it.
+          let (slotA, uploadA) = stagingA.acquire(keyA)
+          if uploadA {
+            // A is M x K, or K x M when transposed.
+            let rows = transposeState.A ? sizeK : sizeM
+            let columns = transposeState.A ? sizeM : sizeK
+            let origin = transposeState.A
+            ? (originK, originM) : (originM, originK)
+            Self.copyBlock(
+              source: A,
+              sourceLeadingDimension: leadingDimensions.A,
+              sourceOrigin: origin,
+              destination: bufferA[slotA].contents,
+              destinationLeadingDimension: columns,
+              destinationOrigin: (0, 0),
+              size: (rows, columns),
+              elementSize: memoryPrecisions.A.size)
+            uploadedBytes += rows * columns * memoryPrecisions.A.size
+          }
+          let (slotB, uploadB) = stagingB.acquire(keyB)
+          if uploadB {
+            // B is K x N, or N x K when transposed.
+            let rows = transposeState.B ? sizeN : sizeK
+            let columns = transposeState.B ? sizeK : sizeN
+            let origin = transposeState.B
+            ? (originN, originK) : (originK, originN)
+            Self.copyBlock(
+              source: B,
+              sourceLeadingDimension: leadingDimensions.B,
+              sourceOrigin: origin,
+              destination: bufferB[slotB].contents,
+              destinationLeadingDimension: columns,
+              destinationOrigin: (0, 0),
+              size: (rows, columns),
+              elementSize: memoryPrecisions.B.size)
+            uploadedBytes += rows * columns * memoryPrecisions.B.size
+          }
+
+          var gemmDesc = GEMMDescriptor()
+          gemmDesc.accuracyPolicy = descriptor.accuracyPolicy
+          gemmDesc.accumulation = descriptor.accumulation
+          gemmDesc.loadPreviousC = descriptor.loadPreviousC || originK > 0
+          gemmDesc.matrixDimensions = (
+            M: UInt32(sizeM), N: UInt32(sizeN), K: UInt32(sizeK))
+          gemmDesc.memoryPrecisions = memoryPrecisions
+          gemmDesc.transposeState = transposeState
+
+          let commandBuffer = backend.makeCommandBuffer()
+          commandBuffer.encodeGEMM(
+            descriptor: gemmDesc,
+            A: GEMMOperandBinding(bufferA[slotA]),
+            B: GEMMOperandBinding(bufferB[slotB]),
+            C: GEMMOperandBinding(bufferC[slotC]))
+          commandBuffer.commit()
+          stagingA.users[slotA] = commandBuffer
+          stagingB.users[slotB] = commandBuffer
+          lastCommandBuffer = commandBuffer
+        }
+
+        pendingDownloads[slotC] = (
+          lastCommandBuffer!, (originM, originN), (sizeM, sizeN))
+      }
+    }
+
+    // Drain the outstanding output panels.
+    for slot in 0..<2 {
+      if let pending = pendingDownloads[slot] {
+        download(pending, slot: slot)
+      }
+    }
+  }
+
+  /// Copies a 2D block of elements between row-major allocations.
+  static func copyBlock(
+    source: UnsafeRawPointer,
+    sourceLeadingDimension: Int,
+    sourceOrigin: (Int, Int),
+    destination: UnsafeMutableRawPointer,
+    destinationLeadingDimension: Int,
+    destinationOrigin: (Int, Int),
+    size: (Int, Int),
+    elementSize: Int
+  ) {
+    let rowSize = size.1 * elementSize
+    for rowID in 0..<size.0 {
+      var sourceOffset = (sourceOrigin.0 + rowID) * sourceLeadingDimension
+      sourceOffset += sourceOrigin.1
+      var destinationOffset = destinationOrigin.0 + rowID
+      destinationOffset *= destinationLeadingDimension
+      destinationOffset += destinationOrigin.1
+      (destination + destinationOffset * elementSize).copyMemory(
+        from: source + sourceOffset * elementSize, byteCount: rowSize)
+    }
+  }
+}
@@ -0,0 +1,259 @@
+//
+//  GEMMTensorParallelDriver.swift
+//  FlashAttention
+//
+
+import CFlashAttention
+import Foundation
+
+/// Shards a GEMM across worker processes on the same host.
+///
+/// Each call forks `processCount` workers. Every worker computes one shard
+/// with the CPU backend (single-threaded, since Dispatch is unavailable after
+/// `fork`). Workers read A and B through the copy-on-write pages inherited
+/// from the parent, and write results into POSIX shared memory. The parent
+/// allocates every buffer the workers use, including their scratch memory,
+/// because the heap lock may be held by another thread at the time of the
+/// fork.
+///
+/// Column parallelism writes disjoint columns of a shared C. Row parallelism
+/// writes FP32 partial sums into per-worker slots, which are combined with a
+/// binary tree reduction:
+///
+/// ```
+/// round 0:  0 <- 1    2 <- 3    4 <- 5    6 <- 7
+/// round 1:  0 <- 2              4 <- 6
+/// round 2:  0 <- 4
+/// ```
+///
+/// A worker signals its tree parent by writing one byte to a pipe, after it
+/// has absorbed all of its children. If a worker dies, the reader sees
+/// end-of-file and the failure propagates to the host.
+public final class GEMMTensorParallelDriver {
+  public let descriptor: GEMMDescriptor
+  public let parallelism: GEMMTensorParallelism
+  public let processCount: Int
+
+  public init(
+    descriptor: GEMMDescriptor,
+    parallelism: GEMMTensorParallelism,
+    processCount: Int
+  ) {
+    guard descriptor.matrixDimensions != nil,
+          descriptor.memoryPrecisions != nil,
+          descriptor.transposeState != nil else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard processCount > 0 else {
+      fatalError("Process count must be positive.")
+    }
+    self.descriptor = descriptor
+    self.parallelism = parallelism
+    self.processCount = processCount
+  }
+
+  /// Computes C = A * B (or C += A * B), and blocks until every worker has
+  /// exited.
+  public func multiply(
+    A: UnsafeRawPointer,
+    B: UnsafeRawPointer,
+    C: UnsafeMutableRawPointer
+  ) {
+    let matrixDimensions = descriptor.matrixDimensions!
+    let memoryPrecisions = descriptor.memoryPrecisions!
+    let M = Int(matrixDimensions.M)
+    let N = Int(matrixDimensions.N)
+    let leadingC = Int(descriptor.resolvedLeadingDimensions.C)
+
+    // The rows of C in memory. These are the columns of C when transposed.
+    let (storedRows, storedColumns) = descriptor.transposeC ? (N, M) : (M, N)
+    let shards = descriptor.shards(
+      count: processCount, parallelism: parallelism)
+    let bytesC = memoryPrecisions.C.size
+
+    // One scratch slot per worker, for 'CPUGEMMBackend.multiply'.
+    var scratchStride = 0
+    for shard in shards {
+      scratchStride = max(
+        scratchStride,
+        CPUGEMMBackend.scratchLength(descriptor: shard.descriptor))
+    }
+    scratchStride = (scratchStride + 63) / 64 * 64
+    let scratch = SharedMemoryRegion(length: processCount * scratchStride)
+
+    switch parallelism {
+    case .column:
+      let lengthC = max(storedRows * leadingC * bytesC, 1)
+      let region = SharedMemoryRegion(length: lengthC)
+
+      // Only touch the valid elements of each row. The caller's C may end
+      // right after the last element, without the padding of a full row.
+      let rowLength = storedColumns * bytesC
+      if descriptor.loadPreviousC {
+        for row in 0..<storedRows {
+          let offset = row * leadingC * bytesC
+          (region.contents + offset).copyMemory(
+            from: C + offset, byteCount: rowLength)
+        }
+      }
+      launchWorkers { workerID, _ in
+        let shard = shards[workerID]
+        CPUGEMMBackend.multiply(
+          descriptor: shard.descriptor,
+          A: A + shard.offsets.A,
+          B: B + shard.offsets.B,
+          C: region.contents + shard.offsets.C,
+          scratch: scratch.contents + workerID * scratchStride)
+      }
+
+      for row in 0..<storedRows {
+        let offset = row * leadingC * bytesC
+        (C + offset).copyMemory(
+          from: region.contents + offset, byteCount: rowLength)
+      }
+
+    case .row:
+      let partialLength = M * N * 4
+      let region = SharedMemoryRegion(
+        length: max(processCount * partialLength, 1))
+      func partial(_ workerID: Int) -> UnsafeMutablePointer<Float> {
+        let address = region.contents + workerID * partialLength
+        return address.assumingMemoryBound(to: Float.self)
+      }
+
+      launchWorkers { workerID, pipes in
+        // Compute the local partial sum in FP32.
+        var shardDesc = shards[workerID].descriptor
+        shardDesc.loadPreviousC = false
+        shardDesc.memoryPrecisions!.C = .FP32
+        shardDesc.leadingDimensions!.C = UInt32(N)
+        shardDesc.transposeC = false
+        CPUGEMMBackend.multiply(
+          descriptor: shardDesc,
+          A: A + shards[workerID].offsets.A,
+          B: B + shards[workerID].offsets.B,
+          C: partial(workerID),
+          scratch: scratch.contents + workerID * scratchStride)
+
+        // Absorb the children in the reduction tree, then return. Returning
+        // signals the parent.
+        var stride = 1
+        while stride < processCount {
+          guard workerID % (2 * stride) == 0 else {
+            break
+          }
+          let childID = workerID + stride
+          if childID < processCount {
+            pipes.wait(for: childID)
+            let destination = partial(workerID)
+            let source = partial(childID)
+            for i in 0..<(M * N) {
+              destination[i] += source[i]
+            }
+          }
+          stride *= 2
+        }
+      }
+
+      // Worker 0 holds the total. Convert it to the output precision.
+      let total = partial(0)
+      for m in 0..<M {
+        for n in 0..<N {
+          let address = descriptor.transposeC
+          ? n * leadingC + m
+          : m * leadingC + n
+          var value = total[m * N + n]
+          if descriptor.loadPreviousC {
+            value += memoryPrecisions.C.load(C, address)
+          }
+          memoryPrecisions.C.store(value, C, address)
+        }
+      }
+    }
+  }
+}
+
+extension GEMMTensorParallelDriver {
+  /// One pipe per worker, used to announce that the worker has finished.
+  struct CompletionPipes {
+    var readEnds: [Int32] = []
+    var writeEnds: [Int32] = []
+
+    /// Blocks until the worker finishes. Exits the process if the worker
+    /// died without signaling.
+    func wait(for workerID: Int) {
+      var byte: UInt8 = 0
+      while true {
+        let result = read(readEnds[workerID], &byte, 1)
+        if result == 1 {
+          return
+        } else if result < 0, errno == EINTR {
+          continue
+        } else {
+          _exit(1)
+        }
+      }
+    }
+
+    func signal(from workerID: Int) {
+      var byte: UInt8 = 1
+      while write(writeEnds[workerID], &byte, 1) < 0, errno == EINTR { }
+    }
+  }
+
+  /// Forks the workers, runs `body` in each, and waits for all of them.
+  ///
+  /// The body runs in the child process. It must not use Dispatch, Metal,
+  /// or any lock that another thread of the parent might have held.
+  func launchWorkers(_ body: (Int, CompletionPipes) -> Void) {
+    var pipes = CompletionPipes()
+    for _ in 0..<processCount {
+      var fileDescriptors: [Int32] = [0, 0]
+      guard pipe(&fileDescriptors) == 0 else {
+        fatalError("Could not create pipe: errno \(errno)")
+      }
+      pipes.readEnds.append(fileDescriptors[0])
+      pipes.writeEnds.append(fileDescriptors[1])
+    }
+    defer {
+      for fileDescriptor in pipes.readEnds {
+        close(fileDescriptor)
+      }
+    }
+
+    var processIDs: [pid_t] = []
+    for workerID in 0..<processCount {
+      let processID = mfa_fork()
+      guard processID >= 0 else {
+        fatalError("Could not fork worker: errno \(errno)")
+      }
+      if processID == 0 {
+        // Only this worker may write to its pipe. Closing the other write
+        // ends lets readers detect a dead worker through end-of-file.
+        for (otherID, fileDescriptor) in pipes.writeEnds.enumerated()
+        where otherID != workerID {
+          close(fileDescriptor)
+        }
+        body(workerID, pipes)
+        pipes.signal(from: workerID)
+        _exit(0)
+      }
+      processIDs.append(processID)
+    }
+    for fileDescriptor in pipes.writeEnds {
+      close(fileDescriptor)
+    }
+
+    var failed = false
+    for processID in processIDs {
+      var status: Int32 = 0
+      while waitpid(processID, &status, 0) < 0, errno == EINTR { }
+      if status != 0 {
+        failed = true
+      }
+    }
+    guard !failed else {
+      fatalError("A tensor-parallel worker failed.")
+    }
+  }
+}
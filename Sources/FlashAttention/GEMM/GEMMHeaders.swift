@@ -536,6 +536,71 @@ namespace metal
   
   // Add the last section of the header.
   output += """
+    // Loads the elements inside 'matrix_bounds', and zero elsewhere. The
+    // bounds are relative to 'src', in the untransposed coordinate space.
+    // They may be negative, when every element is out of bounds.
+    //
+    // Each element is loaded and checked separately. Therefore, this is
+    // slower than 'load'; only use it at the edges of a matrix.
+    template <typename U>
+    METAL_FUNC void load_predicated(const device U *src, uint elements_per_row, ushort2 matrix_origin, int2 matrix_bounds, bool transpose_matrix = false) {
+      vec<T, 2> registerForm(0);
+#pragma clang loop unroll(full)
+      for (ushort lane = 0; lane < 2; ++lane) {
+        int2 position = int2(matrix_origin) + int2(lane, 0);
+        if (all(position < matrix_bounds)) {
+          uint address;
+          if (transpose_matrix) {
+            address = uint(position.x) * elements_per_row + uint(position.y);
+          } else {
+            address = uint(position.y) * elements_per_row + uint(position.x);
+          }
+          registerForm[lane] = T(src[address]);
+        }
+      }
+      *(thread_elements()) = registerForm;
+    }
+    
+    // Stores the elements inside 'matrix_bounds', and skips the rest.
+    template <typename U>
+    METAL_FUNC void store_predicated(device U *dst, uint elements_per_row, ushort2 matrix_origin, int2 matrix_bounds, bool transpose_matrix = false) {
+      vec<T, 2> registerForm = *(thread_elements());
+#pragma clang loop unroll(full)
+      for (ushort lane = 0; lane < 2; ++lane) {
+        int2 position = int2(matrix_origin) + int2(lane, 0);
+        if (all(position < matrix_bounds)) {
+          uint address;
+          if (transpose_matrix) {
+            address = uint(position.x) * elements_per_row + uint(position.y);
+          } else {
+            address = uint(position.y) * elements_per_row + uint(position.x);
+          }
+          dst[address] = U(registerForm[lane]);
+        }
+      }
+    }
+    
+    // Truncates to BF16, like 'store_bfloat'. A converting store would round
+    // to nearest, so the edges of a matrix would round differently from the
+    // interior.
+    METAL_FUNC void store_predicated(device bfloat *dst, uint elements_per_row, ushort2 matrix_origin, int2 matrix_bounds, bool transpose_matrix = false) {
+      vec<T, 2> registerForm = *(thread_elements());
+#pragma clang loop unroll(full)
+      for (ushort lane = 0; lane < 2; ++lane) {
+        int2 position = int2(matrix_origin) + int2(lane, 0);
+        if (all(position < matrix_bounds)) {
+          uint address;
+          if (transpose_matrix) {
+            address = uint(position.x) * elements_per_row + uint(position.y);
+          } else {
+            address = uint(position.y) * elements_per_row + uint(position.x);
+          }
+          float value = float(registerForm[lane]);
+          dst[address] = as_type<bfloat2>(value)[1];
+        }
+      }
+    }
+    
     template <typename U, typename V>
     METAL_FUNC void multiply(simdgroup_matrix_storage<U> a, simdgroup_matrix_storage<V> b, bool accumulate = true) {
       if (!accumulate) {
@@ -553,3 +618,78 @@ namespace metal
   return output
 }
 
+/// Create the source code for 'load_fragment' and 'store_fragment'.
+///
+/// These access a single 8x8 fragment of a densely packed, row-major matrix,
+/// directly from device memory. They serve the kernels that skip threadgroup
+/// memory entirely.
+func createFragmentAccessors() -> String {
+  """
+
+// Loads the 8x8 fragment at 'origin' of a row-major matrix. Fragments that
+// overhang the matrix take the predicated path, which zero-fills.
+template <typename U>
+METAL_FUNC void load_fragment(
+  thread simdgroup_matrix_storage<float> *fragment,
+  const device U *src, uint2 dimensions, uint2 origin, ushort2 morton_offset
+) {
+  uint2 position = origin + uint2(morton_offset);
+  auto thread_src = simdgroup_matrix_storage<U>::apply_offset(
+    src, dimensions.x, position);
+  if (all(origin + 8 <= dimensions)) {
+    fragment->load(thread_src, dimensions.x, ushort2(0));
+  } else {
+    int2 bounds = int2(dimensions) - int2(position);
+    fragment->load_predicated(thread_src, dimensions.x, ushort2(0), bounds);
+  }
+}
+
+METAL_FUNC void load_fragment(
+  thread simdgroup_matrix_storage<float> *fragment,
+  const device bfloat *src, uint2 dimensions, uint2 origin,
+  ushort2 morton_offset
+) {
+  uint2 position = origin + uint2(morton_offset);
+  auto thread_src = simdgroup_matrix_storage<bfloat>::apply_offset(
+    src, dimensions.x, position);
+  if (all(origin + 8 <= dimensions)) {
+    fragment->load_bfloat(thread_src, dimensions.x, ushort2(0));
+  } else {
+    int2 bounds = int2(dimensions) - int2(position);
+    fragment->load_predicated(thread_src, dimensions.x, ushort2(0), bounds);
+  }
+}
+
+template <typename U>
+METAL_FUNC void store_fragment(
+  thread simdgroup_matrix_storage<float> *fragment,
+  device U *dst, uint2 dimensions, uint2 origin, ushort2 morton_offset
+) {
+  uint2 position = origin + uint2(morton_offset);
+  auto thread_dst = simdgroup_matrix_storage<U>::apply_offset(
+    dst, dimensions.x, position);
+  if (all(origin + 8 <= dimensions)) {
+    fragment->store(thread_dst, dimensions.x, ushort2(0));
+  } else {
+    int2 bounds = int2(dimensions) - int2(position);
+    fragment->store_predicated(thread_dst, dimensions.x, ushort2(0), bounds);
+  }
+}
+
+METAL_FUNC void store_fragment(
+  thread simdgroup_matrix_storage<float> *fragment,
+  device bfloat *dst, uint2 dimensions, uint2 origin, ushort2 morton_offset
+) {
+  uint2 position = origin + uint2(morton_offset);
+  auto thread_dst = simdgroup_matrix_storage<bfloat>::apply_offset(
+    dst, dimensions.x, position);
+  if (all(origin + 8 <= dimensions)) {
+    fragment->store_bfloat(thread_dst, dimensions.x, ushort2(0));
+  } else {
+    int2 bounds = int2(dimensions) - int2(position);
+    fragment->store_predicated(thread_dst, dimensions.x, ushort2(0), bounds);
+  }
+}
+
+"""
+}
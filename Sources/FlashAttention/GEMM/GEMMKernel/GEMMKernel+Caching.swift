@@ -36,8 +36,9 @@ extension GEMMKernel {
   func createInitializeC() -> String {
     """
     
-    simdgroup_matrix_storage<\(registerName("C"))> C_sram[
+    simdgroup_matrix_storage<\(accumulatorName)> C_sram[
       \((registerM / 8) * (registerN / 8))];
+    \(createInitializeBlockAccumulators())
     
     if (load_previous_C) {
       \(createLoadC())
@@ -48,7 +49,7 @@ extension GEMMKernel {
         for (ushort n = 0; n < \(registerN); n += 8) {
           ushort2 origin(n, m);
           auto C = get_sram(C_sram, \(registerN), origin);
-          *C = simdgroup_matrix_storage<\(registerName("C"))>(0);
+          *C = simdgroup_matrix_storage<\(accumulatorName)>(0);
         }
       }
     }
@@ -72,7 +73,7 @@ if (\(directAccessCondition)) {
   uint2 C_offset(N_offset + offset_in_group.x,
                  M_offset + offset_in_group.y);
   auto C_dst = simdgroup_matrix_storage<\(memoryName("C"))>::apply_offset(
-    C, \(leadingDimension("C")), C_offset);
+    C, \(leadingDimension("C")), C_offset, C_trans);
   
   // Write the accumulator to device memory.
 #pragma clang loop unroll(full)
@@ -81,7 +82,8 @@ if (\(directAccessCondition)) {
     for (ushort n = 0; n < \(registerN); n += 8) {
       ushort2 origin(n, m);
       auto C = get_sram(C_sram, \(registerN), origin);
-      C->\(loadFunctionC)(C_dst, \(leadingDimension("C")), origin);
+      C->\(loadFunctionC)(
+        C_dst, \(leadingDimension("C")), origin, C_trans);
     }
   }
 } else {
@@ -89,7 +91,7 @@ if (\(directAccessCondition)) {
   auto C_block = (threadgroup \(memoryName("C"))*)(threadgroup_block);
   auto C_block_dst =
   simdgroup_matrix_storage<\(memoryName("C"))>::apply_offset(
-    C_block, \(leadingBlockDimensions.C), offset_in_group);
+    C_block, \(leadingBlockDimensions.C), offset_in_group, C_trans);
   
   // Launch the async copy from threadgroup to device memory.
   if (sidx == 0 && lane_id == 0) {
@@ -97,12 +99,12 @@ if (\(directAccessCondition)) {
     ushort2 C_tile(min(uint(N_group), N - C_offset.x),
                    min(uint(M_group), M - C_offset.y));
     auto C_dst = simdgroup_matrix_storage<\(memoryName("C"))>::apply_offset(
-      C, \(leadingDimension("C")), C_offset);
+      C, \(leadingDimension("C")), C_offset, C_trans);
     
     simdgroup_event event;
     event.async_copy(
       C_block, \(leadingBlockDimensions.C), C_tile,
-      C_dst, \(leadingDimension("C")), C_tile);
+      C_dst, \(leadingDimension("C")), C_tile, C_trans);
     simdgroup_event::wait(1, &event);
   }
   threadgroup_barrier(mem_flags::mem_threadgroup);
@@ -115,7 +117,7 @@ if (\(directAccessCondition)) {
       ushort2 origin(n, m);
       auto C = get_sram(C_sram, \(registerN), origin);
       C->\(loadFunctionC)(
-        C_block_dst, \(leadingBlockDimensions.C), origin);
+        C_block_dst, \(leadingBlockDimensions.C), origin, C_trans);
     }
   }
   threadgroup_barrier(mem_flags::mem_threadgroup);
@@ -140,7 +142,7 @@ if (\(directAccessCondition)) {
   uint2 C_offset(N_offset + offset_in_group.x,
                  M_offset + offset_in_group.y);
   auto C_dst = simdgroup_matrix_storage<\(memoryName("C"))>::apply_offset(
-    C, \(leadingDimension("C")), C_offset);
+    C, \(leadingDimension("C")), C_offset, C_trans);
   
   // Write the accumulator to device memory.
 #pragma clang loop unroll(full)
@@ -149,7 +151,8 @@ if (\(directAccessCondition)) {
     for (ushort n = 0; n < \(registerN); n += 8) {
       ushort2 origin(n, m);
       auto C = get_sram(C_sram, \(registerN), origin);
-      C->\(storeFunctionC)(C_dst, \(leadingDimension("C")), origin);
+      C->\(storeFunctionC)(
+        C_dst, \(leadingDimension("C")), origin, C_trans);
     }
   }
 } else {
@@ -157,7 +160,7 @@ if (\(directAccessCondition)) {
   auto C_block = (threadgroup \(memoryName("C"))*)(threadgroup_block);
   auto C_block_dst =
   simdgroup_matrix_storage<\(memoryName("C"))>::apply_offset(
-    C_block, \(leadingBlockDimensions.C), offset_in_group);
+    C_block, \(leadingBlockDimensions.C), offset_in_group, C_trans);
   threadgroup_barrier(mem_flags::mem_threadgroup);
   
   // Write the accumulator to threadgroup memory.
@@ -168,7 +171,7 @@ if (\(directAccessCondition)) {
       ushort2 origin(n, m);
       auto C = get_sram(C_sram, \(registerN), origin);
       C->\(storeFunctionC)(
-        C_block_dst, \(leadingBlockDimensions.C), origin);
+        C_block_dst, \(leadingBlockDimensions.C), origin, C_trans);
     }
   }
   threadgroup_barrier(mem_flags::mem_threadgroup);
@@ -179,7 +182,7 @@ if (\(directAccessCondition)) {
     ushort2 C_tile(min(uint(N_group), N - C_offset.x),
                    min(uint(M_group), M - C_offset.y));
     auto C_dst = simdgroup_matrix_storage<\(memoryName("C"))>::apply_offset(
-      C, \(leadingDimension("C")), C_offset);
+      C, \(leadingDimension("C")), C_offset, C_trans);
     
     // If we shift successfully, the garbage zone moves from the bottom right
     // to the top left.
@@ -192,13 +195,13 @@ if (\(directAccessCondition)) {
         C_block_shift.x = N_shift;
       }
       C_block = simdgroup_matrix_storage<\(memoryName("C"))>::apply_offset(
-        C_block, \(leadingBlockDimensions.C), C_block_shift);
+        C_block, \(leadingBlockDimensions.C), C_block_shift, C_trans);
     }
     
     simdgroup_event event;
     event.async_copy(
       C_dst, \(leadingDimension("C")), C_tile,
-      C_block, \(leadingBlockDimensions.C), C_tile);
+      C_block, \(leadingBlockDimensions.C), C_tile, C_trans);
   }
 }
 """
@@ -12,6 +12,10 @@ extension GEMMKernel {
     var leadingDimensionB: String?
     var loadFunctionA: String?
     var loadFunctionB: String?
+    
+    /// Whether to check every element against the matrix bounds. Only
+    /// supported for device memory.
+    var predicated: Bool = false
   }
   
   func createMultiply(descriptor: MultiplyDescriptor) -> String {
@@ -23,13 +27,26 @@ extension GEMMKernel {
       fatalError("Descriptor was incomplete.")
     }
     
+    // The predicated overload takes the bounds of each operand, and replaces
+    // the load functions with one that zero-fills out-of-bounds elements.
+    var boundsArguments = ""
+    var loadA = "\(loadFunctionA)(A_src, \(leadingDimensionA), ushort2(k, m)"
+    var loadB = "\(loadFunctionB)(B_src, \(leadingDimensionB), ushort2(n, k)"
+    if descriptor.predicated {
+      boundsArguments = "int2 A_bounds,\nint2 B_bounds,\n"
+      loadA = "load_predicated(A_src, \(leadingDimensionA), ushort2(k, m), "
+      loadA += "A_bounds"
+      loadB = "load_predicated(B_src, \(leadingDimensionB), ushort2(n, k), "
+      loadB += "B_bounds"
+    }
+    
     return """
 
 // One multiply-accumulate loop iteration, or 8 dot products.
 METAL_FUNC void multiply_accumulate(
 const \(addressSpace) \(memoryName("A")) *A_src,
 const \(addressSpace) \(memoryName("B")) *B_src,
-thread simdgroup_matrix_storage<\(registerName("A"))> *A_sram,
+\(boundsArguments)thread simdgroup_matrix_storage<\(registerName("A"))> *A_sram,
 thread simdgroup_matrix_storage<\(registerName("B"))> *B_sram,
 thread simdgroup_matrix_storage<\(registerName("C"))> *C_sram,
 ushort k
@@ -38,13 +55,13 @@ ushort k
 for (ushort m = 0; m < \(registerM); m += 8) {
   ushort2 origin(0, m);
   auto A = get_sram(A_sram, 8, origin);
-  A->\(loadFunctionA)(A_src, \(leadingDimensionA), ushort2(k, m), A_trans);
+  A->\(loadA), A_trans);
 }
 #pragma clang loop unroll(full)
 for (ushort n = 0; n < \(registerN); n += 8) {
   ushort2 origin(n, 0);
   auto B = get_sram(B_sram, \(registerN), origin);
-  B->\(loadFunctionB)(B_src, \(leadingDimensionB), ushort2(n, k), B_trans);
+  B->\(loadB), B_trans);
 }
 #pragma clang loop unroll(full)
 for (ushort m = 0; m < \(registerM); m += 8) {
@@ -99,6 +116,12 @@ METAL_FUNC thread simdgroup_matrix_storage<T>* get_sram(
       multiplyDesc.leadingDimensionB = leadingDimension("B")
       output += createMultiply(descriptor: multiplyDesc)
       
+      if !preferAsyncLoad {
+        multiplyDesc.predicated = true
+        output += createMultiply(descriptor: multiplyDesc)
+        multiplyDesc.predicated = false
+      }
+      
       multiplyDesc.addressSpace = "threadgroup"
       multiplyDesc.leadingDimensionA = "\(leadingBlockDimensions.A)"
       multiplyDesc.leadingDimensionB = "\(leadingBlockDimensions.B)"
@@ -115,31 +138,18 @@ extension GEMMKernel {
     if preferAsyncLoad {
       asyncIterationsStart = "0"
     } else {
-      asyncIterationsStart = "(K - (K % K_group))"
+      asyncIterationsStart = "K"
     }
     let paddedCeilingK = "(K + K_remainder_padded - K_remainder)"
     
     return """
 
 // Perform the iterations where async copy is avoided.
-for (uint k = 0; k < \(asyncIterationsStart); k += 8) {
-  uint2 A_offset(k, M_offset);
-  uint2 B_offset(N_offset, k);
-  A_offset += uint2(morton_offset.x, offset_in_group.y);
-  B_offset += uint2(offset_in_group.x, morton_offset.y);
-  
-  auto A_src = simdgroup_matrix_storage<\(memoryName("A"))>::apply_offset(
-    A, \(leadingDimension("A")), A_offset, A_trans);
-  auto B_src = simdgroup_matrix_storage<\(memoryName("B"))>::apply_offset(
-    B, \(leadingDimension("B")), B_offset, B_trans);
-
-  simdgroup_matrix_storage<\(registerName("A"))> A_sram[
-    \(registerM / 8) * (8 / 8)];
-  simdgroup_matrix_storage<\(registerName("B"))> B_sram[
-    (8 / 8) * \(registerN / 8)];
-  multiply_accumulate(A_src, B_src,
-                      A_sram, B_sram, C_sram, 0);
+for (uint k = 0; k < \(syncIterationsEnd); k += 8) {
+  \(createDirectIteration(predicated: edgeTileCondition))
+  \(createFoldC(condition: "(k + 8) % K_group == 0"))
 }
+\(createDirectRemainder())
 
 // Perform the iterations where async copy is used.
 for (uint k = \(asyncIterationsStart); k < K; k += K_group) {
@@ -194,7 +204,7 @@ for (uint k = \(asyncIterationsStart); k < K; k += K_group) {
 #pragma clang loop unroll(full)
   for (ushort k = 0; k < K_remainder_padded; k += 8) {
     multiply_accumulate(A_block_src, B_block_src,
-                        A_sram, B_sram, C_sram, k);
+                        A_sram, B_sram, \(innerAccumulator), k);
   }
   
   // Will there be any iterations after this one?
@@ -203,12 +213,196 @@ for (uint k = \(asyncIterationsStart); k < K; k += K_group) {
 #pragma clang loop unroll(full)
     for (ushort k = K_remainder_padded; k < K_group; k += 8) {
       multiply_accumulate(A_block_src, B_block_src,
-                          A_sram, B_sram, C_sram, k);
+                          A_sram, B_sram, \(innerAccumulator), k);
     }
     threadgroup_barrier(mem_flags::mem_threadgroup);
   }
+  \(createFoldC(condition: "true"))
 }
 
 """
   }
 }
+
+extension GEMMKernel {
+  // The end of the loop over device memory.
+  //
+  // Without async loads, the loop covers all of K, except a partial
+  // iteration of fewer than 8 elements.
+  fileprivate var syncIterationsEnd: String {
+    if preferAsyncLoad {
+      return "0"
+    } else {
+      return "(K - (K % 8))"
+    }
+  }
+  
+  // Whether a block may overhang the edge of M or N.
+  //
+  // If the matrix spans at least one block, the final block is shifted
+  // within bounds. Otherwise, some rows or columns must be predicated. This
+  // only depends on function constants, so the compiler removes the branch.
+  fileprivate var edgeTileCondition: String {
+    "(M < M_group) || (N < N_group)"
+  }
+  
+  // One iteration of 8 dot products, loading straight from device memory.
+  fileprivate func createDirectIteration(predicated: String) -> String {
+    let multiply = """
+    multiply_accumulate(A_src, B_src,
+                        A_sram, B_sram, \(innerAccumulator), 0);
+    """
+    
+    var accumulate: String
+    if preferAsyncLoad {
+      accumulate = multiply
+    } else {
+      accumulate = """
+      
+      if (\(predicated)) {
+        int2 A_bounds = int2(K, M) - int2(A_offset);
+        int2 B_bounds = int2(N, K) - int2(B_offset);
+        multiply_accumulate(A_src, B_src, A_bounds, B_bounds,
+                            A_sram, B_sram, \(innerAccumulator), 0);
+      } else {
+        \(multiply)
+      }
+      
+      """
+    }
+    
+    return """
+    
+    uint2 A_offset(k, M_offset);
+    uint2 B_offset(N_offset, k);
+    A_offset += uint2(morton_offset.x, offset_in_group.y);
+    B_offset += uint2(offset_in_group.x, morton_offset.y);
+    
+    auto A_src = simdgroup_matrix_storage<\(memoryName("A"))>::apply_offset(
+      A, \(leadingDimension("A")), A_offset, A_trans);
+    auto B_src = simdgroup_matrix_storage<\(memoryName("B"))>::apply_offset(
+      B, \(leadingDimension("B")), B_offset, B_trans);
+    
+    simdgroup_matrix_storage<\(registerName("A"))> A_sram[
+      \(registerM / 8) * (8 / 8)];
+    simdgroup_matrix_storage<\(registerName("B"))> B_sram[
+      (8 / 8) * \(registerN / 8)];
+    \(accumulate)
+    
+    """
+  }
+  
+  // The final K % 8 elements, with predicated loads. Then, fold the last
+  // partial block of a blocked accumulator.
+  fileprivate func createDirectRemainder() -> String {
+    guard !preferAsyncLoad else {
+      return ""
+    }
+    
+    return """
+    
+    if (K % 8 != 0) {
+      uint k = K - (K % 8);
+      \(createDirectIteration(predicated: "true"))
+    }
+    \(createFoldC(condition: "true"))
+    
+    """
+  }
+}
+
+extension GEMMKernel {
+  // Declares the FP16 block accumulator, and the Kahan compensation terms.
+  func createInitializeBlockAccumulators() -> String {
+    guard accumulation != .direct else {
+      return ""
+    }
+    
+    var initializeCompensation: String = ""
+    var declareCompensation: String = ""
+    if accumulation == .compensated {
+      declareCompensation = """
+      
+      simdgroup_matrix_storage<float> C_compensation_sram[
+        \((registerM / 8) * (registerN / 8))];
+      
+      """
+      initializeCompensation = """
+      
+      auto C_compensation = get_sram(
+        C_compensation_sram, \(registerN), origin);
+      *C_compensation = simdgroup_matrix_storage<float>(0);
+      
+      """
+    }
+    
+    return """
+    
+    simdgroup_matrix_storage<\(registerName("C"))> C_block_sram[
+      \((registerM / 8) * (registerN / 8))];
+    \(declareCompensation)
+    
+    #pragma clang loop unroll(full)
+    for (ushort m = 0; m < \(registerM); m += 8) {
+      #pragma clang loop unroll(full)
+      for (ushort n = 0; n < \(registerN); n += 8) {
+        ushort2 origin(n, m);
+        auto C_block = get_sram(C_block_sram, \(registerN), origin);
+        *C_block = simdgroup_matrix_storage<\(registerName("C"))>(0);
+        \(initializeCompensation)
+      }
+    }
+    
+    """
+  }
+  
+  // Adds the FP16 block sum into the FP32 accumulator, then restarts the
+  // block. Kahan summation carries the rounding error of each addition into
+  // the next one.
+  func createFoldC(condition: String) -> String {
+    guard accumulation != .direct else {
+      return ""
+    }
+    
+    var foldStatement: String
+    if accumulation == .compensated {
+      foldStatement = """
+      
+      auto C_compensation = get_sram(
+        C_compensation_sram, \(registerN), origin);
+      float2 compensation = *(C_compensation->thread_elements());
+      float2 y = block_sum - compensation;
+      float2 t = sum + y;
+      *(C_compensation->thread_elements()) = (t - sum) - y;
+      *(C->thread_elements()) = t;
+      
+      """
+    } else {
+      foldStatement = """
+      
+      *(C->thread_elements()) = sum + block_sum;
+      
+      """
+    }
+    
+    return """
+    
+    if (\(condition)) {
+      #pragma clang loop unroll(full)
+      for (ushort m = 0; m < \(registerM); m += 8) {
+        #pragma clang loop unroll(full)
+        for (ushort n = 0; n < \(registerN); n += 8) {
+          ushort2 origin(n, m);
+          auto C = get_sram(C_sram, \(registerN), origin);
+          auto C_block = get_sram(C_block_sram, \(registerN), origin);
+          float2 sum = *(C->thread_elements());
+          float2 block_sum = float2(*(C_block->thread_elements()));
+          \(foldStatement)
+          *C_block = simdgroup_matrix_storage<\(registerName("C"))>(0);
+        }
+      }
+    }
+    
+    """
+  }
+}
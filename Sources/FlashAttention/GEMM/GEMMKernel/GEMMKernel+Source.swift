@@ -32,6 +32,7 @@ using namespace metal;
 //
 // C: the output matrix, alternatively the dot product accumulator
 // - dimensions: M x N
+//               N x M (transposed)
 // - memory precision: memC
 // - register precision: regC
 //
@@ -129,6 +130,7 @@ constant bool load_previous_C [[function_constant(10)]];
 // Whether each matrix is transposed.
 constant bool A_trans = \(transposeState.A);
 constant bool B_trans = \(transposeState.B);
+constant bool C_trans = \(transposeC);
 
 // Define the memory layout of the matrix block.
 constant ushort M_group = \(blockDimensions.M);
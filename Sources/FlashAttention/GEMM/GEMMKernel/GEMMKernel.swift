@@ -5,9 +5,10 @@
 //  Created by Philip Turner on 6/21/24.
 //
 
-import protocol Metal.MTLLibrary
-
 public struct GEMMKernel {
+  // How the dot products are summed along K.
+  var accumulation: GEMMAccumulation
+  
   // Categorical attributes for each operand.
   var memoryPrecisions: (
     A: GEMMOperandPrecision, B: GEMMOperandPrecision, C: GEMMOperandPrecision)
@@ -16,6 +17,7 @@ public struct GEMMKernel {
   var registerPrecisions: (
     A: GEMMOperandPrecision, B: GEMMOperandPrecision, C: GEMMOperandPrecision)
   var transposeState: (A: Bool, B: Bool)
+  var transposeC: Bool
   
   // Layout of the data in registers and threadgroup memory.
   public var blockDimensions: (M: UInt16, N: UInt16, K: UInt16)
@@ -33,6 +35,7 @@ public struct GEMMKernel {
       fatalError("Descriptor was incomplete: \(descriptor)")
     }
     
+    self.accumulation = descriptor.accumulation
     self.memoryPrecisions = memoryPrecisions
     self.preferAsyncLoad = descriptor.preferAsyncLoad
     self.preferAsyncStore = preferAsyncStore
@@ -41,6 +44,7 @@ public struct GEMMKernel {
     self.blockDimensions = blockDimensions
     self.splits = splits
     self.transposeState = transposeState
+    self.transposeC = descriptor.transposeC
     
     // Validate the correctness of register precisions.
     func checkOperandPair(
@@ -101,6 +105,13 @@ public struct GEMMKernel {
       // down execution speed on both M1/M2 and M3+.
       fatalError("BF16 cannot be used as the register precision for C.")
     }
+    if accumulation != .direct {
+      // Blocked accumulation exists to recover accuracy for the FP16
+      // accumulator. An FP32 accumulator gains nothing from it.
+      guard registerPrecisions.C == .FP16 else {
+        fatalError("Blocked accumulation requires an FP16 accumulator.")
+      }
+    }
     
     // Retrieve the "padded" block dimensions, otherwise compute analytically
     // from the true block dimensions.
@@ -144,7 +155,7 @@ public struct GEMMKernel {
       untransposedColumns: blockDimensions.N)
     leadingBlockDimensions.C = chooseLeadingBlockDimension(
       specifiedLeading: descriptor.leadingBlockDimensions?.C,
-      transposeState: false,
+      transposeState: transposeC,
       untransposedRows: blockDimensions.M,
       untransposedColumns: blockDimensions.N)
     
@@ -165,6 +176,25 @@ extension GEMMKernel {
     }
   }
   
+  // The precision of the accumulator that lives across the entire K loop.
+  // With blocked accumulation, this is the FP32 outer accumulator.
+  var accumulatorName: String {
+    if accumulation == .direct {
+      return registerName("C")
+    } else {
+      return GEMMOperandPrecision.FP32.name
+    }
+  }
+  
+  // The accumulator passed to 'multiply_accumulate'.
+  var innerAccumulator: String {
+    if accumulation == .direct {
+      return "C_sram"
+    } else {
+      return "C_block_sram"
+    }
+  }
+  
   func registerName(_ operand: String) -> String {
     switch operand {
     case "A": return registerPrecisions.A.name
@@ -179,7 +209,7 @@ extension GEMMKernel {
     switch operand {
     case "A": return transposeState.A
     case "B": return transposeState.B
-    case "C": return false
+    case "C": return transposeC
     default: fatalError("Unrecognized operand.")
     }
   }
@@ -5,8 +5,6 @@
 //  Created by Philip Turner on 6/21/24.
 //
 
-import protocol Metal.MTLDevice
-
 /// A configuration for a GEMM kernel.
 ///
 /// The information in this data structure is enough to uniquely identify the
@@ -19,6 +17,12 @@ import protocol Metal.MTLDevice
 /// a shader source, provided a configuration. The user is responsible for
 /// choosing that configuration.
 public struct GEMMKernelDescriptor {
+  /// How the dot products are summed along K. The default is `.direct`.
+  ///
+  /// The blocked modes require the register precision of C to be FP16. The
+  /// FP16 accumulators restart every K_group block, and fold into FP32.
+  public var accumulation: GEMMAccumulation = .direct
+  
   /// Required. The number of matrix elements spanned by each threadgroup.
   /// - Parameter M: Number of output columns spanned.
   /// - Parameter N: Number of output rows spanned.
@@ -132,10 +136,11 @@ public struct GEMMKernelDescriptor {
   /// matrix multiplication loop.
   ///
   /// The default value is `true`. Async copies improve performance on Apple7
-  /// and Apple8, but harm performance on Apple9 and later. However, they are
-  /// essential for correctness when reading from the edges of unaligned
-  /// matrices. Setting the value to `false` means skipping async copies when
-  /// doing so will not change the final result.
+  /// and Apple8, but harm performance on Apple9 and later. Setting the value
+  /// to `false` skips async copies entirely. The edges of unaligned matrices
+  /// (the final K % 8 elements, and blocks that overhang M or N) are then
+  /// read with predicated loads, which substitute zero for every element
+  /// outside the matrix.
   public var preferAsyncLoad: Bool = true
   
   /// Required. Whether async copies will improve performance when storing the
@@ -175,12 +180,19 @@ public struct GEMMKernelDescriptor {
   /// Required. Whether each of the inputs deviates from row-major order.
   public var transposeState: (A: Bool, B: Bool)?
   
+  /// Whether the output is stored column-major (as C^T). The default is
+  /// `false`. The accumulator is transposed while it is written, in both
+  /// the direct and the async store paths, so no separate transpose kernel
+  /// is needed.
+  public var transposeC: Bool = false
+  
   public init() {
     
   }
 }
 
 struct GEMMKernelKey: Equatable, Hashable {
+  var accumulation: UInt8
   var blockDimensions: SIMD3<UInt16>
   var leadingBlockDimensions: SIMD3<UInt16>
   var memoryPrecisions: SIMD3<UInt16>
@@ -189,8 +201,10 @@ struct GEMMKernelKey: Equatable, Hashable {
   var registerPrecisions: SIMD3<UInt16>
   var splits: SIMD2<UInt16>
   var transposeState: SIMD2<UInt8>
+  var transposeC: UInt8
   
   init(copying source: GEMMKernelDescriptor) {
+    accumulation = source.accumulation.rawValue
     blockDimensions = Self.createBlockDimensions(source.blockDimensions)
     leadingBlockDimensions = Self.createBlockDimensions(
       source.leadingBlockDimensions)
@@ -205,6 +219,7 @@ struct GEMMKernelKey: Equatable, Hashable {
       splits[1] = N
     }
     transposeState = Self.createTransposeState(source.transposeState)
+    transposeC = Self.createBoolean(source.transposeC)
   }
   
   @_transparent // performance in -Ounchecked
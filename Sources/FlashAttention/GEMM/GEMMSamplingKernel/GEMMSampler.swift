@@ -0,0 +1,134 @@
+//
+//  GEMMSampler.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+// Matches the layout of 'gemm_sampling_arguments'.
+struct GEMMSamplingArguments {
+  var sequenceCount: UInt32
+  var logitScale: Float
+  var topP: Float
+  var seed: UInt32
+  var step: UInt32
+}
+
+/// The LM head and the sampler of a decoder, on the GPU.
+///
+/// The unembedding matrix stays resident. Each call turns the hidden states
+/// of a batch of sequences into one token each, in two dispatches, without
+/// writing the logits to memory.
+public final class GEMMSampler {
+  public let descriptor: GEMMSamplingDescriptor
+  public let commandQueue: MTLCommandQueue
+
+  /// W, in the weight precision.
+  public let weights: MTLBuffer
+
+  /// - Parameter weights: W, K x N and row-major.
+  public init(
+    descriptor: GEMMSamplingDescriptor,
+    weights: [Float],
+    commandQueue: MTLCommandQueue = MTLContext.global.commandQueue
+  ) {
+    guard let (K, N) = descriptor.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard weights.count == Int(K) * Int(N) else {
+      fatalError("Weights had the wrong size.")
+    }
+    self.descriptor = descriptor
+    self.commandQueue = commandQueue
+
+    let precision = descriptor.weightPrecision
+    guard let buffer = commandQueue.device.makeBuffer(
+      length: max(weights.count * precision.size, 4)) else {
+      fatalError("Could not allocate buffer.")
+    }
+    for i in weights.indices {
+      precision.store(weights[i], buffer.contents(), i)
+    }
+    self.weights = buffer
+  }
+
+  /// Draws one token per sequence.
+  ///
+  /// - Parameter hidden: One row of K elements per sequence, FP32.
+  public func sample(
+    hidden: [Float], parameters: GEMMSamplingParameters
+  ) -> [UInt32] {
+    let hiddenDimension = Int(descriptor.matrixDimensions!.K)
+    let sequenceCount = hidden.count / hiddenDimension
+    guard hidden.count == sequenceCount * hiddenDimension else {
+      fatalError("Hidden states had the wrong size.")
+    }
+    guard sequenceCount > 0 else {
+      return []
+    }
+
+    GEMMSamplingKernel.register(descriptor: descriptor)
+    let (kernel, tilePipeline, mergePipeline) = GEMMSamplingKernel
+      .pipelineCache[descriptor]!
+    let device = commandQueue.device
+    let slotCount = sequenceCount * kernel.tileCount
+    let candidateCount = slotCount * Int(descriptor.candidateCount)
+    func createBuffer(length: Int) -> MTLBuffer {
+      guard let buffer = device.makeBuffer(length: length) else {
+        fatalError("Could not allocate buffer.")
+      }
+      return buffer
+    }
+    let bufferHidden = createBuffer(length: hidden.count * 4)
+    for i in hidden.indices {
+      GEMMOperandPrecision.FP32.store(hidden[i], bufferHidden.contents(), i)
+    }
+    let bufferValues = createBuffer(length: candidateCount * 4)
+    let bufferIndices = createBuffer(length: candidateCount * 4)
+    let bufferStatistics = createBuffer(length: slotCount * 8)
+    let bufferTokens = createBuffer(length: sequenceCount * 4)
+
+    guard let commandBuffer = commandQueue.makeCommandBuffer(),
+          let encoder = commandBuffer.makeComputeCommandEncoder() else {
+      fatalError("Could not create command buffer.")
+    }
+    encoder.setBuffer(bufferHidden, offset: 0, index: 0)
+    encoder.setBuffer(weights, offset: 0, index: 1)
+    encoder.setBuffer(bufferValues, offset: 0, index: 2)
+    encoder.setBuffer(bufferIndices, offset: 0, index: 3)
+    encoder.setBuffer(bufferStatistics, offset: 0, index: 4)
+    var arguments = GEMMSamplingArguments(
+      sequenceCount: UInt32(sequenceCount),
+      logitScale: parameters.logitScale,
+      topP: parameters.nucleusMass,
+      seed: parameters.seed,
+      step: parameters.step)
+    encoder.setBytes(
+      &arguments, length: MemoryLayout<GEMMSamplingArguments>.stride,
+      index: 5)
+    encoder.setBuffer(bufferTokens, offset: 0, index: 6)
+
+    encoder.setComputePipelineState(tilePipeline)
+    encoder.setThreadgroupMemoryLength(
+      kernel.threadgroupMemoryAllocation, index: 0)
+    encoder.dispatchThreadgroups(
+      MTLSize(width: kernel.tileCount, height: sequenceCount, depth: 1),
+      threadsPerThreadgroup: MTLSize(
+        width: GEMMSamplingKernel.tileSize, height: 1, depth: 1))
+
+    encoder.setComputePipelineState(mergePipeline)
+    encoder.dispatchThreads(
+      MTLSize(width: sequenceCount, height: 1, depth: 1),
+      threadsPerThreadgroup: MTLSize(
+        width: min(sequenceCount, 32), height: 1, depth: 1))
+    encoder.endEncoding()
+    commandBuffer.commit()
+    commandBuffer.waitUntilCompleted()
+
+    let tokens = bufferTokens.contents()
+      .assumingMemoryBound(to: UInt32.self)
+    return Array(UnsafeBufferPointer(start: tokens, count: sequenceCount))
+  }
+}
+#endif
@@ -0,0 +1,178 @@
+//
+//  GEMMSamplingDescriptor+Reference.swift
+//  FlashAttention
+//
+
+// The Taylor series of 2^f, from the highest degree down.
+let samplingExp2Coefficients: [Float] = [
+  1.525273e-5, 1.540353e-4, 1.333355e-3, 9.618129e-3,
+  5.550411e-2, 2.402265e-1, 6.931472e-1, 1,
+]
+
+// Must match 'sampling_exp2' in the generated source.
+func samplingExp2(_ x: Float) -> Float {
+  if x < -126 {
+    return 0
+  }
+  let integerPart = x.rounded(.down)
+  let f = x - integerPart
+  var p = samplingExp2Coefficients[0]
+  for coefficient in samplingExp2Coefficients.dropFirst() {
+    p = coefficient.addingProduct(p, f)
+  }
+  let exponent = UInt32(Int32(integerPart) + 127) << 23
+  return p * Float(bitPattern: exponent)
+}
+
+// Must match 'philox' in the generated source.
+func philox(_ counter: SIMD2<UInt32>, _ key: UInt32) -> SIMD2<UInt32> {
+  var counter = counter
+  var key = key
+  for _ in 0..<10 {
+    let (high, low) = UInt32(0xD256D193).multipliedFullWidth(by: counter.x)
+    counter = SIMD2(high ^ key ^ counter.y, low)
+    key &+= 0x9E3779B9
+  }
+  return counter
+}
+
+// Must match 'sampling_uniform' in the generated source.
+func samplingUniform(_ bits: UInt32) -> Float {
+  Float(bits >> 8) * 5.9604645e-8
+}
+
+// A candidate for the sampled token. Ordered by value, then by index.
+private struct SamplingCandidate {
+  var value: Float
+  var index: UInt32
+
+  func precedes(_ other: SamplingCandidate) -> Bool {
+    if value != other.value {
+      return value > other.value
+    }
+    return index < other.index
+  }
+}
+
+extension GEMMSamplingDescriptor {
+  /// Draws one token per sequence on the CPU, with the same arithmetic as
+  /// the GPU kernels. The result matches `GEMMSampler` exactly.
+  ///
+  /// - Parameter weights: W, K x N and row-major. The values are rounded to
+  ///   the weight precision first, as the GPU sees them.
+  /// - Parameter hidden: One row of K elements per sequence.
+  public func referenceSample(
+    weights: [Float], hidden: [Float], parameters: GEMMSamplingParameters
+  ) -> [UInt32] {
+    guard let (K, N) = matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let (hiddenDimension, vocabularySize) = (Int(K), Int(N))
+    let sequenceCount = hidden.count / hiddenDimension
+    guard weights.count == hiddenDimension * vocabularySize,
+          hidden.count == sequenceCount * hiddenDimension else {
+      fatalError("Operands had the wrong size.")
+    }
+    let W = weights.map { value -> Float in
+      var storage: UInt32 = .zero
+      return withUnsafeMutableBytes(of: &storage) {
+        weightPrecision.store(value, $0.baseAddress!, 0)
+        return weightPrecision.load($0.baseAddress!, 0)
+      }
+    }
+    let k = Int(candidateCount)
+    let tileSize = GEMMSamplingKernel.tileSize
+    let logitScale = parameters.logitScale
+
+    func insert(
+      _ candidate: SamplingCandidate, into list: inout [SamplingCandidate]
+    ) {
+      guard candidate.precedes(list[k - 1]) else {
+        return
+      }
+      var i = k - 1
+      while i > 0, candidate.precedes(list[i - 1]) {
+        list[i] = list[i - 1]
+        i -= 1
+      }
+      list[i] = candidate
+    }
+    let empty = SamplingCandidate(
+      value: -.greatestFiniteMagnitude, index: .max)
+
+    var tokens: [UInt32] = []
+    for sequence in 0..<sequenceCount {
+      // The tiles of the GEMV.
+      var tileStatistics: [(m: Float, l: Float)] = []
+      var tileCandidates: [[SamplingCandidate]] = []
+      for tileStart in stride(from: 0, to: vocabularySize, by: tileSize) {
+        let tileEnd = min(tileStart + tileSize, vocabularySize)
+        var candidates = [SamplingCandidate](repeating: empty, count: k)
+        var m = -Float.greatestFiniteMagnitude
+        var l: Float = 0
+        for n in tileStart..<tileEnd {
+          var sum: Float = 0
+          for kk in 0..<hiddenDimension {
+            sum = sum.addingProduct(
+              hidden[sequence * hiddenDimension + kk],
+              W[kk * vocabularySize + n])
+          }
+          let x = sum * logitScale
+          if x > m {
+            l = Float(1).addingProduct(l, samplingExp2(m - x))
+            m = x
+          } else {
+            l += samplingExp2(x - m)
+          }
+          insert(
+            SamplingCandidate(value: x, index: UInt32(n)), into: &candidates)
+        }
+        tileStatistics.append((m, l))
+        tileCandidates.append(candidates)
+      }
+
+      // The merge.
+      var m = -Float.greatestFiniteMagnitude
+      for statistics in tileStatistics {
+        m = max(m, statistics.m)
+      }
+      var l: Float = 0
+      for statistics in tileStatistics {
+        l = l.addingProduct(statistics.l, samplingExp2(statistics.m - m))
+      }
+      var candidates = [SamplingCandidate](repeating: empty, count: k)
+      for candidate in tileCandidates.joined() where candidate.index != .max {
+        insert(candidate, into: &candidates)
+      }
+
+      let threshold = parameters.nucleusMass * l
+      var keptMass: Float = 0
+      var keptCount = 0
+      for i in 0..<k {
+        if candidates[i].index == .max {
+          break
+        }
+        keptMass += samplingExp2(candidates[i].value - m)
+        keptCount = i + 1
+        if keptMass >= threshold {
+          break
+        }
+      }
+
+      let random = philox(
+        SIMD2(UInt32(sequence), parameters.step), parameters.seed)
+      let target = samplingUniform(random.x) * keptMass
+      var token = candidates[0].index
+      var cumulative: Float = 0
+      for i in 0..<keptCount {
+        cumulative += samplingExp2(candidates[i].value - m)
+        if cumulative > target {
+          token = candidates[i].index
+          break
+        }
+      }
+      tokens.append(token)
+    }
+    return tokens
+  }
+}
@@ -0,0 +1,118 @@
+//
+//  GEMMSamplingDescriptor.swift
+//  FlashAttention
+//
+
+/// A description of the LM head of a decoder, fused with sampling.
+///
+/// Each sequence has one hidden state h (1 x K). The logits are h * W, with
+/// W the K x N unembedding matrix, row-major. Instead of writing the N
+/// logits and sorting them, each threadgroup of the GEMV keeps the top
+/// `candidateCount` logits of its tile, and the online softmax statistics
+/// (max and sum) of the tile. A small kernel merges them per sequence, and
+/// draws one token from the top-k / top-p distribution.
+///
+/// The GPU kernels and `referenceSample` perform the same floating-point
+/// operations in the same order, so they draw the same tokens for the same
+/// seed.
+public struct GEMMSamplingDescriptor {
+  /// The number of candidates each tile keeps, and the k of top-k. The
+  /// default is 50.
+  public var candidateCount: UInt16 = 50
+
+  /// Required. K is the hidden dimension, N the vocabulary size.
+  public var matrixDimensions: (K: UInt32, N: UInt32)?
+
+  /// The precision of W. The default is FP32. The hidden states are always
+  /// FP32.
+  public var weightPrecision: GEMMOperandPrecision = .FP32
+
+  public init() {
+
+  }
+}
+
+/// The parameters that may change with every token.
+public struct GEMMSamplingParameters {
+  /// Divides the logits before the softmax. The default is 1.
+  ///
+  /// A temperature of 0 is greedy decoding: every sequence draws its most
+  /// likely token. So is any temperature too small to invert, such as a
+  /// subnormal. Negative temperatures are not allowed.
+  public var temperature: Float = 1
+
+  /// The probability mass of the nucleus (top-p). The candidates are kept in
+  /// order of probability, until their mass reaches this fraction of the
+  /// whole vocabulary. The default is 1, which keeps every candidate.
+  public var topP: Float = 1
+
+  /// The key of the random number generator.
+  public var seed: UInt32 = 0
+
+  /// The counter of the random number generator, together with the index
+  /// of the sequence. Advance it with every token.
+  public var step: UInt32 = 0
+
+  public init() {
+
+  }
+
+  // Whether to draw the most likely token. An infinite scale would turn
+  // the logits into infinities and NaNs, so temperatures whose inverse
+  // overflows are greedy, like a temperature of 0.
+  var isGreedy: Bool {
+    !(1.442695041 / temperature).isFinite
+  }
+
+  // Multiplies the logits, to give base-2 logits at this temperature.
+  //
+  // When greedy, the logits keep their scale. The nucleus then holds only
+  // the most likely token (see `nucleusMass`).
+  var logitScale: Float {
+    guard temperature >= 0 else {
+      fatalError("Temperature was negative.")
+    }
+    guard !isGreedy else {
+      return 1.442695041
+    }
+    return 1.442695041 / temperature
+  }
+
+  // The top-p the kernels see. With a mass of 0, the first candidate
+  // already reaches the threshold, so the argmax is always drawn.
+  var nucleusMass: Float {
+    isGreedy ? 0 : topP
+  }
+}
+
+struct GEMMSamplingKey: Equatable, Hashable {
+  var candidateCount: UInt16
+  var matrixDimensions: SIMD2<UInt32>
+  var weightPrecision: UInt16
+
+  init(copying source: GEMMSamplingDescriptor) {
+    candidateCount = source.candidateCount
+
+    matrixDimensions = SIMD2(repeating: .max)
+    if let (K, N) = source.matrixDimensions {
+      matrixDimensions = SIMD2(K, N)
+    }
+    weightPrecision = source.weightPrecision.rawValue
+  }
+}
+
+extension GEMMSamplingDescriptor: Hashable, Equatable {
+  public static func == (
+    lhs: GEMMSamplingDescriptor,
+    rhs: GEMMSamplingDescriptor
+  ) -> Bool {
+    let lhsKey = GEMMSamplingKey(copying: lhs)
+    let rhsKey = GEMMSamplingKey(copying: rhs)
+    return lhsKey == rhsKey
+  }
+
+  public func hash(into hasher: inout Hasher) {
+    let key = GEMMSamplingKey(copying: self)
+    hasher.combine(key)
+  }
+}
@@ -0,0 +1,51 @@
+//
+//  GEMMSamplingKernel+PipelineCache.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+extension GEMMSamplingKernel {
+  public typealias PipelineValue = (
+    kernel: GEMMSamplingKernel,
+    tile: MTLComputePipelineState,
+    merge: MTLComputePipelineState)
+
+  public static var pipelineCache: [
+    GEMMSamplingDescriptor: PipelineValue] = [:]
+}
+
+extension GEMMSamplingKernel {
+  // Register this problem configuration in the cache.
+  public static func register(descriptor: GEMMSamplingDescriptor) {
+    guard pipelineCache[descriptor] == nil else {
+      return
+    }
+
+    let kernel = GEMMSamplingKernel(descriptor: descriptor)
+    let source = kernel.createSource()
+    let device = MTLContext.global.device
+
+    // Fast math may reorder or contract the arithmetic, and then the samples
+    // would no longer match the CPU reference.
+    let options = MTLCompileOptions()
+    options.fastMathEnabled = false
+    let library: MTLLibrary
+    do {
+      library = try device.makeLibrary(source: source, options: options)
+    } catch {
+      print("Metal compile error:\n\(error)\n")
+      fatalError("Metal compile failed")
+    }
+    func createPipeline(_ name: String) -> MTLComputePipelineState {
+      let function = library.makeFunction(name: name)!
+      return try! device.makeComputePipelineState(function: function)
+    }
+    pipelineCache[descriptor] = (
+      kernel,
+      createPipeline("gemm_sampling_tile"),
+      createPipeline("gemm_sampling_merge"))
+  }
+}
+#endif
@@ -0,0 +1,294 @@
+//
+//  GEMMSamplingKernel.swift
+//  FlashAttention
+//
+
+/// The kernels for `GEMMSamplingDescriptor`.
+///
+/// `gemm_sampling_tile` computes `tileSize` logits of one sequence per
+/// threadgroup, one per thread. The weights are read in coalesced rows of W.
+/// Then one thread scans the tile in order, for the top-k candidates and
+/// the online softmax statistics.
+///
+/// `gemm_sampling_merge` runs one thread per sequence. It merges the
+/// statistics in tile order, merges the candidates, applies top-p, and
+/// draws a token with the Philox-2x32-10 counter-based generator.
+///
+/// The results must match the CPU reference bit for bit. Every
+/// multiply-add is an explicit `fma`, exp2 is a polynomial built from
+/// `fma`, and the library is compiled without fast math.
+public struct GEMMSamplingKernel {
+  /// The number of logits per threadgroup of the GEMV.
+  public static let tileSize: Int = 256
+
+  /// The largest candidate count this kernel accepts.
+  public static let maximumCandidateCount: UInt16 = 64
+
+  var candidateCount: UInt16
+  var matrixDimensions: (K: UInt32, N: UInt32)
+  var weightPrecision: GEMMOperandPrecision
+
+  public init(descriptor: GEMMSamplingDescriptor) {
+    guard let matrixDimensions = descriptor.matrixDimensions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    guard descriptor.candidateCount > 0,
+          descriptor.candidateCount <= Self.maximumCandidateCount else {
+      fatalError("Invalid candidate count.")
+    }
+    guard descriptor.weightPrecision != .BF16 else {
+      fatalError("BF16 is not supported.")
+    }
+    self.candidateCount = descriptor.candidateCount
+    self.matrixDimensions = matrixDimensions
+    self.weightPrecision = descriptor.weightPrecision
+  }
+
+  /// The number of tiles per sequence.
+  public var tileCount: Int {
+    (Int(matrixDimensions.N) + Self.tileSize - 1) / Self.tileSize
+  }
+
+  public var threadgroupMemoryAllocation: Int {
+    Self.tileSize * 4
+  }
+}
+
+extension GEMMSamplingKernel {
+  public func createSource() -> String {
+    let (K, N) = matrixDimensions
+
+    return """
+
+#include <metal_stdlib>
+using namespace metal;
+
+constant uint K = \(K);
+constant uint N = \(N);
+constant uint TILE = \(Self.tileSize);
+constant uint TOPK = \(candidateCount);
+constant uint TILE_COUNT = \(tileCount);
+
+// Matches the layout of 'GEMMSamplingArguments'.
+struct gemm_sampling_arguments {
+  uint sequence_count;
+  float logit_scale;
+  float top_p;
+  uint seed;
+  uint step;
+};
+
+\(createMathFunctions())
+
+\(createCandidateFunctions())
+
+// hidden: sequence x K
+// candidate_values, candidate_indices: sequence x TILE_COUNT x TOPK
+// tile_statistics: sequence x TILE_COUNT, (max, sum)
+kernel void gemm_sampling_tile(
+  device float *hidden [[buffer(0)]],
+  device \(weightPrecision.name) *W [[buffer(1)]],
+  device float *candidate_values [[buffer(2)]],
+  device uint *candidate_indices [[buffer(3)]],
+  device float2 *tile_statistics [[buffer(4)]],
+  constant gemm_sampling_arguments &arguments [[buffer(5)]],
+  threadgroup float *logits [[threadgroup(0)]],
+
+  uint2 gid [[threadgroup_position_in_grid]],
+  ushort tid [[thread_index_in_threadgroup]])
+{
+  uint tile = gid.x;
+  uint sequence = gid.y;
+  uint tile_start = tile * TILE;
+  uint tile_size = min(TILE, N - tile_start);
+
+  if (tid < tile_size) {
+    device float *h = hidden + sequence * K;
+    uint n = tile_start + tid;
+    float sum = 0;
+    for (uint k = 0; k < K; ++k) {
+      sum = fma(h[k], float(W[k * N + n]), sum);
+    }
+    logits[tid] = sum * arguments.logit_scale;
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+  if (tid != 0) {
+    return;
+  }
+
+  float values[\(candidateCount)];
+  uint indices[\(candidateCount)];
+  candidates_initialize(values, indices);
+  float m = -numeric_limits<float>::max();
+  float l = 0;
+  for (uint i = 0; i < tile_size; ++i) {
+    float x = logits[i];
+    if (x > m) {
+      l = fma(l, sampling_exp2(m - x), 1);
+      m = x;
+    } else {
+      l += sampling_exp2(x - m);
+    }
+    candidates_insert(values, indices, x, tile_start + i);
+  }
+
+  uint slot = sequence * TILE_COUNT + tile;
+  for (uint i = 0; i < TOPK; ++i) {
+    candidate_values[slot * TOPK + i] = values[i];
+    candidate_indices[slot * TOPK + i] = indices[i];
+  }
+  tile_statistics[slot] = float2(m, l);
+}
+
+kernel void gemm_sampling_merge(
+  device float *candidate_values [[buffer(2)]],
+  device uint *candidate_indices [[buffer(3)]],
+  device float2 *tile_statistics [[buffer(4)]],
+  constant gemm_sampling_arguments &arguments [[buffer(5)]],
+  device uint *tokens [[buffer(6)]],
+
+  uint sequence [[thread_position_in_grid]])
+{
+  if (sequence >= arguments.sequence_count) {
+    return;
+  }
+  uint slot_start = sequence * TILE_COUNT;
+
+  // The softmax statistics of the whole vocabulary, in tile order.
+  float m = -numeric_limits<float>::max();
+  for (uint t = 0; t < TILE_COUNT; ++t) {
+    m = max(m, tile_statistics[slot_start + t].x);
+  }
+  float l = 0;
+  for (uint t = 0; t < TILE_COUNT; ++t) {
+    float2 statistics = tile_statistics[slot_start + t];
+    l = fma(statistics.y, sampling_exp2(statistics.x - m), l);
+  }
+
+  float values[\(candidateCount)];
+  uint indices[\(candidateCount)];
+  candidates_initialize(values, indices);
+  for (uint i = 0; i < TILE_COUNT * TOPK; ++i) {
+    uint index = candidate_indices[slot_start * TOPK + i];
+    if (index != UINT_MAX) {
+      float value = candidate_values[slot_start * TOPK + i];
+      candidates_insert(values, indices, value, index);
+    }
+  }
+
+  // Keep the most likely candidates, until they hold 'top_p' of the mass.
+  float threshold = arguments.top_p * l;
+  float kept_mass = 0;
+  uint kept_count = 0;
+  for (uint i = 0; i < TOPK; ++i) {
+    if (indices[i] == UINT_MAX) {
+      break;
+    }
+    kept_mass += sampling_exp2(values[i] - m);
+    kept_count = i + 1;
+    if (kept_mass >= threshold) {
+      break;
+    }
+  }
+
+  uint2 random = philox(uint2(sequence, arguments.step), arguments.seed);
+  float target = sampling_uniform(random.x) * kept_mass;
+  uint token = indices[0];
+  float cumulative = 0;
+  for (uint i = 0; i < kept_count; ++i) {
+    cumulative += sampling_exp2(values[i] - m);
+    if (cumulative > target) {
+      token = indices[i];
+      break;
+    }
+  }
+  tokens[sequence] = token;
+}
+
+"""
+  }
+
+  // Must match 'samplingExp2', 'philox', and 'samplingUniform' in the
+  // reference.
+  func createMathFunctions() -> String {
+    // Bind the coefficients by their bits, so no decimal conversion can
+    // round them differently.
+    let polynomial = samplingExp2Coefficients.dropFirst().map {
+      "  p = fma(p, f, as_type<float>(\($0.bitPattern)u));"
+    }.joined(separator: "\n")
+    let leading = samplingExp2Coefficients[0].bitPattern
+
+    return """
+
+// 2^x for x <= 0. The integer part goes into the exponent bits. The
+// fraction goes through the Taylor series of 2^f, to degree 7.
+float sampling_exp2(float x) {
+  if (x < -126) {
+    return 0;
+  }
+  float integer_part = floor(x);
+  float f = x - integer_part;
+  float p = as_type<float>(\(leading)u);
+\(polynomial)
+  uint exponent = uint(int(integer_part) + 127) << 23;
+  return p * as_type<float>(exponent);
+}
+
+uint2 philox(uint2 counter, uint key) {
+  for (ushort r = 0; r < 10; ++r) {
+    uint high = mulhi(0xD256D193u, counter.x);
+    uint low = 0xD256D193u * counter.x;
+    counter = uint2(high ^ key ^ counter.y, low);
+    key += 0x9E3779B9u;
+  }
+  return counter;
+}
+
+// A uniform number in [0, 1), from the upper 24 bits.
+float sampling_uniform(uint bits) {
+  return float(bits >> 8) * 5.9604645e-8;
+}
+
+"""
+  }
+
+  // The candidates are sorted by value, then by index. Empty slots have the
+  // index UINT_MAX.
+  func createCandidateFunctions() -> String {
+    """
+
+bool candidates_precedes(float lhs_value, uint lhs_index,
+                         float rhs_value, uint rhs_index) {
+  if (lhs_value != rhs_value) {
+    return lhs_value > rhs_value;
+  }
+  return lhs_index < rhs_index;
+}
+
+void candidates_initialize(thread float *values, thread uint *indices) {
+  for (uint i = 0; i < TOPK; ++i) {
+    values[i] = -numeric_limits<float>::max();
+    indices[i] = UINT_MAX;
+  }
+}
+
+void candidates_insert(thread float *values, thread uint *indices,
+                       float value, uint index) {
+  if (!candidates_precedes(
+        value, index, values[TOPK - 1], indices[TOPK - 1])) {
+    return;
+  }
+  uint i = TOPK - 1;
+  while (i > 0 && candidates_precedes(
+                    value, index, values[i - 1], indices[i - 1])) {
+    values[i] = values[i - 1];
+    indices[i] = indices[i - 1];
+    i -= 1;
+  }
+  values[i] = value;
+  indices[i] = index;
+}
+
+"""
+  }
+}
@@ -0,0 +1,60 @@
+//
+//  GEMMSparseDescriptor.swift
+//  FlashAttention
+//
+
+/// A description of C = A * B, where B has 2:4 structured sparsity.
+///
+/// B is bound as two buffers: the values of a `GEMMSparseMatrix` in the
+/// memory precision of B, and its metadata bytes. A and C are row-major and
+/// densely packed.
+public struct GEMMSparseDescriptor {
+  /// Whether to add the previous contents of C to the result.
+  public var loadPreviousC: Bool = false
+
+  /// Required. The dimensions of the dense problem.
+  public var matrixDimensions: (M: UInt32, N: UInt32, K: UInt32)?
+
+  /// Required. The precision of B refers to its values.
+  public var memoryPrecisions: (
+    A: GEMMOperandPrecision,
+    B: GEMMOperandPrecision,
+    C: GEMMOperandPrecision)?
+
+  public init() {
+
+  }
+}
+
+struct GEMMSparseKey: Equatable, Hashable {
+  var loadPreviousC: UInt8
+  var matrixDimensions: SIMD3<UInt32>
+  var memoryPrecisions: SIMD3<UInt16>
+
+  init(copying source: GEMMSparseDescriptor) {
+    loadPreviousC = GEMMKernelKey.createBoolean(source.loadPreviousC)
+
+    matrixDimensions = SIMD3(repeating: .max)
+    if let (M, N, K) = source.matrixDimensions {
+      matrixDimensions = SIMD3(M, N, K)
+    }
+    memoryPrecisions = GEMMKernelKey.createPrecisions(
+      source.memoryPrecisions)
+  }
+}
+
+extension GEMMSparseDescriptor: Hashable, Equatable {
+  public static func == (
+    lhs: GEMMSparseDescriptor,
+    rhs: GEMMSparseDescriptor
+  ) -> Bool {
+    let lhsKey = GEMMSparseKey(copying: lhs)
+    let rhsKey = GEMMSparseKey(copying: rhs)
+    return lhsKey == rhsKey
+  }
+
+  public func hash(into hasher: inout Hasher) {
+    let key = GEMMSparseKey(copying: self)
+    hasher.combine(key)
+  }
+}
@@ -0,0 +1,39 @@
+//
+//  GEMMSparseKernel+PipelineCache.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+extension GEMMSparseKernel {
+  public typealias PipelineValue = (
+    kernel: GEMMSparseKernel, pipeline: MTLComputePipelineState)
+
+  public static var pipelineCache: [
+    GEMMSparseDescriptor: PipelineValue] = [:]
+}
+
+extension GEMMSparseKernel {
+  // Register this problem configuration in the cache.
+  public static func register(descriptor: GEMMSparseDescriptor) {
+    guard pipelineCache[descriptor] == nil else {
+      return
+    }
+
+    let kernel = GEMMSparseKernel(descriptor: descriptor)
+    let source = kernel.createSource()
+    let device = MTLContext.global.device
+    let library: MTLLibrary
+    do {
+      library = try device.makeLibrary(source: source, options: nil)
+    } catch {
+      print("Metal compile error:\n\(error)\n")
+      fatalError("Metal compile failed")
+    }
+    let function = library.makeFunction(name: "gemm_sparse")!
+    let pipeline = try! device.makeComputePipelineState(function: function)
+    pipelineCache[descriptor] = (kernel, pipeline)
+  }
+}
+#endif
@@ -0,0 +1,244 @@
+//
+//  GEMMSparseKernel.swift
+//  FlashAttention
+//
+
+/// The kernel for `GEMMSparseDescriptor`.
+///
+/// Each simdgroup owns a block of C, `rowsPerSimdgroup` x 32. The fragments
+/// of B are expanded from the compressed format as they are loaded, straight
+/// into `simdgroup_matrix_storage`. The multiplications are then dense; the
+/// savings come from reading half as many bytes of B.
+public struct GEMMSparseKernel {
+  var loadPreviousC: Bool
+  var matrixDimensions: (M: UInt32, N: UInt32, K: UInt32)
+  var memoryPrecisions: (
+    A: GEMMOperandPrecision,
+    B: GEMMOperandPrecision,
+    C: GEMMOperandPrecision)
+
+  /// The number of simdgroups in a threadgroup.
+  public var simdgroupsPerThreadgroup: Int =
+    GEMMSparseKernel.defaultSimdgroupsPerThreadgroup
+
+  /// The number of columns of C in each block.
+  public var blockColumns: Int = GEMMSparseKernel.defaultBlockColumns
+
+  // The launch shape that `selectRowsPerSimdgroup` assumes.
+  static let defaultSimdgroupsPerThreadgroup = 4
+  static let defaultBlockColumns = 32
+
+  /// The number of rows of C in each block. Chosen by
+  /// `selectRowsPerSimdgroup`.
+  public var rowsPerSimdgroup: Int
+
+  public init(descriptor: GEMMSparseDescriptor) {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    self.loadPreviousC = descriptor.loadPreviousC
+    self.matrixDimensions = matrixDimensions
+    self.memoryPrecisions = memoryPrecisions
+    self.rowsPerSimdgroup = Self.selectRowsPerSimdgroup(
+      descriptor: descriptor)
+  }
+
+  /// The number of rows of C in each threadgroup.
+  public var threadgroupRows: Int {
+    rowsPerSimdgroup * simdgroupsPerThreadgroup
+  }
+
+  public var threadgroupSize: Int {
+    32 * simdgroupsPerThreadgroup
+  }
+}
+
+extension GEMMSparseKernel {
+  /// The average number of bytes of B read for each element of the dense
+  /// matrix: half of the values, plus 4 bits of metadata per group of 4.
+  public static func compressedElementSize(
+    _ precision: GEMMOperandPrecision
+  ) -> Float {
+    Float(precision.size) / 2 + 1.0 / 8
+  }
+
+  /// Chooses the height of each simdgroup's block of C.
+  ///
+  /// Per multiply-add, a block of R x 32 reads (A.size / 32) bytes of A and
+  /// (B.size / R) bytes of B. A taller block only helps while the B term
+  /// dominates. With the compressed B, that stops at half the height a dense
+  /// B would need, so the kernel can launch more threadgroups instead.
+  public static func selectRowsPerSimdgroup(
+    descriptor: GEMMSparseDescriptor,
+    targetThreadgroupCount: Int = 256
+  ) -> Int {
+    guard let matrixDimensions = descriptor.matrixDimensions,
+          let memoryPrecisions = descriptor.memoryPrecisions else {
+      fatalError("Descriptor was incomplete.")
+    }
+    let elementSizeA = Float(memoryPrecisions.A.size)
+    let elementSizeB = compressedElementSize(memoryPrecisions.B)
+    let maximumRows = 32 * elementSizeB / elementSizeA
+
+    func threadgroupCount(rows: Int) -> Int {
+      let threadgroupRows = defaultSimdgroupsPerThreadgroup * rows
+      let rowGroups = (Int(matrixDimensions.M) + threadgroupRows - 1)
+      / threadgroupRows
+      let columnGroups = (Int(matrixDimensions.N) + defaultBlockColumns - 1)
+      / defaultBlockColumns
+      return rowGroups * columnGroups
+    }
+    var rows = 8
+    while rows < 32,
+          Float(2 * rows) <= maximumRows,
+          threadgroupCount(rows: 2 * rows) >= targetThreadgroupCount {
+      rows *= 2
+    }
+    return rows
+  }
+}
+
+extension GEMMSparseKernel {
+  public func createSource() -> String {
+    """
+
+\(createMetalSimdgroupMatrixStorage())
+using namespace metal;
+
+\(createFragmentAccessors())
+
+constant uint M = \(matrixDimensions.M);
+constant uint N = \(matrixDimensions.N);
+constant uint K = \(matrixDimensions.K);
+constant uint metadata_stride = (N + 1) / 2;
+
+\(createSparseAccessor())
+
+kernel void gemm_sparse(device \(memoryPrecisions.A.name) *A [[buffer(0)]],
+                        device \(valueType) *B_values [[buffer(1)]],
+                        device uchar *B_metadata [[buffer(2)]],
+                        device \(memoryPrecisions.C.name) *C [[buffer(3)]],
+
+                        uint2 gid [[threadgroup_position_in_grid]],
+                        ushort sidx [[simdgroup_index_in_threadgroup]],
+                        ushort lane_id [[thread_index_in_simdgroup]])
+{
+  ushort2 morton_offset = morton_order(lane_id);
+  uint M_offset = (gid.y * \(simdgroupsPerThreadgroup) + sidx)
+  * \(rowsPerSimdgroup);
+  uint N_offset = gid.x * \(blockColumns);
+  if (M_offset >= M) {
+    return;
+  }
+
+  simdgroup_matrix_storage<float> C_sram[\(fragmentCount)];
+#pragma clang loop unroll(full)
+  for (ushort m = 0; m < \(rowsPerSimdgroup); m += 8) {
+#pragma clang loop unroll(full)
+    for (ushort n = 0; n < \(blockColumns); n += 8) {
+      auto C_fragment = C_sram + (m / 8) * \(blockColumns / 8) + n / 8;
+      if (\(loadPreviousC)) {
+        load_fragment(
+          C_fragment, C, uint2(N, M), uint2(N_offset + n, M_offset + m),
+          morton_offset);
+      } else {
+        *C_fragment = simdgroup_matrix_storage<float>(0);
+      }
+    }
+  }
+
+  for (uint k = 0; k < K; k += 8) {
+    simdgroup_matrix_storage<float> B_sram[\(blockColumns / 8)];
+#pragma clang loop unroll(full)
+    for (ushort n = 0; n < \(blockColumns); n += 8) {
+      load_sparse(
+        B_sram + n / 8, B_values, B_metadata, uint2(N_offset + n, k),
+        morton_offset);
+    }
+
+#pragma clang loop unroll(full)
+    for (ushort m = 0; m < \(rowsPerSimdgroup); m += 8) {
+      simdgroup_matrix_storage<float> A_sram;
+      load_fragment(
+        &A_sram, A, uint2(K, M), uint2(k, M_offset + m), morton_offset);
+#pragma clang loop unroll(full)
+      for (ushort n = 0; n < \(blockColumns); n += 8) {
+        C_sram[(m / 8) * \(blockColumns / 8) + n / 8]
+          .multiply(A_sram, B_sram[n / 8]);
+      }
+    }
+  }
+
+#pragma clang loop unroll(full)
+  for (ushort m = 0; m < \(rowsPerSimdgroup); m += 8) {
+#pragma clang loop unroll(full)
+    for (ushort n = 0; n < \(blockColumns); n += 8) {
+      if ((M_offset + m < M) && (N_offset + n < N)) {
+        store_fragment(
+          C_sram + (m / 8) * \(blockColumns / 8) + n / 8, C, uint2(N, M),
+          uint2(N_offset + n, M_offset + m), morton_offset);
+      }
+    }
+  }
+}
+
+"""
+  }
+
+  var fragmentCount: Int {
+    (rowsPerSimdgroup / 8) * (blockColumns / 8)
+  }
+
+  // BF16 values are read as raw bits, so the kernel does not depend on
+  // scalar 'bfloat' arithmetic.
+  var valueType: String {
+    (memoryPrecisions.B == .BF16) ? "ushort" : memoryPrecisions.B.name
+  }
+
+  func createSparseAccessor() -> String {
+    var conversion: String
+    if memoryPrecisions.B == .BF16 {
+      conversion = "as_type<float>(uint(value) << 16)"
+    } else {
+      conversion = "float(value)"
+    }
+
+    return """
+
+// Expands the 8x8 fragment of B at 'origin' from the compressed 2:4 format.
+// The two columns of each thread share a metadata byte, because the column
+// in 'morton_offset' is always even.
+METAL_FUNC void load_sparse(
+  thread simdgroup_matrix_storage<float> *fragment,
+  const device \(valueType) *values, const device uchar *metadata,
+  uint2 origin, ushort2 morton_offset
+) {
+  uint2 position = origin + uint2(morton_offset);
+  float2 result = float2(0);
+  if (position.y < K && position.x < N) {
+    uint group = position.y / 4;
+    uint slot = position.y % 4;
+    uchar byte = metadata[group * metadata_stride + position.x / 2];
+#pragma clang loop unroll(full)
+    for (ushort i = 0; i < 2; ++i) {
+      uint column = position.x + i;
+      uchar nibble = (byte >> (4 * i)) & 0xF;
+      int row = -1;
+      if (slot == uint(nibble & 0x3)) {
+        row = 2 * group;
+      } else if (slot == uint(nibble >> 2)) {
+        row = 2 * group + 1;
+      }
+      if (column < N && row >= 0) {
+        auto value = values[uint(row) * N + column];
+        result[i] = \(conversion);
+      }
+    }
+  }
+  *(fragment->thread_elements()) = result;
+}
+
+"""
+  }
+}
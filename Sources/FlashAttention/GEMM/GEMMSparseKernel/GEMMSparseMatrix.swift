@@ -0,0 +1,133 @@
+//
+//  GEMMSparseMatrix.swift
+//  FlashAttention
+//
+
+/// A K x N matrix with 2:4 structured sparsity, in compressed form.
+///
+/// Along each column, every group of 4 consecutive rows holds at most 2
+/// nonzero elements. The compressed matrix stores only those 2 elements,
+/// plus the 2-bit row index of each one within its group.
+///
+/// ```
+/// values    (K_groups * 2) x N, row-major
+///             row 2g + j holds the j-th kept element of group g
+/// metadata  K_groups x ceil(N / 2) bytes, row-major
+///             the byte for columns (2i, 2i + 1) holds two nibbles
+///             nibble bits 0-1: row index of the first kept element
+///             nibble bits 2-3: row index of the second kept element
+///             column 2i uses the low nibble
+/// ```
+///
+/// K_groups is K / 4, rounded up. The rows past K are padded with zeroes.
+/// The values take half the bytes of the dense matrix, and the metadata adds
+/// one bit per element.
+public struct GEMMSparseMatrix {
+  /// The number of rows (K) of the dense matrix.
+  public private(set) var rows: Int
+
+  /// The number of columns (N) of the dense matrix.
+  public private(set) var columns: Int
+
+  /// The kept elements, before conversion to the memory precision.
+  public var values: [Float]
+
+  /// The packed 2-bit row indices.
+  public var metadata: [UInt8]
+
+  /// Compresses a row-major K x N matrix.
+  ///
+  /// Keeps the 2 elements of largest magnitude in each group of 4, so a
+  /// dense matrix is pruned to 2:4 sparsity as it is packed. A matrix that
+  /// is already 2:4 sparse round-trips exactly.
+  public init(pruning dense: [Float], rows: Int, columns: Int) {
+    guard dense.count == rows * columns else {
+      fatalError("Matrix had the wrong number of elements.")
+    }
+    self.rows = rows
+    self.columns = columns
+    let groupCount = Self.groupCount(rows: rows)
+    let metadataStride = Self.metadataStride(columns: columns)
+    values = [Float](repeating: .zero, count: 2 * groupCount * columns)
+    metadata = [UInt8](repeating: 0, count: groupCount * metadataStride)
+
+    for groupID in 0..<groupCount {
+      for columnID in 0..<columns {
+        // Rank the rows of the group by magnitude. Ties keep the lower row,
+        // and an all-zero group keeps rows 0 and 1.
+        var rowIndices = [0, 1, 2, 3]
+        func element(_ index: Int) -> Float {
+          let rowID = groupID * 4 + index
+          guard rowID < rows else {
+            return .zero
+          }
+          return dense[rowID * columns + columnID]
+        }
+        rowIndices.sort {
+          let lhs = abs(element($0))
+          let rhs = abs(element($1))
+          return (lhs != rhs) ? (lhs > rhs) : ($0 < $1)
+        }
+        let kept = rowIndices[0..<2].sorted()
+
+        for j in 0..<2 {
+          let address = (2 * groupID + j) * columns + columnID
+          values[address] = element(kept[j])
+        }
+        let nibble = UInt8(kept[0] | (kept[1] << 2))
+        let shift = UInt8(4 * (columnID % 2))
+        metadata[groupID * metadataStride + columnID / 2] |= nibble << shift
+      }
+    }
+  }
+
+  /// Wraps a matrix that was compressed earlier.
+  public init(
+    rows: Int, columns: Int, values: [Float], metadata: [UInt8]
+  ) {
+    let groupCount = Self.groupCount(rows: rows)
+    guard values.count == 2 * groupCount * columns,
+          metadata.count == groupCount * Self.metadataStride(
+            columns: columns) else {
+      fatalError("Compressed matrix had the wrong size.")
+    }
+    self.rows = rows
+    self.columns = columns
+    self.values = values
+    self.metadata = metadata
+  }
+
+  /// Reverses the compression, with zeroes in place of the pruned elements.
+  public func expand() -> [Float] {
+    let metadataStride = Self.metadataStride(columns: columns)
+    var output = [Float](repeating: .zero, count: rows * columns)
+    for groupID in 0..<Self.groupCount(rows: rows) {
+      for columnID in 0..<columns {
+        let byte = metadata[groupID * metadataStride + columnID / 2]
+        let nibble = byte >> UInt8(4 * (columnID % 2))
+        for j in 0..<2 {
+          let index = Int((nibble >> UInt8(2 * j)) & 3)
+          let rowID = groupID * 4 + index
+          guard rowID < rows else {
+            continue
+          }
+          let address = (2 * groupID + j) * columns + columnID
+          output[rowID * columns + columnID] = values[address]
+        }
+      }
+    }
+    return output
+  }
+}
+
+extension GEMMSparseMatrix {
+  /// The number of groups of 4 rows.
+  public static func groupCount(rows: Int) -> Int {
+    (rows + 3) / 4
+  }
+
+  /// The number of metadata bytes in each row of groups.
+  public static func metadataStride(columns: Int) -> Int {
+    (columns + 1) / 2
+  }
+}
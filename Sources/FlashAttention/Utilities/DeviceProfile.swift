@@ -0,0 +1,164 @@
+//
+//  DeviceProfile.swift
+//  FlashAttention
+//
+
+/// The properties of a GPU that the kernel heuristics depend on.
+///
+/// The heuristics read `DeviceProfile.current`, which describes the device
+/// of `MTLContext.global`. A tool that generates kernels ahead of time can
+/// substitute each target device in turn with `withProfile(_:_:)`, without
+/// running on that device. This also works without Metal, for example on
+/// Linux.
+public struct DeviceProfile: Sendable {
+  /// An Apple GPU family, matching `MTLGPUFamily.apple7` and later.
+  public enum Family: Int, Sendable {
+    case apple7 = 7
+    case apple8 = 8
+    case apple9 = 9
+  }
+
+  /// The chip name, for example "M1" or "A17".
+  public var name: String
+
+  /// The newest Apple GPU family the device supports.
+  public var family: Family
+
+  public var coreCount: Int
+
+  public init(name: String, family: Family, coreCount: Int) {
+    self.name = name
+    self.family = family
+    self.coreCount = coreCount
+  }
+
+  // Scoped to the current task, so concurrent tasks can substitute different
+  // devices without seeing each other's profile.
+  @TaskLocal static var substitute: DeviceProfile?
+
+  /// The profile the heuristics use.
+  public static var current: DeviceProfile {
+    if let substitute = substitute {
+      return substitute
+    }
+#if canImport(Metal)
+    return system
+#else
+    fatalError("No GPU to profile. Substitute one with 'withProfile'.")
+#endif
+  }
+
+  /// Runs the closure as if `profile` described the GPU. The device of this
+  /// machine is never queried.
+  ///
+  /// The substitution applies to the current task and the child tasks it
+  /// creates. Other threads and tasks keep their own profile.
+  public static func withProfile<Result>(
+    _ profile: DeviceProfile, _ body: () throws -> Result
+  ) rethrows -> Result {
+    try $substitute.withValue(profile) {
+      try body()
+    }
+  }
+
+  public func supportsFamily(_ family: Family) -> Bool {
+    self.family.rawValue >= family.rawValue
+  }
+}
+
+#if canImport(Metal)
+import Metal
+
+extension DeviceProfile {
+  // Queried on first access, then cached.
+  static let system = DeviceProfile(device: MTLContext.global.device)
+
+  /// Queries the properties of a device.
+  ///
+  /// Typical latency to initiate a Metal device, provided the function has
+  /// been called numerous times prior:
+  /// - macOS 14
+  ///   - Swift debug mode,   Metal API validation on:  ≥33 μs
+  ///   - Swift release mode, Metal API validation off: ≥38 μs
+  /// - iOS 17
+  ///   - Swift debug mode,   Metal API validation on:   ≥0 μs
+  ///   - Swift release mode, Metal API validation off:  ≥0 μs
+  ///
+  /// The IORegistry query for the core count is slower still, which is why
+  /// `current` is cached.
+  public init(device mtlDevice: MTLDevice) {
+    // Trim the device name to something easier to process.
+    //
+    // M1 Max: Apple M1 Max -> M1
+    // M4:     Apple M4 GPU -> M4
+    func createDeviceName() -> String {
+      let deviceName = mtlDevice.name
+      var splits = deviceName.split(separator: " ").map(String.init)
+      splits.removeAll(where: { $0.starts(with: "Apple") })
+      splits.removeAll(where: { $0.starts(with: "GPU") })
+      
+      // Iterate over the space-separated words.
+      var matchingSplitIDs: [UInt32] = []
+      for splitID in splits.indices {
+        // Screen out obvious non-candidates.
+        let split = splits[splitID]
+        guard split.starts(with: "A") || split.starts(with: "M") else {
+          continue
+        }
+        
+        // Extract the second character.
+        guard split.count > 1 else {
+          continue
+        }
+        let secondCharacterInt8 = split.utf8CString[1]
+        let secondCharacterUInt32 = UInt32(secondCharacterInt8)
+        let secondCharacterUnicode = Unicode.Scalar(secondCharacterUInt32)!
+        let secondCharacter = Character(secondCharacterUnicode)
+        
+        // If the second character is numeric, the candidate passes.
+        if secondCharacter.isWholeNumber {
+          matchingSplitIDs.append(UInt32(splitID))
+        }
+      }
+      guard matchingSplitIDs.count == 1 else {
+        fatalError("Failed to locate device name.")
+      }
+      
+      let splitID = matchingSplitIDs[0]
+      return splits[Int(splitID)]
+    }
+    let deviceName = createDeviceName()
+    
+    var family = Family.apple7
+    if mtlDevice.supportsFamily(.apple9) {
+      family = .apple9
+    } else if mtlDevice.supportsFamily(.apple8) {
+      family = .apple8
+    }
+    
+    // Find the core count.
+#if os(macOS)
+let coreCount: Int
+if mtlDevice.supportsFamily(.apple9) {
+  // Not used; the GEMM heuristic returns early on apple9 anyway.
+  coreCount = 0
+} else {
+  coreCount = findCoreCount()
+}
+#elseif os(iOS)
+    var coreCount: Int
+    if deviceName.starts(with: "A") {
+      if mtlDevice.supportsFamily(.apple9) {
+        coreCount = 6
+      } else {
+        coreCount = 5
+      }
+    } else {
+      coreCount = 10
+    }
+#endif
+    
+    self.init(name: deviceName, family: family, coreCount: coreCount)
+  }
+}
+#endif
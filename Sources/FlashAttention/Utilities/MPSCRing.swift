@@ -0,0 +1,76 @@
+//
+//  MPSCRing.swift
+//  FlashAttention
+//
+
+import CFlashAttention
+import Foundation
+
+/// A bounded lock-free queue, with many producers and one consumer.
+///
+/// Any thread may push. Only one thread at a time may pop. The sequence
+/// numbers are C11 atomics (see `mfa_mpsc_ring` in CFlashAttention); the
+/// elements live in a Swift array beside them. A producer that finds the
+/// ring full yields until the consumer frees a slot.
+public final class MPSCRing<Element> {
+  public let capacity: Int
+
+  let ring: OpaquePointer
+  let elements: UnsafeMutablePointer<Element?>
+
+  /// - Parameter capacity: Must be a power of two.
+  public init(capacity: Int) {
+    guard capacity > 0,
+          capacity & (capacity - 1) == 0,
+          capacity <= Int(UInt32.max) else {
+      fatalError("Capacity must be a power of two.")
+    }
+    guard let ring = mfa_mpsc_ring_create(UInt32(capacity)) else {
+      fatalError("Could not allocate ring.")
+    }
+    self.capacity = capacity
+    self.ring = ring
+    self.elements = .allocate(capacity: capacity)
+    elements.initialize(repeating: nil, count: capacity)
+  }
+
+  deinit {
+    elements.deinitialize(count: capacity)
+    elements.deallocate()
+    mfa_mpsc_ring_destroy(ring)
+  }
+
+  /// Appends an element, or returns false if the ring is full.
+  public func tryPush(_ element: Element) -> Bool {
+    var position: UInt64 = .zero
+    guard mfa_mpsc_ring_claim(ring, &position) else {
+      return false
+    }
+    elements[Int(position & UInt64(capacity - 1))] = element
+    mfa_mpsc_ring_publish(ring, position)
+    return true
+  }
+
+  /// Appends an element, waiting for a free slot if necessary.
+  public func push(_ element: Element) {
+    while !tryPush(element) {
+      sched_yield()
+    }
+  }
+
+  /// Removes the oldest element. Returns nil if the ring is empty, or if
+  /// the oldest slot is claimed but not published yet.
+  ///
+  /// Must only be called from the consumer thread.
+  public func pop() -> Element? {
+    var position: UInt64 = .zero
+    guard mfa_mpsc_ring_peek(ring, &position) else {
+      return nil
+    }
+    let slot = Int(position & UInt64(capacity - 1))
+    let element = elements[slot]
+    elements[slot] = nil
+    mfa_mpsc_ring_consume(ring)
+    return element
+  }
+}
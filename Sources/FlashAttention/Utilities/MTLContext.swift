@@ -5,6 +5,7 @@
 //  Created by Philip Turner on 6/26/24.
 //
 
+#if canImport(Metal)
 import Metal
 
 public struct MTLContext {
@@ -18,3 +19,4 @@ public struct MTLContext {
     commandQueue = device.makeCommandQueue()!
   }
 }
+#endif
@@ -0,0 +1,50 @@
+//
+//  SharedMemoryRegion.swift
+//  FlashAttention
+//
+
+import CFlashAttention
+import Foundation
+
+/// A POSIX shared memory object, mapped into the address space.
+///
+/// The name is unlinked right after creation, so the object disappears once
+/// the last mapping is gone, even if a process crashes. Child processes
+/// created with `fork` inherit the mapping, and see each other's writes.
+public final class SharedMemoryRegion {
+  public let contents: UnsafeMutableRawPointer
+  public let length: Int
+
+  public init(length: Int) {
+    guard length > 0 else {
+      fatalError("Shared memory region must not be empty.")
+    }
+
+    // macOS limits the name to 31 characters.
+    let suffix = UInt32.random(in: 0..<UInt32.max)
+    let name = "/mfa-\(getpid())-\(suffix)"
+    let fileDescriptor = mfa_shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0o600)
+    guard fileDescriptor >= 0 else {
+      fatalError("Could not create shared memory object: errno \(errno)")
+    }
+    defer {
+      close(fileDescriptor)
+      mfa_shm_unlink(name)
+    }
+    guard ftruncate(fileDescriptor, off_t(length)) == 0 else {
+      fatalError("Could not resize shared memory object: errno \(errno)")
+    }
+
+    let address = mmap(
+      nil, length, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0)
+    guard let address, address != MAP_FAILED else {
+      fatalError("Could not map shared memory object: errno \(errno)")
+    }
+    self.contents = address
+    self.length = length
+  }
+
+  deinit {
+    munmap(contents, length)
+  }
+}
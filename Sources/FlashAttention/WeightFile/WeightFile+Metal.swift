@@ -0,0 +1,37 @@
+//
+//  WeightFile+Metal.swift
+//  FlashAttention
+//
+
+#if canImport(Metal)
+import Metal
+
+extension WeightFile {
+  /// Wraps the mapped pages of a tensor in a buffer, without copying.
+  ///
+  /// The buffer retains the weight file, so the mapping outlives every buffer
+  /// created from it. The tensor starts at offset 0 of the buffer. The buffer
+  /// length is rounded up to the page size; the padding is zeroes.
+  public func makeBuffer(
+    device: MTLDevice,
+    name: String
+  ) -> MTLBuffer {
+    guard let descriptor = descriptor(named: name) else {
+      fatalError("Tensor \(name) does not exist.")
+    }
+    let region = paddedContents(of: descriptor)
+    let buffer = device.makeBuffer(
+      bytesNoCopy: region.baseAddress!,
+      length: region.count,
+      options: .storageModeShared,
+      deallocator: { _, _ in
+        // Keep the mapping alive until the buffer is released.
+        withExtendedLifetime(self) { }
+      })
+    guard let buffer else {
+      fatalError("Could not wrap tensor \(name) in a buffer.")
+    }
+    return buffer
+  }
+}
+#endif
@@ -0,0 +1,176 @@
+//
+//  WeightFile.swift
+//  FlashAttention
+//
+
+import Foundation
+
+/// A weight file mapped into the address space.
+///
+/// Opening the file only touches the header and the tensor table. Payload
+/// pages are faulted in lazily by whoever reads them first (the CPU, or the
+/// GPU through a buffer that aliases the mapping). There is no intermediate
+/// copy into a heap allocation, so the resident set never holds two copies of
+/// the checkpoint.
+///
+/// The mapping is private and writable. Pages stay clean and file-backed
+/// until someone writes to them, so the kernel can evict them under memory
+/// pressure. Metal requires writable memory for `bytesNoCopy` buffers.
+public final class WeightFile {
+  public let tensors: [WeightTensorDescriptor]
+  let indices: [String: Int]
+
+  let baseAddress: UnsafeMutableRawPointer
+  let mappedLength: Int
+
+  public init(url: URL, verifyChecksums: Bool = false) throws {
+    let fileDescriptor = open(url.path, O_RDONLY)
+    guard fileDescriptor >= 0 else {
+      throw WeightFileError.openFailed(errno)
+    }
+    defer { close(fileDescriptor) }
+
+    var status = stat()
+    guard fstat(fileDescriptor, &status) == 0 else {
+      throw WeightFileError.openFailed(errno)
+    }
+    let fileSize = Int(status.st_size)
+    guard fileSize >= WeightFileFormat.headerSize else {
+      throw WeightFileError.truncated
+    }
+
+    let address = mmap(
+      nil, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileDescriptor, 0)
+    guard let address, address != MAP_FAILED else {
+      throw WeightFileError.mapFailed(errno)
+    }
+    self.baseAddress = address
+    self.mappedLength = fileSize
+
+    // If parsing fails, 'deinit' does not run for a partially initialized
+    // class instance. Unmap manually.
+    do {
+      let bytes = UnsafeRawBufferPointer(start: address, count: fileSize)
+      let tensors = try Self.parse(bytes)
+      var indices: [String: Int] = [:]
+      for (i, descriptor) in tensors.enumerated() {
+        guard indices[descriptor.name] == nil else {
+          throw WeightFileError.duplicateTensor(descriptor.name)
+        }
+        indices[descriptor.name] = i
+      }
+      self.tensors = tensors
+      self.indices = indices
+    } catch {
+      munmap(address, fileSize)
+      throw error
+    }
+
+    if verifyChecksums {
+      try self.verifyChecksums()
+    }
+  }
+
+  deinit {
+    munmap(baseAddress, mappedLength)
+  }
+
+  static func parse(
+    _ bytes: UnsafeRawBufferPointer
+  ) throws -> [WeightTensorDescriptor] {
+    var decoder = WeightFileDecoder(bytes)
+    guard try decoder.read(UInt32.self) == WeightFileFormat.magic else {
+      throw WeightFileError.badMagic
+    }
+    let version = try decoder.read(UInt32.self)
+    guard version == WeightFileFormat.version else {
+      throw WeightFileError.unsupportedVersion(version)
+    }
+    let tensorCount = Int(try decoder.read(UInt32.self))
+    let tableSize = Int(try decoder.read(UInt32.self))
+    guard WeightFileFormat.headerSize + tableSize <= bytes.count else {
+      throw WeightFileError.truncated
+    }
+    let payloadStart = WeightFileFormat.align(
+      WeightFileFormat.headerSize + tableSize)
+
+    var descriptors: [WeightTensorDescriptor] = []
+    for _ in 0..<tensorCount {
+      let descriptor = try decoder.readDescriptor()
+      guard descriptor.offset % WeightFileFormat.alignment == 0 else {
+        throw WeightFileError.misalignedTensor(descriptor.name)
+      }
+
+      // The table is untrusted, so every size is checked for overflow. A
+      // payload may not start inside the header or the table, and may not
+      // be empty (Metal cannot wrap zero bytes).
+      guard descriptor.offset >= payloadStart,
+            let expectedSize = descriptor.layout.checkedPayloadSize(
+              shape: descriptor.shape, precision: descriptor.precision),
+            expectedSize > 0,
+            descriptor.length == expectedSize,
+            let paddedLength = WeightFileFormat.checkedAlign(
+              descriptor.length) else {
+        throw WeightFileError.invalidTensor(descriptor.name)
+      }
+      let (end, overflow) = descriptor.offset
+        .addingReportingOverflow(paddedLength)
+      guard !overflow, end <= bytes.count else {
+        throw WeightFileError.truncated
+      }
+      descriptors.append(descriptor)
+    }
+    guard decoder.cursor == WeightFileFormat.headerSize + tableSize else {
+      throw WeightFileError.truncated
+    }
+
+    // Payloads, including their padding, must not alias each other.
+    let sorted = descriptors.sorted { $0.offset < $1.offset }
+    for (previous, next) in zip(sorted, sorted.dropFirst()) {
+      guard previous.offset + previous.paddedLength <= next.offset else {
+        throw WeightFileError.overlappingTensor(next.name)
+      }
+    }
+    return descriptors
+  }
+
+  /// Returns the descriptor of a tensor, or `nil` if it does not exist.
+  public func descriptor(named name: String) -> WeightTensorDescriptor? {
+    guard let index = indices[name] else {
+      return nil
+    }
+    return tensors[index]
+  }
+
+  /// The payload bytes of a tensor, aliasing the mapped file.
+  ///
+  /// The pointer is only valid while the `WeightFile` is alive.
+  public func contents(of name: String) -> UnsafeRawBufferPointer {
+    guard let descriptor = descriptor(named: name) else {
+      fatalError("Tensor \(name) does not exist.")
+    }
+    return UnsafeRawBufferPointer(
+      start: baseAddress + descriptor.offset, count: descriptor.length)
+  }
+
+  /// The payload pointer with the page padding, for APIs that require both
+  /// the address and the length to be page-aligned.
+  func paddedContents(
+    of descriptor: WeightTensorDescriptor
+  ) -> UnsafeMutableRawBufferPointer {
+    UnsafeMutableRawBufferPointer(
+      start: baseAddress + descriptor.offset, count: descriptor.paddedLength)
+  }
+
+  /// Checks every payload against the checksum in the tensor table.
+  ///
+  /// This reads the entire file, so it is opt-in.
+  public func verifyChecksums() throws {
+    for descriptor in tensors {
+      let contents = contents(of: descriptor.name)
+      guard WeightFileFormat.checksum(contents) == descriptor.checksum else {
+        throw WeightFileError.checksumMismatch(descriptor.name)
+      }
+    }
+  }
+}
@@ -0,0 +1,240 @@
+//
+//  WeightFileFormat.swift
+//  FlashAttention
+//
+
+/// The on-disk layout of a weight file.
+///
+/// ```
+/// offset 0:      header
+///                  magic        UInt32  'MFAW'
+///                  version      UInt32
+///                  tensorCount  UInt32
+///                  tableSize    UInt32  bytes following the header
+/// offset 16:     tensor table (tensorCount entries)
+///                  nameLength   UInt16
+///                  name         UTF-8 bytes
+///                  precision    UInt16  GEMMOperandPrecision.rawValue
+///                  layout       UInt16  0 = plain, 1 = tile-major
+///                  tileRows     UInt16
+///                  tileColumns  UInt16
+///                  rank         UInt16
+///                  shape        UInt64 x rank
+///                  offset       UInt64
+///                  length       UInt64
+///                  checksum     UInt64
+/// next page:     payloads, each starting on a page boundary
+/// ```
+///
+/// All integers are little-endian. Every payload begins at a multiple of
+/// `WeightFileFormat.alignment` and is zero-padded to the next multiple. The
+/// GPU can then alias the mapped pages directly, without a staging copy.
+/// Payloads follow the table, are never empty, and do not overlap.
+public enum WeightFileFormat {
+  public static let magic: UInt32 = 0x5741_464D
+  public static let version: UInt32 = 1
+  static let headerSize: Int = 16
+
+  /// The alignment of every payload, in bytes.
+  ///
+  /// The virtual memory page size on Apple silicon is 16 KB. It is also a
+  /// multiple of the 4 KB page size on other platforms.
+  public static let alignment: Int = 16384
+
+  static func align(_ offset: Int) -> Int {
+    guard let output = checkedAlign(offset) else {
+      fatalError("Offset was too large to align.")
+    }
+    return output
+  }
+
+  /// Rounds up to the alignment, or returns `nil` if that overflows.
+  static func checkedAlign(_ offset: Int) -> Int? {
+    let (sum, overflow) = offset.addingReportingOverflow(alignment - 1)
+    guard !overflow else {
+      return nil
+    }
+    return sum / alignment * alignment
+  }
+}
+
+/// The metadata for a single tensor in a weight file.
+public struct WeightTensorDescriptor: Equatable {
+  public var name: String
+  public var precision: GEMMOperandPrecision
+  public var shape: [Int]
+  public var layout: WeightTensorLayout
+
+  /// The location of the payload, relative to the start of the file.
+  public var offset: Int
+
+  /// The size of the payload in bytes, excluding the page padding.
+  public var length: Int
+
+  /// The FNV-1a hash of the payload bytes.
+  public var checksum: UInt64
+
+  public init(
+    name: String,
+    precision: GEMMOperandPrecision,
+    shape: [Int],
+    layout: WeightTensorLayout,
+    offset: Int,
+    length: Int,
+    checksum: UInt64
+  ) {
+    self.name = name
+    self.precision = precision
+    self.shape = shape
+    self.layout = layout
+    self.offset = offset
+    self.length = length
+    self.checksum = checksum
+  }
+
+  /// The size of the payload in bytes, including the page padding.
+  public var paddedLength: Int {
+    WeightFileFormat.align(length)
+  }
+}
+
+extension WeightFileFormat {
+  /// 64-bit FNV-1a over a range of bytes.
+  public static func checksum(_ bytes: UnsafeRawBufferPointer) -> UInt64 {
+    var hash: UInt64 = 0xcbf2_9ce4_8422_2325
+    for byte in bytes {
+      hash ^= UInt64(byte)
+      hash &*= 0x0000_0100_0000_01B3
+    }
+    return hash
+  }
+}
+
+// MARK: - Encoding
+
+struct WeightFileEncoder {
+  var bytes: [UInt8] = []
+
+  mutating func append<T: FixedWidthInteger>(_ value: T) {
+    withUnsafeBytes(of: value.littleEndian) {
+      bytes.append(contentsOf: $0)
+    }
+  }
+
+  mutating func append(_ descriptor: WeightTensorDescriptor) {
+    let name = Array(descriptor.name.utf8)
+    guard name.count <= Int(UInt16.max) else {
+      fatalError("Tensor name was too long.")
+    }
+    append(UInt16(name.count))
+    bytes.append(contentsOf: name)
+    append(descriptor.precision.rawValue)
+
+    switch descriptor.layout {
+    case .plain:
+      append(UInt16(0))
+      append(UInt16(0))
+      append(UInt16(0))
+    case .tileMajor(let rows, let columns):
+      append(UInt16(1))
+      append(rows)
+      append(columns)
+    }
+
+    append(UInt16(descriptor.shape.count))
+    for dimension in descriptor.shape {
+      append(UInt64(dimension))
+    }
+    append(UInt64(descriptor.offset))
+    append(UInt64(descriptor.length))
+    append(descriptor.checksum)
+  }
+}
+
+struct WeightFileDecoder {
+  var bytes: UnsafeRawBufferPointer
+  var cursor: Int = 0
+
+  init(_ bytes: UnsafeRawBufferPointer) {
+    self.bytes = bytes
+  }
+
+  mutating func read<T: FixedWidthInteger>(_ type: T.Type) throws -> T {
+    let size = MemoryLayout<T>.size
+    guard cursor + size <= bytes.count else {
+      throw WeightFileError.truncated
+    }
+    let value = bytes.loadUnaligned(fromByteOffset: cursor, as: T.self)
+    cursor += size
+    return T(littleEndian: value)
+  }
+
+  mutating func readDescriptor() throws -> WeightTensorDescriptor {
+    let nameLength = Int(try read(UInt16.self))
+    guard cursor + nameLength <= bytes.count else {
+      throw WeightFileError.truncated
+    }
+    let nameBytes = UnsafeRawBufferPointer(
+      rebasing: bytes[cursor..<cursor + nameLength])
+    let name = String(decoding: nameBytes, as: UTF8.self)
+    cursor += nameLength
+
+    let precisionValue = try read(UInt16.self)
+    guard let precision = GEMMOperandPrecision(rawValue: precisionValue) else {
+      throw WeightFileError.invalidTensor(name)
+    }
+
+    let layoutValue = try read(UInt16.self)
+    let tileRows = try read(UInt16.self)
+    let tileColumns = try read(UInt16.self)
+    var layout: WeightTensorLayout
+    switch layoutValue {
+    case 0:
+      layout = .plain
+    case 1:
+      guard tileRows > 0, tileColumns > 0 else {
+        throw WeightFileError.invalidTensor(name)
+      }
+      layout = .tileMajor(rows: tileRows, columns: tileColumns)
+    default:
+      throw WeightFileError.invalidTensor(name)
+    }
+
+    let rank = Int(try read(UInt16.self))
+    var shape: [Int] = []
+    for _ in 0..<rank {
+      let dimension = try read(UInt64.self)
+      guard dimension <= UInt64(Int32.max) else {
+        throw WeightFileError.invalidTensor(name)
+      }
+      shape.append(Int(dimension))
+    }
+    if case .tileMajor = layout, rank != 2 {
+      throw WeightFileError.invalidTensor(name)
+    }
+
+    let offset = try read(UInt64.self)
+    let length = try read(UInt64.self)
+    let checksum = try read(UInt64.self)
+    guard offset <= UInt64(Int.max), length <= UInt64(Int.max) else {
+      throw WeightFileError.invalidTensor(name)
+    }
+    return WeightTensorDescriptor(
+      name: name, precision: precision, shape: shape, layout: layout,
+      offset: Int(offset), length: Int(length), checksum: checksum)
+  }
+}
+
+/// The ways a weight file can fail to load.
+public enum WeightFileError: Error, Equatable {
+  case openFailed(Int32)
+  case mapFailed(Int32)
+  case truncated
+  case badMagic
+  case unsupportedVersion(UInt32)
+  case invalidTensor(String)
+  case misalignedTensor(String)
+  case duplicateTensor(String)
+  case overlappingTensor(String)
+  case checksumMismatch(String)
+}
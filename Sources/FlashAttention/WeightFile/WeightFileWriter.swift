@@ -0,0 +1,94 @@
+//
+//  WeightFileWriter.swift
+//  FlashAttention
+//
+
+import Foundation
+
+/// Assembles a weight file from a list of tensors.
+///
+/// Packing happens offline (e.g. during model conversion), so the writer keeps
+/// each payload in memory until `write(to:)` is called. The loader is the
+/// performance-sensitive half.
+public struct WeightFileWriter {
+  var descriptors: [WeightTensorDescriptor] = []
+  var payloads: [[UInt8]] = []
+
+  public init() {
+
+  }
+
+  /// Adds a tensor whose bytes are already in the requested layout.
+  ///
+  /// For a tile-major tensor, pack the bytes with
+  /// `WeightTensorLayout.packTileMajor` first.
+  public mutating func append(
+    name: String,
+    precision: GEMMOperandPrecision,
+    shape: [Int],
+    layout: WeightTensorLayout = .plain,
+    bytes: UnsafeRawBufferPointer
+  ) {
+    guard !descriptors.contains(where: { $0.name == name }) else {
+      fatalError("Duplicate tensor name: \(name)")
+    }
+    let expectedSize = layout.payloadSize(shape: shape, precision: precision)
+    guard expectedSize > 0 else {
+      fatalError("Tensor \(name) was empty.")
+    }
+    guard bytes.count == expectedSize else {
+      fatalError(
+        "Payload for \(name) had \(bytes.count) bytes, expected \(expectedSize).")
+    }
+
+    let descriptor = WeightTensorDescriptor(
+      name: name, precision: precision, shape: shape, layout: layout,
+      offset: 0, length: bytes.count,
+      checksum: WeightFileFormat.checksum(bytes))
+    descriptors.append(descriptor)
+    payloads.append(Array(bytes))
+  }
+
+  /// Serializes the header, the tensor table, and the page-aligned payloads.
+  public func serialize() -> [UInt8] {
+    // The table size does not depend on the offsets, so encode it once to
+    // measure, then again with the final offsets.
+    func encodeTable(_ descriptors: [WeightTensorDescriptor]) -> [UInt8] {
+      var encoder = WeightFileEncoder()
+      for descriptor in descriptors {
+        encoder.append(descriptor)
+      }
+      return encoder.bytes
+    }
+    let tableSize = encodeTable(descriptors).count
+
+    var placedDescriptors = descriptors
+    var cursor = WeightFileFormat.align(WeightFileFormat.headerSize + tableSize)
+    for i in placedDescriptors.indices {
+      placedDescriptors[i].offset = cursor
+      cursor += placedDescriptors[i].paddedLength
+    }
+
+    var encoder = WeightFileEncoder()
+    encoder.append(WeightFileFormat.magic)
+    encoder.append(WeightFileFormat.version)
+    encoder.append(UInt32(placedDescriptors.count))
+    encoder.append(UInt32(tableSize))
+    encoder.bytes += encodeTable(placedDescriptors)
+
+    var output = encoder.bytes
+    for (descriptor, payload) in zip(placedDescriptors, payloads) {
+      let padding = descriptor.offset - output.count
+      output.append(contentsOf: repeatElement(0, count: padding))
+      output.append(contentsOf: payload)
+    }
+    let padding = cursor - output.count
+    output.append(contentsOf: repeatElement(0, count: padding))
+    return output
+  }
+
+  public func write(to url: URL) throws {
+    let bytes = serialize()
+    try Data(bytes).write(to: url)
+  }
+}
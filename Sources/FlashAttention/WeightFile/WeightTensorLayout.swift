@@ -0,0 +1,160 @@
+//
+//  WeightTensorLayout.swift
+//  FlashAttention
+//
+
+/// The arrangement of a tensor's elements inside a weight file.
+///
+/// Plain tensors are stored exactly as the application handed them over
+/// (row-major, densely packed). Tile-major tensors are pre-packed offline, so
+/// that each tile of a 2D matrix occupies a contiguous range of memory. A
+/// kernel can then fetch a whole block with a single linear copy, instead of
+/// `tileRows` strided copies. Partial tiles at the matrix edges are padded
+/// with zeroes, so every tile has the same size.
+public enum WeightTensorLayout: Hashable, Equatable {
+  case plain
+  case tileMajor(rows: UInt16, columns: UInt16)
+
+  /// The number of bytes the payload occupies, before page alignment.
+  public func payloadSize(
+    shape: [Int], precision: GEMMOperandPrecision
+  ) -> Int {
+    guard let output = checkedPayloadSize(
+      shape: shape, precision: precision) else {
+      fatalError("Tensor was too large.")
+    }
+    return output
+  }
+
+  /// The payload size, or `nil` if it does not fit in an `Int`. Use this
+  /// for shapes read from an untrusted file.
+  func checkedPayloadSize(
+    shape: [Int], precision: GEMMOperandPrecision
+  ) -> Int? {
+    var factors: [Int]
+    switch self {
+    case .plain:
+      factors = shape
+    case .tileMajor(let tileRows, let tileColumns):
+      guard shape.count == 2 else {
+        fatalError("Tile-major layout requires a 2D shape.")
+      }
+      let tileCount = Self.tileCount(
+        rows: shape[0], columns: shape[1],
+        tileRows: Int(tileRows), tileColumns: Int(tileColumns))
+      factors = [
+        tileCount.rows, tileCount.columns, Int(tileRows), Int(tileColumns)
+      ]
+    }
+
+    var output = precision.size
+    for factor in factors {
+      let (product, overflow) = output.multipliedReportingOverflow(by: factor)
+      guard !overflow else {
+        return nil
+      }
+      output = product
+    }
+    return output
+  }
+
+  static func tileCount(
+    rows: Int, columns: Int, tileRows: Int, tileColumns: Int
+  ) -> (rows: Int, columns: Int) {
+    guard tileRows > 0, tileColumns > 0 else {
+      fatalError("Tile dimensions must be nonzero.")
+    }
+    let tileCountRows = (rows + tileRows - 1) / tileRows
+    let tileCountColumns = (columns + tileColumns - 1) / tileColumns
+    return (tileCountRows, tileCountColumns)
+  }
+}
+
+extension WeightTensorLayout {
+  /// Rearranges a row-major matrix into the tile-major order.
+  ///
+  /// Tiles are visited in row-major order. Within a tile, elements are also
+  /// row-major.
+  public static func packTileMajor(
+    _ source: UnsafeRawBufferPointer,
+    rows: Int,
+    columns: Int,
+    elementSize: Int,
+    tileRows: Int,
+    tileColumns: Int
+  ) -> [UInt8] {
+    guard source.count >= rows * columns * elementSize else {
+      fatalError("Source was too small.")
+    }
+    let tileCount = Self.tileCount(
+      rows: rows, columns: columns,
+      tileRows: tileRows, tileColumns: tileColumns)
+    let tileSize = tileRows * tileColumns * elementSize
+    var output = [UInt8](
+      repeating: 0, count: tileCount.rows * tileCount.columns * tileSize)
+
+    output.withUnsafeMutableBytes { destination in
+      for tileRowID in 0..<tileCount.rows {
+        for tileColumnID in 0..<tileCount.columns {
+          let tileID = tileRowID * tileCount.columns + tileColumnID
+          let tileBase = tileID * tileSize
+
+          // Only copy the portion of the tile that is in bounds.
+          let rowStart = tileRowID * tileRows
+          let columnStart = tileColumnID * tileColumns
+          let rowEnd = min(rowStart + tileRows, rows)
+          let columnEnd = min(columnStart + tileColumns, columns)
+          let copySize = (columnEnd - columnStart) * elementSize
+
+          for rowID in rowStart..<rowEnd {
+            let sourceOffset = (rowID * columns + columnStart) * elementSize
+            let destinationOffset =
+            tileBase + (rowID - rowStart) * tileColumns * elementSize
+            (destination.baseAddress! + destinationOffset).copyMemory(
+              from: source.baseAddress! + sourceOffset, byteCount: copySize)
+          }
+        }
+      }
+    }
+    return output
+  }
+
+  /// Reverses `packTileMajor`, discarding the padding at the edges.
+  public static func unpackTileMajor(
+    _ source: UnsafeRawBufferPointer,
+    rows: Int,
+    columns: Int,
+    elementSize: Int,
+    tileRows: Int,
+    tileColumns: Int
+  ) -> [UInt8] {
+    let tileCount = Self.tileCount(
+      rows: rows, columns: columns,
+      tileRows: tileRows, tileColumns: tileColumns)
+    let tileSize = tileRows * tileColumns * elementSize
+    guard source.count >= tileCount.rows * tileCount.columns * tileSize else {
+      fatalError("Source was too small.")
+    }
+    var output = [UInt8](repeating: 0, count: rows * columns * elementSize)
+
+    output.withUnsafeMutableBytes { destination in
+      for rowID in 0..<rows {
+        for tileColumnID in 0..<tileCount.columns {
+          let tileRowID = rowID / tileRows
+          let tileID = tileRowID * tileCount.columns + tileColumnID
+          let columnStart = tileColumnID * tileColumns
+          let columnEnd = min(columnStart + tileColumns, columns)
+          let copySize = (columnEnd - columnStart) * elementSize
+
+          let sourceOffset =
+          tileID * tileSize
+          + (rowID - tileRowID * tileRows) * tileColumns * elementSize
+          let destinationOffset = (rowID * columns + columnStart) * elementSize
+          (destination.baseAddress! + destinationOffset).copyMemory(
+            from: source.baseAddress! + sourceOffset, byteCount: copySize)
+        }
+      }
+    }
+    return output
+  }
+}
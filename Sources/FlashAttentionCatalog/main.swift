@@ -0,0 +1,77 @@
+//
+//  main.swift
+//  FlashAttentionCatalog
+//
+
+import FlashAttention
+import Foundation
+
+// Generates the kernels a deployment needs, ahead of time.
+//
+// Usage:
+//   flash-attention-catalog --profiles <profiles.json>
+//     --shapes <shapes.json> --output <directory>
+//
+// profiles.json lists the target devices:
+//   [{ "name": "M1 Max", "family": 7, "coreCount": 32 },
+//    { "name": "M4", "family": 9, "coreCount": 10 }]
+//
+// shapes.json lists the problems:
+//   { "gemm": [{ "M": 4096, "N": 4096, "K": 4096,
+//                "precisions": ["FP16", "FP16", "FP32"] }],
+//     "attention": [{ "row": 2048, "column": 2048, "head": 64,
+//                     "kernels": ["forward", "backwardQuery"] }] }
+//
+// The output directory receives 'manifest.json', and one '.metal' file per
+// distinct kernel under 'kernels'. See 'KernelCatalog.Manifest' for the
+// schema of the manifest.
+
+func exitWithUsage(_ message: String) -> Never {
+  let usage = """
+    Usage: flash-attention-catalog --profiles <profiles.json> \
+    --shapes <shapes.json> --output <directory>
+    """
+  let output = message + "\n" + usage + "\n"
+  FileHandle.standardError.write(output.data(using: .utf8)!)
+  exit(1)
+}
+
+var options: [String: String] = [:]
+var arguments = CommandLine.arguments.dropFirst()
+while let flag = arguments.popFirst() {
+  guard ["--profiles", "--shapes", "--output"].contains(flag) else {
+    exitWithUsage("Unrecognized argument: \(flag)")
+  }
+  guard let value = arguments.popFirst() else {
+    exitWithUsage("Missing value for \(flag)")
+  }
+  options[flag] = value
+}
+guard let profilesPath = options["--profiles"],
+      let shapesPath = options["--shapes"],
+      let outputPath = options["--output"] else {
+  exitWithUsage("Missing a required argument.")
+}
+
+func decode<T: Decodable>(_ type: T.Type, path: String) -> T {
+  do {
+    let data = try Data(contentsOf: URL(fileURLWithPath: path))
+    return try JSONDecoder().decode(type, from: data)
+  } catch {
+    exitWithUsage("Could not read \(path): \(error)")
+  }
+}
+let profiles = decode([KernelCatalog.Profile].self, path: profilesPath)
+let shapes = decode(KernelCatalog.Shapes.self, path: shapesPath)
+
+var catalog = KernelCatalog()
+catalog.add(profiles: profiles, shapes: shapes)
+do {
+  try catalog.write(to: URL(fileURLWithPath: outputPath))
+} catch {
+  exitWithUsage("Could not write \(outputPath): \(error)")
+}
+print("""
+  Wrote \(catalog.kernelFiles.count) kernels for \
+  \(catalog.entries.count) entries to \(outputPath).
+  """)
@@ -0,0 +1,163 @@
+import XCTest
+import FlashAttention
+
+final class AttentionScheduleTest: XCTestCase {
+  func testCoverage() throws {
+    for _ in 0..<20 {
+      var scheduleDesc = AttentionScheduleDescriptor()
+      scheduleDesc.causal = Bool.random()
+      scheduleDesc.sequenceDimensions = (0..<Int.random(in: 1...5)).map { _ in
+        let row = Int.random(in: 0...300)
+        let column = row + Int.random(in: (row == 0 ? 0 : 1)...100)
+        return (row, column)
+      }
+      scheduleDesc.headCount = Int.random(in: 1...4)
+      scheduleDesc.blockDimensions = (
+        parallelization: [16, 32].randomElement()!,
+        traversal: [32, 64].randomElement()!)
+      scheduleDesc.workerCount = Int.random(in: 1...40)
+      scheduleDesc.splitsColumns = Bool.random()
+      checkCoverage(schedule: AttentionSchedule(descriptor: scheduleDesc))
+    }
+  }
+
+  // A mix of causal sequences, from short to long.
+  func testLoadImbalance() throws {
+    var scheduleDesc = AttentionScheduleDescriptor()
+    scheduleDesc.causal = true
+    scheduleDesc.sequenceDimensions = [
+      (4096, 4096), (1024, 1024), (300, 300), (77, 77), (2000, 2048),
+    ]
+    scheduleDesc.headCount = 8
+    scheduleDesc.blockDimensions = (parallelization: 32, traversal: 64)
+    scheduleDesc.workerCount = 160
+
+    let persistent = AttentionSchedule(descriptor: scheduleDesc).simulate()
+    scheduleDesc.sortsByCost = false
+    scheduleDesc.splitsColumns = false
+    let grid = AttentionSchedule(descriptor: scheduleDesc).simulate()
+    XCTAssertEqual(persistent.workerCosts.reduce(0, +), persistent.totalCost)
+    XCTAssertGreaterThanOrEqual(grid.loadImbalance, 1)
+    XCTAssertGreaterThanOrEqual(persistent.loadImbalance, 1)
+    XCTAssertLessThan(persistent.loadImbalance, grid.loadImbalance)
+    XCTAssertLessThan(persistent.loadImbalance, 1.05)
+  }
+
+#if canImport(Metal)
+  func testCorrectness() throws {
+    for _ in 0..<6 {
+      var scheduleDesc = AttentionScheduleDescriptor()
+      scheduleDesc.causal = Bool.random()
+      scheduleDesc.sequenceDimensions = (0..<Int.random(in: 1...3)).map { _ in
+        let row = Int.random(in: 1...150)
+        let column = row + Int.random(in: 0...150)
+        return (row, column)
+      }
+      scheduleDesc.headCount = Int.random(in: 1...3)
+      scheduleDesc.workerCount = Int.random(in: 1...8)
+      runCorrectnessTest(
+        descriptor: scheduleDesc, headDimension: [16, 32, 64].randomElement()!)
+    }
+  }
+#endif
+}
+
+/// Checks that the items of each block of rows partition the columns its
+/// rows can see, and that the items are ordered by cost.
+private func checkCoverage(schedule: AttentionSchedule) {
+  let descriptor = schedule.descriptor
+  let blockRows = descriptor.blockDimensions!.parallelization
+
+  var ranges: [[Int]: [Range<Int>]] = [:]
+  var partialSlots: Set<Int> = []
+  for item in schedule.items {
+    let key = [item.sequence, item.head, item.rowStart]
+    ranges[key, default: []].append(item.columnStart..<item.columnEnd)
+    if let partialSlot = item.partialSlot {
+      XCTAssertTrue(partialSlots.insert(partialSlot).inserted)
+    }
+  }
+  XCTAssertEqual(partialSlots, Set(0..<schedule.partialCount))
+
+  var blockCount = 0
+  for (sequence, (row, column)) in descriptor.sequenceDimensions!.enumerated() {
+    for head in 0..<descriptor.headCount {
+      for rowStart in stride(from: 0, to: row, by: blockRows) {
+        var columnEnd = column
+        if descriptor.causal {
+          let lastRow = min(rowStart + blockRows, row) - 1
+          columnEnd = lastRow + column - row + 1
+        }
+        let pieces = ranges[[sequence, head, rowStart]]!.sorted {
+          $0.lowerBound < $1.lowerBound
+        }
+        XCTAssertEqual(pieces.first!.lowerBound, 0)
+        XCTAssertEqual(pieces.last!.upperBound, columnEnd)
+        for i in pieces.indices.dropLast() {
+          XCTAssertEqual(pieces[i].upperBound, pieces[i + 1].lowerBound)
+          XCTAssertEqual(
+            pieces[i].upperBound % descriptor.blockDimensions!.traversal, 0)
+        }
+        blockCount += 1
+      }
+    }
+  }
+  XCTAssertEqual(ranges.count, blockCount)
+
+  if descriptor.sortsByCost {
+    for i in schedule.items.indices.dropFirst() {
+      XCTAssertGreaterThanOrEqual(
+        schedule.items[i - 1].cost, schedule.items[i].cost)
+    }
+  }
+}
+
+#if canImport(Metal)
+/// Compares the persistent kernel against the CPU reference, one row at a
+/// time under causal masking.
+private func runCorrectnessTest(
+  descriptor: AttentionScheduleDescriptor, headDimension: Int
+) {
+  let sequenceDimensions = descriptor.sequenceDimensions!
+  let H = headDimension
+  let rowCount = sequenceDimensions.reduce(0) { $0 + $1.row }
+  let columnCount = sequenceDimensions.reduce(0) { $0 + $1.column }
+  func randomOperand(_ count: Int) -> [Float] {
+    (0..<count).map { _ in Float.random(in: -1...1) }
+  }
+  let Q = randomOperand(descriptor.headCount * rowCount * H)
+  let K = randomOperand(descriptor.headCount * columnCount * H)
+  let V = randomOperand(descriptor.headCount * columnCount * H)
+
+  let reference = CPUAttentionBackend()
+  var expectedO: [Float] = []
+  var expectedL: [Float] = []
+  for head in 0..<descriptor.headCount {
+    var rowOffset = head * rowCount
+    var columnOffset = head * columnCount
+    for (R, C) in sequenceDimensions {
+      for r in 0..<R {
+        let visibleColumns = descriptor.causal ? (r + C - R + 1) : C
+        let rowRange = ((rowOffset + r) * H)..<((rowOffset + r + 1) * H)
+        let columnRange = (columnOffset * H)..<(
+          (columnOffset + visibleColumns) * H)
+        let (O, L) = reference.forward(
+          matrixDimensions: (1, visibleColumns, H),
+          Q: Array(Q[rowRange]),
+          K: Array(K[columnRange]),
+          V: Array(V[columnRange]))
+        expectedO += O
+        expectedL += L
+      }
+      rowOffset += R
+      columnOffset += C
+    }
+  }
+
+  let backend = MetalAttentionBackend()
+  let (O, L) = backend.forward(
+    scheduleDescriptor: descriptor, headDimension: H, Q: Q, K: K, V: V)
+  compareResults(O, expectedO, tolerance: 1e-4)
+  compareResults(L, expectedL, tolerance: 1e-4)
+}
+#endif
@@ -0,0 +1,175 @@
+#if canImport(Metal)
+import XCTest
+import FlashAttention
+
+final class BlockSelectionTest: XCTestCase {
+  func testCorrectness() throws {
+    for appendsKeyValue in [false, true] {
+      for precision in [GEMMOperandPrecision.FP32, .FP16] {
+        var decodeDesc = AttentionDecodeDescriptor()
+        decodeDesc.appendsKeyValue = appendsKeyValue
+        decodeDesc.blockSelection = AttentionBlockSelection(
+          blockSize: 16, blockCount: 4)
+        decodeDesc.cachePrecision = precision
+        decodeDesc.headDimension = [32, 80].randomElement()!
+        runCorrectnessTest(descriptor: decodeDesc, capacity: 256)
+      }
+    }
+  }
+
+  // Prints the error against dense attention, and the latency, for a range
+  // of selected block counts over a long cache.
+  func testAccuracyVersusSpeed() throws {
+    let H = 128
+    let contextLength = 16384
+    let blockSize: UInt32 = 64
+
+    // Give each block its own mean key, so some blocks matter much more
+    // than others to a given query.
+    let sequenceK = structuredKeys(
+      columnCount: contextLength + 1, headDimension: H,
+      blockSize: Int(blockSize))
+    let sequenceV = (0..<((contextLength + 1) * H)).map { _ in
+      Float.random(in: -1...1)
+    }
+    let Q = (0..<H).map { _ in Float.random(in: -1...1) }
+    let prefix = 0..<(contextLength * H)
+    let last = (contextLength * H)..<((contextLength + 1) * H)
+
+    func decode(
+      _ blockSelection: AttentionBlockSelection?
+    ) -> (O: [Float], latency: Double) {
+      var decodeDesc = AttentionDecodeDescriptor()
+      decodeDesc.blockSelection = blockSelection
+      decodeDesc.headDimension = UInt16(H)
+
+      // Take the best of several trials, each decoding one token after
+      // filling the cache.
+      var O: [Float] = []
+      var minLatency = Double.infinity
+      for _ in 0..<3 {
+        let cache = AttentionKeyValueCache(
+          descriptor: decodeDesc, capacity: contextLength + 1)
+        _ = cache.step(
+          Q: [Float](repeating: .zero, count: contextLength * H),
+          K: Array(sequenceK[prefix]), V: Array(sequenceV[prefix]))
+        O = cache.step(
+          Q: Q, K: Array(sequenceK[last]), V: Array(sequenceV[last])).O
+        minLatency = min(minLatency, cache.latency)
+      }
+      return (O, minLatency)
+    }
+
+    let dense = decode(nil)
+    print()
+    print("Block Selection Accuracy and Performance:")
+    print("blocks | fraction | max error | latency (μs) | speedup")
+    let totalBlockCount = contextLength / Int(blockSize)
+    for blockCount in [8, 32, 64, 128, totalBlockCount] {
+      let sparse = decode(AttentionBlockSelection(
+        blockSize: blockSize, blockCount: UInt32(blockCount)))
+      var maxError: Float = .zero
+      for i in dense.O.indices {
+        maxError = max(maxError, (sparse.O[i] - dense.O[i]).magnitude)
+      }
+      print(
+        String(
+          format: "%6d | %8.3f | %9.2e | %12.1f | %6.2fx",
+          blockCount,
+          Double(blockCount) / Double(totalBlockCount),
+          maxError,
+          sparse.latency * 1e6,
+          dense.latency / sparse.latency))
+
+      // Selecting every block is dense attention.
+      if blockCount == totalBlockCount {
+        XCTAssertLessThan(maxError, 1e-4)
+      }
+    }
+  }
+}
+
+private func structuredKeys(
+  columnCount: Int, headDimension: Int, blockSize: Int
+) -> [Float] {
+  var K: [Float] = []
+  var mean: [Float] = []
+  for c in 0..<columnCount {
+    if c % blockSize == 0 {
+      let magnitude = Float.random(in: 0...2)
+      mean = (0..<headDimension).map { _ in
+        magnitude * Float.random(in: -1...1)
+      }
+    }
+    K += mean.map { $0 + 0.25 * Float.random(in: -1...1) }
+  }
+  return K
+}
+
+/// Decodes a random number of tokens per step, and compares every step
+/// against the CPU reference: the same summaries and scores, then dense
+/// attention over the selected columns.
+private func runCorrectnessTest(
+  descriptor: AttentionDecodeDescriptor, capacity: Int
+) {
+  let H = Int(descriptor.headDimension!)
+  let precision = descriptor.cachePrecision
+  let blockSelection = descriptor.blockSelection!
+  let blockSize = Int(blockSelection.blockSize)
+  let cache = AttentionKeyValueCache(
+    descriptor: descriptor, capacity: capacity)
+
+  func randomOperand(_ count: Int) -> [Float] {
+    (0..<count).map { _ in
+      round(Float.random(in: -1...1), to: precision)
+    }
+  }
+  func gather(_ sequence: [Float], _ columns: [Int]) -> [Float] {
+    columns.flatMap { sequence[($0 * H)..<(($0 + 1) * H)] }
+  }
+  var sequenceK: [Float] = []
+  var sequenceV: [Float] = []
+  let reference = CPUAttentionBackend()
+  while cache.length < capacity - 8 {
+    let rowCount = [1, 1, 3, 8].randomElement()!
+    let Q = randomOperand(rowCount * H)
+    let K = randomOperand(rowCount * H)
+    let V = randomOperand(rowCount * H)
+
+    // Score the full blocks of the cache before this step.
+    let fullBlockCount = cache.length / blockSize
+    let summaries = blockSelection.summaries(
+      K: Array(sequenceK[0..<(fullBlockCount * blockSize * H)]),
+      headDimension: H)
+    let expectedScores = AttentionBlockSelection.scores(
+      Q: Q, summaries: summaries, headDimension: H)
+    let scores = cache.scoreBlocks(Q: Q)
+    compareResults(scores, expectedScores, tolerance: 1e-4 * Float(H))
+
+    let selectedBlocks = blockSelection.select(scores: scores)
+    sequenceK += K
+    sequenceV += V
+    var expectedO: [Float] = []
+    var expectedL: [Float] = []
+    for r in 0..<rowCount {
+      let position = cache.length + r
+      let columns = selectedBlocks.flatMap {
+        (Int($0) * blockSize)..<((Int($0) + 1) * blockSize)
+      } + Array((fullBlockCount * blockSize)...position)
+      let (O, L) = reference.forward(
+        matrixDimensions: (1, columns.count, H),
+        Q: Array(Q[(r * H)..<((r + 1) * H)]),
+        K: gather(sequenceK, columns),
+        V: gather(sequenceV, columns))
+      expectedO += O
+      expectedL += L
+    }
+
+    let (O, L) = cache.step(Q: Q, K: K, V: V)
+    XCTAssertEqual(cache.selectedBlocks, selectedBlocks)
+    let tolerance: Float = (precision == .FP32) ? 1e-4 : 2e-3
+    compareResults(O, expectedO, tolerance: tolerance)
+    compareResults(L, expectedL, tolerance: tolerance)
+  }
+}
+#endif
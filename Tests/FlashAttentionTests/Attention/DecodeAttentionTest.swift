@@ -0,0 +1,122 @@
+#if canImport(Metal)
+import XCTest
+import FlashAttention
+
+final class DecodeAttentionTest: XCTestCase {
+  func testContiguous() throws {
+    for appendsKeyValue in [false, true] {
+      var decodeDesc = AttentionDecodeDescriptor()
+      decodeDesc.appendsKeyValue = appendsKeyValue
+      decodeDesc.headDimension = [24, 64, 80].randomElement()!
+      runCorrectnessTest(
+        descriptor: decodeDesc, capacity: 200, tokenCount: 200)
+    }
+  }
+
+  func testPaged() throws {
+    for precision in [GEMMOperandPrecision.FP32, .FP16] {
+      var decodeDesc = AttentionDecodeDescriptor()
+      decodeDesc.cacheLayout = .paged(pageSize: 16)
+      decodeDesc.cachePrecision = precision
+      decodeDesc.headDimension = [32, 128].randomElement()!
+      runCorrectnessTest(
+        descriptor: decodeDesc, capacity: 256, tokenCount: 256)
+    }
+  }
+
+  func testSlidingWindow() throws {
+    for sinkCount in [0, 4] {
+      var decodeDesc = AttentionDecodeDescriptor()
+      decodeDesc.sinkCount = UInt32(sinkCount)
+      decodeDesc.slidingWindow = 32
+      decodeDesc.headDimension = 64
+      runCorrectnessTest(
+        descriptor: decodeDesc, capacity: 200, tokenCount: 200)
+    }
+  }
+
+  // The sequence grows to several times the capacity.
+  func testRing() throws {
+    for appendsKeyValue in [false, true] {
+      var decodeDesc = AttentionDecodeDescriptor()
+      decodeDesc.appendsKeyValue = appendsKeyValue
+      decodeDesc.cacheLayout = .ring
+      decodeDesc.sinkCount = [0, 4].randomElement()!
+      decodeDesc.slidingWindow = 48
+      decodeDesc.cachePrecision = [.FP32, .FP16].randomElement()!
+      decodeDesc.headDimension = [32, 80].randomElement()!
+      runCorrectnessTest(
+        descriptor: decodeDesc, capacity: 64, tokenCount: 300)
+    }
+  }
+}
+
+/// The logical columns a row sees: the sinks, and the window up to itself.
+private func visibleColumns(
+  position: Int, descriptor: AttentionDecodeDescriptor
+) -> [Int] {
+  guard let window = descriptor.slidingWindow else {
+    return Array(0...position)
+  }
+  let windowStart = max(position + 1 - Int(window), 0)
+  let sinkEnd = min(Int(descriptor.sinkCount), windowStart)
+  return Array(0..<sinkEnd) + Array(windowStart...position)
+}
+
+/// Decodes a random number of tokens per step, and compares every step
+/// against the CPU reference over the logical sequence.
+private func runCorrectnessTest(
+  descriptor: AttentionDecodeDescriptor, capacity: Int, tokenCount: Int
+) {
+  let H = Int(descriptor.headDimension!)
+  let precision = descriptor.cachePrecision
+  let cache = AttentionKeyValueCache(
+    descriptor: descriptor, capacity: capacity)
+  cache.pageTable.shuffle()
+
+  func randomOperand(_ count: Int) -> [Float] {
+    (0..<count).map { _ in
+      round(Float.random(in: -1...1), to: precision)
+    }
+  }
+  var sequenceK: [Float] = []
+  var sequenceV: [Float] = []
+  let reference = CPUAttentionBackend()
+  func gather(_ sequence: [Float], _ columns: [Int]) -> [Float] {
+    columns.flatMap { sequence[($0 * H)..<(($0 + 1) * H)] }
+  }
+  while cache.length < tokenCount - 8 {
+    let rowCount = [1, 1, 3, 8].randomElement()!
+    let Q = randomOperand(rowCount * H)
+    let K = randomOperand(rowCount * H)
+    let V = randomOperand(rowCount * H)
+    sequenceK += K
+    sequenceV += V
+
+    var expectedO: [Float] = []
+    var expectedL: [Float] = []
+    for r in 0..<rowCount {
+      let columns = visibleColumns(
+        position: cache.length + r, descriptor: descriptor)
+      let (O, L) = reference.forward(
+        matrixDimensions: (1, columns.count, H),
+        Q: Array(Q[(r * H)..<((r + 1) * H)]),
+        K: gather(sequenceK, columns),
+        V: gather(sequenceV, columns))
+      expectedO += O
+      expectedL += L
+    }
+
+    let (O, L) = cache.step(Q: Q, K: K, V: V)
+    let tolerance: Float = (precision == .FP32) ? 1e-4 : 2e-3
+    compareResults(O, expectedO, tolerance: tolerance)
+    compareResults(L, expectedL, tolerance: tolerance)
+  }
+
+  let residentColumns = cache.residentColumns
+  XCTAssertLessThanOrEqual(residentColumns.count, capacity)
+  let (cachedK, cachedV) = cache.cachedRows()
+  XCTAssertEqual(cachedK, gather(sequenceK, residentColumns))
+  XCTAssertEqual(cachedV, gather(sequenceV, residentColumns))
+}
+#endif
@@ -0,0 +1,103 @@
+import XCTest
+import FlashAttention
+
+final class DynamicShapeTest: XCTestCase {
+#if canImport(Metal)
+  func testHeadDimensionBucket() throws {
+    var buckets: Set<UInt16> = []
+    for head in UInt16(1)...256 {
+      var attentionDesc = AttentionDescriptor()
+      attentionDesc.matrixDimensions = (row: 1, column: 1, head: head)
+      let bucket = attentionDesc.headDimensionBucket
+      XCTAssertGreaterThanOrEqual(bucket, head)
+      XCTAssertLessThanOrEqual(bucket, max(2 * head, 8))
+      buckets.insert(bucket)
+    }
+    XCTAssertLessThanOrEqual(buckets.count, 12)
+  }
+
+  // Every problem size shares the pipelines of its head dimension bucket.
+  func testCorrectness() throws {
+    let backend = MetalAttentionBackend(pipelinePolicy: .dynamic)
+    let head = 24
+    for _ in 0..<6 {
+      runCorrectnessTest(
+        backend: backend,
+        matrixDimensions: (
+          Int.random(in: 1...150), Int.random(in: 1...150), head))
+    }
+    XCTAssertEqual(backend.pipelineCount, 3)
+  }
+
+  // A problem size gets a specialized pipeline once it is seen often enough.
+  func testAdaptivePolicy() throws {
+    let backend = MetalAttentionBackend(
+      pipelinePolicy: .adaptive(threshold: 3, capacity: 1))
+    let head = 16
+    func forward(_ row: Int, _ column: Int) {
+      let Q = [Float](repeating: 0.5, count: row * head)
+      let K = [Float](repeating: 0.5, count: column * head)
+      let V = [Float](repeating: 0.5, count: column * head)
+      _ = backend.forward(
+        matrixDimensions: (row, column, head), Q: Q, K: K, V: V)
+    }
+
+    forward(40, 50)
+    forward(41, 50)
+    forward(40, 50)
+    XCTAssertEqual(backend.pipelineCount, 1)
+    forward(40, 50)
+    XCTAssertEqual(backend.pipelineCount, 2)
+
+    // Beyond the capacity, new sizes stay dynamic.
+    for _ in 0..<3 {
+      forward(41, 50)
+    }
+    XCTAssertEqual(backend.pipelineCount, 2)
+  }
+#endif
+}
+
+#if canImport(Metal)
+/// Compares the three kernels against the CPU reference.
+private func runCorrectnessTest(
+  backend: AttentionBackend,
+  matrixDimensions: (row: Int, column: Int, head: Int)
+) {
+  let (R, C, H) = matrixDimensions
+  func randomOperand(_ count: Int) -> [Float] {
+    (0..<count).map { _ in Float.random(in: -1...1) }
+  }
+  let Q = randomOperand(R * H)
+  let K = randomOperand(C * H)
+  let V = randomOperand(C * H)
+  let dO = randomOperand(R * H)
+
+  let reference = CPUAttentionBackend()
+  let (expectedO, expectedL) = reference.forward(
+    matrixDimensions: matrixDimensions, Q: Q, K: K, V: V)
+  let (expectedD, expectedDQ) = reference.backwardQuery(
+    matrixDimensions: matrixDimensions, Q: Q, K: K, V: V,
+    O: expectedO, L: expectedL, dO: dO)
+  let (expectedDK, expectedDV) = reference.backwardKeyValue(
+    matrixDimensions: matrixDimensions, Q: Q, K: K, V: V,
+    L: expectedL, D: expectedD, dO: dO)
+
+  let (O, L) = backend.forward(
+    matrixDimensions: matrixDimensions, Q: Q, K: K, V: V)
+  let (D, dQ) = backend.backwardQuery(
+    matrixDimensions: matrixDimensions, Q: Q, K: K, V: V,
+    O: expectedO, L: expectedL, dO: dO)
+  let (dK, dV) = backend.backwardKeyValue(
+    matrixDimensions: matrixDimensions, Q: Q, K: K, V: V,
+    L: expectedL, D: expectedD, dO: dO)
+
+  compareResults(O, expectedO, tolerance: 1e-4)
+  compareResults(L, expectedL, tolerance: 1e-4)
+  compareResults(D, expectedD, tolerance: 1e-4)
+  let tolerance = 1e-4 * Float(max(R, C))
+  compareResults(dQ, expectedDQ, tolerance: tolerance)
+  compareResults(dK, expectedDK, tolerance: tolerance)
+  compareResults(dV, expectedDV, tolerance: tolerance)
+}
+#endif
@@ -0,0 +1,208 @@
+#if canImport(Metal)
+import XCTest
+import FlashAttention
+
+final class GroupedQueryAttentionTest: XCTestCase {
+  func testBlockPacking() throws {
+    var attentionDesc = AttentionDescriptor()
+    attentionDesc.matrixDimensions = (row: 256, column: 256, head: 32)
+    attentionDesc.transposeState = (Q: false, K: false, V: false, O: false)
+
+    func parallelization(_ type: AttentionKernelType) -> UInt16 {
+      let kernelDesc = attentionDesc.kernelDescriptor(type: type)
+      return kernelDesc.blockDimensions!.parallelization
+    }
+    let original = (
+      parallelization(.forward), parallelization(.backwardKeyValue))
+    attentionDesc.multiQueryBlockPacking = true
+    XCTAssertEqual(parallelization(.forward), max(64, original.0))
+    XCTAssertEqual(parallelization(.backwardKeyValue), original.1)
+
+    // Large heads are left alone.
+    attentionDesc.matrixDimensions = (row: 256, column: 256, head: 128)
+    attentionDesc.multiQueryBlockPacking = false
+    let large = parallelization(.forward)
+    attentionDesc.multiQueryBlockPacking = true
+    XCTAssertEqual(parallelization(.forward), large)
+  }
+
+  func testCorrectness() throws {
+    for _ in 0..<6 {
+      var attentionDesc = AttentionDescriptor()
+      attentionDesc.matrixDimensions = (
+        row: UInt32.random(in: 1...100),
+        column: UInt32.random(in: 1...100),
+        head: [16, 32, 64].randomElement()!)
+      attentionDesc.transposeState = (
+        Q: false, K: Bool.random(), V: Bool.random(), O: false)
+      attentionDesc.queryHeadsPerKeyValueHead = [1, 2, 4, 8].randomElement()!
+      attentionDesc.multiQueryBlockPacking = Bool.random()
+      runCorrectnessTest(descriptor: attentionDesc)
+    }
+  }
+}
+
+/// Compares the packed kernels against the CPU reference, one query head at
+/// a time. dK and dV sum over the heads of the group.
+private func runCorrectnessTest(descriptor: AttentionDescriptor) {
+  let matrixDimensions = descriptor.matrixDimensions!
+  let transposeState = descriptor.transposeState!
+  let R = Int(matrixDimensions.row)
+  let C = Int(matrixDimensions.column)
+  let H = Int(matrixDimensions.head)
+  let G = Int(descriptor.queryHeadsPerKeyValueHead)
+
+  func randomOperand(_ count: Int) -> [Float] {
+    (0..<count).map { _ in Float.random(in: -1...1) }
+  }
+  let Q = randomOperand(G * R * H)
+  let K = randomOperand(C * H)
+  let V = randomOperand(C * H)
+  let dO = randomOperand(G * R * H)
+
+  // Run the reference for each head.
+  let reference = CPUAttentionBackend()
+  var expectedO: [Float] = []
+  var expectedL: [Float] = []
+  var expectedD: [Float] = []
+  var expectedDK = [Float](repeating: .zero, count: C * H)
+  var expectedDV = [Float](repeating: .zero, count: C * H)
+  for headID in 0..<G {
+    let rowRange = (headID * R * H)..<((headID + 1) * R * H)
+    let headQ = Array(Q[rowRange])
+    let headDO = Array(dO[rowRange])
+    let (O, L) = reference.forward(
+      matrixDimensions: (R, C, H), Q: headQ, K: K, V: V)
+    let (D, _) = reference.backwardQuery(
+      matrixDimensions: (R, C, H), Q: headQ, K: K, V: V,
+      O: O, L: L, dO: headDO)
+    let (dK, dV) = reference.backwardKeyValue(
+      matrixDimensions: (R, C, H), Q: headQ, K: K, V: V,
+      L: L, D: D, dO: headDO)
+    expectedO += O
+    expectedL += L
+    expectedD += D
+    for i in 0..<(C * H) {
+      expectedDK[i] += dK[i]
+      expectedDV[i] += dV[i]
+    }
+  }
+
+  // Transposes a (sequence x head) matrix.
+  func transpose(_ input: [Float]) -> [Float] {
+    let sequenceDimension = input.count / H
+    var output = [Float](repeating: .zero, count: input.count)
+    for n in 0..<sequenceDimension {
+      for d in 0..<H {
+        output[d * sequenceDimension + n] = input[n * H + d]
+      }
+    }
+    return output
+  }
+  let inputK = transposeState.K ? transpose(K) : K
+  let inputV = transposeState.V ? transpose(V) : V
+
+  let forward = execute(
+    descriptor: descriptor, type: .forward,
+    inputs: [.Q: Q, .K: inputK, .V: inputV])
+  compareResults(forward[.O]!, expectedO, tolerance: 1e-4)
+  compareResults(forward[.L]!, expectedL, tolerance: 1e-4)
+
+  let backward = execute(
+    descriptor: descriptor, type: .backwardKeyValue,
+    inputs: [
+      .Q: Q, .K: inputK, .V: inputV, .L: expectedL, .D: expectedD, .dO: dO,
+    ])
+  var actualDK = backward[.dK]!
+  var actualDV = backward[.dV]!
+  if transposeState.K {
+    actualDK = transpose(actualDK)
+  }
+  if transposeState.V {
+    actualDV = transpose(actualDV)
+  }
+  let tolerance = 1e-4 * Float(G * R)
+  compareResults(actualDK, expectedDK, tolerance: tolerance)
+  compareResults(actualDV, expectedDV, tolerance: tolerance)
+}
+
+/// Dispatches one kernel. Every operand is FP32.
+private func execute(
+  descriptor: AttentionDescriptor,
+  type: AttentionKernelType,
+  inputs: [AttentionOperand: [Float]]
+) -> [AttentionOperand: [Float]] {
+  let matrixDimensions = descriptor.matrixDimensions!
+  let packedRows = Int(descriptor.packedRowDimension)
+  let columns = Int(matrixDimensions.column)
+  let head = Int(matrixDimensions.head)
+
+  let kernelDesc = descriptor.kernelDescriptor(type: type)
+  let kernel = AttentionKernel(descriptor: kernelDesc)
+  let device = MTLContext.global.device
+  let library = try! device.makeLibrary(
+    source: kernel.createSource(), options: nil)
+  let functionConstants = MTLFunctionConstantValues()
+  descriptor.setFunctionConstants(functionConstants)
+  let function = try! library.makeFunction(
+    name: "attention", constantValues: functionConstants)
+  let pipelineDesc = MTLComputePipelineDescriptor()
+  pipelineDesc.computeFunction = function
+  pipelineDesc.maxTotalThreadsPerThreadgroup = 1024
+  let pipeline = try! device.makeComputePipelineState(
+    descriptor: pipelineDesc, options: [], reflection: nil)
+
+  func elementCount(_ operand: AttentionOperand) -> Int {
+    switch operand {
+    case .K, .V, .dV, .dK:
+      return columns * head
+    case .Q, .O, .dO, .dQ:
+      return packedRows * head
+    case .L, .D:
+      return packedRows
+    default:
+      fatalError("Unsupported operand.")
+    }
+  }
+  let bufferIndices: [(AttentionOperand, Int)] = [
+    (.Q, 0), (.K, 1), (.V, 2), (.O, 3), (.L, 4), (.D, 5),
+    (.dO, 6), (.dV, 7), (.dK, 8), (.dQ, 9),
+  ]
+  var buffers: [AttentionOperand: MTLBuffer] = [:]
+  for (operand, _) in bufferIndices {
+    let contents = inputs[operand]
+      ?? [Float](repeating: .zero, count: elementCount(operand))
+    buffers[operand] = MTLContext.global.createBuffer(contents, .FP32)
+  }
+
+  let commandBuffer = MTLContext.global.commandQueue.makeCommandBuffer()!
+  let encoder = commandBuffer.makeComputeCommandEncoder()!
+  for (operand, index) in bufferIndices {
+    encoder.setBuffer(buffers[operand]!, offset: 0, index: index)
+  }
+  encoder.setComputePipelineState(pipeline)
+  encoder.setThreadgroupMemoryLength(
+    Int(kernel.threadgroupMemoryAllocation), index: 0)
+
+  let parallelizationDimension =
+  (type == .backwardKeyValue) ? columns : packedRows
+  let granularity = Int(kernel.blockDimensions.parallelization)
+  encoder.dispatchThreadgroups(
+    MTLSize(
+      width: (parallelizationDimension + granularity - 1) / granularity,
+      height: 1, depth: 1),
+    threadsPerThreadgroup: MTLSize(
+      width: Int(kernel.threadgroupSize), height: 1, depth: 1))
+  encoder.endEncoding()
+  commandBuffer.commit()
+  commandBuffer.waitUntilCompleted()
+
+  var output: [AttentionOperand: [Float]] = [:]
+  for (operand, _) in bufferIndices {
+    var contents = [Float](repeating: .zero, count: elementCount(operand))
+    MTLContext.copy(buffers[operand]!, into: &contents, precision: .FP32)
+    output[operand] = contents
+  }
+  return output
+}
+#endif
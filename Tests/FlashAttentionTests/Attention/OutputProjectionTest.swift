@@ -0,0 +1,76 @@
+#if canImport(Metal)
+import XCTest
+import FlashAttention
+
+final class OutputProjectionTest: XCTestCase {
+  func testCorrectness() throws {
+    for appendsKeyValue in [false, true] {
+      var decodeDesc = AttentionDecodeDescriptor()
+      decodeDesc.appendsKeyValue = appendsKeyValue
+      decodeDesc.headDimension = [32, 64, 80].randomElement()!
+      decodeDesc.outputProjectionDimension = [48, 300].randomElement()!
+      runCorrectnessTest(descriptor: decodeDesc, headCount: 4)
+    }
+  }
+}
+
+/// Decodes a few steps on every head, then compares the sum of the partials
+/// against attention followed by a separate projection.
+private func runCorrectnessTest(
+  descriptor: AttentionDecodeDescriptor, headCount: Int
+) {
+  let D = Int(descriptor.headDimension!)
+  let M = Int(descriptor.outputProjectionDimension!)
+  func randomOperand(_ count: Int) -> [Float] {
+    (0..<count).map { _ in Float.random(in: -1...1) }
+  }
+
+  // W_o is (headCount * D) x M. Head 'h' owns rows h * D through
+  // (h + 1) * D - 1.
+  let W = randomOperand(headCount * D * M)
+  let caches = (0..<headCount).map { h in
+    let cache = AttentionKeyValueCache(descriptor: descriptor, capacity: 64)
+    cache.outputProjection = Array(W[(h * D * M)..<((h + 1) * D * M)])
+    return cache
+  }
+
+  var sequenceK = [[Float]](repeating: [], count: headCount)
+  var sequenceV = [[Float]](repeating: [], count: headCount)
+  let reference = CPUAttentionBackend()
+  for rowCount in [5, 1, 1, 8] {
+    var partials: [[Float]] = []
+    var expected = [Float](repeating: .zero, count: rowCount * M)
+    for h in 0..<headCount {
+      let cache = caches[h]
+      let Q = randomOperand(rowCount * D)
+      let K = randomOperand(rowCount * D)
+      let V = randomOperand(rowCount * D)
+      sequenceK[h] += K
+      sequenceV[h] += V
+
+      for r in 0..<rowCount {
+        let columnCount = cache.length + r + 1
+        let (O, _) = reference.forward(
+          matrixDimensions: (1, columnCount, D),
+          Q: Array(Q[(r * D)..<((r + 1) * D)]),
+          K: Array(sequenceK[h][0..<(columnCount * D)]),
+          V: Array(sequenceV[h][0..<(columnCount * D)]))
+        for j in 0..<M {
+          var sum: Float = .zero
+          for d in 0..<D {
+            sum += O[d] * W[(h * D + d) * M + j]
+          }
+          expected[r * M + j] += sum
+        }
+      }
+
+      let (partial, _) = cache.step(Q: Q, K: K, V: V)
+      XCTAssertEqual(partial.count, rowCount * M)
+      partials.append(partial)
+    }
+
+    let output = AttentionKeyValueCache.reduceOutputProjection(partials)
+    compareResults(output, expected, tolerance: 1e-3 * Float(headCount))
+  }
+}
+#endif
@@ -1,3 +1,4 @@
+#if canImport(Metal)
 import XCTest
 import FlashAttention
 
@@ -484,3 +485,4 @@ private func runCorrectnessTest(descriptor: AttentionDescriptor) {
     check(expected: dQ, actual: resultDerivativeQ, tolerance: 2e-5)
   }
 }
+#endif
@@ -0,0 +1,110 @@
+import XCTest
+import FlashAttention
+
+final class RingAttentionTest: XCTestCase {
+  func testCPUBackend() throws {
+    let backend = CPUAttentionBackend()
+    for (row, column, head) in [(37, 53, 16), (64, 64, 24), (9, 3, 8)] {
+      for workerCount in [1, 2, 4] {
+        runCorrectnessTest(
+          backend: backend,
+          matrixDimensions: (row, column, head),
+          transport: SharedMemoryRingTransport(workerCount: workerCount))
+        runCorrectnessTest(
+          backend: backend,
+          matrixDimensions: (row, column, head),
+          transport: SocketRingTransport(workerCount: workerCount))
+      }
+    }
+  }
+
+#if canImport(Metal)
+  func testMetalBackend() throws {
+    let backend = MetalAttentionBackend()
+    for workerCount in [2, 3] {
+      runCorrectnessTest(
+        backend: backend,
+        matrixDimensions: (96, 80, 32),
+        transport: SharedMemoryRingTransport(workerCount: workerCount))
+    }
+  }
+#endif
+}
+
+/// Splits the sequence into uneven shards, runs the ring, and compares the
+/// reassembled results against a single call to the backend, and against the
+/// attention matrix materialized on the CPU.
+private func runCorrectnessTest(
+  backend: AttentionBackend,
+  matrixDimensions: (row: Int, column: Int, head: Int),
+  transport: RingTransport
+) {
+  let (R, C, H) = matrixDimensions
+  var networkDesc = NetworkDescriptor()
+  networkDesc.rowDimension = R
+  networkDesc.columnDimension = C
+  networkDesc.headDimension = H
+  let network = Network(descriptor: networkDesc)
+
+  // Random split points. Some shards may be empty.
+  func shardRanges(_ count: Int) -> [Range<Int>] {
+    var boundaries = (1..<transport.workerCount).map { _ in
+      Int.random(in: 0...count)
+    }
+    boundaries = [0] + boundaries.sorted() + [count]
+    return (0..<transport.workerCount).map {
+      boundaries[$0]..<boundaries[$0 + 1]
+    }
+  }
+  let rowRanges = shardRanges(R)
+  let columnRanges = shardRanges(C)
+  func split(_ array: [Float], _ ranges: [Range<Int>], _ width: Int)
+    -> [[Float]] {
+    ranges.map {
+      Array(array[($0.lowerBound * width)..<($0.upperBound * width)])
+    }
+  }
+
+  let Q = split(network.Q, rowRanges, H)
+  let K = split(network.K, columnRanges, H)
+  let V = split(network.V, columnRanges, H)
+  let dO = split(network.dO, rowRanges, H)
+
+  let driver = RingAttentionDriver(backend: backend, transport: transport)
+  let (shardsO, shardsL) = driver.forward(Q: Q, K: K, V: V, head: H)
+  let (shardsDerivativeQ, shardsDerivativeK, shardsDerivativeV) = driver
+    .backward(
+      Q: Q, K: K, V: V, O: shardsO, L: shardsL, dO: dO, head: H)
+  let resultO = shardsO.flatMap { $0 }
+  let resultL = shardsL.flatMap { $0 }
+  let resultDerivativeQ = shardsDerivativeQ.flatMap { $0 }
+  let resultDerivativeK = shardsDerivativeK.flatMap { $0 }
+  let resultDerivativeV = shardsDerivativeV.flatMap { $0 }
+
+  // Single worker, same backend.
+  let (singleO, singleL) = backend.forward(
+    matrixDimensions: matrixDimensions,
+    Q: network.Q, K: network.K, V: network.V)
+  let (singleD, singleDerivativeQ) = backend.backwardQuery(
+    matrixDimensions: matrixDimensions,
+    Q: network.Q, K: network.K, V: network.V,
+    O: singleO, L: singleL, dO: network.dO)
+  let (singleDerivativeK, singleDerivativeV) = backend.backwardKeyValue(
+    matrixDimensions: matrixDimensions,
+    Q: network.Q, K: network.K, V: network.V,
+    L: singleL, D: singleD, dO: network.dO)
+  compareResults(resultO, singleO, tolerance: 2e-5)
+  compareResults(resultL, singleL, tolerance: 2e-5)
+  compareResults(resultDerivativeQ, singleDerivativeQ, tolerance: 2e-4)
+  compareResults(resultDerivativeK, singleDerivativeK, tolerance: 2e-4)
+  compareResults(resultDerivativeV, singleDerivativeV, tolerance: 2e-4)
+
+  // Reference attention, with the natural logarithm for L.
+  let expectedL = (0..<R).map(network.createLTerm(rowID:))
+  compareResults(
+    resultL.map { $0 / 1.44269504089 }, expectedL, tolerance: 2e-4)
+  compareResults(resultO, network.inferenceAttention(), tolerance: 2e-4)
+  compareResults(resultDerivativeQ, network.derivativeQ(), tolerance: 2e-3)
+  compareResults(resultDerivativeK, network.derivativeK(), tolerance: 2e-3)
+  compareResults(resultDerivativeV, network.derivativeV(), tolerance: 2e-3)
+}
@@ -1,3 +1,4 @@
+#if canImport(Metal)
 import XCTest
 import FlashAttention
 
@@ -790,3 +791,4 @@ private func profileProblemSize(
   }
   return maxGINSTRS
 }
+#endif
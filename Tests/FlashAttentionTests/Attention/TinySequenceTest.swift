@@ -0,0 +1,81 @@
+import XCTest
+import FlashAttention
+
+final class TinySequenceTest: XCTestCase {
+  func testSelection() throws {
+    func tinyDescriptor(
+      _ row: UInt32, _ column: UInt32, _ head: UInt16
+    ) -> AttentionTinyDescriptor? {
+      var attentionDesc = AttentionDescriptor()
+      attentionDesc.matrixDimensions = (row, column, head)
+      attentionDesc.transposeState = (false, false, false, false)
+      return attentionDesc.tinySequenceDescriptor
+    }
+    XCTAssertNotNil(tinyDescriptor(49, 49, 32))
+    XCTAssertNotNil(tinyDescriptor(49, 49, 64))
+    XCTAssertNil(tinyDescriptor(49, 512, 64))
+    XCTAssertNil(tinyDescriptor(49, 49, 128))
+    XCTAssertNil(tinyDescriptor(49, 49, 0))
+
+    // A 7 x 7 window with a small head shares its threadgroup.
+    let kernel = AttentionTinyKernel(descriptor: tinyDescriptor(49, 49, 16)!)
+    XCTAssertGreaterThan(kernel.problemsPerThreadgroup, 1)
+    XCTAssertLessThanOrEqual(kernel.threadgroupSize, 1024)
+    XCTAssertLessThanOrEqual(kernel.threadgroupMemoryAllocation, 32 * 1024)
+  }
+
+#if canImport(Metal)
+  func testCorrectness() throws {
+    let backend = MetalAttentionBackend()
+    let problems: [(row: Int, column: Int, head: Int)] = [
+      (49, 49, 16),
+      (49, 49, 64),
+      (17, 33, 24),
+      (100, 100, 16),
+      // Runs on the tiled kernel.
+      (40, 200, 32),
+    ]
+    for matrixDimensions in problems {
+      runCorrectnessTest(
+        backend: backend,
+        batchCount: Int.random(in: 1...40),
+        matrixDimensions: matrixDimensions)
+    }
+  }
+#endif
+}
+
+#if canImport(Metal)
+private func runCorrectnessTest(
+  backend: MetalAttentionBackend,
+  batchCount: Int,
+  matrixDimensions: (row: Int, column: Int, head: Int)
+) {
+  let (R, C, H) = matrixDimensions
+  func randomOperand(_ count: Int) -> [Float] {
+    (0..<count).map { _ in Float.random(in: -1...1) }
+  }
+  let Q = randomOperand(batchCount * R * H)
+  let K = randomOperand(batchCount * C * H)
+  let V = randomOperand(batchCount * C * H)
+
+  let reference = CPUAttentionBackend()
+  var expectedO: [Float] = []
+  var expectedL: [Float] = []
+  for problem in 0..<batchCount {
+    let (O, L) = reference.forward(
+      matrixDimensions: matrixDimensions,
+      Q: Array(Q[(problem * R * H)..<((problem + 1) * R * H)]),
+      K: Array(K[(problem * C * H)..<((problem + 1) * C * H)]),
+      V: Array(V[(problem * C * H)..<((problem + 1) * C * H)]))
+    expectedO += O
+    expectedL += L
+  }
+
+  let (O, L) = backend.forward(
+    batchCount: batchCount, matrixDimensions: matrixDimensions,
+    Q: Q, K: K, V: V)
+  compareResults(O, expectedO, tolerance: 1e-4)
+  compareResults(L, expectedL, tolerance: 1e-4)
+}
+#endif
@@ -0,0 +1,130 @@
+import XCTest
+import FlashAttention
+
+final class AccuracyPolicyTest: XCTestCase {
+  // Simulates the accumulation on the CPU, rounding after every FMA, and
+  // checks that the observed error never exceeds the model.
+  func testErrorModel() throws {
+    for reductionLength in [8, 64, 512, 4096] {
+      for signedInputs in [true, false] {
+        for (accumulator, output) in [
+          (GEMMOperandPrecision.FP16, GEMMOperandPrecision.FP16),
+          (GEMMOperandPrecision.FP32, GEMMOperandPrecision.FP16),
+          (GEMMOperandPrecision.FP32, GEMMOperandPrecision.FP32),
+        ] {
+          let observed = measureError(
+            accumulator: accumulator,
+            output: output,
+            reductionLength: reductionLength,
+            signedInputs: signedInputs)
+          let modeled = AccuracyPolicy.estimatedError(
+            accumulator: accumulator,
+            output: output,
+            reductionLength: reductionLength)
+          XCTAssertLessThanOrEqual(
+            observed, modeled,
+            "accumulator=\(accumulator), K=\(reductionLength)")
+        }
+      }
+    }
+  }
+
+#if canImport(Metal)
+  func testPolicyMapping() throws {
+    XCTAssertTrue(
+      AccuracyPolicy.fastest.permitsLowPrecisionAccumulator(output: .FP16))
+    XCTAssertFalse(
+      AccuracyPolicy.balanced.permitsLowPrecisionAccumulator(output: .FP16))
+    XCTAssertTrue(
+      AccuracyPolicy.errorBound(5e-2, reductionLength: 64)
+        .permitsLowPrecisionAccumulator(output: .FP16))
+    XCTAssertFalse(
+      AccuracyPolicy.errorBound(5e-2, reductionLength: 4096)
+        .permitsLowPrecisionAccumulator(output: .FP16))
+    XCTAssertTrue(AccuracyPolicy.fastest.permitsBF16Truncation)
+    XCTAssertFalse(AccuracyPolicy.balanced.permitsBF16Truncation)
+
+    func registerPrecisionC(
+      _ policy: AccuracyPolicy
+    ) -> GEMMOperandPrecision {
+      var gemmDesc = GEMMDescriptor()
+      gemmDesc.accuracyPolicy = policy
+      gemmDesc.matrixDimensions = (M: 256, N: 256, K: 4096)
+      gemmDesc.memoryPrecisions = (.FP16, .FP16, .FP16)
+      gemmDesc.transposeState = (false, false)
+      let kernelDesc = GEMMKernelDescriptor(descriptor: gemmDesc)
+      return kernelDesc.registerPrecisions!.C
+    }
+    XCTAssertEqual(registerPrecisionC(.fastest), .FP16)
+    XCTAssertEqual(registerPrecisionC(.balanced), .FP32)
+    XCTAssertEqual(
+      registerPrecisionC(.errorBound(1e-1, reductionLength: 4096)), .FP32)
+    XCTAssertEqual(
+      registerPrecisionC(.errorBound(1e-1, reductionLength: 64)), .FP16)
+
+    var attentionDesc = AttentionDescriptor()
+    attentionDesc.lowPrecisionInputs = true
+    attentionDesc.lowPrecisionIntermediates = true
+    attentionDesc.accuracyPolicy = .fastest
+    XCTAssertEqual(attentionDesc.registerPrecisions[.S], .FP16)
+    attentionDesc.accuracyPolicy = .balanced
+    XCTAssertEqual(attentionDesc.registerPrecisions[.S], .FP32)
+    XCTAssertEqual(attentionDesc.registerPrecisions[.dS], .FP32)
+  }
+
+  func testCacheKey() throws {
+    var gemmDesc = GEMMDescriptor()
+    gemmDesc.matrixDimensions = (M: 128, N: 128, K: 128)
+    gemmDesc.memoryPrecisions = (.FP16, .FP16, .FP16)
+    gemmDesc.transposeState = (false, false)
+
+    var fastDesc = gemmDesc
+    fastDesc.accuracyPolicy = .fastest
+    var accurateDesc = gemmDesc
+    accurateDesc.accuracyPolicy = .balanced
+    XCTAssertNotEqual(fastDesc, accurateDesc)
+
+    GEMMKernel.register(descriptor: fastDesc)
+    GEMMKernel.register(descriptor: accurateDesc)
+    let fastPipeline = GEMMKernel.pipelineCache[fastDesc]!.pipeline
+    let accuratePipeline = GEMMKernel.pipelineCache[accurateDesc]!.pipeline
+    XCTAssertFalse(fastPipeline === accuratePipeline)
+  }
+#endif
+}
+
+/// Returns the maximum error of a dot product, relative to Σ|a * b|.
+private func measureError(
+  accumulator: GEMMOperandPrecision,
+  output: GEMMOperandPrecision,
+  reductionLength: Int,
+  signedInputs: Bool
+) -> Float {
+  var maxError: Float = .zero
+  for _ in 0..<64 {
+    let range: ClosedRange<Float> = signedInputs ? -1...1 : 0...1
+    let a = (0..<reductionLength).map { _ in
+      round(Float.random(in: range), to: .FP16)
+    }
+    let b = (0..<reductionLength).map { _ in
+      round(Float.random(in: range), to: .FP16)
+    }
+
+    var exact: Double = .zero
+    var magnitude: Double = .zero
+    var accumulated: Float = .zero
+    for k in 0..<reductionLength {
+      let product = Double(a[k]) * Double(b[k])
+      exact += product
+      magnitude += product.magnitude
+
+      // A fused multiply-add rounds once, to the accumulator precision.
+      let sum = Double(accumulated) + product
+      accumulated = round(Float(sum), to: accumulator)
+    }
+    let result = round(accumulated, to: output)
+    let error = (Double(result) - exact).magnitude / magnitude
+    maxError = max(maxError, Float(error))
+  }
+  return maxError
+}
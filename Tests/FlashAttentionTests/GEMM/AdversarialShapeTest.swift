@@ -1,3 +1,4 @@
+#if canImport(Metal)
 import XCTest
 import FlashAttention
 
@@ -42,12 +43,13 @@ final class AdversarialShapeTest: XCTestCase {
       let transposeState = (
         A: Bool.random(),
         B: Bool.random())
+      let transposeC = Bool.random()
       
       // Set the leading dimensions.
       var leadingDimensions = (
         A: transposeState.A ? matrixDimensions.M : matrixDimensions.K,
         B: transposeState.B ? matrixDimensions.K : matrixDimensions.N,
-        C: false ? matrixDimensions.M : matrixDimensions.N)
+        C: transposeC ? matrixDimensions.M : matrixDimensions.N)
       if Bool.random() {
         leadingDimensions = (
           A: leadingDimensions.A + UInt32.random(in: 0..<64),
@@ -62,6 +64,10 @@ final class AdversarialShapeTest: XCTestCase {
       gemmDesc.matrixDimensions = matrixDimensions
       gemmDesc.memoryPrecisions = memoryPrecisions
       gemmDesc.transposeState = transposeState
+      gemmDesc.transposeC = transposeC
+      if Bool.random() {
+        gemmDesc.preferAsyncLoad = false
+      }
       runCorrectnessTest(descriptor: gemmDesc)
     }
   }
@@ -92,7 +98,7 @@ private func runCorrectnessTest(descriptor: GEMMDescriptor) {
   let trailingDimensionB = chooseTrailingBlockDimension(
     transposeState.B, matrixDimensions.K, matrixDimensions.N)
   let trailingDimensionC = chooseTrailingBlockDimension(
-    false, matrixDimensions.M, matrixDimensions.N)
+    descriptor.transposeC, matrixDimensions.M, matrixDimensions.N)
   
   let checkpoint0 = CACurrentMediaTime()
   
@@ -176,7 +182,9 @@ private func runCorrectnessTest(descriptor: GEMMDescriptor) {
     let sourcePointer = bufferC.contents()
     for m in 0..<matrixDimensions.M {
       for n in 0..<matrixDimensions.N {
-        let address = m * leadingDimensions.C + n
+        let address = descriptor.transposeC
+        ? n * leadingDimensions.C + m
+        : m * leadingDimensions.C + n
         var sourceValue: Float
         
         switch memoryPrecisions.C {
@@ -230,7 +238,9 @@ private func runCorrectnessTest(descriptor: GEMMDescriptor) {
         dotProduct += valueA * valueB
       }
       
-      let addressC: UInt32 = m * leadingDimensions.C + n
+      let addressC: UInt32 = descriptor.transposeC
+      ? n * leadingDimensions.C + m
+      : m * leadingDimensions.C + n
       if descriptor.loadPreviousC {
         dotProduct += operandPreviousC[Int(addressC)]
       }
@@ -243,7 +253,9 @@ private func runCorrectnessTest(descriptor: GEMMDescriptor) {
   var totalDistance: Float = .zero
   for m in 0..<matrixDimensions.M {
     for n in 0..<matrixDimensions.N {
-      let address = m * leadingDimensions.C + n
+      let address = descriptor.transposeC
+      ? n * leadingDimensions.C + m
+      : m * leadingDimensions.C + n
       let cpuValue = cpuOperandC[Int(address)]
       let gpuValue = gpuOperandC[Int(address)]
       
@@ -335,3 +347,4 @@ private func createTolerance(
   
   return tolerance
 }
+#endif
@@ -0,0 +1,102 @@
+import XCTest
+import FlashAttention
+
+final class AsyncExecutionTest: XCTestCase {
+  // Many GEMMs in flight at once, bounded by the queue.
+  func testGEMM() async throws {
+    let backend = CPUGEMMBackend()
+    let queue = AsyncExecutionQueue(maximumInFlight: 3)
+    let problemCount = 20
+
+    let problems = (0..<problemCount).map { _ in
+      (M: Int.random(in: 1...40),
+       N: Int.random(in: 1...40),
+       K: Int.random(in: 1...40))
+    }
+    let results = await withTaskGroup(
+      of: ([Float], [Float]).self
+    ) { group in
+      for problem in problems {
+        group.addTask {
+          await queue.submit {
+            await runGEMM(backend: backend, problem: problem)
+          }
+        }
+      }
+      var results: [([Float], [Float])] = []
+      for await result in group {
+        results.append(result)
+      }
+      return results
+    }
+
+    XCTAssertEqual(results.count, problemCount)
+    for (actual, expected) in results {
+      compareResults(actual, expected, tolerance: 1e-4)
+    }
+    let completedCount = await queue.completedCount
+    let inFlightCount = await queue.inFlightCount
+    let peakInFlightCount = await queue.peakInFlightCount
+    XCTAssertEqual(completedCount, problemCount)
+    XCTAssertEqual(inFlightCount, 0)
+    XCTAssertGreaterThan(peakInFlightCount, 0)
+    XCTAssertLessThanOrEqual(peakInFlightCount, 3)
+  }
+
+  // The asynchronous path returns what the synchronous one does.
+  func testAttention() async throws {
+    let backend = CPUAttentionBackend()
+    let matrixDimensions = (row: 17, column: 33, head: 8)
+    func randomOperand(_ count: Int) -> [Float] {
+      (0..<count).map { _ in Float.random(in: -1...1) }
+    }
+    let Q = randomOperand(17 * 8)
+    let K = randomOperand(33 * 8)
+    let V = randomOperand(33 * 8)
+
+    let expected = backend.forward(
+      matrixDimensions: matrixDimensions, Q: Q, K: K, V: V)
+    let actual = await backend.run {
+      $0.forward(matrixDimensions: matrixDimensions, Q: Q, K: K, V: V)
+    }
+    XCTAssertEqual(actual.O, expected.O)
+    XCTAssertEqual(actual.L, expected.L)
+  }
+}
+
+/// Returns the result of the backend, and of the naive loop.
+private func runGEMM(
+  backend: GEMMBackend, problem: (M: Int, N: Int, K: Int)
+) async -> ([Float], [Float]) {
+  let (M, N, K) = problem
+  let A = (0..<(M * K)).map { _ in Float.random(in: -1...1) }
+  let B = (0..<(K * N)).map { _ in Float.random(in: -1...1) }
+  var expected = [Float](repeating: .zero, count: M * N)
+  referenceGEMM(M: M, N: N, K: K, A: A, B: B, C: &expected)
+
+  var gemmDesc = GEMMDescriptor()
+  gemmDesc.matrixDimensions = (UInt32(M), UInt32(N), UInt32(K))
+  gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+  gemmDesc.transposeState = (false, false)
+
+  let bufferA = backend.makeBuffer(length: A.count * 4)
+  let bufferB = backend.makeBuffer(length: B.count * 4)
+  let bufferC = backend.makeBuffer(length: M * N * 4)
+  A.withUnsafeBytes {
+    bufferA.contents.copyMemory(from: $0.baseAddress!, byteCount: $0.count)
+  }
+  B.withUnsafeBytes {
+    bufferB.contents.copyMemory(from: $0.baseAddress!, byteCount: $0.count)
+  }
+
+  await backend.run { commandBuffer in
+    commandBuffer.encodeGEMM(
+      descriptor: gemmDesc,
+      A: GEMMOperandBinding(bufferA),
+      B: GEMMOperandBinding(bufferB),
+      C: GEMMOperandBinding(bufferC))
+  }
+  let pointerC = bufferC.contents.assumingMemoryBound(to: Float.self)
+  let actual = Array(UnsafeBufferPointer(start: pointerC, count: M * N))
+  return (actual, expected)
+}
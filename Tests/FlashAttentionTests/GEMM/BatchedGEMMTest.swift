@@ -0,0 +1,101 @@
+import XCTest
+import FlashAttention
+
+final class BatchedGEMMTest: XCTestCase {
+#if canImport(Metal)
+  func testDispatch() throws {
+    var gemmDesc = GEMMDescriptor()
+    gemmDesc.matrixDimensions = (M: 8, N: 8, K: 8)
+    gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+    gemmDesc.transposeState = (false, false)
+    XCTAssertFalse(GEMMBatchedKernel.isEligible(descriptor: gemmDesc))
+
+    gemmDesc.batchDimension = 1000
+    XCTAssertTrue(GEMMBatchedKernel.isEligible(descriptor: gemmDesc))
+    XCTAssertEqual(
+      GEMMBatchedKernel(descriptor: gemmDesc).problemsPerSimdgroup, 4)
+
+    gemmDesc.matrixDimensions = (M: 32, N: 17, K: 32)
+    XCTAssertTrue(GEMMBatchedKernel.isEligible(descriptor: gemmDesc))
+    XCTAssertEqual(
+      GEMMBatchedKernel(descriptor: gemmDesc).problemsPerSimdgroup, 1)
+
+    gemmDesc.matrixDimensions = (M: 33, N: 8, K: 8)
+    XCTAssertFalse(GEMMBatchedKernel.isEligible(descriptor: gemmDesc))
+
+    for dimensions in [(0, 8, 8), (8, 0, 8), (8, 8, 0)] {
+      gemmDesc.matrixDimensions = (
+        M: UInt32(dimensions.0),
+        N: UInt32(dimensions.1),
+        K: UInt32(dimensions.2))
+      XCTAssertFalse(GEMMBatchedKernel.isEligible(descriptor: gemmDesc))
+    }
+  }
+
+  func testCorrectness() throws {
+    for _ in 0..<20 {
+      let M = Int.random(in: 1...32)
+      let N = Int.random(in: 1...32)
+      let K = Int.random(in: 1...32)
+      let batchSize = Int.random(in: 2...300)
+
+      func randomPrecision() -> GEMMOperandPrecision {
+        [GEMMOperandPrecision.FP32, .FP16, .BF16].randomElement()!
+      }
+      var gemmDesc = GEMMDescriptor()
+      gemmDesc.batchDimension = batchSize
+      gemmDesc.loadPreviousC = Bool.random()
+      gemmDesc.matrixDimensions = (UInt32(M), UInt32(N), UInt32(K))
+      gemmDesc.memoryPrecisions = (
+        randomPrecision(), randomPrecision(), randomPrecision())
+      gemmDesc.transposeState = (Bool.random(), Bool.random())
+      gemmDesc.transposeC = Bool.random()
+      runCorrectnessTest(descriptor: gemmDesc)
+    }
+  }
+
+  // A batch of problems that are too large falls back to the main kernel.
+  func testFallback() throws {
+    var gemmDesc = GEMMDescriptor()
+    gemmDesc.batchDimension = 3
+    gemmDesc.matrixDimensions = (M: 40, N: 24, K: 72)
+    gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+    gemmDesc.transposeState = (false, true)
+    runCorrectnessTest(descriptor: gemmDesc)
+  }
+#endif
+}
+
+#if canImport(Metal)
+/// Compares the Metal backend against the CPU backend, which executes the
+/// problems one at a time.
+private func runCorrectnessTest(descriptor: GEMMDescriptor) {
+  let memoryPrecisions = descriptor.memoryPrecisions!
+  let batchStrides = descriptor.batchStrides
+  let batchSize = descriptor.batchDimension
+  let A = randomOperand(
+    count: batchStrides.A * batchSize, precision: memoryPrecisions.A)
+  let B = randomOperand(
+    count: batchStrides.B * batchSize, precision: memoryPrecisions.B)
+  let previousC = randomOperand(
+    count: batchStrides.C * batchSize, precision: memoryPrecisions.C)
+  let bindingA = MTLContext.global.createBinding(A, memoryPrecisions.A)
+  let bindingB = MTLContext.global.createBinding(B, memoryPrecisions.B)
+
+  // The magnitude of C grows with K.
+  var relativeTolerance = backendTolerance(precision: memoryPrecisions.C)
+  if memoryPrecisions.C == .FP16,
+     memoryPrecisions.A == .FP16, memoryPrecisions.B == .FP16 {
+    relativeTolerance = 1e-2
+  }
+  let K = Int(descriptor.matrixDimensions!.K)
+  compareBackends(
+    previousC: previousC,
+    precision: memoryPrecisions.C,
+    tolerance: relativeTolerance * Float(K + 1)
+  ) { commandBuffer, bindingC in
+    commandBuffer.encodeGEMM(
+      descriptor: descriptor, A: bindingA, B: bindingB, C: bindingC)
+  }
+}
+#endif
@@ -0,0 +1,109 @@
+import XCTest
+import FlashAttention
+
+final class ChainedGEMMTest: XCTestCase {
+  func testActivation() throws {
+    for activation in [
+      GEMMActivation.identity, .relu, .gelu, .silu
+    ] {
+      XCTAssertEqual(activation.apply(0), 0)
+    }
+    XCTAssertEqual(GEMMActivation.relu.apply(-2), 0)
+    XCTAssertEqual(GEMMActivation.gelu.apply(1), 0.8412, accuracy: 1e-3)
+    XCTAssertEqual(GEMMActivation.silu.apply(1), 0.7311, accuracy: 1e-3)
+  }
+
+#if canImport(Metal)
+  func testCorrectness() throws {
+    for _ in 0..<20 {
+      func randomPrecision() -> GEMMOperandPrecision {
+        [GEMMOperandPrecision.FP32, .FP16, .BF16].randomElement()!
+      }
+      var chainedDesc = GEMMChainedDescriptor()
+      chainedDesc.activation = [
+        GEMMActivation.identity, .relu, .gelu, .silu
+      ].randomElement()!
+      chainedDesc.loadPreviousC = Bool.random()
+      chainedDesc.matrixDimensions = (
+        M: UInt32.random(in: 1...200),
+        K: UInt32.random(in: 1...100),
+        R: [8, 17, 64, 128].randomElement()!,
+        N: UInt32.random(in: 1...300))
+      chainedDesc.memoryPrecisions = (
+        randomPrecision(), randomPrecision(), randomPrecision(),
+        randomPrecision())
+      runCorrectnessTest(descriptor: chainedDesc)
+    }
+  }
+
+  func testLowRankAdapter() throws {
+    for (R, scale) in [(UInt32(4), Float(0.5)), (16, -1), (64, 0.25)] {
+      var chainedDesc = GEMMChainedDescriptor()
+      chainedDesc.lowRankScale = scale
+      chainedDesc.matrixDimensions = (M: 77, K: 96, R: R, N: 130)
+      chainedDesc.memoryPrecisions = (.FP32, .FP32, .FP32, .FP32)
+      runCorrectnessTest(descriptor: chainedDesc)
+
+      chainedDesc.loadPreviousC = true
+      chainedDesc.memoryPrecisions = (.FP16, .FP16, .FP16, .FP32)
+      runCorrectnessTest(descriptor: chainedDesc)
+    }
+  }
+
+  // The scale is bound at encoding time, so every value shares a pipeline.
+  func testLowRankScalePipeline() throws {
+    var chainedDesc = GEMMChainedDescriptor()
+    chainedDesc.lowRankScale = 0.5
+    chainedDesc.matrixDimensions = (M: 8, K: 8, R: 8, N: 8)
+    chainedDesc.memoryPrecisions = (.FP32, .FP32, .FP32, .FP32)
+    GEMMChainedKernel.register(descriptor: chainedDesc)
+    let pipeline = GEMMChainedKernel.pipelineCache[chainedDesc]!.pipeline
+
+    for scale in [Float(2), .infinity, .nan] {
+      chainedDesc.lowRankScale = scale
+      GEMMChainedKernel.register(descriptor: chainedDesc)
+      let entry = GEMMChainedKernel.pipelineCache[chainedDesc]!
+      XCTAssertTrue(entry.pipeline === pipeline)
+    }
+  }
+#endif
+}
+
+#if canImport(Metal)
+/// Compares the Metal backend against the CPU backend, which materializes
+/// the intermediate.
+private func runCorrectnessTest(descriptor: GEMMChainedDescriptor) {
+  let (M, K, R, N) = descriptor.matrixDimensions!
+  let memoryPrecisions = descriptor.memoryPrecisions!
+  func randomBinding(
+    _ count: UInt32, _ precision: GEMMOperandPrecision
+  ) -> GEMMOperandBinding {
+    let operand = randomOperand(count: Int(count), precision: precision)
+    return MTLContext.global.createBinding(operand, precision)
+  }
+  let bindingA = randomBinding(M * K, memoryPrecisions.A)
+  let bindingB1 = randomBinding(K * R, memoryPrecisions.B1)
+  let bindingB2 = randomBinding(R * N, memoryPrecisions.B2)
+  let bindingW = randomBinding(K * N, memoryPrecisions.B1)
+  let previousC = randomOperand(
+    count: Int(M * N), precision: memoryPrecisions.C)
+
+  // Both backends keep the intermediate in FP32. The magnitude of C grows
+  // with K * R.
+  let relativeTolerance = backendTolerance(precision: memoryPrecisions.C)
+  let magnitude = Float(K + 1) * Float(R + 1)
+  compareBackends(
+    previousC: previousC,
+    precision: memoryPrecisions.C,
+    tolerance: relativeTolerance * magnitude
+  ) { commandBuffer, bindingC in
+    commandBuffer.encodeChainedGEMM(
+      descriptor: descriptor,
+      A: bindingA,
+      B1: bindingB1,
+      B2: bindingB2,
+      W: (descriptor.lowRankScale != nil) ? bindingW : nil,
+      C: bindingC)
+  }
+}
+#endif
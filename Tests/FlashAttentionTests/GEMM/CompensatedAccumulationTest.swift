@@ -0,0 +1,165 @@
+import XCTest
+import FlashAttention
+
+final class CompensatedAccumulationTest: XCTestCase {
+  // Simulates the three accumulation modes on the CPU, with same-sign data
+  // (the worst case for FP16 stagnation), across a range of K.
+  func testErrorGrowth() throws {
+    let blockLength = 32
+    var errors: [GEMMAccumulation: [Float]] = [:]
+    let reductionLengths = [256, 1024, 4096, 16384]
+    for reductionLength in reductionLengths {
+      for accumulation in [
+        GEMMAccumulation.direct, .blocked, .compensated
+      ] {
+        let observed = measureError(
+          accumulation: accumulation,
+          blockLength: blockLength,
+          reductionLength: reductionLength)
+        let modeled = AccuracyPolicy.estimatedError(
+          accumulation: accumulation,
+          blockLength: blockLength,
+          output: .FP16,
+          reductionLength: reductionLength)
+        XCTAssertLessThanOrEqual(
+          observed, modeled,
+          "accumulation=\(accumulation), K=\(reductionLength)")
+        errors[accumulation, default: []].append(observed)
+      }
+    }
+
+    // The direct FP16 accumulator stagnates at large K. The blocked modes
+    // stay near the rounding error of the FP16 output.
+    let direct = errors[.direct]!
+    let blocked = errors[.blocked]!
+    let compensated = errors[.compensated]!
+    XCTAssertGreaterThan(direct.last!, 10 * blocked.last!)
+    XCTAssertGreaterThan(direct.last!, 10 * compensated.last!)
+    XCTAssertLessThan(blocked.last!, 4 * blocked.first!)
+    XCTAssertLessThan(compensated.last!, 4 * compensated.first!)
+  }
+
+#if canImport(Metal)
+  func testCorrectness() throws {
+    let (M, N, K) = (64, 64, 8192)
+    let A = (0..<(M * K)).map { _ in
+      round(Float.random(in: 0...1), to: .FP16)
+    }
+    let B = (0..<(K * N)).map { _ in
+      round(Float.random(in: 0...1), to: .FP16)
+    }
+
+    // Reference in FP64, and the normalizing magnitudes Σ|a * b|.
+    var expected = [Double](repeating: .zero, count: M * N)
+    var magnitude = [Double](repeating: .zero, count: M * N)
+    for m in 0..<M {
+      for n in 0..<N {
+        for k in 0..<K {
+          let product = Double(A[m * K + k]) * Double(B[k * N + n])
+          expected[m * N + n] += product
+          magnitude[m * N + n] += product.magnitude
+        }
+      }
+    }
+
+    var observedErrors: [GEMMAccumulation: Float] = [:]
+    for accumulation in [
+      GEMMAccumulation.direct, .blocked, .compensated
+    ] {
+      var gemmDesc = GEMMDescriptor()
+      gemmDesc.accumulation = accumulation
+      gemmDesc.matrixDimensions = (UInt32(M), UInt32(N), UInt32(K))
+      gemmDesc.memoryPrecisions = (.FP16, .FP16, .FP16)
+      gemmDesc.transposeState = (false, false)
+
+      let bufferA = MTLContext.global.createBuffer(A, .FP16)
+      let bufferB = MTLContext.global.createBuffer(B, .FP16)
+      let bufferC = MTLContext.global.createBuffer(
+        [Float](repeating: .zero, count: M * N), .FP16)
+      let backend = MetalGEMMBackend()
+      let commandBuffer = backend.makeCommandBuffer()
+      commandBuffer.encodeGEMM(
+        descriptor: gemmDesc,
+        A: GEMMOperandBinding(MetalGEMMBuffer(bufferA)),
+        B: GEMMOperandBinding(MetalGEMMBuffer(bufferB)),
+        C: GEMMOperandBinding(MetalGEMMBuffer(bufferC)))
+      commandBuffer.commit()
+      commandBuffer.waitUntilCompleted()
+
+      var C = [Float](repeating: .zero, count: M * N)
+      MTLContext.copy(bufferC, into: &C, precision: .FP16)
+      var maxError: Float = .zero
+      for i in C.indices {
+        let error = (Double(C[i]) - expected[i]).magnitude / magnitude[i]
+        maxError = max(maxError, Float(error))
+      }
+      observedErrors[accumulation] = maxError
+
+      // The largest K_group any device selects for FP16 is 40.
+      if accumulation != .direct {
+        let modeled = AccuracyPolicy.estimatedError(
+          accumulation: accumulation,
+          blockLength: 40,
+          output: .FP16,
+          reductionLength: K)
+        XCTAssertLessThanOrEqual(maxError, modeled)
+      }
+    }
+    XCTAssertLessThan(observedErrors[.blocked]!, observedErrors[.direct]!)
+    XCTAssertLessThan(
+      observedErrors[.compensated]!, observedErrors[.direct]!)
+  }
+#endif
+}
+
+/// Simulates one dot product per trial, rounding after every FMA, and
+/// returns the maximum error relative to Σ|a * b|.
+private func measureError(
+  accumulation: GEMMAccumulation,
+  blockLength: Int,
+  reductionLength: Int
+) -> Float {
+  var maxError: Float = .zero
+  for _ in 0..<8 {
+    let a = (0..<reductionLength).map { _ in
+      round(Float.random(in: 0...1), to: .FP16)
+    }
+    let b = (0..<reductionLength).map { _ in
+      round(Float.random(in: 0...1), to: .FP16)
+    }
+
+    var exact: Double = .zero
+    var magnitude: Double = .zero
+    var inner: Float = .zero
+    var outer: Float = .zero
+    var compensation: Float = .zero
+    for k in 0..<reductionLength {
+      let product = Double(a[k]) * Double(b[k])
+      exact += product
+      magnitude += product.magnitude
+      inner = round(Float(Double(inner) + product), to: .FP16)
+
+      // Fold the block sum into FP32.
+      let endOfBlock = (k + 1) % blockLength == 0
+      guard accumulation != .direct,
+            endOfBlock || k == reductionLength - 1 else {
+        continue
+      }
+      if accumulation == .compensated {
+        let y = inner - compensation
+        let t = outer + y
+        compensation = (t - outer) - y
+        outer = t
+      } else {
+        outer += inner
+      }
+      inner = .zero
+    }
+
+    let accumulated = (accumulation == .direct) ? inner : outer
+    let result = round(accumulated, to: .FP16)
+    let error = (Double(result) - exact).magnitude / magnitude
+    maxError = max(maxError, Float(error))
+  }
+  return maxError
+}
@@ -0,0 +1,78 @@
+import XCTest
+import FlashAttention
+
+final class ComplexGEMMTest: XCTestCase {
+  // (1 + 2i) * (3 + 4i) = -5 + 10i, in both layouts.
+  func testReference() throws {
+    for layout in [GEMMComplexLayout.interleaved, .planar] {
+      var complexDesc = GEMMComplexDescriptor()
+      complexDesc.layout = layout
+      complexDesc.matrixDimensions = (M: 1, N: 1, K: 1)
+      complexDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+
+      var A: [Float] = [1, 2]
+      var B: [Float] = [3, 4]
+      var C: [Float] = [0, 0]
+      CPUGEMMBackend.multiplyComplex(
+        descriptor: complexDesc, A: &A, B: &B, C: &C)
+      XCTAssertEqual(C, [-5, 10])
+    }
+  }
+
+#if canImport(Metal)
+  func testCorrectness() throws {
+    for _ in 0..<20 {
+      func randomPrecision() -> GEMMOperandPrecision {
+        [GEMMOperandPrecision.FP32, .FP16].randomElement()!
+      }
+      var complexDesc = GEMMComplexDescriptor()
+      complexDesc.algorithm = [
+        GEMMComplexAlgorithm.fourM, .threeM
+      ].randomElement()!
+      complexDesc.layout = [
+        GEMMComplexLayout.interleaved, .planar
+      ].randomElement()!
+      complexDesc.loadPreviousC = Bool.random()
+      complexDesc.matrixDimensions = (
+        M: UInt32.random(in: 1...150),
+        N: UInt32.random(in: 1...150),
+        K: UInt32.random(in: 1...150))
+      complexDesc.memoryPrecisions = (
+        randomPrecision(), randomPrecision(), randomPrecision())
+      runCorrectnessTest(descriptor: complexDesc)
+    }
+  }
+#endif
+}
+
+#if canImport(Metal)
+/// Compares the Metal backend against the CPU backend.
+private func runCorrectnessTest(descriptor: GEMMComplexDescriptor) {
+  let memoryPrecisions = descriptor.memoryPrecisions!
+  let scalarCounts = descriptor.scalarCounts
+  let A = randomOperand(
+    count: scalarCounts.A, precision: memoryPrecisions.A)
+  let B = randomOperand(
+    count: scalarCounts.B, precision: memoryPrecisions.B)
+  let previousC = randomOperand(
+    count: scalarCounts.C, precision: memoryPrecisions.C)
+  let bindingA = MTLContext.global.createBinding(A, memoryPrecisions.A)
+  let bindingB = MTLContext.global.createBinding(B, memoryPrecisions.B)
+
+  // Each complex dot product sums 2K real products, and 3M cancels in the
+  // imaginary part.
+  var relativeTolerance = backendTolerance(precision: memoryPrecisions.C)
+  if descriptor.algorithm == .threeM {
+    relativeTolerance *= 2
+  }
+  let K = Int(descriptor.matrixDimensions!.K)
+  compareBackends(
+    previousC: previousC,
+    precision: memoryPrecisions.C,
+    tolerance: relativeTolerance * Float(2 * K + 1)
+  ) { commandBuffer, bindingC in
+    commandBuffer.encodeComplexGEMM(
+      descriptor: descriptor, A: bindingA, B: bindingB, C: bindingC)
+  }
+}
+#endif
@@ -0,0 +1,142 @@
+import XCTest
+import FlashAttention
+
+final class FusedSamplingTest: XCTestCase {
+#if canImport(Metal)
+  // The GPU draws exactly the tokens of the CPU reference.
+  func testReproducibility() throws {
+    for candidateCount in [1, 8, 50] as [UInt16] {
+      for precision in [GEMMOperandPrecision.FP32, .FP16] {
+        var samplingDesc = GEMMSamplingDescriptor()
+        samplingDesc.candidateCount = candidateCount
+        samplingDesc.matrixDimensions = (K: 64, N: 1000)
+        samplingDesc.weightPrecision = precision
+        runReproducibilityTest(descriptor: samplingDesc, sequenceCount: 16)
+      }
+    }
+  }
+#endif
+
+  // The empirical distribution of the reference matches the softmax.
+  func testDistribution() throws {
+    let (K, N) = (8, 40)
+    var samplingDesc = GEMMSamplingDescriptor()
+    samplingDesc.candidateCount = 64
+    samplingDesc.matrixDimensions = (K: UInt32(K), N: UInt32(N))
+    let weights = (0..<(K * N)).map { _ in Float.random(in: -1...1) }
+    let hidden = (0..<K).map { _ in Float.random(in: -1...1) }
+    var parameters = GEMMSamplingParameters()
+    parameters.temperature = 0.7
+    parameters.seed = 42
+
+    var expected = [Float](repeating: .zero, count: N)
+    for n in 0..<N {
+      var logit: Float = .zero
+      for k in 0..<K {
+        logit += hidden[k] * weights[k * N + n]
+      }
+      expected[n] = exp(logit / parameters.temperature)
+    }
+    let sum = expected.reduce(0, +)
+    expected = expected.map { $0 / sum }
+
+    let trialCount = 20000
+    var frequencies = [Float](repeating: .zero, count: N)
+    for step in 0..<trialCount {
+      parameters.step = UInt32(step)
+      let tokens = samplingDesc.referenceSample(
+        weights: weights, hidden: hidden, parameters: parameters)
+      frequencies[Int(tokens[0])] += 1 / Float(trialCount)
+    }
+    compareResults(frequencies, expected, tolerance: 0.02)
+  }
+
+  // Top-p keeps the most likely tokens, until they reach the mass.
+  func testNucleus() throws {
+    let (K, N) = (4, 100)
+    var samplingDesc = GEMMSamplingDescriptor()
+    samplingDesc.candidateCount = 20
+    samplingDesc.matrixDimensions = (K: UInt32(K), N: UInt32(N))
+
+    // One dominant token holds nearly all the mass.
+    var weights = [Float](repeating: .zero, count: K * N)
+    weights[0 * N + 37] = 10
+    let hidden: [Float] = [1, 0, 0, 0]
+    var parameters = GEMMSamplingParameters()
+    parameters.topP = 0.9
+    for step in 0..<100 {
+      parameters.step = UInt32(step)
+      let tokens = samplingDesc.referenceSample(
+        weights: weights, hidden: hidden, parameters: parameters)
+      XCTAssertEqual(tokens, [37])
+    }
+  }
+
+  // A temperature of 0 always draws the largest logit. So does one too small
+  // to invert, instead of producing NaN logits.
+  func testGreedy() throws {
+    let (K, N) = (16, 300)
+    var samplingDesc = GEMMSamplingDescriptor()
+    samplingDesc.candidateCount = 8
+    samplingDesc.matrixDimensions = (K: UInt32(K), N: UInt32(N))
+    let weights = (0..<(K * N)).map { _ in Float.random(in: -1...1) }
+    let sequenceCount = 4
+    let hidden = (0..<(sequenceCount * K)).map { _ in
+      Float.random(in: -1...1)
+    }
+
+    var expected: [UInt32] = []
+    for sequence in 0..<sequenceCount {
+      var logits = [Float](repeating: .zero, count: N)
+      for n in 0..<N {
+        for k in 0..<K {
+          logits[n] = logits[n].addingProduct(
+            hidden[sequence * K + k], weights[k * N + n])
+        }
+      }
+      expected.append(UInt32(logits.indices.max { logits[$0] < logits[$1] }!))
+    }
+
+    for temperature in [
+      0, Float.leastNonzeroMagnitude, Float.leastNormalMagnitude / 4
+    ] {
+      var parameters = GEMMSamplingParameters()
+      parameters.temperature = temperature
+      for step in 0..<20 {
+        parameters.seed = UInt32.random(in: 0...UInt32.max)
+        parameters.step = UInt32(step)
+        let tokens = samplingDesc.referenceSample(
+          weights: weights, hidden: hidden, parameters: parameters)
+        XCTAssertEqual(tokens, expected)
+      }
+    }
+  }
+}
+
+#if canImport(Metal)
+private func runReproducibilityTest(
+  descriptor: GEMMSamplingDescriptor, sequenceCount: Int
+) {
+  let (K, N) = descriptor.matrixDimensions!
+  let weights = (0..<(Int(K) * Int(N))).map { _ in
+    Float.random(in: -1...1)
+  }
+  let sampler = GEMMSampler(descriptor: descriptor, weights: weights)
+
+  for step in 0..<4 {
+    let hidden = (0..<(sequenceCount * Int(K))).map { _ in
+      Float.random(in: -1...1)
+    }
+    var parameters = GEMMSamplingParameters()
+    parameters.temperature = [0, 0.5, 1, 1.5].randomElement()!
+    parameters.topP = [1, 0.9, 0.5].randomElement()!
+    parameters.seed = UInt32.random(in: 0...UInt32.max)
+    parameters.step = UInt32(step)
+
+    let tokens = sampler.sample(hidden: hidden, parameters: parameters)
+    let expected = descriptor.referenceSample(
+      weights: weights, hidden: hidden, parameters: parameters)
+    XCTAssertEqual(tokens, expected)
+  }
+}
+#endif
@@ -0,0 +1,108 @@
+import XCTest
+import FlashAttention
+
+final class KernelCatalogTest: XCTestCase {
+  // The catalog never queries the GPU of this machine, and shares kernels
+  // between problems that differ only in their function constants.
+  func testDeduplication() throws {
+    var catalog = KernelCatalog()
+    catalog.add(profiles: profiles, shapes: shapes)
+
+    // 2 profiles x (2 GEMMs + 2 attention problems x 1 kernel)
+    XCTAssertEqual(catalog.entries.count, 8)
+    XCTAssertEqual(catalog.kernelFiles.count, catalog.sources.count)
+    XCTAssertEqual(
+      Set(catalog.kernelFiles.map(\.name)).count, catalog.kernelFiles.count)
+    XCTAssertEqual(Set(catalog.sources).count, catalog.sources.count)
+
+    func entries(
+      device: String, operation: String
+    ) -> [KernelCatalog.Entry] {
+      catalog.entries.filter {
+        $0.device == device && $0.operation == operation
+      }
+    }
+
+    // On apple9, every GEMM uses the same block size.
+    let newGEMMs = entries(device: "M4", operation: "gemm")
+    XCTAssertEqual(newGEMMs.count, 2)
+    XCTAssertEqual(newGEMMs[0].kernels, newGEMMs[1].kernels)
+    XCTAssertNotEqual(
+      newGEMMs[0].functionConstants.map(\.value),
+      newGEMMs[1].functionConstants.map(\.value))
+
+    // The older device gets its own kernels.
+    let oldGEMMs = entries(device: "M1 Max", operation: "gemm")
+    XCTAssertEqual(oldGEMMs.count, 2)
+    XCTAssertTrue(Set(oldGEMMs[0].kernels).isDisjoint(
+      with: newGEMMs[0].kernels))
+
+    // The sequence length is a function constant.
+    let forward = entries(device: "M4", operation: "attention.forward")
+    XCTAssertEqual(forward.count, 2)
+    XCTAssertEqual(forward[0].kernels, forward[1].kernels)
+    XCTAssertEqual(forward[0].maxTotalThreadsPerThreadgroup, 1024)
+  }
+
+  func testBundle() throws {
+    var catalog = KernelCatalog()
+    catalog.add(profiles: profiles, shapes: shapes)
+
+    let directory = FileManager.default.temporaryDirectory
+      .appendingPathComponent("mfa-catalog-\(UUID().uuidString)")
+    defer { try? FileManager.default.removeItem(at: directory) }
+    try catalog.write(to: directory)
+
+    let data = try Data(
+      contentsOf: directory.appendingPathComponent("manifest.json"))
+    let manifest = try JSONDecoder().decode(
+      KernelCatalog.Manifest.self, from: data)
+    XCTAssertEqual(manifest.entries.count, catalog.entries.count)
+    for (kernelFile, source) in zip(manifest.kernels, catalog.sources) {
+      let url = directory.appendingPathComponent(kernelFile.file)
+      XCTAssertEqual(try String(contentsOf: url, encoding: .utf8), source)
+    }
+    let names = Set(manifest.kernels.map(\.name))
+    for entry in manifest.entries {
+      XCTAssertTrue(names.isSuperset(of: entry.kernels))
+    }
+  }
+
+  // Threads that substitute different devices at the same time each see
+  // only their own profile.
+  func testConcurrentProfiles() throws {
+    let threadCount = 8
+    var mismatches = [Int](repeating: 0, count: threadCount)
+    mismatches.withUnsafeMutableBufferPointer { mismatches in
+      DispatchQueue.concurrentPerform(iterations: threadCount) { threadID in
+        let profile = DeviceProfile(
+          name: "M\(threadID)", family: .apple7, coreCount: threadID)
+        DeviceProfile.withProfile(profile) {
+          for _ in 0..<1000 {
+            if DeviceProfile.current.coreCount != threadID {
+              mismatches[threadID] += 1
+            }
+          }
+        }
+      }
+    }
+    XCTAssertEqual(mismatches, [Int](repeating: 0, count: threadCount))
+  }
+}
+
+private let profiles: [KernelCatalog.Profile] = [
+  KernelCatalog.Profile(name: "M1 Max", family: 7, coreCount: 32),
+  KernelCatalog.Profile(name: "M4", family: 9, coreCount: 10),
+]
+
+private let shapes = KernelCatalog.Shapes(
+  gemm: [
+    KernelCatalog.GEMMProblem(
+      M: 256, N: 256, K: 256, precisions: ["FP32", "FP32", "FP32"]),
+    KernelCatalog.GEMMProblem(
+      M: 1024, N: 1024, K: 1024, precisions: ["FP32", "FP32", "FP32"]),
+  ],
+  attention: [
+    KernelCatalog.AttentionProblem(row: 512, column: 512, head: 64),
+    KernelCatalog.AttentionProblem(row: 2048, column: 2048, head: 64),
+  ])
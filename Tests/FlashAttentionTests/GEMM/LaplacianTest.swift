@@ -1,3 +1,4 @@
+#if canImport(Metal)
 import XCTest
 import FlashAttention
 
@@ -348,3 +349,4 @@ private func profileProblemSize(
   
   return SIMD2(maxGFLOPS, occupancy)
 }
+#endif
@@ -4,6 +4,7 @@
 //
 //  Created by Krishna Srinivasamurthy on 12/30/25.
 //
+#if canImport(Metal)
 import XCTest
 import FlashAttention
 
@@ -53,4 +54,25 @@ final class LeadingDimensionsCacheKeyTest: XCTestCase {
     XCTAssertNotNil(GEMMKernel.pipelineCache[d1])
     XCTAssertNotNil(GEMMKernel.pipelineCache[d2])
   }
+
+  func testPipelineCacheDifferentiatesTransposeC() throws {
+    var d1 = GEMMDescriptor()
+    d1.matrixDimensions = (M: 96, N: 128, K: 64)
+    d1.memoryPrecisions = (.FP16, .FP16, .FP16)
+    d1.transposeState = (false, false)
+    var d2 = d1
+    d2.transposeC = true
+    XCTAssertNotEqual(d1, d2)
+
+    // The default leading dimension of C follows the transpose.
+    XCTAssertEqual(d1.resolvedLeadingDimensions.C, 128)
+    XCTAssertEqual(d2.resolvedLeadingDimensions.C, 96)
+
+    GEMMKernel.register(descriptor: d1)
+    GEMMKernel.register(descriptor: d2)
+    let pipeline1 = GEMMKernel.pipelineCache[d1]!.pipeline
+    let pipeline2 = GEMMKernel.pipelineCache[d2]!.pipeline
+    XCTAssertFalse(pipeline1 === pipeline2)
+  }
 }
+#endif
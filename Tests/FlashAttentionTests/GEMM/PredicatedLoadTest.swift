@@ -0,0 +1,202 @@
+import XCTest
+import FlashAttention
+
+final class PredicatedLoadTest: XCTestCase {
+  // Replays the direct-load schedule of the GEMM kernel on the CPU, lane by
+  // lane. Checks that every unpredicated load lands inside the matrix, and
+  // that the zero-filled edges produce the exact product.
+  func testSimulation() throws {
+    let configurations: [(registerSize: Int, splits: Int)] = [
+      (32, 1), (32, 2), (16, 2),
+    ]
+    for configuration in configurations {
+      for _ in 0..<10 {
+        let M = Int.random(in: 1...100)
+        let N = Int.random(in: 1...100)
+        let K = Int.random(in: 1...50)
+        simulateDirectLoads(
+          matrixDimensions: (M, N, K),
+          registerSize: configuration.registerSize,
+          splits: configuration.splits)
+      }
+    }
+  }
+
+#if canImport(Metal)
+  // Compares the kernels with and without async loads, on shapes that do not
+  // align with any block size.
+  func testUnalignedShapes() throws {
+    let shapes: [(M: UInt32, N: UInt32, K: UInt32)] = [
+      (511, 511, 511), (1489, 17, 93), (20, 40, 13), (7, 129, 1000),
+    ]
+    for shape in shapes {
+      for precision in [GEMMOperandPrecision.FP32, .FP16, .BF16] {
+        var gemmDesc = GEMMDescriptor()
+        gemmDesc.matrixDimensions = shape
+        gemmDesc.memoryPrecisions = (precision, precision, .FP32)
+        gemmDesc.transposeState = (Bool.random(), Bool.random())
+
+        let (M, N, K) = (Int(shape.M), Int(shape.N), Int(shape.K))
+        let A = (0..<(M * K)).map { _ in
+          round(Float.random(in: -1...1), to: precision)
+        }
+        let B = (0..<(K * N)).map { _ in
+          round(Float.random(in: -1...1), to: precision)
+        }
+        var expected = [Float](repeating: .zero, count: M * N)
+        referenceGEMM(
+          M: M, N: N, K: K, A: A, B: B, C: &expected,
+          transposeState: gemmDesc.transposeState!)
+
+        for preferAsyncLoad in [true, false] {
+          gemmDesc.preferAsyncLoad = preferAsyncLoad
+          let bufferA = MTLContext.global.createBuffer(A, precision)
+          let bufferB = MTLContext.global.createBuffer(B, precision)
+          let bufferC = MTLContext.global.createBuffer(
+            [Float](repeating: .nan, count: M * N), .FP32)
+          let backend = MetalGEMMBackend()
+          let commandBuffer = backend.makeCommandBuffer()
+          commandBuffer.encodeGEMM(
+            descriptor: gemmDesc,
+            A: GEMMOperandBinding(MetalGEMMBuffer(bufferA)),
+            B: GEMMOperandBinding(MetalGEMMBuffer(bufferB)),
+            C: GEMMOperandBinding(MetalGEMMBuffer(bufferC)))
+          commandBuffer.commit()
+          commandBuffer.waitUntilCompleted()
+
+          var C = [Float](repeating: .zero, count: M * N)
+          MTLContext.copy(bufferC, into: &C, precision: .FP32)
+          let tolerance = (precision == .BF16) ? 2e-2 : 1e-2
+          compareResults(
+            C, expected, tolerance: tolerance * Float(K).squareRoot())
+        }
+      }
+    }
+  }
+#endif
+}
+
+/// Mirrors 'morton_order' in the simdgroup_matrix_storage header.
+private func mortonOrder(_ laneID: Int) -> (x: Int, y: Int) {
+  let quadID = laneID / 4
+  let y = (quadID / 4) * 4 + (laneID / 2) % 4
+  let x = (quadID & 2) * 2 + (laneID % 2) * 2
+  return (x, y)
+}
+
+/// Mirrors the kernel source for 'preferAsyncLoad == false': the early exit,
+/// the block shift, the loop over K in steps of 8, and the predicated
+/// remainder. Both operands are row-major.
+private func simulateDirectLoads(
+  matrixDimensions: (M: Int, N: Int, K: Int),
+  registerSize: Int,
+  splits: Int
+) {
+  let (M, N, K) = matrixDimensions
+  let A = (0..<(M * K)).map { _ in Float.random(in: -1...1) }
+  let B = (0..<(K * N)).map { _ in Float.random(in: -1...1) }
+  var expected = [Float](repeating: .zero, count: M * N)
+  referenceGEMM(M: M, N: N, K: K, A: A, B: B, C: &expected)
+
+  let group = registerSize * splits
+  let M_edge = M - M % group
+  let N_edge = N - N % group
+  let M_remainder = (M % registerSize == 0) ? registerSize : M % registerSize
+  let N_remainder = (N % registerSize == 0) ? registerSize : N % registerSize
+  let M_shift = (M < group) ? 0 : registerSize - M_remainder
+  let N_shift = (N < group) ? 0 : registerSize - N_remainder
+  let edgeTile = (M < group) || (N < group)
+
+  // An element loaded by one lane, either checked or not.
+  func load(
+    _ matrix: [Float], _ x: Int, _ y: Int, _ bounds: (x: Int, y: Int),
+    predicated: Bool
+  ) -> Float {
+    if predicated {
+      guard x < bounds.x, y < bounds.y else {
+        return .zero
+      }
+    } else {
+      precondition(
+        x < bounds.x && y < bounds.y, "Unpredicated load out of bounds.")
+    }
+    return matrix[y * bounds.x + x]
+  }
+
+  var C = [Float](repeating: .nan, count: M * N)
+  let gridM = (M + group - 1) / group
+  let gridN = (N + group - 1) / group
+  for gidY in 0..<gridM {
+    for gidX in 0..<gridN {
+      for sidY in 0..<splits {
+        for sidX in 0..<splits {
+          var M_offset = gidY * group
+          var N_offset = gidX * group
+          if M_offset + sidY * registerSize >= M ||
+              N_offset + sidX * registerSize >= N {
+            continue
+          }
+          if M_shift != 0, gidY * group >= M_edge {
+            M_offset -= M_shift
+          }
+          if N_shift != 0, gidX * group >= N_edge {
+            N_offset -= N_shift
+          }
+          let rowStart = M_offset + sidY * registerSize
+          let columnStart = N_offset + sidX * registerSize
+
+          var accumulator = [Float](
+            repeating: .zero, count: registerSize * registerSize)
+          func iterate(k: Int, predicated: Bool) {
+            // Gather the 8-wide slices of A and B, two elements per lane.
+            var sliceA = [Float](repeating: .nan, count: registerSize * 8)
+            var sliceB = [Float](repeating: .nan, count: 8 * registerSize)
+            for laneID in 0..<32 {
+              let morton = mortonOrder(laneID)
+              for m in stride(from: 0, to: registerSize, by: 8) {
+                for lane in 0..<2 {
+                  let x = k + morton.x + lane
+                  let y = rowStart + morton.y + m
+                  sliceA[(m + morton.y) * 8 + morton.x + lane] = load(
+                    A, x, y, (K, M), predicated: predicated)
+                }
+              }
+              for n in stride(from: 0, to: registerSize, by: 8) {
+                for lane in 0..<2 {
+                  let x = columnStart + morton.x + n + lane
+                  let y = k + morton.y
+                  sliceB[morton.y * registerSize + n + morton.x + lane] =
+                  load(B, x, y, (N, K), predicated: predicated)
+                }
+              }
+            }
+            for m in 0..<registerSize {
+              for n in 0..<registerSize {
+                for k in 0..<8 {
+                  accumulator[m * registerSize + n] +=
+                  sliceA[m * 8 + k] * sliceB[k * registerSize + n]
+                }
+              }
+            }
+          }
+
+          for k in stride(from: 0, to: K - K % 8, by: 8) {
+            iterate(k: k, predicated: edgeTile)
+          }
+          if K % 8 != 0 {
+            iterate(k: K - K % 8, predicated: true)
+          }
+
+          // Only the elements inside the matrix are stored.
+          for m in 0..<registerSize where rowStart + m < M {
+            for n in 0..<registerSize where columnStart + n < N {
+              let address = (rowStart + m) * N + columnStart + n
+              C[address] = accumulator[m * registerSize + n]
+            }
+          }
+        }
+      }
+    }
+  }
+  compareResults(C, expected, tolerance: 1e-4)
+}
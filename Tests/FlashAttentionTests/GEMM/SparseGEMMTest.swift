@@ -0,0 +1,116 @@
+import XCTest
+import FlashAttention
+
+final class SparseGEMMTest: XCTestCase {
+  func testPacking() throws {
+    // A matrix that is already 2:4 sparse round-trips exactly.
+    let K = 13
+    let N = 7
+    let sparse = createSparseMatrix(rows: K, columns: N)
+    let packed = GEMMSparseMatrix(pruning: sparse, rows: K, columns: N)
+    XCTAssertEqual(packed.values.count, 2 * 4 * N)
+    XCTAssertEqual(packed.metadata.count, 4 * 4)
+    XCTAssertEqual(packed.expand(), sparse)
+
+    // A dense matrix keeps the 2 largest elements of each group.
+    let dense: [Float] = [1, -4, 3, 2]
+    let pruned = GEMMSparseMatrix(pruning: dense, rows: 4, columns: 1)
+    XCTAssertEqual(pruned.expand(), [0, -4, 3, 0])
+    XCTAssertEqual(pruned.metadata, [0b1001])
+  }
+
+  func testHeuristic() throws {
+    func rows(
+      _ M: UInt32, _ N: UInt32,
+      _ precisionA: GEMMOperandPrecision, _ precisionB: GEMMOperandPrecision
+    ) -> Int {
+      var sparseDesc = GEMMSparseDescriptor()
+      sparseDesc.matrixDimensions = (M: M, N: N, K: 4096)
+      sparseDesc.memoryPrecisions = (precisionA, precisionB, .FP32)
+      return GEMMSparseKernel.selectRowsPerSimdgroup(descriptor: sparseDesc)
+    }
+
+    // A dense FP16 B would reach 32 rows. The compressed B does not pay for
+    // the extra height.
+    XCTAssertEqual(rows(4096, 4096, .FP16, .FP16), 16)
+    XCTAssertEqual(rows(4096, 4096, .FP32, .FP32), 16)
+    XCTAssertEqual(rows(4096, 4096, .FP16, .FP32), 32)
+
+    // Small problems keep the short block, to fill the GPU.
+    XCTAssertEqual(rows(64, 64, .FP16, .FP32), 8)
+  }
+
+#if canImport(Metal)
+  func testCorrectness() throws {
+    for _ in 0..<20 {
+      func randomPrecision() -> GEMMOperandPrecision {
+        [GEMMOperandPrecision.FP32, .FP16, .BF16].randomElement()!
+      }
+      var sparseDesc = GEMMSparseDescriptor()
+      sparseDesc.loadPreviousC = Bool.random()
+      sparseDesc.matrixDimensions = (
+        M: UInt32.random(in: 1...300),
+        N: UInt32.random(in: 1...200),
+        K: UInt32.random(in: 1...200))
+      sparseDesc.memoryPrecisions = (
+        randomPrecision(), randomPrecision(), randomPrecision())
+      runCorrectnessTest(descriptor: sparseDesc)
+    }
+  }
+#endif
+}
+
+/// Creates a random matrix where each group of 4 rows has 2 nonzeroes per
+/// column.
+private func createSparseMatrix(rows: Int, columns: Int) -> [Float] {
+  var output = [Float](repeating: .zero, count: rows * columns)
+  for groupStart in stride(from: 0, to: rows, by: 4) {
+    for columnID in 0..<columns {
+      let kept = [0, 1, 2, 3].shuffled()[0..<2]
+      for index in kept where groupStart + index < rows {
+        let value = Float.random(in: 0.5...1) * (Bool.random() ? 1 : -1)
+        output[(groupStart + index) * columns + columnID] = value
+      }
+    }
+  }
+  return output
+}
+
+#if canImport(Metal)
+/// Compares the Metal backend against the CPU backend.
+private func runCorrectnessTest(descriptor: GEMMSparseDescriptor) {
+  let (M, N, K) = descriptor.matrixDimensions!
+  let memoryPrecisions = descriptor.memoryPrecisions!
+  let A = randomOperand(
+    count: Int(M * K), precision: memoryPrecisions.A)
+  let previousC = randomOperand(
+    count: Int(M * N), precision: memoryPrecisions.C)
+  var B = GEMMSparseMatrix(
+    pruning: createSparseMatrix(rows: Int(K), columns: Int(N)),
+    rows: Int(K), columns: Int(N))
+  B.values = B.values.map { round($0, to: memoryPrecisions.B) }
+
+  let device = MTLContext.global.device
+  let bindingA = MTLContext.global.createBinding(A, memoryPrecisions.A)
+  let bindingB = MTLContext.global.createBinding(
+    B.values, memoryPrecisions.B)
+  let bufferMetadata = device.makeBuffer(
+    bytes: B.metadata, length: B.metadata.count)!
+  let bindingMetadata = GEMMOperandBinding(MetalGEMMBuffer(bufferMetadata))
+
+  // Only half of the K products are nonzero.
+  let relativeTolerance = backendTolerance(precision: memoryPrecisions.C)
+  compareBackends(
+    previousC: previousC,
+    precision: memoryPrecisions.C,
+    tolerance: relativeTolerance * Float(K / 2 + 1)
+  ) { commandBuffer, bindingC in
+    commandBuffer.encodeSparseGEMM(
+      descriptor: descriptor,
+      A: bindingA,
+      B: bindingB,
+      metadata: bindingMetadata,
+      C: bindingC)
+  }
+}
+#endif
@@ -0,0 +1,129 @@
+import XCTest
+import FlashAttention
+
+final class SplitGEMMTest: XCTestCase {
+  func testCorrectness() throws {
+    // Model a device that is much faster than the CPU backend, so the
+    // partitioner moves rows between the two halves across iterations.
+    let driver = GEMMSplitDriver(
+      primary: SimulatedGEMMBackend(throughput: 1e9),
+      secondary: CPUGEMMBackend(),
+      initialPrimaryFraction: 0.5)
+    runSplitTest(driver: driver)
+  }
+
+#if canImport(Metal)
+  func testCorrectnessMetal() throws {
+    let driver = GEMMSplitDriver(
+      primary: MetalGEMMBackend(),
+      secondary: CPUGEMMBackend(),
+      initialPrimaryFraction: 0.5)
+    runSplitTest(driver: driver)
+  }
+#endif
+
+  func testAdaptivePartition() throws {
+    // The primary device is 3x faster, so it should converge to 75% of the
+    // rows.
+    let driver = GEMMSplitDriver(
+      primary: SimulatedGEMMBackend(throughput: 3e8),
+      secondary: SimulatedGEMMBackend(throughput: 1e8),
+      initialPrimaryFraction: 0.95)
+    driver.rowGranularity = 16
+    driver.minimumRows = 16
+
+    let (M, N, K) = (1024, 64, 64)
+    var gemmDesc = GEMMDescriptor()
+    gemmDesc.matrixDimensions = (UInt32(M), UInt32(N), UInt32(K))
+    gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+    gemmDesc.transposeState = (false, false)
+
+    let bufferA = driver.primary.makeBuffer(length: M * K * 4)
+    let bufferB = driver.primary.makeBuffer(length: K * N * 4)
+    let bufferC = driver.primary.makeBuffer(length: M * N * 4)
+    for _ in 0..<8 {
+      driver.multiply(
+        descriptor: gemmDesc,
+        A: GEMMOperandBinding(bufferA),
+        B: GEMMOperandBinding(bufferB),
+        C: GEMMOperandBinding(bufferC))
+    }
+    XCTAssertEqual(driver.primaryFraction, 0.75, accuracy: 0.05)
+  }
+
+  func testRecovery() throws {
+    // The split starts with every row on the primary device, which is
+    // actually 3x slower. The secondary device still gets its minimum share,
+    // so its throughput is measured and the split moves toward 25%.
+    let driver = GEMMSplitDriver(
+      primary: SimulatedGEMMBackend(throughput: 1e8),
+      secondary: SimulatedGEMMBackend(throughput: 3e8),
+      initialPrimaryFraction: 1)
+    driver.rowGranularity = 16
+    driver.minimumRows = 16
+
+    let (M, N, K) = (1024, 64, 64)
+    var gemmDesc = GEMMDescriptor()
+    gemmDesc.matrixDimensions = (UInt32(M), UInt32(N), UInt32(K))
+    gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+    gemmDesc.transposeState = (false, false)
+
+    let bufferA = driver.primary.makeBuffer(length: M * K * 4)
+    let bufferB = driver.primary.makeBuffer(length: K * N * 4)
+    let bufferC = driver.primary.makeBuffer(length: M * N * 4)
+    for _ in 0..<8 {
+      driver.multiply(
+        descriptor: gemmDesc,
+        A: GEMMOperandBinding(bufferA),
+        B: GEMMOperandBinding(bufferB),
+        C: GEMMOperandBinding(bufferC))
+    }
+    XCTAssertEqual(driver.primaryFraction, 0.25, accuracy: 0.05)
+  }
+}
+
+private func runSplitTest(driver: GEMMSplitDriver) {
+  let problems: [(M: Int, N: Int, K: Int)] = [
+    (200, 67, 90),
+    (31, 40, 50),
+    (97, 128, 33),
+  ]
+  for problem in problems {
+    for transposeState in [(false, false), (false, true), (true, false)] {
+      let (M, N, K) = problem
+      let A = (0..<(M * K)).map { _ in Float.random(in: -1...1) }
+      let B = (0..<(K * N)).map { _ in Float.random(in: -1...1) }
+      var expected = [Float](repeating: .zero, count: M * N)
+      referenceGEMM(
+        M: M, N: N, K: K, A: A, B: B, C: &expected,
+        transposeState: transposeState)
+
+      var gemmDesc = GEMMDescriptor()
+      gemmDesc.matrixDimensions = (UInt32(M), UInt32(N), UInt32(K))
+      gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+      gemmDesc.transposeState = transposeState
+
+      // Both halves share the allocations from the primary backend.
+      let bufferA = driver.primary.makeBuffer(length: A.count * 4)
+      let bufferB = driver.primary.makeBuffer(length: B.count * 4)
+      let bufferC = driver.primary.makeBuffer(length: expected.count * 4)
+      A.withUnsafeBytes {
+        bufferA.contents.copyMemory(from: $0.baseAddress!, byteCount: $0.count)
+      }
+      B.withUnsafeBytes {
+        bufferB.contents.copyMemory(from: $0.baseAddress!, byteCount: $0.count)
+      }
+
+      for _ in 0..<3 {
+        driver.multiply(
+          descriptor: gemmDesc,
+          A: GEMMOperandBinding(bufferA),
+          B: GEMMOperandBinding(bufferB),
+          C: GEMMOperandBinding(bufferC))
+        let pointerC = bufferC.contents.assumingMemoryBound(to: Float.self)
+        let actual = Array(UnsafeBufferPointer(start: pointerC, count: M * N))
+        compareResults(actual, expected, tolerance: 1e-4)
+      }
+    }
+  }
+}
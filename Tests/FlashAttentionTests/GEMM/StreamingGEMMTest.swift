@@ -0,0 +1,147 @@
+import XCTest
+import FlashAttention
+
+final class StreamingGEMMTest: XCTestCase {
+  func testCPUBackend() throws {
+    // The CPU backend is the reference for the host-side drivers, so check
+    // it against the naive loop first.
+    for _ in 0..<10 {
+      let M = Int.random(in: 1...70)
+      let N = Int.random(in: 1...70)
+      let K = Int.random(in: 1...70)
+      let transposeState = (A: Bool.random(), B: Bool.random())
+      let loadPreviousC = Bool.random()
+
+      let A = (0..<(M * K)).map { _ in Float.random(in: -1...1) }
+      let B = (0..<(K * N)).map { _ in Float.random(in: -1...1) }
+      let previousC = (0..<(M * N)).map { _ in Float.random(in: -1...1) }
+      var expected = previousC
+      referenceGEMM(
+        M: M, N: N, K: K, A: A, B: B, C: &expected,
+        transposeState: transposeState, loadPreviousC: loadPreviousC)
+
+      var gemmDesc = GEMMDescriptor()
+      gemmDesc.loadPreviousC = loadPreviousC
+      gemmDesc.matrixDimensions = (UInt32(M), UInt32(N), UInt32(K))
+      gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+      gemmDesc.transposeState = transposeState
+
+      let backend = CPUGEMMBackend()
+      let bufferA = backend.makeBuffer(length: A.count * 4)
+      let bufferB = backend.makeBuffer(length: B.count * 4)
+      let bufferC = backend.makeBuffer(length: previousC.count * 4)
+      A.withUnsafeBytes { bufferA.contents.copyMemory(from: $0.baseAddress!, byteCount: $0.count) }
+      B.withUnsafeBytes { bufferB.contents.copyMemory(from: $0.baseAddress!, byteCount: $0.count) }
+      previousC.withUnsafeBytes { bufferC.contents.copyMemory(from: $0.baseAddress!, byteCount: $0.count) }
+
+      let commandBuffer = backend.makeCommandBuffer()
+      commandBuffer.encodeGEMM(
+        descriptor: gemmDesc,
+        A: GEMMOperandBinding(bufferA),
+        B: GEMMOperandBinding(bufferB),
+        C: GEMMOperandBinding(bufferC))
+      commandBuffer.commit()
+      commandBuffer.waitUntilCompleted()
+      XCTAssertTrue(commandBuffer.isCompleted)
+
+      let pointerC = bufferC.contents.assumingMemoryBound(to: Float.self)
+      let actual = Array(UnsafeBufferPointer(start: pointerC, count: M * N))
+      compareResults(actual, expected, tolerance: 1e-4)
+    }
+  }
+
+  func testStreamingCPU() throws {
+    runStreamingTest(backend: CPUGEMMBackend())
+  }
+
+#if canImport(Metal)
+  func testStreamingMetal() throws {
+    runStreamingTest(backend: MetalGEMMBackend())
+  }
+#endif
+
+  func testPanelReuse() throws {
+    // When K fits in a single panel, the A panel should be uploaded once,
+    // and reused across the N panels it pairs with.
+    var descriptor = GEMMStreamingDescriptor()
+    descriptor.matrixDimensions = (M: 64, N: 256, K: 64)
+    descriptor.memoryPrecisions = (.FP32, .FP32, .FP32)
+    descriptor.transposeState = (false, false)
+    descriptor.memoryBudget = 2 * 4 * (64 * 64 + 64 * 128 + 64 * 128)
+
+    let driver = GEMMStreamingDriver(
+      backend: CPUGEMMBackend(), descriptor: descriptor)
+    XCTAssertEqual(driver.panelDimensions.K, 64)
+    XCTAssertLessThan(driver.panelDimensions.N, 256)
+
+    let A = [Float](repeating: 1, count: 64 * 64)
+    let B = [Float](repeating: 1, count: 64 * 256)
+    var C = [Float](repeating: .zero, count: 64 * 256)
+    driver.multiply(A: A, B: B, C: &C)
+    XCTAssertEqual(C, [Float](repeating: 64, count: 64 * 256))
+
+    let bytesA = 64 * 64 * 4
+    let bytesB = 64 * 256 * 4
+    XCTAssertEqual(driver.uploadedBytes, bytesA + bytesB)
+  }
+
+  func testEmptyProblem() throws {
+    for problem in [(M: 0, N: 5, K: 7), (5, 0, 7), (5, 7, 0)] {
+      for loadPreviousC in [false, true] {
+        var descriptor = GEMMStreamingDescriptor()
+        descriptor.matrixDimensions = problem
+        descriptor.memoryPrecisions = (.FP32, .FP32, .FP32)
+        descriptor.transposeState = (false, false)
+        descriptor.loadPreviousC = loadPreviousC
+        descriptor.memoryBudget = 1 << 20
+
+        let driver = GEMMStreamingDriver(
+          backend: CPUGEMMBackend(), descriptor: descriptor)
+        let A = [Float](repeating: 1, count: problem.M * problem.K)
+        let B = [Float](repeating: 1, count: problem.K * problem.N)
+        var C = [Float](repeating: 2, count: problem.M * problem.N)
+        driver.multiply(A: A, B: B, C: &C)
+        XCTAssertEqual(C, [Float](
+          repeating: loadPreviousC ? 2 : 0, count: problem.M * problem.N))
+        XCTAssertEqual(driver.uploadedBytes, 0)
+      }
+    }
+  }
+}
+
+private func runStreamingTest(backend: GEMMBackend) {
+  let problems: [(M: Int, N: Int, K: Int)] = [
+    (150, 97, 300),
+    (33, 200, 65),
+    (128, 128, 1),
+  ]
+  for problem in problems {
+    for transposeState in [(false, false), (false, true), (true, false)] {
+      for loadPreviousC in [false, true] {
+        let (M, N, K) = problem
+        let A = (0..<(M * K)).map { _ in Float.random(in: -1...1) }
+        let B = (0..<(K * N)).map { _ in Float.random(in: -1...1) }
+        let previousC = (0..<(M * N)).map { _ in Float.random(in: -1...1) }
+        var expected = previousC
+        referenceGEMM(
+          M: M, N: N, K: K, A: A, B: B, C: &expected,
+          transposeState: transposeState, loadPreviousC: loadPreviousC)
+
+        // Budget for roughly a quarter of each operand, to force panels in
+        // every dimension.
+        var descriptor = GEMMStreamingDescriptor()
+        descriptor.matrixDimensions = problem
+        descriptor.memoryPrecisions = (.FP32, .FP32, .FP32)
+        descriptor.transposeState = transposeState
+        descriptor.loadPreviousC = loadPreviousC
+        descriptor.memoryBudget = 2 * (M * K + K * N + M * N)
+
+        let driver = GEMMStreamingDriver(
+          backend: backend, descriptor: descriptor)
+        var actual = previousC
+        driver.multiply(A: A, B: B, C: &actual)
+        compareResults(actual, expected, tolerance: 1e-4)
+      }
+    }
+  }
+}
@@ -0,0 +1,204 @@
+import XCTest
+import FlashAttention
+
+final class SubmissionQueueTest: XCTestCase {
+  // Every element arrives exactly once, in order per producer.
+  func testRing() throws {
+    let producerCount = 8
+    let elementCount = 20_000
+    let ring = MPSCRing<(producer: Int, index: Int)>(capacity: 256)
+
+    let group = runProducers(count: producerCount) { producer in
+      for index in 0..<elementCount {
+        ring.push((producer, index))
+      }
+    }
+    var nextIndices = [Int](repeating: 0, count: producerCount)
+    var receivedCount = 0
+    while receivedCount < producerCount * elementCount {
+      guard let element = ring.pop() else {
+        continue
+      }
+      XCTAssertEqual(element.index, nextIndices[element.producer])
+      nextIndices[element.producer] = element.index + 1
+      receivedCount += 1
+    }
+    group.wait()
+    XCTAssertNil(ring.pop())
+    XCTAssertEqual(
+      nextIndices, Array(repeating: elementCount, count: producerCount))
+  }
+
+  func testSubmissionQueue() throws {
+    let backend = CPUGEMMBackend()
+    let queue = GEMMSubmissionQueue(
+      backend: backend, capacity: 16, maximumBatchSize: 8)
+    let producerCount = 8
+    let dispatchesPerProducer = 10
+
+    struct Problem {
+      var M: Int, N: Int, K: Int
+      var A: [Float], B: [Float]
+      var bufferC: GEMMBackendBuffer
+    }
+    var problems: [[Problem]] = []
+    for _ in 0..<producerCount {
+      var producerProblems: [Problem] = []
+      for _ in 0..<dispatchesPerProducer {
+        let (M, N, K) = (
+          Int.random(in: 1...24), Int.random(in: 1...24),
+          Int.random(in: 1...24))
+        producerProblems.append(Problem(
+          M: M, N: N, K: K,
+          A: (0..<(M * K)).map { _ in Float.random(in: -1...1) },
+          B: (0..<(K * N)).map { _ in Float.random(in: -1...1) },
+          bufferC: backend.makeBuffer(length: M * N * 4)))
+      }
+      problems.append(producerProblems)
+    }
+
+    let completedCount = CompletionCounter()
+    let group = runProducers(count: producerCount) { producer in
+      for problem in problems[producer] {
+        func upload(_ values: [Float]) -> GEMMOperandBinding {
+          let buffer = backend.makeBuffer(length: values.count * 4)
+          values.withUnsafeBytes {
+            buffer.contents.copyMemory(
+              from: $0.baseAddress!, byteCount: $0.count)
+          }
+          return GEMMOperandBinding(buffer)
+        }
+        var gemmDesc = GEMMDescriptor()
+        gemmDesc.matrixDimensions = (
+          UInt32(problem.M), UInt32(problem.N), UInt32(problem.K))
+        gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+        gemmDesc.transposeState = (false, false)
+        queue.submit(GEMMDispatchRecord(
+          descriptor: gemmDesc,
+          A: upload(problem.A),
+          B: upload(problem.B),
+          C: GEMMOperandBinding(problem.bufferC),
+          completion: { completedCount.increment() }))
+      }
+    }
+    group.wait()
+    queue.finish()
+
+    let dispatchCount = producerCount * dispatchesPerProducer
+    XCTAssertEqual(queue.dispatchCount, dispatchCount)
+    XCTAssertGreaterThan(queue.commandBufferCount, 0)
+    XCTAssertLessThanOrEqual(queue.commandBufferCount, dispatchCount)
+    XCTAssertEqual(completedCount.value, dispatchCount)
+    for problem in problems.joined() {
+      var expected = [Float](repeating: .zero, count: problem.M * problem.N)
+      referenceGEMM(
+        M: problem.M, N: problem.N, K: problem.K,
+        A: problem.A, B: problem.B, C: &expected)
+      let pointerC = problem.bufferC.contents
+        .assumingMemoryBound(to: Float.self)
+      let actual = Array(
+        UnsafeBufferPointer(start: pointerC, count: problem.M * problem.N))
+      compareResults(actual, expected, tolerance: 1e-4)
+    }
+  }
+
+  // Compares the ring against a mutex around a shared array, from 1 to 64
+  // producer threads.
+  func testContention() throws {
+    let elementCount = 400_000
+
+    print()
+    print("producers | ring (M/s) | mutex (M/s)")
+    for producerCount in [1, 2, 4, 8, 16, 32, 64] {
+      let elementsPerProducer = elementCount / producerCount
+      let totalCount = elementsPerProducer * producerCount
+
+      // The ring, drained by this thread.
+      let ring = MPSCRing<Int>(capacity: 4096)
+      let ringStart = Date()
+      let ringGroup = runProducers(count: producerCount) { _ in
+        for index in 0..<elementsPerProducer {
+          ring.push(index)
+        }
+      }
+      var receivedCount = 0
+      while receivedCount < totalCount {
+        if ring.pop() != nil {
+          receivedCount += 1
+        }
+      }
+      ringGroup.wait()
+      let ringTime = Date().timeIntervalSince(ringStart)
+
+      // The mutex, drained by this thread in batches.
+      let lock = NSLock()
+      var pending: [Int] = []
+      pending.reserveCapacity(4096)
+      let mutexStart = Date()
+      let mutexGroup = runProducers(count: producerCount) { _ in
+        for index in 0..<elementsPerProducer {
+          lock.lock()
+          pending.append(index)
+          lock.unlock()
+        }
+      }
+      receivedCount = 0
+      while receivedCount < totalCount {
+        lock.lock()
+        receivedCount += pending.count
+        pending.removeAll(keepingCapacity: true)
+        lock.unlock()
+      }
+      mutexGroup.wait()
+      let mutexTime = Date().timeIntervalSince(mutexStart)
+
+      func rate(_ time: Double) -> String {
+        String(format: "%.1f", Double(totalCount) / time / 1e6)
+      }
+      var line = String(producerCount)
+      line += String(repeating: " ", count: 10 - line.count) + "| "
+      line += rate(ringTime)
+      line += String(repeating: " ", count: 23 - line.count) + "| "
+      line += rate(mutexTime)
+      print(line)
+    }
+  }
+}
+
+/// Starts one thread per producer, released at the same time.
+private func runProducers(
+  count: Int, _ body: @escaping (Int) -> Void
+) -> DispatchGroup {
+  let group = DispatchGroup()
+  let start = DispatchSemaphore(value: 0)
+  for producer in 0..<count {
+    group.enter()
+    let thread = Thread {
+      start.wait()
+      body(producer)
+      group.leave()
+    }
+    thread.start()
+  }
+  for _ in 0..<count {
+    start.signal()
+  }
+  return group
+}
+
+private final class CompletionCounter {
+  let lock = NSLock()
+  var count: Int = 0
+
+  func increment() {
+    lock.lock()
+    count += 1
+    lock.unlock()
+  }
+
+  var value: Int {
+    lock.lock()
+    defer { lock.unlock() }
+    return count
+  }
+}
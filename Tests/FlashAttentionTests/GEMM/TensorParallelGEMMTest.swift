@@ -0,0 +1,166 @@
+import XCTest
+import FlashAttention
+
+final class TensorParallelGEMMTest: XCTestCase {
+  func testCorrectness() throws {
+    let problems: [(M: Int, N: Int, K: Int)] = [
+      (64, 96, 80),
+      (33, 7, 129),
+    ]
+    for problem in problems {
+      for parallelism in [GEMMTensorParallelism.column, .row] {
+        // Include counts that are not powers of 2, to cover the uneven
+        // branches of the reduction tree.
+        for processCount in [1, 2, 3, 5] {
+          for transposeState in [(false, false), (true, true)] {
+            let loadPreviousC = Bool.random()
+            runCorrectnessTest(
+              problem: problem,
+              parallelism: parallelism,
+              processCount: processCount,
+              transposeState: transposeState,
+              loadPreviousC: loadPreviousC)
+          }
+        }
+      }
+    }
+  }
+
+  // C ends right after its last element, so a worker must not copy the
+  // padding of the last row.
+  func testPaddedRows() throws {
+    let (M, N, K) = (9, 13, 17)
+    let leadingC = N + 5
+    let A = (0..<(M * K)).map { _ in Float.random(in: -1...1) }
+    let B = (0..<(K * N)).map { _ in Float.random(in: -1...1) }
+    let previousC = (0..<(M * N)).map { _ in Float.random(in: -1...1) }
+    var expected = previousC
+    referenceGEMM(
+      M: M, N: N, K: K, A: A, B: B, C: &expected, loadPreviousC: true)
+
+    var gemmDesc = GEMMDescriptor()
+    gemmDesc.leadingDimensions = (UInt32(K), UInt32(N), UInt32(leadingC))
+    gemmDesc.loadPreviousC = true
+    gemmDesc.matrixDimensions = (UInt32(M), UInt32(N), UInt32(K))
+    gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+    gemmDesc.transposeState = (false, false)
+
+    // Fill the padding with a sentinel.
+    var C = [Float](repeating: -42, count: (M - 1) * leadingC + N)
+    for m in 0..<M {
+      for n in 0..<N {
+        C[m * leadingC + n] = previousC[m * N + n]
+      }
+    }
+    let driver = GEMMTensorParallelDriver(
+      descriptor: gemmDesc, parallelism: .column, processCount: 3)
+    A.withUnsafeBytes { A in
+      B.withUnsafeBytes { B in
+        C.withUnsafeMutableBytes { C in
+          driver.multiply(
+            A: A.baseAddress!, B: B.baseAddress!, C: C.baseAddress!)
+        }
+      }
+    }
+
+    var actual: [Float] = []
+    for m in 0..<M {
+      actual += C[(m * leadingC)..<(m * leadingC + N)]
+      if m < M - 1 {
+        let padding = C[(m * leadingC + N)..<((m + 1) * leadingC)]
+        XCTAssertEqual(Array(padding), Array(repeating: -42, count: 5))
+      }
+    }
+    compareResults(actual, expected, tolerance: 1e-4)
+  }
+
+  func testPerformance() throws {
+    // The CPU backend runs each shard on a single thread, so the speedup
+    // over one process approximates the parallel efficiency.
+    let problemSize = 512
+    let maxProcessCount = ProcessInfo.processInfo.activeProcessorCount
+    var processCounts: [Int] = []
+    var processCount = 1
+    while processCount <= min(maxProcessCount, 16) {
+      processCounts.append(processCount)
+      processCount *= 2
+    }
+
+    let A = (0..<(problemSize * problemSize)).map { _ in
+      Float.random(in: -1...1)
+    }
+    let B = (0..<(problemSize * problemSize)).map { _ in
+      Float.random(in: -1...1)
+    }
+    var C = [Float](repeating: .zero, count: problemSize * problemSize)
+
+    var gemmDesc = GEMMDescriptor()
+    let n = UInt32(problemSize)
+    gemmDesc.matrixDimensions = (n, n, n)
+    gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+    gemmDesc.transposeState = (false, false)
+
+    print()
+    print("Tensor-Parallel GEMM Performance Data:")
+    for parallelism in [GEMMTensorParallelism.column, .row] {
+      var baseline: Double?
+      for processCount in processCounts {
+        let driver = GEMMTensorParallelDriver(
+          descriptor: gemmDesc,
+          parallelism: parallelism,
+          processCount: processCount)
+
+        // Take the best of several trials.
+        var minLatency = Double.infinity
+        for _ in 0..<3 {
+          let start = Date()
+          driver.multiply(A: A, B: B, C: &C)
+          minLatency = min(minLatency, Date().timeIntervalSince(start))
+        }
+        let operations = 2 * problemSize * problemSize * problemSize
+        let gflops = Double(operations) / minLatency / 1e9
+        baseline = baseline ?? gflops
+
+        var repr = "\(processCount)"
+        while repr.count < 2 {
+          repr = " " + repr
+        }
+        print(parallelism == .column ? "column" : "row   ", terminator: " | ")
+        print("processes = \(repr)", terminator: " | ")
+        print(String(format: "%6.1f GFLOPS", gflops), terminator: " | ")
+        print(String(format: "%.2fx", gflops / baseline!))
+      }
+    }
+  }
+}
+
+private func runCorrectnessTest(
+  problem: (M: Int, N: Int, K: Int),
+  parallelism: GEMMTensorParallelism,
+  processCount: Int,
+  transposeState: (A: Bool, B: Bool),
+  loadPreviousC: Bool
+) {
+  let (M, N, K) = problem
+  let A = (0..<(M * K)).map { _ in Float.random(in: -1...1) }
+  let B = (0..<(K * N)).map { _ in Float.random(in: -1...1) }
+  let previousC = (0..<(M * N)).map { _ in Float.random(in: -1...1) }
+  var expected = previousC
+  referenceGEMM(
+    M: M, N: N, K: K, A: A, B: B, C: &expected,
+    transposeState: transposeState, loadPreviousC: loadPreviousC)
+
+  var gemmDesc = GEMMDescriptor()
+  gemmDesc.loadPreviousC = loadPreviousC
+  gemmDesc.matrixDimensions = (UInt32(M), UInt32(N), UInt32(K))
+  gemmDesc.memoryPrecisions = (.FP32, .FP32, .FP32)
+  gemmDesc.transposeState = transposeState
+
+  let driver = GEMMTensorParallelDriver(
+    descriptor: gemmDesc,
+    parallelism: parallelism,
+    processCount: processCount)
+  var actual = previousC
+  driver.multiply(A: A, B: B, C: &actual)
+  compareResults(actual, expected, tolerance: 1e-4)
+}
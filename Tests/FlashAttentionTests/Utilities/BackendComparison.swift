@@ -0,0 +1,73 @@
+#if canImport(Metal)
+import FlashAttention
+import Metal
+
+/// Random numbers in [-1, 1], already rounded to the precision of the
+/// buffer that will hold them.
+func randomOperand(
+  count: Int, precision: GEMMOperandPrecision
+) -> [Float] {
+  (0..<count).map { _ in
+    round(Float.random(in: -1...1), to: precision)
+  }
+}
+
+/// The error allowed per unit of magnitude in C, when the CPU and Metal
+/// backends compute the same problem.
+///
+/// Both backends accumulate in FP32, and both truncate BF16. A different
+/// order of accumulation can still move the stored value by one unit in
+/// the last place (2^-7 relative for BF16).
+func backendTolerance(precision: GEMMOperandPrecision) -> Float {
+  switch precision {
+  case .FP32:
+    return 1e-5
+  case .FP16:
+    return 2e-3
+  case .BF16:
+    return 8e-3
+  }
+}
+
+extension MTLContext {
+  /// Uploads an operand, and wraps it for the backend interface.
+  func createBinding(
+    _ operand: [Float],
+    _ precision: GEMMOperandPrecision
+  ) -> GEMMOperandBinding {
+    let buffer = createBuffer(operand, precision)
+    return GEMMOperandBinding(MetalGEMMBuffer(buffer))
+  }
+}
+
+/// Runs the same problem on the CPU and Metal backends, and compares C.
+///
+/// `encode` is called once per backend, with a fresh copy of `previousC`.
+/// The inputs can be shared between the two calls, as neither backend
+/// writes to them.
+func compareBackends(
+  previousC: [Float],
+  precision: GEMMOperandPrecision,
+  tolerance: Float,
+  file: StaticString = #filePath,
+  line: UInt = #line,
+  encode: (GEMMCommandBuffer, GEMMOperandBinding) -> Void
+) {
+  func execute(backend: GEMMBackend) -> [Float] {
+    let bufferC = MTLContext.global.createBuffer(previousC, precision)
+    let commandBuffer = backend.makeCommandBuffer()
+    encode(commandBuffer, GEMMOperandBinding(MetalGEMMBuffer(bufferC)))
+    commandBuffer.commit()
+    commandBuffer.waitUntilCompleted()
+
+    var C = [Float](repeating: .zero, count: previousC.count)
+    MTLContext.copy(bufferC, into: &C, precision: precision)
+    return C
+  }
+
+  let expected = execute(backend: CPUGEMMBackend())
+  let actual = execute(backend: MetalGEMMBackend())
+  compareResults(
+    actual, expected, tolerance: tolerance, file: file, line: line)
+}
+#endif
@@ -0,0 +1,51 @@
+import FlashAttention
+
+/// The textbook triple loop, over FP32 row-major matrices.
+///
+/// Slow, but simple enough to be obviously correct. Used to validate the
+/// backends and the host-side drivers built on top of them.
+func referenceGEMM(
+  M: Int, N: Int, K: Int,
+  A: [Float], B: [Float], C: inout [Float],
+  transposeState: (A: Bool, B: Bool) = (false, false),
+  loadPreviousC: Bool = false
+) {
+  for m in 0..<M {
+    for n in 0..<N {
+      var dotProduct: Float = .zero
+      for k in 0..<K {
+        let addressA = transposeState.A ? k * M + m : m * K + k
+        let addressB = transposeState.B ? n * K + k : k * N + n
+        dotProduct += A[addressA] * B[addressB]
+      }
+      if loadPreviousC {
+        dotProduct += C[m * N + n]
+      }
+      C[m * N + n] = dotProduct
+    }
+  }
+}
+
+/// Asserts that two arrays match within an absolute tolerance, and returns
+/// the largest error.
+@discardableResult
+func compareResults(
+  _ actual: [Float],
+  _ expected: [Float],
+  tolerance: Float,
+  file: StaticString = #filePath,
+  line: UInt = #line
+) -> Float {
+  precondition(actual.count == expected.count, "Sizes did not match.")
+  var maxError: Float = .zero
+  for i in actual.indices {
+    let error = (actual[i] - expected[i]).magnitude
+    if error.isNaN || error > tolerance {
+      fatalError(
+        "Element \(i) was \(actual[i]), expected \(expected[i]).",
+        file: file, line: line)
+    }
+    maxError = max(maxError, error)
+  }
+  return maxError
+}
@@ -1,3 +1,4 @@
+#if canImport(Metal)
 import FlashAttention
 import Metal
 
@@ -77,3 +78,4 @@ extension MTLContext {
     }
   }
 }
+#endif
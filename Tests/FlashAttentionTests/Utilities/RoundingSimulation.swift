@@ -0,0 +1,15 @@
+import FlashAttention
+
+/// Rounds to the nearest value in the given precision. Ignores subnormals and
+/// overflow, which the error-growth tests never reach.
+func round(
+  _ value: Float, to precision: GEMMOperandPrecision
+) -> Float {
+  guard precision != .FP32, value != .zero else {
+    return value
+  }
+  let mantissaBits = (precision == .FP16) ? 10 : 7
+  let ulp = Float(
+    sign: .plus, exponent: value.exponent - mantissaBits, significand: 1)
+  return (value / ulp).rounded(.toNearestOrEven) * ulp
+}
@@ -0,0 +1,155 @@
+import Foundation
+import FlashAttention
+
+/// A stand-in for a device with a known throughput.
+///
+/// Results are computed by the CPU reference, then the command buffer sleeps
+/// until the modeled latency has elapsed. This lets scheduling logic be
+/// tested deterministically, and on machines without a GPU.
+final class SimulatedGEMMBackend: GEMMBackend {
+  /// Modeled compute throughput, in FLOPS.
+  let throughput: Double
+
+  /// Modeled fixed cost of each command buffer, in seconds.
+  let launchLatency: Double
+
+  let queue = DispatchQueue(label: "com.flash-attention.simulated-gemm")
+
+  init(throughput: Double, launchLatency: Double = 0) {
+    self.throughput = throughput
+    self.launchLatency = launchLatency
+  }
+
+  func makeBuffer(length: Int) -> GEMMBackendBuffer {
+    CPUGEMMBuffer(length: length)
+  }
+
+  func makeCommandBuffer() -> GEMMCommandBuffer {
+    SimulatedGEMMCommandBuffer(backend: self)
+  }
+}
+
+final class SimulatedGEMMCommandBuffer: GEMMCommandBuffer {
+  let backend: SimulatedGEMMBackend
+  let group = DispatchGroup()
+  var commands: [() -> Void] = []
+  var completedHandlers: [() -> Void] = []
+  var operations: Double = 0
+  var completed = false
+
+  init(backend: SimulatedGEMMBackend) {
+    self.backend = backend
+  }
+
+  func encodeGEMM(
+    descriptor: GEMMDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    C: GEMMOperandBinding
+  ) {
+    let (M, N, K) = descriptor.matrixDimensions!
+    operations += 2 * Double(M) * Double(N) * Double(K)
+    let pointerA = UnsafeRawPointer(A.contents)
+    let pointerB = UnsafeRawPointer(B.contents)
+    let pointerC = C.contents
+    commands.append {
+      CPUGEMMBackend.multiply(
+        descriptor: descriptor, A: pointerA, B: pointerB, C: pointerC)
+    }
+  }
+
+  func encodeChainedGEMM(
+    descriptor: GEMMChainedDescriptor,
+    A: GEMMOperandBinding,
+    B1: GEMMOperandBinding,
+    B2: GEMMOperandBinding,
+    W: GEMMOperandBinding?,
+    C: GEMMOperandBinding
+  ) {
+    let (M, K, R, N) = descriptor.matrixDimensions!
+    operations += 2 * Double(M) * (Double(K) + Double(N)) * Double(R)
+    if descriptor.lowRankScale != nil {
+      operations += 2 * Double(M) * Double(N) * Double(K)
+    }
+    let pointerA = UnsafeRawPointer(A.contents)
+    let pointerB1 = UnsafeRawPointer(B1.contents)
+    let pointerB2 = UnsafeRawPointer(B2.contents)
+    let pointerW = W.map { UnsafeRawPointer($0.contents) }
+    let pointerC = C.contents
+    commands.append {
+      CPUGEMMBackend.multiplyChained(
+        descriptor: descriptor,
+        A: pointerA, B1: pointerB1, B2: pointerB2, W: pointerW,
+        C: pointerC)
+    }
+  }
+
+  func encodeComplexGEMM(
+    descriptor: GEMMComplexDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    C: GEMMOperandBinding
+  ) {
+    let (M, N, K) = descriptor.matrixDimensions!
+    operations += 8 * Double(M) * Double(N) * Double(K)
+    let pointerA = UnsafeRawPointer(A.contents)
+    let pointerB = UnsafeRawPointer(B.contents)
+    let pointerC = C.contents
+    commands.append {
+      CPUGEMMBackend.multiplyComplex(
+        descriptor: descriptor, A: pointerA, B: pointerB, C: pointerC)
+    }
+  }
+
+  func encodeSparseGEMM(
+    descriptor: GEMMSparseDescriptor,
+    A: GEMMOperandBinding,
+    B: GEMMOperandBinding,
+    metadata: GEMMOperandBinding,
+    C: GEMMOperandBinding
+  ) {
+    let (M, N, K) = descriptor.matrixDimensions!
+    operations += 2 * Double(M) * Double(N) * Double(K)
+    let pointerA = UnsafeRawPointer(A.contents)
+    let pointerB = UnsafeRawPointer(B.contents)
+    let pointerMetadata = UnsafeRawPointer(metadata.contents)
+    let pointerC = C.contents
+    commands.append {
+      CPUGEMMBackend.multiplySparse(
+        descriptor: descriptor, A: pointerA, B: pointerB,
+        metadata: pointerMetadata, C: pointerC)
+    }
+  }
+
+  func addCompletedHandler(_ handler: @escaping () -> Void) {
+    completedHandlers.append(handler)
+  }
+
+  func commit() {
+    let latency = backend.launchLatency + operations / backend.throughput
+    group.enter()
+    backend.queue.async { [self] in
+      let start = Date()
+      for command in commands {
+        command()
+      }
+      let remaining = latency - Date().timeIntervalSince(start)
+      if remaining > 0 {
+        Thread.sleep(forTimeInterval: remaining)
+      }
+      completed = true
+      for handler in completedHandlers {
+        handler()
+      }
+      group.leave()
+    }
+  }
+
+  func waitUntilCompleted() {
+    group.wait()
+  }
+
+  var isCompleted: Bool {
+    completed
+  }
+}
@@ -0,0 +1,231 @@
+import XCTest
+import FlashAttention
+#if canImport(Metal)
+import Metal
+#endif
+
+final class WeightFileTest: XCTestCase {
+  func createTemporaryURL() -> URL {
+    let directory = FileManager.default.temporaryDirectory
+    return directory.appendingPathComponent("weights-\(UUID()).mfaw")
+  }
+
+  func createWeightFile(url: URL) -> (embedding: [Float], projection: [Float16]) {
+    let embedding = (0..<(37 * 19)).map { _ in Float.random(in: -1...1) }
+    let projection = (0..<(70 * 45)).map { _ in
+      Float16(Float.random(in: -1...1))
+    }
+
+    var writer = WeightFileWriter()
+    embedding.withUnsafeBytes {
+      writer.append(
+        name: "embedding", precision: .FP32, shape: [37, 19], bytes: $0)
+    }
+    let packed = projection.withUnsafeBytes {
+      WeightTensorLayout.packTileMajor(
+        $0, rows: 70, columns: 45, elementSize: 2,
+        tileRows: 32, tileColumns: 32)
+    }
+    packed.withUnsafeBytes {
+      writer.append(
+        name: "projection", precision: .FP16, shape: [70, 45],
+        layout: .tileMajor(rows: 32, columns: 32), bytes: $0)
+    }
+    XCTAssertNoThrow(try writer.write(to: url))
+    return (embedding, projection)
+  }
+
+  func testRoundTrip() throws {
+    let url = createTemporaryURL()
+    defer { try? FileManager.default.removeItem(at: url) }
+    let (embedding, projection) = createWeightFile(url: url)
+
+    let file = try WeightFile(url: url, verifyChecksums: true)
+    XCTAssertEqual(file.tensors.map(\.name), ["embedding", "projection"])
+
+    // Every payload must start on a page boundary.
+    for name in ["embedding", "projection"] {
+      let contents = file.contents(of: name)
+      let address = Int(bitPattern: contents.baseAddress!)
+      XCTAssertEqual(address % WeightFileFormat.alignment, 0)
+    }
+
+    let embeddingContents = file.contents(of: "embedding")
+    XCTAssertEqual(
+      Array(embeddingContents.bindMemory(to: Float.self)), embedding)
+
+    let projectionDescriptor = file.descriptor(named: "projection")!
+    XCTAssertEqual(projectionDescriptor.shape, [70, 45])
+    XCTAssertEqual(
+      projectionDescriptor.layout, .tileMajor(rows: 32, columns: 32))
+    XCTAssertEqual(projectionDescriptor.length, 3 * 2 * 32 * 32 * 2)
+    let unpacked = WeightTensorLayout.unpackTileMajor(
+      file.contents(of: "projection"), rows: 70, columns: 45, elementSize: 2,
+      tileRows: 32, tileColumns: 32)
+    let expected = projection.withUnsafeBytes { Array($0) }
+    XCTAssertEqual(unpacked, expected)
+
+    XCTAssertNil(file.descriptor(named: "missing"))
+  }
+
+  func testCorruption() throws {
+    let url = createTemporaryURL()
+    defer { try? FileManager.default.removeItem(at: url) }
+    _ = createWeightFile(url: url)
+
+    // Flip a bit inside the second payload.
+    var bytes = try Data(contentsOf: url)
+    let file = try WeightFile(url: url)
+    let offset = file.descriptor(named: "projection")!.offset
+    bytes[offset + 100] ^= 0x01
+    try bytes.write(to: url)
+
+    XCTAssertThrowsError(try WeightFile(url: url, verifyChecksums: true)) {
+      XCTAssertEqual(
+        $0 as? WeightFileError, .checksumMismatch("projection"))
+    }
+
+    // A truncated file must be rejected before any payload is touched.
+    try bytes.prefix(offset).write(to: url)
+    XCTAssertThrowsError(try WeightFile(url: url)) {
+      XCTAssertEqual($0 as? WeightFileError, .truncated)
+    }
+
+    try Data([0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15])
+      .write(to: url)
+    XCTAssertThrowsError(try WeightFile(url: url)) {
+      XCTAssertEqual($0 as? WeightFileError, .badMagic)
+    }
+  }
+
+  // Sizes in the tensor table that overflow an Int must be rejected, not
+  // trap.
+  func testMalformedHeader() throws {
+    let url = createTemporaryURL()
+    defer { try? FileManager.default.removeItem(at: url) }
+    func expectError(
+      shape: [UInt64], offset: UInt64, length: UInt64,
+      _ expected: WeightFileError
+    ) throws {
+      try createHeader(tensors: [(shape, offset, length)]).write(to: url)
+      XCTAssertThrowsError(try WeightFile(url: url)) {
+        XCTAssertEqual($0 as? WeightFileError, expected)
+      }
+    }
+
+    // The element count overflows.
+    let maximumDimension = UInt64(Int32.max)
+    try expectError(
+      shape: [maximumDimension, maximumDimension, maximumDimension],
+      offset: 16384, length: 0, .invalidTensor("x"))
+
+    // The length is valid for the shape, but rounding it up to a page
+    // overflows.
+    try expectError(
+      shape: [1_541_431_166, 1_495_910_463],
+      offset: 16384, length: 4 * 1_541_431_166 * 1_495_910_463,
+      .invalidTensor("x"))
+
+    // The end of the payload overflows.
+    let offset = UInt64(Int.max) / 16384 * 16384
+    try expectError(shape: [4], offset: offset, length: 16, .truncated)
+  }
+
+  // Payloads must follow the table, hold at least one byte, and not alias
+  // each other.
+  func testInvalidPayloadRanges() throws {
+    let url = createTemporaryURL()
+    defer { try? FileManager.default.removeItem(at: url) }
+    func expectError(
+      _ tensors: [(shape: [UInt64], offset: UInt64, length: UInt64)],
+      _ expected: WeightFileError
+    ) throws {
+      try createHeader(tensors: tensors, fileSize: 3 * 16384).write(to: url)
+      XCTAssertThrowsError(try WeightFile(url: url)) {
+        XCTAssertEqual($0 as? WeightFileError, expected)
+      }
+    }
+
+    // The payload starts inside the header.
+    try expectError([([4], 0, 16)], .invalidTensor("x"))
+
+    // The payload is empty.
+    try expectError([([0], 16384, 0)], .invalidTensor("x"))
+
+    // A payload starts inside another, in either order of the table.
+    try expectError(
+      [([8192], 16384, 32768), ([4], 32768, 16)], .overlappingTensor("y"))
+    try expectError(
+      [([4], 32768, 16), ([8192], 16384, 32768)], .overlappingTensor("x"))
+
+    // Adjacent payloads are accepted.
+    try createHeader(
+      tensors: [([4], 32768, 16), ([4096], 16384, 16384)],
+      fileSize: 3 * 16384
+    ).write(to: url)
+    XCTAssertNoThrow(try WeightFile(url: url))
+  }
+
+#if canImport(Metal)
+  func testZeroCopyBuffer() throws {
+    let url = createTemporaryURL()
+    defer { try? FileManager.default.removeItem(at: url) }
+    let (embedding, _) = createWeightFile(url: url)
+
+    var file: WeightFile? = try WeightFile(url: url)
+    let buffer = file!.makeBuffer(
+      device: MTLContext.global.device, name: "embedding")
+    XCTAssertEqual(
+      buffer.contents(),
+      UnsafeMutableRawPointer(mutating: file!.contents(of: "embedding").baseAddress!))
+    XCTAssertEqual(buffer.length % WeightFileFormat.alignment, 0)
+
+    // The buffer keeps the mapping alive after the file is released.
+    file = nil
+    var output = [Float](repeating: .zero, count: embedding.count)
+    MTLContext.copy(buffer, into: &output)
+    XCTAssertEqual(output, embedding)
+  }
+#endif
+}
+
+/// Encodes a file with up to three FP32 tensors, named "x", "y" and "z",
+/// followed by zeroes up to `fileSize` bytes.
+private func createHeader(
+  tensors: [(shape: [UInt64], offset: UInt64, length: UInt64)],
+  fileSize: Int = 0
+) -> Data {
+  var table = Data()
+  func append<T: FixedWidthInteger>(_ value: T) {
+    withUnsafeBytes(of: value.littleEndian) { table.append(contentsOf: $0) }
+  }
+  for (index, tensor) in tensors.enumerated() {
+    let name = ["x", "y", "z"][index]
+    append(UInt16(name.utf8.count))
+    table.append(contentsOf: Array(name.utf8))
+    append(GEMMOperandPrecision.FP32.rawValue)
+    append(UInt16(0))
+    append(UInt16(0))
+    append(UInt16(0))
+    append(UInt16(tensor.shape.count))
+    for dimension in tensor.shape {
+      append(dimension)
+    }
+    append(tensor.offset)
+    append(tensor.length)
+    append(UInt64(0))
+  }
+
+  var header = Data()
+  for value in [
+    WeightFileFormat.magic, WeightFileFormat.version,
+    UInt32(tensors.count), UInt32(table.count)
+  ] {
+    withUnsafeBytes(of: value.littleEndian) { header.append(contentsOf: $0) }
+  }
+  var output = header + table
+  if output.count < fileSize {
+    output.append(Data(count: fileSize - output.count))
+  }
+  return output
+}